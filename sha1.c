@@ -3,25 +3,51 @@
  */
 
 #include "sha1.h"
+#include "sha1_dc.h"
+#include "sha1_kernel.h"
+#include "sha1_stats.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h> // only needed for exit() right now
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Nonzero while collision detection is on; see SHA1_set_collision_detection
+ */
+static int sha1_detect_collisions = 0;
+
 SHA1_WORD_t SHA1_circular_shift(int n, SHA1_WORD_t word)
 {
     return (word << n) | (word >> (32 - n));
 }
 
 /*
- * PROCESS BLOCK
+ * INITIALIZE HASH
  */
-SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
+void SHA1_init_hash(SHA1_SHA1Object_p_t sha1_p)
+{
+    sha1_p->temp_hash[0] = 0x67452301;
+    sha1_p->temp_hash[1] = 0xEFCDAB89;
+    sha1_p->temp_hash[2] = 0x98BADCFE;
+    sha1_p->temp_hash[3] = 0x10325476;
+    sha1_p->temp_hash[4] = 0xC3D2E1F0;
+}
+
+/*
+ * COMPRESS BLOCK
+ * The 80-step compression function itself. It reads the 64 bytes at
+ * block directly, so callers holding whole blocks in their own buffers
+ * never have to copy them into a message_block first.
+ */
+static void SHA1_compress_block(SHA1_WORD_t hash[5], const uint8_t *block)
 {
 
     /*
      * variable initialization
      */
-    SHA1_ERRCODE err = SHA1_SUCCESS;
     SHA1_WORD_t word_80[80];             /* 80-word sequence */
     SHA1_WORD_t temp_word;               /* Temporary word value */
     SHA1_WORD_t A, B, C, D, E;           /* Word buffers */
@@ -47,10 +73,10 @@ SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
     for(t = 0; t < 16; t++)
     {
         word_80[t] = (
-            sha1_p->message_block[t * 4]     << 24 |
-            sha1_p->message_block[t * 4 + 1] << 16 |
-            sha1_p->message_block[t * 4 + 2] << 8  |
-            sha1_p->message_block[t * 4 + 3]
+            (SHA1_WORD_t)block[t * 4]     << 24 |
+            (SHA1_WORD_t)block[t * 4 + 1] << 16 |
+            (SHA1_WORD_t)block[t * 4 + 2] << 8  |
+            (SHA1_WORD_t)block[t * 4 + 3]
         );
     } 
 
@@ -75,11 +101,11 @@ SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
     /*
      * set up temporary hash arrays
      */
-    A = sha1_p->temp_hash[0];
-    B = sha1_p->temp_hash[1];
-    C = sha1_p->temp_hash[2];
-    D = sha1_p->temp_hash[3];
-    E = sha1_p->temp_hash[4];
+    A = hash[0];
+    B = hash[1];
+    C = hash[2];
+    D = hash[3];
+    E = hash[4];
 
     /*
      * For the first twenty values in the block, take the circular
@@ -137,11 +163,163 @@ SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
     /*
      * Assign the newly computed WORDs to the temporary hash array
      */
-    sha1_p->temp_hash[0] += A;
-    sha1_p->temp_hash[1] += B;
-    sha1_p->temp_hash[2] += C;
-    sha1_p->temp_hash[3] += D;
-    sha1_p->temp_hash[4] += E;
+    hash[0] += A;
+    hash[1] += B;
+    hash[2] += C;
+    hash[3] += D;
+    hash[4] += E;
+}
+
+/*
+ * EXPAND SCHEDULE
+ * Fill word_80[16..79] from word_80[0..15]. With SSE2, four words are
+ * computed per iteration; the fourth depends on the first of the same
+ * group, so it is computed without that term and patched afterwards.
+ */
+static void SHA1_expand_schedule(SHA1_WORD_t word_80[80])
+{
+#ifdef __SSE2__
+    for (int t = 16; t < 80; t += 4)
+    {
+        __m128i w, r;
+
+        w = _mm_srli_si128(_mm_load_si128((const __m128i *)&word_80[t - 4]), 4);
+        w = _mm_xor_si128(w, _mm_load_si128((const __m128i *)&word_80[t - 8]));
+        w = _mm_xor_si128(w, _mm_loadu_si128((const __m128i *)&word_80[t - 14]));
+        w = _mm_xor_si128(w, _mm_load_si128((const __m128i *)&word_80[t - 16]));
+        w = _mm_or_si128(_mm_slli_epi32(w, 1), _mm_srli_epi32(w, 31));
+
+        r = _mm_slli_si128(w, 12); /* W[t] into the lane of W[t+3] */
+        w = _mm_xor_si128(w, _mm_or_si128(_mm_slli_epi32(r, 1), _mm_srli_epi32(r, 31)));
+
+        _mm_store_si128((__m128i *)&word_80[t], w);
+    }
+#else
+    for (int t = 16; t < 80; ++t)
+    {
+        word_80[t] = SHA1_circular_shift(1, word_80[t-3] ^ word_80[t-8] ^ word_80[t-14] ^ word_80[t-16]);
+    }
+#endif
+}
+
+/*
+ * COMPRESS BLOCK WITH COLLISION DETECTION
+ * Same as SHA1_compress_block, but keeps the message schedule and the A
+ * register after every step for SHA1DC_check_block. Returns nonzero if
+ * the block is part of a collision; hash is updated either way.
+ */
+static int SHA1_compress_block_dc(SHA1_WORD_t hash[5], const uint8_t *block)
+{
+    SHA1_WORD_t word_80[80] __attribute__((aligned(16)));
+    SHA1_WORD_t Q[SHA1DC_N_Q];           /* A after every step, see sha1_dc.h */
+    SHA1_WORD_t temp_word;
+    SHA1_WORD_t A, B, C, D, E;
+    int t = 0;
+    const SHA1_WORD_t constants_K[4] = {
+        0x5A827999,
+        0x6ED9EBA1,
+        0x8F1BBCDC,
+        0xCA62C1D6
+    };
+
+    for(t = 0; t < 16; t++)
+    {
+        word_80[t] = (
+            (SHA1_WORD_t)block[t * 4]     << 24 |
+            (SHA1_WORD_t)block[t * 4 + 1] << 16 |
+            (SHA1_WORD_t)block[t * 4 + 2] << 8  |
+            (SHA1_WORD_t)block[t * 4 + 3]
+        );
+    }
+    SHA1_expand_schedule(word_80);
+
+    A = hash[0];
+    B = hash[1];
+    C = hash[2];
+    D = hash[3];
+    E = hash[4];
+
+    Q[0] = SHA1_circular_shift(2, E); /* undo the S^30 */
+    Q[1] = SHA1_circular_shift(2, D);
+    Q[2] = SHA1_circular_shift(2, C);
+    Q[3] = B;
+    Q[4] = A;
+
+#define SHA1_DC_STEP(f, k)                                                  \
+    temp_word = SHA1_circular_shift(5,A) + (f) + E + word_80[t] + (k);      \
+    E = D;                                                                  \
+    D = C;                                                                  \
+    C = SHA1_circular_shift(30,B);                                          \
+    B = A;                                                                  \
+    A = temp_word;                                                          \
+    Q[t + 5] = A
+
+    for(t=0; t<20; t++)
+    {
+        SHA1_DC_STEP((B & C) | ((~B) & D), constants_K[0]);
+    }
+    for(t=20; t<40; t++)
+    {
+        SHA1_DC_STEP(B ^ C ^ D, constants_K[1]);
+    }
+    for(t=40; t<60; t++)
+    {
+        SHA1_DC_STEP((B & C) | (B & D) | (C & D), constants_K[2]);
+    }
+    for(t=60; t<80; t++)
+    {
+        SHA1_DC_STEP(B ^ C ^ D, constants_K[3]);
+    }
+
+#undef SHA1_DC_STEP
+
+    hash[0] += A;
+    hash[1] += B;
+    hash[2] += C;
+    hash[3] += D;
+    hash[4] += E;
+
+    return SHA1DC_check_block(hash, word_80, Q);
+}
+
+/*
+ * SET COLLISION DETECTION
+ */
+void SHA1_set_collision_detection(int enable)
+{
+    if (enable)
+    {
+        SHA1DC_init();
+    }
+    sha1_detect_collisions = enable;
+}
+
+/*
+ * GET COLLISION DETECTION
+ */
+int SHA1_get_collision_detection(void)
+{
+    return sha1_detect_collisions;
+}
+
+/*
+ * SCALAR COMPRESS
+ */
+void SHA1_compress_scalar(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
+{
+    while (n_blocks--)
+    {
+        SHA1_compress_block(hash, data);
+        data += 64;
+    }
+}
+
+/*
+ * PROCESS BLOCK
+ */
+SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
+{
+    SHA1_ERRCODE err = SHA1_process_blocks(sha1_p->temp_hash, sha1_p->message_block, 1);
 
 #ifdef DEBUG
     printf("printout of first 20 of sha1_p->message_block (should be same):\n");
@@ -164,220 +342,237 @@ SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p)
 }
 
 /*
- * PAD AND PROCESS BLOCK
+ * PROCESS BLOCKS
  */
-SHA1_ERRCODE SHA1_pad_block(SHA1_SHA1Object_p_t sha1_p, int block_idx, const int msg_length)
+SHA1_ERRCODE SHA1_process_blocks(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
 {
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    const SHA1_Kernel_t *kernel_p;
 
-    SHA1_ERRCODE err = 0;
+    SHA1_STATS_ADD(blocks, n_blocks);
 
-    if (block_idx > 55 && block_idx < 64)
+    if (sha1_detect_collisions)
     {
-
-#ifdef DEBUG
-        printf("Padding block of size %02i with\"1\" and \"0s\"\n", (block_idx-1));
-#endif
-
         /*
-         * Add "1", then pad with "0" until block idx == 64
+         * Only candidate blocks need the states after every step; the
+         * runs between them go through the kernels as usual
          */
+        while (n_blocks > 0)
+        {
+            size_t clean = SHA1DC_scan(data, n_blocks);
 
-        sha1_p->message_block[block_idx++] = 0x80; /* NOTE why is this "1" not 0x01? */
-        /* NOTE the inline increment */
+            if (clean > 0)
+            {
+                kernel_p = SHA1_kernel_for(clean);
+                SHA1_STATS_ADD(kernel_blocks[kernel_p->id], clean);
+                kernel_p->compress(hash, data, clean);
+                data += clean * 64;
+                n_blocks -= clean;
+                continue;
+            }
+            SHA1_STATS_ADD(kernel_blocks[SHA1_KERNEL_DC], 1);
+            if (SHA1_compress_block_dc(hash, data))
+            {
+                err = SHA1_COLLISION_DETECTED;
+            }
+            data += 64;
+            n_blocks--;
+        }
 
-        while (block_idx < 64)
+        return err;
+    }
+
+    /*
+     * The kernel measured fastest for calls of this size; see sha1_kernel.h
+     */
+    kernel_p = SHA1_kernel_for(n_blocks);
+    SHA1_STATS_ADD(kernel_blocks[kernel_p->id], n_blocks);
+    kernel_p->compress(hash, data, n_blocks);
+
+    return SHA1_SUCCESS;
+}
+
+/*
+ * PROCESS ZERO BLOCKS
+ */
+SHA1_ERRCODE SHA1_process_zero_blocks(SHA1_WORD_t hash[5], uint64_t n_blocks)
+{
+    static const uint8_t zero_block[64] = { 0 };
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    SHA1_STATS_ADD(blocks, n_blocks);
+
+    /*
+     * Unless the zero block is a candidate for some DV (see sha1_dc.h),
+     * the shortcut below holds with collision detection on as well
+     */
+    if (sha1_detect_collisions && SHA1DC_scan(zero_block, 1) == 0)
+    {
+        SHA1_STATS_ADD(kernel_blocks[SHA1_KERNEL_DC], n_blocks);
+        while (n_blocks--)
         {
-            sha1_p->message_block[block_idx++] = 0x0;
+            if (SHA1_compress_block_dc(hash, zero_block))
+            {
+                err = SHA1_COLLISION_DETECTED;
+            }
         }
 
-        /*
-         * Process block;
-         * Add second word of 0s and original length
-         */
-        err = SHA1_process_block(sha1_p);
+        return err;
+    }
 
-        /* recursive call to itself to add block of 0s and length; the
-         * below else-if branch should be hit at this point
-         */
-        block_idx = 0;
-        SHA1_pad_block(sha1_p, block_idx, msg_length);
+    SHA1_STATS_ADD(kernel_blocks[SHA1_KERNEL_ZERO], n_blocks);
+    SHA1_compress_zeros(hash, n_blocks);
 
-    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * PAD AND PROCESS BLOCK
+ */
+SHA1_ERRCODE SHA1_pad_block(SHA1_SHA1Object_p_t sha1_p, int block_idx, const uint64_t msg_length)
+{
 
-    else if (block_idx < 55)
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    uint64_t len = msg_length * 8; /* in bits, not bytes */
+
+    if (block_idx < 0 || block_idx > 63)
     {
+        return SHA1_GENERIC_ERROR;
+    }
 
-        int len = msg_length * 8; /* in bits, not bytes */
+    /*
+     * The "1" is the most significant bit of the first free byte;
+     * SHA-1 is big-endian at the bit level too, hence 0x80.
+     */
+    sha1_p->message_block[block_idx++] = 0x80; /* NOTE the inline increment */
+
+    if (block_idx > 56)
+    {
 
 #ifdef DEBUG
-        printf("Padding block of size %02i with \"0s\" and creating "
-                "fill block of \"0s\" and original length %010i\n",
-                (block_idx-1), len);
+        printf("Padding block of size %02i with\"1\" and \"0s\"\n", (block_idx-1));
 #endif
 
         /*
-         * NOTE
-         * Does a 1 need to be appended here as well?
-         * Double check reference implementation(s).
+         * No room left for the length: pad with "0" until block idx == 64,
+         * process this block, and put the length in a fresh block of "0s"
          */
-        while (block_idx < 56)
+        while (block_idx < 64)
         {
             sha1_p->message_block[block_idx++] = 0x0;
         }
 
-
-        /*
-         * Add original length of message
-         */
-        sha1_p->message_block[block_idx++] = len >> 24;
-        sha1_p->message_block[block_idx++] = len >> 16;
-        sha1_p->message_block[block_idx++] = len >> 8;
-        sha1_p->message_block[block_idx++] = len;
-
-        /* Now... zeros? The ref impl. looks like it's adding zeros */
-        sha1_p->message_block[block_idx++] = 0;
-        sha1_p->message_block[block_idx++] = 0;
-        sha1_p->message_block[block_idx++] = 0;
-        sha1_p->message_block[block_idx++] = 0;
-
-        if (block_idx != 64)
+        err = SHA1_process_block(sha1_p);
+        if (err != SHA1_SUCCESS && err != SHA1_COLLISION_DETECTED)
         {
+            return err;
+        }
+
+        block_idx = 0;
+    }
 
 #ifdef DEBUG
-            printf("ERROR block_idx == %i != 64 after adding length!\n", block_idx);
+    printf("Padding block of size %02i with \"0s\" and original "
+            "length %020llu\n", block_idx, (unsigned long long)len);
 #endif
 
-            err = SHA1_GENERIC_ERROR;
-            return err;
-        }
+    while (block_idx < 56)
+    {
+        sha1_p->message_block[block_idx++] = 0x0;
+    }
 
-        /* compute intermediate hash */
-        err = SHA1_process_block(sha1_p);
+    /*
+     * Add original length of message as a 64-bit big-endian integer
+     */
+    sha1_p->message_block[block_idx++] = len >> 56;
+    sha1_p->message_block[block_idx++] = len >> 48;
+    sha1_p->message_block[block_idx++] = len >> 40;
+    sha1_p->message_block[block_idx++] = len >> 32;
+    sha1_p->message_block[block_idx++] = len >> 24;
+    sha1_p->message_block[block_idx++] = len >> 16;
+    sha1_p->message_block[block_idx++] = len >> 8;
+    sha1_p->message_block[block_idx++] = len;
+
+    /* compute final hash, keeping a collision found in the block before */
+    if (SHA1_process_block(sha1_p) != SHA1_SUCCESS)
+    {
+        err = SHA1_COLLISION_DETECTED;
     }
 
     return err;
 }
 
 /*
- * PROCESS MESSAGE
+ * PROCESS FINAL
  */
-SHA1_ERRCODE SHA1_process_message(const char *msg_p, SHA1_SHA1Object_p_t sha1_p)
+SHA1_ERRCODE SHA1_process_final(SHA1_SHA1Object_p_t sha1_p, const uint8_t *tail,
+                                size_t tail_len, uint64_t msg_length)
 {
+    if (tail_len > 63)
+    {
+        return SHA1_GENERIC_ERROR;
+    }
 
-    /*
-     * Process the message string in 512 bit blocks. For each block,
-     * compute the temporary hash and store it. Only after the message
-     * string has ended can we produce the final result.
-     */
+    memcpy(sha1_p->message_block, tail, tail_len);
 
-    /*
-     * initialize counter variables
-     */
-    const int msg_length = strlen(msg_p); /* to store original message length */
-    int mutable_msg_length = msg_length;     /* for counting */
-    int block_idx  = 0;                   /* store the block index posittion */
-    SHA1_ERRCODE ret_code = 0;            /* store return codes */
+    return SHA1_pad_block(sha1_p, (int)tail_len, msg_length);
+}
+
+/*
+ * PROCESS BUFFER
+ */
+SHA1_ERRCODE SHA1_process_buffer(const uint8_t *msg_p, uint64_t msg_length,
+                                 SHA1_SHA1Object_p_t sha1_p)
+{
+    uint64_t n_blocks = msg_length / 64;
+    SHA1_ERRCODE err, final_err;
+    SHA1_STATS_TIMER(start);
 
 #ifdef DEBUG
-    printf("INITIAL MESSAGE LENTGH: %08i\n", mutable_msg_length);
+    printf("INITIAL MESSAGE LENGTH: %020llu\n", (unsigned long long)msg_length);
 #endif
 
-    /* While the message length is nonzero, we process each 512-bit
-     * WORD and compute its hash. This hash is stored temporarily,
-     * and will be used in the computations of subsequent computations.
-     */
+    SHA1_init_hash(sha1_p);
 
     /*
-     * Initialize intermediate hash buffer with constants
+     * Every whole block is compressed straight out of the caller's
+     * buffer; only the tail is copied into the message block for padding.
      */
-    sha1_p->temp_hash[0] = 0x67452301;
-    sha1_p->temp_hash[1] = 0xEFCDAB89;
-    sha1_p->temp_hash[2] = 0x98BADCFE;
-    sha1_p->temp_hash[3] = 0x10325476;
-    sha1_p->temp_hash[4] = 0xC3D2E1F0;
+    err = SHA1_process_blocks(sha1_p->temp_hash, msg_p, n_blocks);
+    final_err = SHA1_process_final(sha1_p, msg_p + n_blocks * 64,
+                                   msg_length % 64, msg_length);
 
-    while (mutable_msg_length > 0)
+#if SHA1_STATS
+    if (SHA1_STATS_ON())
     {
+        uint64_t latency = SHA1_stats_now() - start;
 
-        while (mutable_msg_length > 0 && block_idx < 64)
-        {
-            /* Assign the value of msg_p[block_idx] to the
-             * message block. Increment the index counter and message ptr
-             */
-            sha1_p->message_block[block_idx] = *(msg_p);
-            mutable_msg_length--;
-            block_idx++;
-            msg_p++;
-        }
-
-#ifdef DEBUG
-        printf("Message block (first 20):\n");
-        for (int i=0; i<20; ++i)
-        {
-            printf("%08X ", sha1_p->message_block[i]);
-        }
-        printf("\n\n");
+        SHA1_stats_local()->compress_ns += latency;
+        SHA1_stats_record_message(msg_length, latency);
+    }
 #endif
 
-        /*
-         * The above while-loop has finished due to one of two conditions:
-         * 1) the message isn't long enough or 2) we've filled the block
-         */
-
-        if (block_idx == 64)
-        {
-            /*
-             * Process the block and store the intermediate hash.
-             * The block_idx is reset after and NOT by the function
-             * which processes the block.
-             */
-            ret_code = SHA1_process_block(sha1_p);
-            if (ret_code != SHA1_SUCCESS)
-            {
-                printf("BORKED after processing\n");
-                return ret_code;
-            }
-        }
-
-        else if (block_idx <= 56)
-        {
-            /*
-             * We need to create two WORDs and compute the has for each.
-             * The first word will have a "1" added to it (8-bit int), and
-             * then padded with "0" until the block_idx == 64, at which point
-             * this WORD can be processed and its hash stored. Following this,
-             * create another WORD out of all "0" until block_idx == 56; the
-             * remaining 8 slots (8 bytes, 64 bits) will allow for a 64-bit
-             * integer to denote the length of the original message.
-             */
-            ret_code = SHA1_pad_block(sha1_p, block_idx, msg_length);
-            if (ret_code != SHA1_SUCCESS)
-            {
-                printf("BORKED after padding\n");
-                return ret_code;
-            }
-        }
+    return final_err != SHA1_SUCCESS ? final_err : err;
+}
 
-        /*
-         * resetting the block_idx
-         */
-        block_idx = 0;
+/*
+ * PROCESS MESSAGE
+ */
+SHA1_ERRCODE SHA1_process_message(const char *msg_p, SHA1_SHA1Object_p_t sha1_p)
+{
+    return SHA1_process_buffer((const uint8_t *)msg_p, strlen(msg_p), sha1_p);
+}
 
-        /*
-         * if the original message was 64 bytes (512 bits) long exactly,
-         * then we need to add a second WORD made of all 0s plus the
-         * original length at the end
-         */
-        if (msg_length == 64)
-        {
-            ret_code = SHA1_pad_block(sha1_p, block_idx, msg_length);
-            if (ret_code != SHA1_SUCCESS)
-            {
-                printf("BORKED after padding\n");
-                return ret_code;
-            }
-        }
+/*
+ * GET DIGEST
+ */
+void SHA1_get_digest(const SHA1_SHA1Object_t *sha1_p, SHA1_DIGEST_t digest)
+{
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4]     = sha1_p->temp_hash[i] >> 24;
+        digest[i * 4 + 1] = sha1_p->temp_hash[i] >> 16;
+        digest[i * 4 + 2] = sha1_p->temp_hash[i] >> 8;
+        digest[i * 4 + 3] = sha1_p->temp_hash[i];
     }
-
-    return ret_code;
 }
@@ -1,5 +1,6 @@
 /* SHA1 header file */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef _SHA1_H_
@@ -154,6 +155,7 @@
  */
 typedef uint32_t SHA1_WORD_t, *SHA1_WORD_p_t;      /* 4-byte int */
 typedef uint8_t SHA1_BLOCK_t[64], *SHA1_BLOCK_p_t; /* 1-byte char */
+typedef uint8_t SHA1_DIGEST_t[20];                 /* final 160-bit digest */
 
 typedef struct SHA1_SHA1Object {
     //SHA1_WORD_t digest[5];      /* digest is 5 WORDs */
@@ -167,12 +169,19 @@ typedef struct SHA1_SHA1Object {
 typedef enum _sha1_errcode
 {
     SHA1_SUCCESS = 0,
-    SHA1_GENERIC_ERROR = 1
+    SHA1_GENERIC_ERROR = 1,
+    SHA1_BAD_INPUT = 2,      /* malformed caller input (hex, manifest, ...) */
+    SHA1_IO_ERROR = 3,       /* read/write/open failed; see errno */
+    SHA1_ALLOC_ERROR = 4,    /* out of memory */
+    SHA1_COLLISION_DETECTED = 5 /* input is part of a SHA-1 collision attack;
+                                 * the digest is still computed */
 } SHA1_ERRCODE;
 
 /*
  * Constants
  */
+#define SHA1_BLOCK_SIZE  64 /* bytes per 512-bit block */
+#define SHA1_DIGEST_SIZE 20 /* bytes per 160-bit digest */
 
 /*
  * All function prototypes
@@ -185,6 +194,12 @@ typedef enum _sha1_errcode
  */
 SHA1_WORD_t SHA1_circular_shift(int n, SHA1_WORD_t word);
 
+/*
+ * INITIALIZE HASH
+ * Load H0..H4 (defined above) into SHA1Object->temp_hash.
+ */
+void SHA1_init_hash(SHA1_SHA1Object_p_t sha1_p);
+
 /*
  * PAD MESSAGE STRING
  * Pad a given message string according to the padding algorithm
@@ -213,24 +228,106 @@ SHA1_ERRCODE SHA1_pad_message(SHA1_SHA1Object_p_t sha1_p, uint8_t *msg, uint64_t
  */
 SHA1_ERRCODE SHA1_process_block(SHA1_SHA1Object_p_t sha1_p);
 
+/*
+ * SET COLLISION DETECTION
+ * Turn SHA1DC-style collision detection (see sha1_dc.h) on or off for
+ * every subsequent block compressed by this process. While it is on,
+ * any function that compresses a block crafted as part of a collision
+ * attack returns SHA1_COLLISION_DETECTED, after finishing its work.
+ */
+void SHA1_set_collision_detection(int enable);
+
+/*
+ * GET COLLISION DETECTION
+ * Returns
+ *  nonzero while collision detection is on
+ */
+int SHA1_get_collision_detection(void);
+
+/*
+ * PROCESS BLOCKS
+ * Compress n_blocks consecutive 512-bit blocks read directly from data
+ * into the 5-WORD hash. No padding is applied and nothing is copied, so
+ * this is the path for callers that already hold whole blocks.
+ *
+ * Parameters
+ *  hash: intermediate hash to update in place
+ *  data: pointer to n_blocks * 64 bytes
+ *  n_blocks: number of blocks
+ *
+ * Returns
+ *  SHA1_ERRCODE
+ */
+SHA1_ERRCODE SHA1_process_blocks(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks);
+
+/*
+ * PROCESS ZERO BLOCKS
+ * As SHA1_process_blocks for n_blocks blocks of zero bytes, without
+ * reading them from anywhere: the message schedule of an all-zero block
+ * is itself all zero, so a precomputed one is used (sha1_kernel.h).
+ * Meant for holes in sparse files.
+ *
+ * Parameters
+ *  hash: intermediate hash to update in place
+ *  n_blocks: number of all-zero blocks
+ *
+ * Returns
+ *  SHA1_ERRCODE
+ */
+SHA1_ERRCODE SHA1_process_zero_blocks(SHA1_WORD_t hash[5], uint64_t n_blocks);
+
 /*
  * PAD BLOCK
- * Pad the block for a given SHA1Object to 512 bits (64 bytes). If
- * 55 < block_idx < 64, the block will be padded with a "1" then
- * "0s" until the block_idx is 64. If block_idx < 55, a "1" will be added,
- * followed by the required "0s" until the block_idx == 56. This leaves enough
- * space for a 64-bit integer at the end, containing the length of the
- * original message.
+ * Pad the block for a given SHA1Object to 512 bits (64 bytes) and process
+ * it. A "1" is always added at block_idx. If 55 < block_idx < 64, the block
+ * is then padded with "0s" until the block_idx is 64, processed, and a
+ * second block of "0s" is started. Otherwise "0s" are added until the
+ * block_idx == 56. This leaves enough space for a 64-bit integer at the
+ * end, containing the length of the original message in bits.
 *
 * Parameters
 *   sha1_p: pointer to SHA1 object
 *   block_idx: current block index (the next available spot)
-*   msg_length: length of original message
+*   msg_length: length of original message in bytes
 *
 * Returns
 *   SHA1_ERRCODE int
  */
-SHA1_ERRCODE SHA1_pad_block(SHA1_SHA1Object_p_t sha1_p, int block_idx, const int msg_length);
+SHA1_ERRCODE SHA1_pad_block(SHA1_SHA1Object_p_t sha1_p, int block_idx, const uint64_t msg_length);
+
+/*
+ * PROCESS FINAL
+ * Copy the last tail_len (< 64) bytes of a message into the message block,
+ * pad it and process it. msg_length is the length of the whole message,
+ * in bytes, that has been fed through SHA1_process_blocks plus this tail.
+ *
+ * Parameters
+ *  sha1_p: pointer to SHA1Object_t
+ *  tail: pointer to the remaining bytes
+ *  tail_len: number of remaining bytes
+ *  msg_length: total message length in bytes
+ *
+ * Returns
+ *  SHA1_ERRCODE
+ */
+SHA1_ERRCODE SHA1_process_final(SHA1_SHA1Object_p_t sha1_p, const uint8_t *tail,
+                                size_t tail_len, uint64_t msg_length);
+
+/*
+ * PROCESS BUFFER
+ * Compute the hash for a message of msg_length bytes. Unlike
+ * SHA1_process_message the message may contain NUL bytes.
+ *
+ * Parameters
+ *  msg_p: pointer to message
+ *  msg_length: length of message in bytes
+ *  sha1_p: pointer to SHA1Object_t
+ *
+ * Returns
+ *  SHA1_ERRCODE
+ */
+SHA1_ERRCODE SHA1_process_buffer(const uint8_t *msg_p, uint64_t msg_length,
+                                 SHA1_SHA1Object_p_t sha1_p);
 
 /*
  * PROCESS MESSAGE
@@ -245,4 +342,11 @@ SHA1_ERRCODE SHA1_pad_block(SHA1_SHA1Object_p_t sha1_p, int block_idx, const int
  */
 SHA1_ERRCODE SHA1_process_message(const char *msg_p, SHA1_SHA1Object_p_t sha1_p);
 
+/*
+ * GET DIGEST
+ * Serialize SHA1Object->temp_hash (H0 H1 H2 H3 H4) into the 20-byte,
+ * big-endian digest.
+ */
+void SHA1_get_digest(const SHA1_SHA1Object_t *sha1_p, SHA1_DIGEST_t digest);
+
 #endif /* _SHA1_H_ */
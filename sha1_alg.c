@@ -0,0 +1,585 @@
+/*
+ * Hashing through the Linux kernel crypto API (AF_ALG)
+ */
+
+#define _GNU_SOURCE
+#include "sha1_alg.h"
+#include "sha1_file.h"
+#include "sha1_kernel.h"
+#include "sha1_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_alg.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+static pthread_once_t alg_once = PTHREAD_ONCE_INIT;
+static int alg_tfm_fd = -1;     /* bound to hash/sha1; accept(2) gives a fresh hash */
+static int alg_errno = 0;       /* why it is unavailable */
+static char alg_driver[64] = "unknown";
+
+/*
+ * Highest-priority sha1 driver in /proc/crypto that passed the kernel's
+ * own self-test
+ */
+static void find_driver(void)
+{
+    FILE *fp = fopen("/proc/crypto", "r");
+    char line[256], name[64] = "", driver[64] = "";
+    long priority = -1, best = -1;
+    int passed = 1;
+
+    if (fp == NULL)
+    {
+        return;
+    }
+    for (;;)
+    {
+        char *value, *got = fgets(line, sizeof(line), fp);
+
+        /*
+         * An entry ends at a blank line (or end of file)
+         */
+        if (got == NULL || line[0] == '\n')
+        {
+            if (strcmp(name, "sha1") == 0 && passed && priority > best)
+            {
+                best = priority;
+                snprintf(alg_driver, sizeof(alg_driver), "%s", driver);
+            }
+            name[0] = driver[0] = '\0';
+            priority = -1;
+            passed = 1;
+            if (got == NULL)
+            {
+                break;
+            }
+            continue;
+        }
+        value = strchr(line, ':');
+        if (value == NULL)
+        {
+            continue;
+        }
+        value += strspn(value + 1, " ") + 1;
+        value[strcspn(value, "\n")] = '\0';
+        if (strncmp(line, "name ", 5) == 0)
+        {
+            snprintf(name, sizeof(name), "%s", value);
+        }
+        else if (strncmp(line, "driver ", 7) == 0)
+        {
+            snprintf(driver, sizeof(driver), "%s", value);
+        }
+        else if (strncmp(line, "priority ", 9) == 0)
+        {
+            priority = strtol(value, NULL, 10);
+        }
+        else if (strncmp(line, "selftest ", 9) == 0)
+        {
+            passed = strcmp(value, "passed") == 0;
+        }
+    }
+    fclose(fp);
+}
+
+static int alg_accept(void)
+{
+    return accept4(alg_tfm_fd, NULL, NULL, SOCK_CLOEXEC);
+}
+
+/*
+ * Read the digest; this finishes the hash after data sent with MSG_MORE
+ */
+static SHA1_ERRCODE alg_result(int op_fd, SHA1_DIGEST_t digest)
+{
+    ssize_t n;
+
+    do
+    {
+        n = read(op_fd, digest, SHA1_DIGEST_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != SHA1_DIGEST_SIZE)
+    {
+        if (n >= 0)
+        {
+            errno = EIO;
+        }
+        return SHA1_IO_ERROR;
+    }
+    return SHA1_SUCCESS;
+}
+
+static SHA1_ERRCODE alg_send(int op_fd, const uint8_t *data, size_t len)
+{
+    do
+    {
+        ssize_t n = send(op_fd, data, len, MSG_MORE);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return SHA1_IO_ERROR;
+        }
+        data += n;
+        len -= (size_t)n;
+    } while (len > 0);
+    return SHA1_SUCCESS;
+}
+
+static SHA1_ERRCODE alg_hash_buffer(const uint8_t *data, size_t len, SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int saved_errno;
+    int op_fd = alg_accept();
+
+    if (op_fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (len > 0)
+    {
+        err = alg_send(op_fd, data, len);
+    }
+    if (err == SHA1_SUCCESS)
+    {
+        err = alg_result(op_fd, digest);
+    }
+    saved_errno = errno;
+    close(op_fd);
+    errno = saved_errno;
+    return err;
+}
+
+/*
+ * SELF-TEST
+ * The RFC 3174 vectors, the empty message, and a buffer long enough to
+ * take several sends, against the in-process digest
+ */
+static int alg_self_test(void)
+{
+    static const struct {
+        const char *msg;
+        const char *hex;
+    } vectors[] = {
+        { "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+        { "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+    };
+    SHA1_SHA1Object_t sha1;
+    SHA1_DIGEST_t digest, expected;
+    size_t big = 3 * SHA1_ALG_PIPE_SIZE + 17;
+    uint8_t *buf;
+    int ok;
+
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++)
+    {
+        if (alg_hash_buffer((const uint8_t *)vectors[v].msg, strlen(vectors[v].msg),
+                            digest) != SHA1_SUCCESS)
+        {
+            return 0;
+        }
+        for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+        {
+            char hex[3];
+
+            snprintf(hex, sizeof(hex), "%02x", digest[i]);
+            if (memcmp(hex, vectors[v].hex + 2 * i, 2) != 0)
+            {
+                errno = EBADMSG;
+                return 0;
+            }
+        }
+    }
+
+    buf = malloc(big);
+    if (buf == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < big; i++)
+    {
+        buf[i] = (uint8_t)(i * 131 + 7);
+    }
+    SHA1_process_buffer(buf, big, &sha1);
+    SHA1_get_digest(&sha1, expected);
+    ok = alg_hash_buffer(buf, big, digest) == SHA1_SUCCESS &&
+         memcmp(digest, expected, SHA1_DIGEST_SIZE) == 0;
+    free(buf);
+    if (!ok && errno == 0)
+    {
+        errno = EBADMSG;
+    }
+    return ok;
+}
+
+static void alg_setup(void)
+{
+    struct sockaddr_alg addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.salg_family = AF_ALG;
+    strcpy((char *)addr.salg_type, "hash");
+    strcpy((char *)addr.salg_name, "sha1");
+
+    alg_tfm_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (alg_tfm_fd < 0)
+    {
+        alg_errno = errno;
+        return;
+    }
+    if (bind(alg_tfm_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        alg_errno = errno;
+        close(alg_tfm_fd);
+        alg_tfm_fd = -1;
+        return;
+    }
+
+    errno = 0;
+    if (!alg_self_test())
+    {
+        alg_errno = errno != 0 ? errno : EIO;
+        close(alg_tfm_fd);
+        alg_tfm_fd = -1;
+        return;
+    }
+    find_driver();
+}
+
+int SHA1_alg_available(void)
+{
+    pthread_once(&alg_once, alg_setup);
+    return alg_tfm_fd >= 0;
+}
+
+const char *SHA1_alg_driver(void)
+{
+    pthread_once(&alg_once, alg_setup);
+    return alg_driver;
+}
+
+SHA1_ERRCODE SHA1_alg_hash_buffer(const uint8_t *data, size_t len, SHA1_DIGEST_t digest)
+{
+    if (!SHA1_alg_available())
+    {
+        return SHA1_GENERIC_ERROR;
+    }
+    return alg_hash_buffer(data, len, digest);
+}
+
+/*
+ * Move n bytes from the pipe into the hash
+ */
+static SHA1_ERRCODE drain_pipe(int pipe_fd, int op_fd, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t moved = splice(pipe_fd, NULL, op_fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (moved < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return SHA1_IO_ERROR;
+        }
+        if (moved == 0)
+        {
+            errno = EIO;
+            return SHA1_IO_ERROR;
+        }
+        n -= (size_t)moved;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * Splice fd into the hash until end of file; *len_p counts the bytes.
+ * A pipe fd goes straight in, anything else through a pipe of ours.
+ */
+static SHA1_ERRCODE splice_fd(int fd, int op_fd, uint64_t *len_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    struct stat st;
+    int pipe_fd[2];
+    int is_pipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    size_t chunk = SHA1_ALG_PIPE_SIZE;
+    int saved_errno;
+
+    if (!is_pipe)
+    {
+        int size;
+
+        if (pipe2(pipe_fd, O_CLOEXEC) != 0)
+        {
+            return SHA1_IO_ERROR;
+        }
+
+        /*
+         * As large as allowed (fs.pipe-max-size); the default 64 KiB
+         * works too, with more system calls
+         */
+        size = fcntl(pipe_fd[1], F_SETPIPE_SZ, SHA1_ALG_PIPE_SIZE);
+        if (size < 0)
+        {
+            size = fcntl(pipe_fd[1], F_GETPIPE_SZ);
+        }
+        if (size > 0)
+        {
+            chunk = (size_t)size;
+        }
+    }
+
+    for (;;)
+    {
+        ssize_t n = splice(fd, NULL, is_pipe ? op_fd : pipe_fd[1], NULL, chunk,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            /*
+             * Files that cannot be spliced fail on the first call,
+             * before anything was consumed
+             */
+            err = *len_p == 0 && errno == EINVAL ? SHA1_GENERIC_ERROR : SHA1_IO_ERROR;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        *len_p += (uint64_t)n;
+        if (!is_pipe)
+        {
+            err = drain_pipe(pipe_fd[0], op_fd, (size_t)n);
+            if (err != SHA1_SUCCESS)
+            {
+                break;
+            }
+        }
+    }
+
+    if (!is_pipe)
+    {
+        saved_errno = errno;
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        errno = saved_errno;
+    }
+    return err;
+}
+
+SHA1_ERRCODE SHA1_alg_hash_fd(int fd, SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err;
+    uint64_t msg_length = 0;
+    int saved_errno;
+    int op_fd;
+    SHA1_STATS_TIMER(start);
+
+    if (!SHA1_alg_available())
+    {
+        return SHA1_GENERIC_ERROR;
+    }
+    op_fd = alg_accept();
+    if (op_fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+
+    err = splice_fd(fd, op_fd, &msg_length);
+    if (err == SHA1_SUCCESS)
+    {
+        err = alg_result(op_fd, digest);
+    }
+    saved_errno = errno;
+    close(op_fd);
+    errno = saved_errno;
+
+#if SHA1_STATS
+    if (err == SHA1_SUCCESS && SHA1_STATS_ON())
+    {
+        uint64_t n_blocks = (msg_length + 8) / SHA1_BLOCK_SIZE + 1; /* with padding */
+
+        SHA1_STATS_ADD(blocks, n_blocks);
+        SHA1_STATS_ADD(kernel_blocks[SHA1_KERNEL_AFALG], n_blocks);
+        SHA1_STATS_ELAPSED(start, compress_ns);
+        SHA1_stats_record_message(msg_length, SHA1_stats_now() - start);
+    }
+#endif
+    return err;
+}
+
+/*
+ * BENCHMARK
+ */
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void print_rate(FILE *fp, const char *label, const char *how, double seconds, off_t size)
+{
+    fprintf(fp, "  %-10s %-24s %10.1f MB/s\n", label, how,
+            seconds > 0 ? (double)size / seconds / 1e6 : 0.0);
+}
+
+SHA1_ERRCODE SHA1_alg_benchmark(const char *path, FILE *fp)
+{
+    static const char *const kernel_names[] = { "shani", "avx512", "avx2", "ssse3", "scalar" };
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    SHA1_DIGEST_t expected, digest;
+    struct stat st;
+    uint8_t *map;
+    double best;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return SHA1_IO_ERROR;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size < SHA1_BLOCK_SIZE)
+    {
+        close(fd);
+        errno = EINVAL;
+        return SHA1_IO_ERROR;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return SHA1_IO_ERROR;
+    }
+
+    fprintf(fp, "%s: %lld bytes, from the page cache, best of 3\n", path, (long long)st.st_size);
+    SHA1_kernels_init();
+
+    /*
+     * Every in-process kernel, on the mapped pages: compression alone
+     */
+    for (size_t k = 0; k < sizeof(kernel_names) / sizeof(kernel_names[0]); k++)
+    {
+        const SHA1_Kernel_t *kernel_p = SHA1_kernel_by_name(kernel_names[k]);
+
+        if (kernel_p == NULL || !kernel_p->verified)
+        {
+            continue;
+        }
+        best = 0;
+        for (int round = 0; round < 3; round++)
+        {
+            SHA1_WORD_t hash[5] = { 0 };
+            double t0 = now_s(), elapsed;
+
+            kernel_p->compress(hash, map, (size_t)st.st_size / SHA1_BLOCK_SIZE);
+            elapsed = now_s() - t0;
+            if (round == 0 || elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+        print_rate(fp, kernel_p->name, "compress (mapped)", best, st.st_size);
+    }
+
+    /*
+     * The usual file path: read(2) into a buffer, SHA1_process_blocks
+     */
+    best = 0;
+    for (int round = 0; round < 3 && err == SHA1_SUCCESS; round++)
+    {
+        double t0 = now_s(), elapsed;
+
+        if (lseek(fd, 0, SEEK_SET) != 0 || SHA1_hash_fd(fd, expected) != SHA1_SUCCESS)
+        {
+            err = SHA1_IO_ERROR;
+            break;
+        }
+        elapsed = now_s() - t0;
+        if (round == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    if (err == SHA1_SUCCESS)
+    {
+        print_rate(fp, "user", "read + process_blocks", best, st.st_size);
+    }
+
+    /*
+     * The kernel crypto API, spliced
+     */
+    if (err == SHA1_SUCCESS && !SHA1_alg_available())
+    {
+        fprintf(fp, "  %-10s not available: %s\n", "afalg", strerror(alg_errno));
+    }
+    else if (err == SHA1_SUCCESS)
+    {
+        for (int round = 0; round < 3 && err == SHA1_SUCCESS; round++)
+        {
+            double t0 = now_s(), elapsed;
+
+            if (lseek(fd, 0, SEEK_SET) != 0)
+            {
+                err = SHA1_IO_ERROR;
+                break;
+            }
+            err = SHA1_alg_hash_fd(fd, digest);
+            elapsed = now_s() - t0;
+            if (round == 0 || elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+        if (err == SHA1_GENERIC_ERROR)
+        {
+            fprintf(fp, "  %-10s cannot splice this file\n", "afalg");
+            err = SHA1_SUCCESS;
+        }
+        else if (err == SHA1_SUCCESS)
+        {
+            char how[sizeof(alg_driver) + 16];
+
+            snprintf(how, sizeof(how), "splice (%s)", alg_driver);
+            print_rate(fp, "afalg", how, best, st.st_size);
+            if (memcmp(digest, expected, SHA1_DIGEST_SIZE) != 0)
+            {
+                fprintf(fp, "  afalg digest differs from the in-process one\n");
+                err = SHA1_BAD_INPUT;
+            }
+        }
+    }
+
+    munmap(map, (size_t)st.st_size);
+    close(fd);
+    return err;
+}
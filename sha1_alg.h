@@ -0,0 +1,80 @@
+/* SHA1 Linux kernel crypto (AF_ALG) header file */
+
+#include <stdio.h>
+#include "sha1.h"
+
+#ifndef _SHA1_ALG_H_
+#define _SHA1_ALG_H_
+
+/*
+ * Hash through the Linux kernel crypto API instead of the in-process
+ * kernels: an AF_ALG "hash" socket bound to "sha1" runs whichever SHA-1
+ * driver the kernel ranks highest (sha1-ni, sha1-avx2, an offload
+ * engine, or the generic C code).
+ *
+ * File data does not pass through user space. It is spliced from the
+ * file into a pipe and from the pipe into the socket, so only page
+ * references move, and the digest is read back at the end. Pipes are
+ * spliced straight into the socket.
+ *
+ * The socket is bound and checked against known digests once per
+ * process; a kernel without AF_ALG (or without sha1, or a sandbox that
+ * forbids the socket family) simply makes the backend unavailable.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_ALG_PIPE_SIZE (1024 * 1024) /* pipe buffer asked for; bytes per splice */
+
+/*
+ * ALG AVAILABLE
+ * Nonzero if the kernel's sha1 can be used (bound and self-tested on
+ * the first call).
+ */
+int SHA1_alg_available(void);
+
+/*
+ * ALG DRIVER
+ * Name of the driver the kernel is expected to use for sha1 (the
+ * highest-priority one in /proc/crypto), or "unknown".
+ */
+const char *SHA1_alg_driver(void);
+
+/*
+ * ALG HASH BUFFER
+ * Hash len bytes at data in the kernel (copied in with send(2)).
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_GENERIC_ERROR if AF_ALG is unavailable, or
+ *  SHA1_IO_ERROR (errno set)
+ */
+SHA1_ERRCODE SHA1_alg_hash_buffer(const uint8_t *data, size_t len, SHA1_DIGEST_t digest);
+
+/*
+ * ALG HASH FD
+ * Hash everything readable from fd, up to end of file, by splicing it
+ * into the kernel.
+ *
+ * Returns
+ *  SHA1_SUCCESS;
+ *  SHA1_GENERIC_ERROR if AF_ALG is unavailable or fd cannot be spliced
+ *  (nothing has been read then: hash fd some other way);
+ *  SHA1_IO_ERROR (errno set)
+ */
+SHA1_ERRCODE SHA1_alg_hash_fd(int fd, SHA1_DIGEST_t digest);
+
+/*
+ * ALG BENCHMARK
+ * Time the file at path, from the page cache, through every verified
+ * in-process kernel (compression of the mapped file), through
+ * SHA1_hash_fd (read(2) and SHA1_process_blocks), and through AF_ALG
+ * with splice; best of three runs each. Writes a table to fp.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_BAD_INPUT if the
+ *  AF_ALG digest differs from the in-process one
+ */
+SHA1_ERRCODE SHA1_alg_benchmark(const char *path, FILE *fp);
+
+#endif /* _SHA1_ALG_H_ */
@@ -0,0 +1,432 @@
+/*
+ * Persistent digest cache keyed by stat data
+ */
+
+#define _GNU_SOURCE
+#include "sha1_cache.h"
+#include "sha1_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_HEADER_SIZE 64
+
+_Static_assert(sizeof(SHA1_CacheSlot_t) == 64, "cache slots are one cache line");
+
+/*
+ * Header layout: magic (8 bytes), version (u32), log2 of the slot count
+ * (u32), slots in use (u64)
+ */
+#define HEADER_VERSION(map)  ((uint32_t *)((map) + 8))
+#define HEADER_LOG2(map)     ((uint32_t *)((map) + 12))
+#define HEADER_N_USED(map)   ((uint64_t *)((map) + 16))
+
+static int64_t stat_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static uint64_t slot_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = ino * 0x9E3779B97F4A7C15ULL ^ dev * 0xC2B2AE3D27D4EB4FULL;
+
+    return h ^ h >> 29;
+}
+
+static int stat_matches(const SHA1_CacheSlot_t *slot_p, const struct stat *st)
+{
+    return slot_p->size == (uint64_t)st->st_size &&
+           slot_p->mtime_ns == stat_ns(&st->st_mtim) &&
+           slot_p->ctime_ns == stat_ns(&st->st_ctim);
+}
+
+/*
+ * Copy a slot consistently.
+ *
+ * Returns
+ *  the slot's (even) sequence number, 0 if it is empty, or 1 if it was
+ *  being written
+ */
+static uint32_t slot_read(const SHA1_CacheSlot_t *slot_p, SHA1_CacheSlot_t *copy_p)
+{
+    uint32_t seq = __atomic_load_n(&slot_p->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == 0 || (seq & 1))
+    {
+        return seq == 0 ? 0 : 1;
+    }
+    memcpy(copy_p, slot_p, sizeof(*copy_p));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot_p->seq, __ATOMIC_RELAXED) == seq ? seq : 1;
+}
+
+/*
+ * Overwrite a slot whose sequence number is still seq.
+ *
+ * Returns
+ *  nonzero if it was written, 0 if another writer got there first
+ */
+static int slot_write(SHA1_CacheSlot_t *slot_p, uint32_t seq, const struct stat *st,
+                      const SHA1_DIGEST_t digest)
+{
+    uint32_t next = seq + 2 != 0 ? seq + 2 : 2;
+
+    if (!__atomic_compare_exchange_n(&slot_p->seq, &seq, seq + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE); /* the odd seq before any field */
+    slot_p->dev = st->st_dev;
+    slot_p->ino = st->st_ino;
+    slot_p->size = (uint64_t)st->st_size;
+    slot_p->mtime_ns = stat_ns(&st->st_mtim);
+    slot_p->ctime_ns = stat_ns(&st->st_ctim);
+    memcpy(slot_p->digest, digest, SHA1_DIGEST_SIZE);
+    __atomic_store_n(&slot_p->seq, next, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Put an entry in the slot of its key, or in the first empty one
+ */
+static int cache_insert(SHA1_Cache_p_t cache_p, const struct stat *st, const SHA1_DIGEST_t digest)
+{
+    uint64_t h = slot_hash(st->st_dev, st->st_ino);
+
+    for (uint64_t p = 0; p < SHA1_CACHE_MAX_PROBE; p++)
+    {
+        SHA1_CacheSlot_t *slot_p = &cache_p->slots[(h + p) & cache_p->mask];
+        SHA1_CacheSlot_t copy;
+        uint32_t seq = slot_read(slot_p, &copy);
+
+        if (seq == 0)
+        {
+            if (!slot_write(slot_p, 0, st, digest))
+            {
+                return 0;
+            }
+            __atomic_fetch_add(cache_p->n_used_p, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (seq != 1 && copy.dev == (uint64_t)st->st_dev && copy.ino == (uint64_t)st->st_ino)
+        {
+            return slot_write(slot_p, seq, st, digest);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Map the cache file open on fd read-write.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR, or SHA1_BAD_INPUT if it is not a valid
+ *  cache
+ */
+static SHA1_ERRCODE cache_map(int fd, SHA1_Cache_p_t cache_p)
+{
+    struct stat st;
+    uint32_t log2;
+    uint8_t *map;
+
+    memset(cache_p, 0, sizeof(*cache_p));
+    if (fstat(fd, &st) != 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (st.st_size < CACHE_HEADER_SIZE)
+    {
+        return SHA1_BAD_INPUT;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return SHA1_IO_ERROR;
+    }
+
+    log2 = *HEADER_LOG2(map);
+    if (memcmp(map, SHA1_CACHE_MAGIC, sizeof(SHA1_CACHE_MAGIC)) != 0 ||
+        *HEADER_VERSION(map) != SHA1_CACHE_VERSION || log2 > 40 ||
+        (uint64_t)st.st_size != CACHE_HEADER_SIZE + (sizeof(SHA1_CacheSlot_t) << log2))
+    {
+        munmap(map, (size_t)st.st_size);
+        return SHA1_BAD_INPUT;
+    }
+
+    cache_p->map = map;
+    cache_p->map_size = (size_t)st.st_size;
+    cache_p->slots = (SHA1_CacheSlot_t *)(map + CACHE_HEADER_SIZE);
+    cache_p->mask = ((uint64_t)1 << log2) - 1;
+    cache_p->n_used_p = HEADER_N_USED(map);
+    return SHA1_SUCCESS;
+}
+
+/*
+ * Write a new, empty cache of 2^log2 slots, carry over the entries of
+ * old_p (if not NULL) and rename it over path
+ */
+static SHA1_ERRCODE cache_create(const char *path, uint32_t log2, const SHA1_Cache_t *old_p)
+{
+    size_t tmp_len = strlen(path) + 16;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    SHA1_Cache_t cache;
+    char *tmp_path;
+    int saved_errno;
+    int fd;
+
+    tmp_path = malloc(tmp_len);
+    if (tmp_path == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    snprintf(tmp_path, tmp_len, "%s.%ld.tmp", path, (long)getpid());
+
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        free(tmp_path);
+        return SHA1_IO_ERROR;
+    }
+    if (ftruncate(fd, (off_t)(CACHE_HEADER_SIZE + (sizeof(SHA1_CacheSlot_t) << log2))) != 0 ||
+        pwrite(fd, SHA1_CACHE_MAGIC, sizeof(SHA1_CACHE_MAGIC), 0) != sizeof(SHA1_CACHE_MAGIC) ||
+        pwrite(fd, &(uint32_t){ SHA1_CACHE_VERSION }, 4, 8) != 4 ||
+        pwrite(fd, &log2, 4, 12) != 4)
+    {
+        err = SHA1_IO_ERROR;
+    }
+    else if ((err = cache_map(fd, &cache)) == SHA1_SUCCESS)
+    {
+        for (uint64_t i = 0; old_p != NULL && i <= old_p->mask; i++)
+        {
+            SHA1_CacheSlot_t copy;
+            struct stat st;
+
+            if (slot_read(&old_p->slots[i], &copy) < 2)
+            {
+                continue;
+            }
+            memset(&st, 0, sizeof(st));
+            st.st_dev = copy.dev;
+            st.st_ino = copy.ino;
+            st.st_size = (off_t)copy.size;
+            st.st_mtim.tv_sec = copy.mtime_ns / 1000000000LL;
+            st.st_mtim.tv_nsec = copy.mtime_ns % 1000000000LL;
+            st.st_ctim.tv_sec = copy.ctime_ns / 1000000000LL;
+            st.st_ctim.tv_nsec = copy.ctime_ns % 1000000000LL;
+            cache_insert(&cache, &st, copy.digest);
+        }
+        munmap(cache.map, cache.map_size);
+    }
+
+    saved_errno = errno;
+    if (close(fd) != 0 && err == SHA1_SUCCESS)
+    {
+        err = SHA1_IO_ERROR;
+        saved_errno = errno;
+    }
+    if (err == SHA1_SUCCESS && rename(tmp_path, path) != 0)
+    {
+        err = SHA1_IO_ERROR;
+        saved_errno = errno;
+    }
+    if (err != SHA1_SUCCESS)
+    {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    errno = saved_errno;
+    return err == SHA1_BAD_INPUT ? SHA1_IO_ERROR : err;
+}
+
+/*
+ * CACHE OPEN
+ */
+SHA1_ERRCODE SHA1_cache_open(const char *path, SHA1_Cache_p_t cache_p)
+{
+    uint32_t min_log2 = (uint32_t)__builtin_ctz(SHA1_CACHE_MIN_SLOTS);
+
+    /*
+     * At most: create or replace, then grow once
+     */
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        SHA1_ERRCODE err;
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if (errno != ENOENT)
+            {
+                return SHA1_IO_ERROR;
+            }
+            err = cache_create(path, min_log2, NULL);
+            if (err != SHA1_SUCCESS)
+            {
+                return err;
+            }
+            continue;
+        }
+
+        err = cache_map(fd, cache_p);
+        close(fd);
+        if (err == SHA1_BAD_INPUT)
+        {
+            err = cache_create(path, min_log2, NULL);
+            if (err != SHA1_SUCCESS)
+            {
+                return err;
+            }
+            continue;
+        }
+        if (err != SHA1_SUCCESS)
+        {
+            return err;
+        }
+
+        if (attempt < 2 &&
+            __atomic_load_n(cache_p->n_used_p, __ATOMIC_RELAXED) * 2 > cache_p->mask + 1)
+        {
+            uint32_t log2 = (uint32_t)__builtin_ctzll(cache_p->mask + 1) + 2;
+
+            err = cache_create(path, log2, cache_p);
+            SHA1_cache_close(cache_p);
+            if (err != SHA1_SUCCESS)
+            {
+                return err;
+            }
+            continue;
+        }
+        return SHA1_SUCCESS;
+    }
+
+    errno = EAGAIN;
+    return SHA1_IO_ERROR;
+}
+
+/*
+ * CACHE CLOSE
+ */
+void SHA1_cache_close(SHA1_Cache_p_t cache_p)
+{
+    if (cache_p->map != NULL)
+    {
+        munmap(cache_p->map, cache_p->map_size);
+    }
+    memset(cache_p, 0, sizeof(*cache_p));
+}
+
+/*
+ * CACHE LOOKUP
+ */
+int SHA1_cache_lookup(SHA1_Cache_p_t cache_p, const struct stat *st, SHA1_DIGEST_t digest)
+{
+    uint64_t h = slot_hash(st->st_dev, st->st_ino);
+
+    for (uint64_t p = 0; p < SHA1_CACHE_MAX_PROBE; p++)
+    {
+        SHA1_CacheSlot_t copy;
+        uint32_t seq = slot_read(&cache_p->slots[(h + p) & cache_p->mask], &copy);
+
+        if (seq == 0)
+        {
+            break;
+        }
+        if (seq != 1 && copy.dev == (uint64_t)st->st_dev && copy.ino == (uint64_t)st->st_ino)
+        {
+            if (!stat_matches(&copy, st))
+            {
+                break;
+            }
+            memcpy(digest, copy.digest, SHA1_DIGEST_SIZE);
+            __atomic_fetch_add(&cache_p->hits, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+
+    __atomic_fetch_add(&cache_p->misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * CACHE STORE
+ */
+void SHA1_cache_store(SHA1_Cache_p_t cache_p, const struct stat *st, const SHA1_DIGEST_t digest,
+                      int64_t hash_start_ns)
+{
+    if (stat_ns(&st->st_mtim) > hash_start_ns - SHA1_CACHE_RACY_NS ||
+        stat_ns(&st->st_ctim) > hash_start_ns - SHA1_CACHE_RACY_NS)
+    {
+        return;
+    }
+    if (cache_insert(cache_p, st, digest))
+    {
+        __atomic_fetch_add(&cache_p->stored, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * HASH FILE CACHED
+ */
+SHA1_ERRCODE SHA1_hash_file_cached(SHA1_Cache_p_t cache_p, const char *path, SHA1_DIGEST_t digest)
+{
+    struct stat before, after;
+    struct timespec start;
+    SHA1_ERRCODE err;
+    int saved_errno;
+    int fd;
+
+    if (cache_p == NULL)
+    {
+        return SHA1_hash_file(path, digest);
+    }
+
+    /*
+     * The common case: one stat, no open. Entries may predate collision
+     * detection being turned on, so it always reads.
+     */
+    if (!SHA1_get_collision_detection() &&
+        stat(path, &before) == 0 && S_ISREG(before.st_mode) &&
+        SHA1_cache_lookup(cache_p, &before, digest))
+    {
+        return SHA1_SUCCESS;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    clock_gettime(CLOCK_REALTIME, &start);
+    if (fstat(fd, &before) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return SHA1_IO_ERROR;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    err = SHA1_hash_fd(fd, digest);
+
+    /*
+     * Only cache what did not change while it was read
+     */
+    if (err == SHA1_SUCCESS && S_ISREG(before.st_mode) && fstat(fd, &after) == 0 &&
+        before.st_size == after.st_size &&
+        stat_ns(&before.st_mtim) == stat_ns(&after.st_mtim) &&
+        stat_ns(&before.st_ctim) == stat_ns(&after.st_ctim))
+    {
+        SHA1_cache_store(cache_p, &before, digest, stat_ns(&start));
+    }
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return err;
+}
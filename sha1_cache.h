@@ -0,0 +1,112 @@
+/* SHA1 persistent digest cache header file */
+
+#include <sys/stat.h>
+#include "sha1.h"
+
+#ifndef _SHA1_CACHE_H_
+#define _SHA1_CACHE_H_
+
+/*
+ * An on-disk map from a file's stat data to its digest, so that hashing
+ * a mostly unchanged tree again costs one stat(2) per unchanged file, in
+ * the spirit of the stat data in git's index.
+ *
+ * The cache file is a 64-byte header followed by a power-of-two number
+ * of 64-byte slots, mapped shared and read-write. A slot holds (dev,
+ * inode, size, mtime_ns, ctime_ns), the digest and a sequence number;
+ * slots are found by open addressing with linear probing on (dev,
+ * inode). The file is native byte order and meant for one machine.
+ *
+ * Several threads and processes may use one cache at once. A writer
+ * claims a slot by moving its sequence number from even to odd with a
+ * compare-and-swap, fills it in and makes the number even again; a
+ * reader copies a slot and rereads the number, and treats a slot that
+ * was odd or changed meanwhile as a miss. No lock is ever taken, and an
+ * update that loses a race is simply not cached.
+ *
+ * Racy timestamps: a file written in the same timestamp tick just after
+ * it was hashed would still match its entry. As in git, such entries
+ * must not be trusted, so a digest is only stored if the file's mtime
+ * and ctime are at least SHA1_CACHE_RACY_NS older than the moment
+ * hashing started, and its stat data is the same before and after
+ * hashing. Freshly written files are therefore cached on a later run.
+ *
+ * The table is grown (rewritten with four times as many slots and
+ * renamed into place) when opened more than half full; while open, an
+ * insert that finds no free slot within SHA1_CACHE_MAX_PROBE slots is
+ * dropped.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_CACHE_MAGIC       "SHA1CCH"                 /* with its NUL, 8 bytes */
+#define SHA1_CACHE_VERSION     1
+#define SHA1_CACHE_MIN_SLOTS   (1u << 16)
+#define SHA1_CACHE_MAX_PROBE   32
+#define SHA1_CACHE_RACY_NS     (2 * 1000000000LL)        /* coarsest timestamps we expect */
+
+typedef struct SHA1_CacheSlot {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    uint32_t seq;            /* 0: empty; odd: being written */
+} __attribute__((aligned(64))) SHA1_CacheSlot_t, *SHA1_CacheSlot_p_t;
+
+typedef struct SHA1_Cache {
+    uint8_t *map;
+    size_t map_size;
+    SHA1_CacheSlot_t *slots;
+    uint64_t mask;           /* slots - 1 */
+    uint64_t *n_used_p;      /* in the header, atomic */
+    size_t hits;             /* atomic counters for this process */
+    size_t misses;
+    size_t stored;
+} SHA1_Cache_t, *SHA1_Cache_p_t;
+
+/*
+ * CACHE OPEN
+ * Map the cache at path, creating it (or replacing an invalid one) if
+ * needed, and growing it if it is over half full.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_cache_open(const char *path, SHA1_Cache_p_t cache_p);
+
+/*
+ * CACHE CLOSE
+ */
+void SHA1_cache_close(SHA1_Cache_p_t cache_p);
+
+/*
+ * CACHE LOOKUP
+ * Find the digest recorded for the file st describes.
+ *
+ * Returns
+ *  nonzero, with digest set, if an entry matches all of st's stat data
+ */
+int SHA1_cache_lookup(SHA1_Cache_p_t cache_p, const struct stat *st, SHA1_DIGEST_t digest);
+
+/*
+ * CACHE STORE
+ * Record digest for the file st describes, unless its timestamps are
+ * racy with respect to hash_start_ns (CLOCK_REALTIME when reading the
+ * file began).
+ */
+void SHA1_cache_store(SHA1_Cache_p_t cache_p, const struct stat *st, const SHA1_DIGEST_t digest,
+                      int64_t hash_start_ns);
+
+/*
+ * HASH FILE CACHED
+ * As SHA1_hash_file, but answer from the cache when path's stat data
+ * matches an entry, and record the digest of a regular file otherwise.
+ * While collision detection is on, files are always read (and recorded
+ * if clean). A NULL cache_p hashes without a cache.
+ */
+SHA1_ERRCODE SHA1_hash_file_cached(SHA1_Cache_p_t cache_p, const char *path, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_CACHE_H_ */
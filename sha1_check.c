@@ -0,0 +1,643 @@
+/*
+ * Parallel sha1sum -c style manifest verification
+ */
+
+#define _GNU_SOURCE
+#include "sha1_check.h"
+#include "sha1_file.h"
+#include "sha1_hex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+
+/*
+ * Files at least this large get their physical offset looked up with
+ * FIEMAP (one extra open); smaller ones are ordered by inode number,
+ * which most file systems allocate close to the data.
+ */
+#define CHECK_FIEMAP_MIN_SIZE (64 * 1024)
+
+/*
+ * Entries handed to a worker per trip to the shared counter
+ */
+#define CHECK_BATCH 16
+
+typedef struct check_entry {
+    const char *name;        /* file name inside the mapping, maybe escaped */
+    uint32_t name_len;
+    uint8_t escaped;         /* name uses sha1sum backslash escapes */
+    int err;                 /* errno from the stat pass, 0 if none */
+    uint64_t dev;            /* sort key: device, */
+    uint64_t phys;           /*   physical offset of first extent, */
+    uint64_t ino;            /*   inode */
+    SHA1_DIGEST_t expected;
+} check_entry_t;
+
+typedef struct check_job {
+    check_entry_t *entries;
+    size_t n_entries;
+    size_t next;             /* next unclaimed entry, atomic */
+    const SHA1_CheckOptions_t *options_p;
+    SHA1_Writer_p_t writer_p;
+    pthread_mutex_t lock;    /* guards writer_p and counts */
+    SHA1_CheckResult_t counts;
+    void (*pass)(struct check_job *, check_entry_t *, char *, uint8_t *);
+} check_job_t;
+
+/*
+ * PARSING
+ */
+
+/*
+ * Nonzero if every backslash in name starts a valid escape
+ */
+static int valid_escapes(const char *name, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (name[i] == '\\')
+        {
+            if (i + 1 == len || strchr("\\nr", name[i + 1]) == NULL)
+            {
+                return 0;
+            }
+            i++;
+        }
+    }
+    return 1;
+}
+
+SHA1_ERRCODE SHA1_parse_check_line(const char *line, size_t len, SHA1_DIGEST_t digest,
+                                   const char **name_pp, size_t *name_len_p, int *escaped_p)
+{
+    const char *end = line + len;
+    const char *hex, *name;
+
+    while (line < end && (*line == ' ' || *line == '\t'))
+    {
+        line++;
+    }
+
+    *escaped_p = 0;
+    if (line < end && *line == '\\')
+    {
+        *escaped_p = 1;
+        line++;
+    }
+    len = (size_t)(end - line);
+
+    if (len > 6 && memcmp(line, "SHA1 (", 6) == 0)
+    {
+        /* BSD: "SHA1 (NAME) = HEX"; the digest has a fixed length, so
+         * the name is whatever lies between, ") = " included */
+        if (len < 6 + 1 + 4 + SHA1_HEX_SIZE ||
+            memcmp(end - SHA1_HEX_SIZE - 4, ") = ", 4) != 0)
+        {
+            return SHA1_BAD_INPUT;
+        }
+        hex = end - SHA1_HEX_SIZE;
+        name = line + 6;
+        *name_len_p = (size_t)(end - SHA1_HEX_SIZE - 4 - name);
+    }
+    else
+    {
+        /* GNU: "HEX  NAME" or "HEX *NAME" */
+        if (len < SHA1_HEX_SIZE + 2 || line[SHA1_HEX_SIZE] != ' ')
+        {
+            return SHA1_BAD_INPUT;
+        }
+        hex = line;
+        name = line + SHA1_HEX_SIZE + 1;
+        if (*name == ' ' || *name == '*')
+        {
+            name++;
+        }
+        *name_len_p = (size_t)(end - name);
+    }
+
+    if (*name_len_p == 0 || *name_len_p >= PATH_MAX ||
+        (*escaped_p && !valid_escapes(name, *name_len_p)) ||
+        SHA1_hex_to_digest(hex, digest) != SHA1_SUCCESS)
+    {
+        return SHA1_BAD_INPUT;
+    }
+
+    *name_pp = name;
+    return SHA1_SUCCESS;
+}
+
+/*
+ * Copy (and unescape) an entry's name into path, NUL-terminated
+ */
+static void entry_path(const check_entry_t *entry_p, char *path)
+{
+    if (!entry_p->escaped)
+    {
+        memcpy(path, entry_p->name, entry_p->name_len);
+        path[entry_p->name_len] = '\0';
+        return;
+    }
+
+    for (uint32_t i = 0; i < entry_p->name_len; i++)
+    {
+        char c = entry_p->name[i];
+
+        if (c == '\\')
+        {
+            c = entry_p->name[++i];
+            c = c == 'n' ? '\n' : c == 'r' ? '\r' : '\\';
+        }
+        *path++ = c;
+    }
+    *path = '\0';
+}
+
+/*
+ * PASS 1: stat and physical layout
+ */
+static void stat_entry(check_job_t *job_p, check_entry_t *entry_p, char *path, uint8_t *buf)
+{
+    struct stat st;
+
+    (void)job_p;
+    (void)buf;
+
+    entry_path(entry_p, path);
+    if (stat(path, &st) != 0)
+    {
+        entry_p->err = errno;
+        entry_p->dev = UINT64_MAX; /* sort the failures last */
+        return;
+    }
+
+    entry_p->dev = st.st_dev;
+    entry_p->ino = st.st_ino;
+    entry_p->phys = 0;
+
+    if (S_ISREG(st.st_mode) && st.st_size >= CHECK_FIEMAP_MIN_SIZE)
+    {
+        struct {
+            struct fiemap map;
+            struct fiemap_extent extent;
+        } fm;
+        int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+
+        if (fd < 0)
+        {
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        if (fd >= 0)
+        {
+            memset(&fm, 0, sizeof(fm));
+            fm.map.fm_length = ~0ULL;
+            fm.map.fm_extent_count = 1;
+            if (ioctl(fd, FS_IOC_FIEMAP, &fm.map) == 0 && fm.map.fm_mapped_extents == 1)
+            {
+                entry_p->phys = fm.extent.fe_physical;
+            }
+            close(fd);
+        }
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const check_entry_t *x = a, *y = b;
+
+    if (x->dev != y->dev)   return x->dev < y->dev ? -1 : 1;
+    if (x->phys != y->phys) return x->phys < y->phys ? -1 : 1;
+    if (x->ino != y->ino)   return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+/*
+ * PASS 2: hash and report
+ */
+static void report(check_job_t *job_p, const check_entry_t *entry_p, const char *status,
+                   size_t *count_p, int failure)
+{
+    SHA1_Writer_p_t writer_p = job_p->writer_p;
+    const SHA1_CheckOptions_t *options_p = job_p->options_p;
+
+    pthread_mutex_lock(&job_p->lock);
+    (*count_p)++;
+    if (!options_p->status_only && (failure || !options_p->quiet))
+    {
+        if (entry_p->escaped)
+        {
+            SHA1_writer_put(writer_p, "\\", 1);
+        }
+        SHA1_writer_put(writer_p, entry_p->name, entry_p->name_len);
+        SHA1_writer_put(writer_p, ": ", 2);
+        SHA1_writer_put(writer_p, status, strlen(status));
+        SHA1_writer_put(writer_p, "\n", 1);
+        if (failure)
+        {
+            SHA1_writer_flush(writer_p);
+        }
+    }
+    pthread_mutex_unlock(&job_p->lock);
+}
+
+static void verify_entry(check_job_t *job_p, check_entry_t *entry_p, char *path, uint8_t *buf)
+{
+    const SHA1_CheckOptions_t *options_p = job_p->options_p;
+    SHA1_DIGEST_t digest;
+    SHA1_ERRCODE hash_err = SHA1_SUCCESS;
+    int err = entry_p->err;
+
+    entry_path(entry_p, path);
+    if (err == 0)
+    {
+        hash_err = SHA1_hash_file_buffered(path, buf, SHA1_FILE_CHUNK, digest);
+        if (hash_err != SHA1_SUCCESS && hash_err != SHA1_COLLISION_DETECTED)
+        {
+            err = errno;
+        }
+    }
+
+    if (err == 0 && hash_err == SHA1_COLLISION_DETECTED)
+    {
+        report(job_p, entry_p, "FAILED collision attack detected", &job_p->counts.n_mismatched, 1);
+    }
+    else if (err == ENOENT && options_p->ignore_missing)
+    {
+        pthread_mutex_lock(&job_p->lock);
+        job_p->counts.n_missing++;
+        pthread_mutex_unlock(&job_p->lock);
+    }
+    else if (err != 0)
+    {
+        if (!options_p->status_only)
+        {
+            pthread_mutex_lock(&job_p->lock);
+            SHA1_writer_flush(job_p->writer_p);
+            fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, path, strerror(err));
+            pthread_mutex_unlock(&job_p->lock);
+        }
+        report(job_p, entry_p, "FAILED open or read", &job_p->counts.n_unreadable, 1);
+    }
+    else if (memcmp(digest, entry_p->expected, SHA1_DIGEST_SIZE) != 0)
+    {
+        report(job_p, entry_p, "FAILED", &job_p->counts.n_mismatched, 1);
+    }
+    else
+    {
+        report(job_p, entry_p, "OK", &job_p->counts.n_ok, 0);
+    }
+}
+
+/*
+ * WORKERS
+ */
+static void *check_worker(void *arg)
+{
+    check_job_t *job_p = arg;
+    char *path = malloc(PATH_MAX);
+    uint8_t *buf = NULL;
+
+    if (path == NULL || posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        free(path);
+        return (void *)1;
+    }
+
+    for (;;)
+    {
+        size_t first = __atomic_fetch_add(&job_p->next, CHECK_BATCH, __ATOMIC_RELAXED);
+        size_t last = first + CHECK_BATCH;
+
+        if (first >= job_p->n_entries)
+        {
+            break;
+        }
+        if (last > job_p->n_entries)
+        {
+            last = job_p->n_entries;
+        }
+        for (size_t i = first; i < last; i++)
+        {
+            job_p->pass(job_p, &job_p->entries[i], path, buf);
+        }
+    }
+
+    free(buf);
+    free(path);
+    return NULL;
+}
+
+/*
+ * Run job_p->pass over every entry on n_threads threads. The calling
+ * thread is one of them.
+ */
+static SHA1_ERRCODE run_pass(check_job_t *job_p, int n_threads)
+{
+    pthread_t *threads = calloc((size_t)n_threads, sizeof(*threads));
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int started = 0;
+
+    if (threads == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+
+    job_p->next = 0;
+    for (int i = 1; i < n_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, check_worker, job_p) != 0)
+        {
+            break; /* carry on with fewer workers */
+        }
+        started++;
+    }
+
+    if (check_worker(job_p) != NULL)
+    {
+        err = SHA1_ALLOC_ERROR;
+    }
+    for (int i = 1; i <= started; i++)
+    {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        if (ret != NULL)
+        {
+            err = SHA1_ALLOC_ERROR;
+        }
+    }
+
+    free(threads);
+    return err;
+}
+
+/*
+ * MANIFEST
+ */
+static void warn_count(const char *prog, size_t n, const char *one, const char *many)
+{
+    if (n > 0)
+    {
+        fprintf(stderr, "%s: WARNING: %zu %s\n", prog, n, n == 1 ? one : many);
+    }
+}
+
+/*
+ * Read a manifest that cannot be mapped (standard input, a pipe) into a
+ * heap buffer, up to end of file
+ */
+static SHA1_ERRCODE read_manifest(int fd, char **buf_p, size_t *size_p)
+{
+    char *buf = NULL;
+    size_t size = 0, cap = 0;
+
+    for (;;)
+    {
+        ssize_t n;
+
+        if (size == cap)
+        {
+            char *grown;
+
+            cap = cap ? cap * 2 : 64 * 1024;
+            grown = realloc(buf, cap);
+            if (grown == NULL)
+            {
+                free(buf);
+                return SHA1_ALLOC_ERROR;
+            }
+            buf = grown;
+        }
+        n = read(fd, buf + size, cap - size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            free(buf);
+            return SHA1_IO_ERROR;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        size += (size_t)n;
+    }
+
+    *buf_p = buf;
+    *size_p = size;
+    return SHA1_SUCCESS;
+}
+
+SHA1_ERRCODE SHA1_check_manifest(const char *path, const SHA1_CheckOptions_t *options_p,
+                                 SHA1_Writer_p_t writer_p, SHA1_CheckResult_p_t result_p)
+{
+    check_job_t job;
+    struct stat st;
+    const char *map = NULL, *line, *end;
+    char *copy = NULL;
+    size_t size = 0, cap = 0, line_no = 0;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int n_threads = options_p->n_threads;
+    int is_stdin = strcmp(path, "-") == 0;
+    int fd;
+
+    memset(&job, 0, sizeof(job));
+    job.options_p = options_p;
+    job.writer_p = writer_p;
+
+    /*
+     * STEP 1
+     * map the manifest, or read it if it is not a regular file ("-" is
+     * standard input)
+     */
+    fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        err = SHA1_IO_ERROR;
+        goto out;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        err = read_manifest(fd, &copy, &size);
+        if (err != SHA1_SUCCESS)
+        {
+            goto out;
+        }
+        map = copy;
+    }
+    else if (st.st_size > 0)
+    {
+        size = (size_t)st.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            map = NULL;
+            err = SHA1_IO_ERROR;
+            goto out;
+        }
+        madvise((void *)map, size, MADV_SEQUENTIAL);
+    }
+
+    /*
+     * STEP 2
+     * parse every line in place
+     */
+    for (line = map, end = map + size; line != NULL && line < end; )
+    {
+        const char *nl = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = nl != NULL ? nl : end;
+        size_t len = (size_t)(line_end - line);
+        check_entry_t *entry_p;
+        const char *name;
+        size_t name_len;
+        int escaped;
+
+        line_no++;
+        if (len > 0 && line[len - 1] == '\r')
+        {
+            len--;
+        }
+
+        if (len > 0 && line[0] != '#')
+        {
+            if (job.n_entries == cap)
+            {
+                check_entry_t *grown;
+
+                cap = cap ? cap * 2 : 1024;
+                grown = realloc(job.entries, cap * sizeof(*grown));
+                if (grown == NULL)
+                {
+                    err = SHA1_ALLOC_ERROR;
+                    goto out;
+                }
+                job.entries = grown;
+            }
+
+            entry_p = &job.entries[job.n_entries];
+            if (SHA1_parse_check_line(line, len, entry_p->expected,
+                                      &name, &name_len, &escaped) == SHA1_SUCCESS)
+            {
+                entry_p->name = name;
+                entry_p->name_len = (uint32_t)name_len;
+                entry_p->escaped = (uint8_t)escaped;
+                entry_p->err = 0;
+                job.n_entries++;
+            }
+            else
+            {
+                job.counts.n_improper++;
+                if (options_p->warn)
+                {
+                    fprintf(stderr, "%s: %s: %zu: improperly formatted SHA1 checksum line\n",
+                            options_p->prog_name, path, line_no);
+                }
+            }
+        }
+
+        line = nl != NULL ? nl + 1 : end;
+    }
+    job.counts.n_proper = job.n_entries;
+
+    if (job.n_entries == 0)
+    {
+        if (!options_p->status_only)
+        {
+            fprintf(stderr, "%s: %s: no properly formatted SHA1 checksum lines found\n",
+                    options_p->prog_name, path);
+        }
+        err = SHA1_BAD_INPUT;
+        goto out;
+    }
+
+    /*
+     * STEP 3
+     * stat pass, layout sort, verify pass
+     */
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+    if ((size_t)n_threads > job.n_entries)
+    {
+        n_threads = (int)job.n_entries;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    job.pass = stat_entry;
+    err = run_pass(&job, n_threads);
+    if (err == SHA1_SUCCESS)
+    {
+        qsort(job.entries, job.n_entries, sizeof(*job.entries), compare_entries);
+        job.pass = verify_entry;
+        err = run_pass(&job, n_threads);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    SHA1_writer_flush(writer_p);
+
+    /*
+     * STEP 4
+     * summary, as sha1sum prints it
+     */
+    if (!options_p->status_only)
+    {
+        const char *prog = options_p->prog_name;
+
+        warn_count(prog, job.counts.n_improper,
+                   "line is improperly formatted", "lines are improperly formatted");
+        warn_count(prog, job.counts.n_unreadable,
+                   "listed file could not be read", "listed files could not be read");
+        warn_count(prog, job.counts.n_mismatched,
+                   "computed checksum did NOT match", "computed checksums did NOT match");
+    }
+    if (options_p->ignore_missing && job.counts.n_missing == job.n_entries)
+    {
+        if (!options_p->status_only)
+        {
+            fprintf(stderr, "%s: %s: no file was verified\n", options_p->prog_name, path);
+        }
+        err = SHA1_BAD_INPUT;
+    }
+
+out:
+    if (err == SHA1_IO_ERROR)
+    {
+        int saved_errno = errno;
+        fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, path, strerror(saved_errno));
+    }
+    if (copy != NULL)
+    {
+        free(copy);
+    }
+    else if (map != NULL)
+    {
+        munmap((void *)map, size);
+    }
+    if (fd >= 0 && !is_stdin)
+    {
+        close(fd);
+    }
+    free(job.entries);
+
+    result_p->n_ok         += job.counts.n_ok;
+    result_p->n_mismatched += job.counts.n_mismatched;
+    result_p->n_unreadable += job.counts.n_unreadable;
+    result_p->n_missing    += job.counts.n_missing;
+    result_p->n_improper   += job.counts.n_improper;
+    result_p->n_proper     += job.counts.n_proper;
+
+    return err;
+}
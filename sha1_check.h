@@ -0,0 +1,83 @@
+/* SHA1 manifest check header file */
+
+#include "sha1.h"
+#include "sha1_output.h"
+
+#ifndef _SHA1_CHECK_H_
+#define _SHA1_CHECK_H_
+
+/*
+ * sha1sum -c compatible verification of digest manifests.
+ *
+ * A manifest file is mapped, never read into a copy: every line is
+ * parsed in place and its digest decoded straight from the mapping with
+ * SHA1_hex_to_digest. Standard input ("-") and pipes, which cannot be
+ * mapped, are read into one heap buffer first and parsed the same way.
+ * A file name is only materialised (and unescaped) in a per-worker path
+ * buffer at the moment it is handed to open(2).
+ *
+ * Verification runs in two parallel passes over the parsed entries:
+ *
+ *   1. stat every file and look up the physical offset of its first
+ *      extent (FIEMAP), then sort entries by (device, physical offset,
+ *      inode) so reads walk each disk in layout order;
+ *   2. hash the files in that order on n_threads workers.
+ *
+ * Results are reported as they are found: FAILED lines are flushed the
+ * moment they are produced, OK lines are batched. Unlike sha1sum the
+ * lines therefore come out in verification order, not manifest order.
+ */
+
+typedef struct SHA1_CheckOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    int n_threads;           /* workers; <= 0 means one per online CPU */
+    int quiet;               /* don't print OK lines */
+    int status_only;         /* print nothing, exit status only */
+    int warn;                /* warn about improperly formatted lines */
+    int strict;              /* improperly formatted lines are failures */
+    int ignore_missing;      /* don't report files that don't exist */
+} SHA1_CheckOptions_t, *SHA1_CheckOptions_p_t;
+
+typedef struct SHA1_CheckResult {
+    size_t n_ok;             /* digests that matched */
+    size_t n_mismatched;     /* digests that did NOT match */
+    size_t n_unreadable;     /* files that could not be opened or read */
+    size_t n_missing;        /* skipped because of ignore_missing */
+    size_t n_improper;       /* improperly formatted lines */
+    size_t n_proper;         /* properly formatted lines */
+} SHA1_CheckResult_t, *SHA1_CheckResult_p_t;
+
+/*
+ * CHECK MANIFEST
+ * Verify every entry of the manifest at path, writing "NAME: OK" /
+ * "NAME: FAILED" lines to writer_p and diagnostics to stderr. Counts are
+ * added to result_p (not reset, so several manifests can be summed).
+ *
+ * Parameters
+ *  path: manifest file, in sha1sum or sha1sum --tag format; "-" for
+ *        standard input
+ *  options_p: options, see above
+ *  writer_p: output writer
+ *  result_p: accumulated counts
+ *
+ * Returns
+ *  SHA1_SUCCESS if the manifest itself could be processed (individual
+ *  mismatches are reported through result_p), SHA1_IO_ERROR if it could
+ *  not be opened or mapped, SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_check_manifest(const char *path, const SHA1_CheckOptions_t *options_p,
+                                 SHA1_Writer_p_t writer_p, SHA1_CheckResult_p_t result_p);
+
+/*
+ * PARSE CHECK LINE
+ * Parse one manifest line (without its line terminator) in place.
+ * On success *name_pp / *name_len_p point at the file name inside line,
+ * still escaped if *escaped_p is set.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_BAD_INPUT for an improperly formatted line
+ */
+SHA1_ERRCODE SHA1_parse_check_line(const char *line, size_t len, SHA1_DIGEST_t digest,
+                                   const char **name_pp, size_t *name_len_p, int *escaped_p);
+
+#endif /* _SHA1_CHECK_H_ */
@@ -0,0 +1,244 @@
+/*
+ * Client library for the local hashing daemon
+ */
+
+#define _GNU_SOURCE
+#include "sha1_client.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static SHA1_ERRCODE send_request(SHA1_Client_p_t client_p, const SHA1_DaemonRequest_t *req,
+                                 const uint8_t *payload, size_t len, int fd)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov[2] = {
+        { (void *)req, sizeof(*req) },
+        { (void *)payload, len },
+    };
+    struct msghdr msg = { 0 };
+    ssize_t n;
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    if (fd >= 0)
+    {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    do
+    {
+        n = sendmsg(client_p->fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+
+    return n < 0 ? SHA1_IO_ERROR : SHA1_SUCCESS;
+}
+
+/*
+ * CLIENT CONNECT
+ */
+SHA1_ERRCODE SHA1_client_connect(SHA1_Client_p_t client_p, const char *socket_path,
+                                 size_t region_size)
+{
+    struct sockaddr_un addr;
+    SHA1_DaemonRequest_t req;
+    SHA1_ERRCODE err, status;
+    int saved_errno;
+    int memfd;
+
+    memset(client_p, 0, sizeof(*client_p));
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return SHA1_IO_ERROR;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    client_p->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (client_p->fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (connect(client_p->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        goto fail;
+    }
+    if (region_size == 0)
+    {
+        return SHA1_SUCCESS;
+    }
+
+    /*
+     * The shared region: a memfd we map read-write, the daemon read-only.
+     * Its size is sealed, as the daemon requires.
+     */
+    memfd = memfd_create("sha1-client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0)
+    {
+        goto fail;
+    }
+    if (ftruncate(memfd, (off_t)region_size) != 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0 ||
+        (client_p->region = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 memfd, 0)) == MAP_FAILED)
+    {
+        client_p->region = NULL;
+        saved_errno = errno;
+        close(memfd);
+        errno = saved_errno;
+        goto fail;
+    }
+    client_p->region_size = region_size;
+
+    memset(&req, 0, sizeof(req));
+    req.op = SHA1_DAEMON_REGISTER;
+    req.id = client_p->next_id++;
+    req.len = region_size;
+    err = send_request(client_p, &req, NULL, 0, memfd);
+    saved_errno = errno;
+    close(memfd);
+    errno = saved_errno;
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_client_wait(client_p, NULL, NULL, &status);
+    }
+    if (err != SHA1_SUCCESS)
+    {
+        goto fail;
+    }
+    if (status != SHA1_SUCCESS)
+    {
+        SHA1_client_close(client_p);
+        return SHA1_BAD_INPUT;
+    }
+    return SHA1_SUCCESS;
+
+fail:
+    saved_errno = errno;
+    SHA1_client_close(client_p);
+    errno = saved_errno;
+    return SHA1_IO_ERROR;
+}
+
+/*
+ * CLIENT CLOSE
+ */
+void SHA1_client_close(SHA1_Client_p_t client_p)
+{
+    if (client_p->region != NULL)
+    {
+        munmap(client_p->region, client_p->region_size);
+        client_p->region = NULL;
+    }
+    if (client_p->fd >= 0)
+    {
+        close(client_p->fd);
+        client_p->fd = -1;
+    }
+}
+
+/*
+ * CLIENT SUBMIT
+ */
+SHA1_ERRCODE SHA1_client_submit(SHA1_Client_p_t client_p, const uint8_t *data, size_t len,
+                                uint64_t *id_p)
+{
+    SHA1_DaemonRequest_t req;
+    SHA1_ERRCODE err;
+
+    memset(&req, 0, sizeof(req));
+    req.id = client_p->next_id++;
+    req.len = len;
+
+    if (client_p->region != NULL && data >= client_p->region &&
+        len <= client_p->region_size && (size_t)(data - client_p->region) <= client_p->region_size - len)
+    {
+        req.op = SHA1_DAEMON_HASH_REGION;
+        req.offset = (uint64_t)(data - client_p->region);
+        err = send_request(client_p, &req, NULL, 0, -1);
+    }
+    else if (len <= SHA1_DAEMON_MAX_INLINE)
+    {
+        req.op = SHA1_DAEMON_HASH_INLINE;
+        err = send_request(client_p, &req, data, len, -1);
+    }
+    else
+    {
+        return SHA1_BAD_INPUT;
+    }
+
+    if (err == SHA1_SUCCESS && id_p != NULL)
+    {
+        *id_p = req.id;
+    }
+    return err;
+}
+
+/*
+ * CLIENT WAIT
+ */
+SHA1_ERRCODE SHA1_client_wait(SHA1_Client_p_t client_p, uint64_t *id_p, SHA1_DIGEST_t digest,
+                              SHA1_ERRCODE *status_p)
+{
+    SHA1_DaemonReply_t reply;
+    ssize_t n;
+
+    do
+    {
+        n = recv(client_p->fd, &reply, sizeof(reply), 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != sizeof(reply))
+    {
+        if (n >= 0)
+        {
+            errno = 0;
+        }
+        return SHA1_IO_ERROR;
+    }
+    if (id_p != NULL)
+    {
+        *id_p = reply.id;
+    }
+    if (digest != NULL && reply.status == SHA1_SUCCESS)
+    {
+        memcpy(digest, reply.digest, SHA1_DIGEST_SIZE);
+    }
+    *status_p = (SHA1_ERRCODE)reply.status;
+    return SHA1_SUCCESS;
+}
+
+/*
+ * CLIENT HASH
+ */
+SHA1_ERRCODE SHA1_client_hash(SHA1_Client_p_t client_p, const uint8_t *data, size_t len,
+                              SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err, status;
+
+    err = SHA1_client_submit(client_p, data, len, NULL);
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_client_wait(client_p, NULL, digest, &status);
+    }
+    return err == SHA1_SUCCESS ? status : err;
+}
@@ -0,0 +1,91 @@
+/* SHA1 hashing daemon client header file */
+
+#include "sha1.h"
+#include "sha1_daemon.h"
+
+#ifndef _SHA1_CLIENT_H_
+#define _SHA1_CLIENT_H_
+
+/*
+ * Client side of sha1_daemon.h.
+ *
+ * A client connects once, optionally with a shared region: a memfd of
+ * region_size bytes mapped read-write at region and registered with the
+ * daemon. Payloads written into the region are sent by reference and
+ * never copied; others are copied into the request and are limited to
+ * SHA1_DAEMON_MAX_INLINE bytes.
+ *
+ * SHA1_client_submit queues a payload and returns at once; replies are
+ * collected with SHA1_client_wait, in completion order, matched to
+ * requests by id. SHA1_client_hash does both for one payload. A client
+ * is not thread-safe; use one per thread.
+ */
+
+typedef struct SHA1_Client {
+    int fd;
+    uint8_t *region;             /* shared with the daemon, or NULL */
+    size_t region_size;
+    uint64_t next_id;
+} SHA1_Client_t, *SHA1_Client_p_t;
+
+/*
+ * CLIENT CONNECT
+ * Connect to the daemon at socket_path and, if region_size is nonzero,
+ * set up a shared region of that many bytes.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_BAD_INPUT if the
+ *  daemon refused the region
+ */
+SHA1_ERRCODE SHA1_client_connect(SHA1_Client_p_t client_p, const char *socket_path,
+                                 size_t region_size);
+
+/*
+ * CLIENT CLOSE
+ */
+void SHA1_client_close(SHA1_Client_p_t client_p);
+
+/*
+ * CLIENT SUBMIT
+ * Ask for the digest of len bytes at data; if data lies in the region
+ * it must not change until the reply has arrived.
+ *
+ * Parameters
+ *  id_p: set to the id the reply will carry (may be NULL)
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_BAD_INPUT for a payload too large to send inline,
+ *  or SHA1_IO_ERROR (errno set)
+ */
+SHA1_ERRCODE SHA1_client_submit(SHA1_Client_p_t client_p, const uint8_t *data, size_t len,
+                                uint64_t *id_p);
+
+/*
+ * CLIENT WAIT
+ * Wait for the next reply.
+ *
+ * Parameters
+ *  id_p: set to the id of the request answered
+ *  digest: its digest, if status is SHA1_SUCCESS
+ *  status_p: the daemon's verdict (SHA1_SUCCESS, SHA1_BAD_INPUT,
+ *      SHA1_ALLOC_ERROR or SHA1_COLLISION_DETECTED)
+ *
+ * Returns
+ *  SHA1_SUCCESS once a reply was read, else SHA1_IO_ERROR (errno set;
+ *  0 if the daemon hung up)
+ */
+SHA1_ERRCODE SHA1_client_wait(SHA1_Client_p_t client_p, uint64_t *id_p, SHA1_DIGEST_t digest,
+                              SHA1_ERRCODE *status_p);
+
+/*
+ * CLIENT HASH
+ * Submit one payload and wait for its digest. No other request may be
+ * outstanding.
+ *
+ * Returns
+ *  as SHA1_client_submit, or the daemon's status
+ */
+SHA1_ERRCODE SHA1_client_hash(SHA1_Client_p_t client_p, const uint8_t *data, size_t len,
+                              SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_CLIENT_H_ */
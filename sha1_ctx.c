@@ -0,0 +1,446 @@
+/*
+ * Compact streaming contexts, context pool and structure-of-arrays table
+ */
+
+#include "sha1_ctx.h"
+#include "sha1_kernel.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(SHA1_Ctx_t) <= 96, "SHA1_Ctx_t must stay within 96 bytes");
+
+struct SHA1_CtxPool {
+    void **slabs;          /* SHA1_CTX_POOL_SLAB contexts each */
+    size_t n_slabs;
+    SHA1_Ctx_p_t free_p;   /* free list, linked through the buffers */
+};
+
+/*
+ * IV of a new message
+ */
+static void stream_init(SHA1_WORD_t hash[5])
+{
+    SHA1_SHA1Object_t sha1;
+
+    SHA1_init_hash(&sha1);
+    memcpy(hash, sha1.temp_hash, sizeof(sha1.temp_hash));
+}
+
+/*
+ * Pad the length bytes long message whose last length % 64 bytes are in
+ * buffer, finish hash and write the digest
+ */
+static SHA1_ERRCODE stream_final(SHA1_WORD_t hash[5], const uint8_t *buffer, uint64_t length,
+                                 SHA1_DIGEST_t digest)
+{
+    uint8_t block[2 * SHA1_BLOCK_SIZE];
+    size_t used = length % SHA1_BLOCK_SIZE;
+    size_t len = used < 56 ? SHA1_BLOCK_SIZE : 2 * SHA1_BLOCK_SIZE;
+    uint64_t bits = length * 8;
+    SHA1_SHA1Object_t sha1;
+    SHA1_ERRCODE err;
+
+    memcpy(block, buffer, used);
+    block[used] = 0x80;
+    memset(block + used + 1, 0, len - used - 1);
+    for (int i = 0; i < 8; i++)
+    {
+        block[len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    err = SHA1_process_blocks(hash, block, len / SHA1_BLOCK_SIZE);
+
+    memcpy(sha1.temp_hash, hash, sizeof(sha1.temp_hash));
+    SHA1_get_digest(&sha1, digest);
+    return err;
+}
+
+/*
+ * CTX INIT
+ */
+void SHA1_ctx_init(SHA1_Ctx_p_t ctx_p)
+{
+    stream_init(ctx_p->hash);
+    ctx_p->reserved = 0;
+    ctx_p->length = 0;
+}
+
+/*
+ * CTX UPDATE
+ */
+SHA1_ERRCODE SHA1_ctx_update(SHA1_Ctx_p_t ctx_p, const uint8_t *data, size_t len)
+{
+    size_t used = ctx_p->length % SHA1_BLOCK_SIZE;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    size_t n_blocks;
+
+    ctx_p->length += len;
+
+    if (used > 0)
+    {
+        size_t take = SHA1_BLOCK_SIZE - used < len ? SHA1_BLOCK_SIZE - used : len;
+
+        memcpy(ctx_p->buffer + used, data, take);
+        data += take;
+        len -= take;
+        if (used + take < SHA1_BLOCK_SIZE)
+        {
+            return SHA1_SUCCESS;
+        }
+        err = SHA1_process_blocks(ctx_p->hash, ctx_p->buffer, 1);
+    }
+
+    n_blocks = len / SHA1_BLOCK_SIZE;
+    if (n_blocks > 0 &&
+        SHA1_process_blocks(ctx_p->hash, data, n_blocks) == SHA1_COLLISION_DETECTED)
+    {
+        err = SHA1_COLLISION_DETECTED;
+    }
+    memcpy(ctx_p->buffer, data + n_blocks * SHA1_BLOCK_SIZE, len % SHA1_BLOCK_SIZE);
+
+    return err;
+}
+
+/*
+ * UPDATE IOV
+ * The context buffer carries a split block from one segment into the
+ * next; everything else is compressed where it lies
+ */
+SHA1_ERRCODE SHA1_update_iov(SHA1_Ctx_p_t ctx_p, const struct iovec *iov, int cnt)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    if (cnt < 0)
+    {
+        return SHA1_BAD_INPUT;
+    }
+    for (int i = 0; i < cnt; i++)
+    {
+        if (iov[i].iov_len > 0 &&
+            SHA1_ctx_update(ctx_p, iov[i].iov_base, iov[i].iov_len) == SHA1_COLLISION_DETECTED)
+        {
+            err = SHA1_COLLISION_DETECTED;
+        }
+    }
+    return err;
+}
+
+/*
+ * CTX FINAL
+ */
+SHA1_ERRCODE SHA1_ctx_final(SHA1_Ctx_p_t ctx_p, SHA1_DIGEST_t digest)
+{
+    return stream_final(ctx_p->hash, ctx_p->buffer, ctx_p->length, digest);
+}
+
+/*
+ * CTX POOL CREATE
+ */
+SHA1_CtxPool_p_t SHA1_ctx_pool_create(void)
+{
+    return calloc(1, sizeof(SHA1_CtxPool_t));
+}
+
+/*
+ * CTX POOL DESTROY
+ */
+void SHA1_ctx_pool_destroy(SHA1_CtxPool_p_t pool_p)
+{
+    if (pool_p == NULL)
+    {
+        return;
+    }
+    for (size_t s = 0; s < pool_p->n_slabs; s++)
+    {
+        free(pool_p->slabs[s]);
+    }
+    free(pool_p->slabs);
+    free(pool_p);
+}
+
+/*
+ * CTX ALLOC
+ */
+SHA1_Ctx_p_t SHA1_ctx_alloc(SHA1_CtxPool_p_t pool_p)
+{
+    SHA1_Ctx_p_t ctx_p;
+
+    if (pool_p->free_p == NULL)
+    {
+        void **slabs = realloc(pool_p->slabs, (pool_p->n_slabs + 1) * sizeof(void *));
+        SHA1_Ctx_p_t slab_p;
+
+        if (slabs == NULL)
+        {
+            return NULL;
+        }
+        pool_p->slabs = slabs;
+
+        /* 4096 * 96 bytes is a whole number of cache lines */
+        slab_p = aligned_alloc(64, SHA1_CTX_POOL_SLAB * sizeof(SHA1_Ctx_t));
+        if (slab_p == NULL)
+        {
+            return NULL;
+        }
+        pool_p->slabs[pool_p->n_slabs++] = slab_p;
+
+        /* thread the slab onto the free list, lowest address first */
+        for (size_t i = SHA1_CTX_POOL_SLAB; i-- > 0; )
+        {
+            memcpy(slab_p[i].buffer, &pool_p->free_p, sizeof(pool_p->free_p));
+            pool_p->free_p = &slab_p[i];
+        }
+    }
+
+    ctx_p = pool_p->free_p;
+    memcpy(&pool_p->free_p, ctx_p->buffer, sizeof(pool_p->free_p));
+    SHA1_ctx_init(ctx_p);
+    return ctx_p;
+}
+
+/*
+ * CTX FREE
+ */
+void SHA1_ctx_free(SHA1_CtxPool_p_t pool_p, SHA1_Ctx_p_t ctx_p)
+{
+    memcpy(ctx_p->buffer, &pool_p->free_p, sizeof(pool_p->free_p));
+    pool_p->free_p = ctx_p;
+}
+
+/*
+ * Cache-line aligned array of n elements of size bytes
+ */
+static void *table_array(size_t n, size_t size)
+{
+    size_t bytes = (n * size + 63) & ~(size_t)63;
+
+    return aligned_alloc(64, bytes ? bytes : 64);
+}
+
+/*
+ * CTX TABLE CREATE
+ */
+SHA1_CtxTable_p_t SHA1_ctx_table_create(size_t capacity)
+{
+    SHA1_CtxTable_p_t table_p = calloc(1, sizeof(SHA1_CtxTable_t));
+    int ok;
+
+    if (table_p == NULL)
+    {
+        return NULL;
+    }
+    table_p->capacity = capacity;
+    ok = 1;
+    for (int k = 0; k < 5; k++)
+    {
+        table_p->hash[k] = table_array(capacity, sizeof(SHA1_WORD_t));
+        ok &= table_p->hash[k] != NULL;
+    }
+    table_p->length = table_array(capacity, sizeof(uint64_t));
+    table_p->buffer = table_array(capacity, SHA1_BLOCK_SIZE);
+    if (!ok || table_p->length == NULL || table_p->buffer == NULL)
+    {
+        SHA1_ctx_table_destroy(table_p);
+        return NULL;
+    }
+
+    for (size_t id = 0; id < capacity; id++)
+    {
+        SHA1_ctx_table_reset(table_p, id);
+    }
+    return table_p;
+}
+
+/*
+ * CTX TABLE DESTROY
+ */
+void SHA1_ctx_table_destroy(SHA1_CtxTable_p_t table_p)
+{
+    if (table_p == NULL)
+    {
+        return;
+    }
+    for (int k = 0; k < 5; k++)
+    {
+        free(table_p->hash[k]);
+    }
+    free(table_p->length);
+    free(table_p->buffer);
+    free(table_p);
+}
+
+static inline void table_gather(SHA1_CtxTable_p_t table_p, size_t id, SHA1_WORD_t hash[5])
+{
+    for (int k = 0; k < 5; k++)
+    {
+        hash[k] = table_p->hash[k][id];
+    }
+}
+
+static inline void table_scatter(SHA1_CtxTable_p_t table_p, size_t id, const SHA1_WORD_t hash[5])
+{
+    for (int k = 0; k < 5; k++)
+    {
+        table_p->hash[k][id] = hash[k];
+    }
+}
+
+/*
+ * CTX TABLE RESET
+ */
+void SHA1_ctx_table_reset(SHA1_CtxTable_p_t table_p, size_t id)
+{
+    SHA1_WORD_t hash[5];
+
+    stream_init(hash);
+    table_scatter(table_p, id, hash);
+    table_p->length[id] = 0;
+}
+
+/*
+ * Lanes of one SHA1_ctx_table_update call: the state of each busy lane
+ * lives in the lane until its stream's blocks are all compressed
+ */
+typedef struct table_lanes {
+    SHA1_WORD_t state[5][SHA1_MB_MAX_LANES] __attribute__((aligned(64)));
+    const uint8_t *data[SHA1_MB_MAX_LANES];
+    size_t blocks[SHA1_MB_MAX_LANES];
+    size_t id[SHA1_MB_MAX_LANES];
+    unsigned busy;
+    int n_lanes;
+} table_lanes_t;
+
+/*
+ * Compress every busy lane as far as the shortest run among them, and
+ * write the streams that are finished back to the table
+ */
+static void table_run_lanes(SHA1_CtxTable_p_t table_p, table_lanes_t *lanes_p)
+{
+    unsigned busy = lanes_p->busy;
+    size_t n_blocks = SIZE_MAX;
+
+    for (int lane = 0; lane < lanes_p->n_lanes; lane++)
+    {
+        if ((busy & (1u << lane)) && lanes_p->blocks[lane] < n_blocks)
+        {
+            n_blocks = lanes_p->blocks[lane];
+        }
+    }
+
+    SHA1_mb_compress(lanes_p->state, lanes_p->data, busy, n_blocks);
+
+    for (int lane = 0; lane < lanes_p->n_lanes; lane++)
+    {
+        if ((busy & (1u << lane)) && (lanes_p->blocks[lane] -= n_blocks) == 0)
+        {
+            for (int k = 0; k < 5; k++)
+            {
+                table_p->hash[k][lanes_p->id[lane]] = lanes_p->state[k][lane];
+            }
+            lanes_p->busy &= ~(1u << lane);
+        }
+    }
+}
+
+/*
+ * CTX TABLE UPDATE
+ */
+SHA1_ERRCODE SHA1_ctx_table_update(SHA1_CtxTable_p_t table_p, const SHA1_CtxUpdate_t *updates,
+                                   size_t count)
+{
+    int detect = SHA1_get_collision_detection();
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    table_lanes_t lanes;
+    unsigned all;
+
+    lanes.busy = 0;
+    lanes.n_lanes = SHA1_mb_kernel()->lanes;
+    all = (1u << lanes.n_lanes) - 1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t id = updates[i].id;
+        const uint8_t *data = updates[i].data;
+        size_t len = updates[i].len;
+        size_t used = table_p->length[id] % SHA1_BLOCK_SIZE;
+        SHA1_WORD_t hash[5];
+        size_t n_blocks;
+        int lane;
+
+        table_p->length[id] += len;
+
+        /*
+         * Complete the buffered block on its own
+         */
+        if (used > 0)
+        {
+            size_t take = SHA1_BLOCK_SIZE - used < len ? SHA1_BLOCK_SIZE - used : len;
+
+            memcpy(table_p->buffer[id] + used, data, take);
+            data += take;
+            len -= take;
+            if (used + take < SHA1_BLOCK_SIZE)
+            {
+                continue;
+            }
+            table_gather(table_p, id, hash);
+            if (SHA1_process_blocks(hash, table_p->buffer[id], 1) == SHA1_COLLISION_DETECTED)
+            {
+                err = SHA1_COLLISION_DETECTED;
+            }
+            table_scatter(table_p, id, hash);
+        }
+
+        n_blocks = len / SHA1_BLOCK_SIZE;
+        memcpy(table_p->buffer[id], data + n_blocks * SHA1_BLOCK_SIZE, len % SHA1_BLOCK_SIZE);
+        if (n_blocks == 0)
+        {
+            continue;
+        }
+
+        /*
+         * Only the single-buffer path detects collisions
+         */
+        if (detect)
+        {
+            table_gather(table_p, id, hash);
+            if (SHA1_process_blocks(hash, data, n_blocks) == SHA1_COLLISION_DETECTED)
+            {
+                err = SHA1_COLLISION_DETECTED;
+            }
+            table_scatter(table_p, id, hash);
+            continue;
+        }
+
+        while (lanes.busy == all)
+        {
+            table_run_lanes(table_p, &lanes);
+        }
+        lane = __builtin_ctz(~lanes.busy & all);
+        for (int k = 0; k < 5; k++)
+        {
+            lanes.state[k][lane] = table_p->hash[k][id];
+        }
+        lanes.data[lane] = data;
+        lanes.blocks[lane] = n_blocks;
+        lanes.id[lane] = id;
+        lanes.busy |= 1u << lane;
+    }
+
+    while (lanes.busy != 0)
+    {
+        table_run_lanes(table_p, &lanes);
+    }
+
+    return err;
+}
+
+/*
+ * CTX TABLE FINAL
+ */
+SHA1_ERRCODE SHA1_ctx_table_final(SHA1_CtxTable_p_t table_p, size_t id, SHA1_DIGEST_t digest)
+{
+    SHA1_WORD_t hash[5];
+
+    table_gather(table_p, id, hash);
+    return stream_final(hash, table_p->buffer[id], table_p->length[id], digest);
+}
@@ -0,0 +1,165 @@
+/* SHA1 compact streaming context header file */
+
+#include <sys/uio.h>
+#include "sha1.h"
+
+#ifndef _SHA1_CTX_H_
+#define _SHA1_CTX_H_
+
+/*
+ * State for programs that keep a SHA-1 in progress per connection or
+ * upload, possibly millions at once.
+ *
+ * SHA1_Ctx_t is a whole streaming hash in 96 bytes: the partial block,
+ * the five hash words and the byte count, whose low six bits double as
+ * the index into the partial block. It is 32-byte aligned, so two
+ * contexts fill three cache lines exactly and no context touches more
+ * than two. A SHA1_CtxPool_t hands them out of 64-byte aligned slabs
+ * through a free list, with no per-context malloc.
+ *
+ * SHA1_CtxTable_t keeps the same fields for a fixed number of streams as
+ * structure-of-arrays, one array per hash word, streams addressed by
+ * index. A batch of updates then gathers the state of up to 16 streams
+ * straight into the lanes of the multi-buffer kernel (sha1_kernel.h):
+ * five 4-byte loads per stream, instead of a context's cache lines.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_CTX_POOL_SLAB 4096 /* contexts per pool slab */
+
+typedef struct SHA1_Ctx {
+    uint8_t buffer[SHA1_BLOCK_SIZE]; /* partial block, length % 64 bytes */
+    SHA1_WORD_t hash[5];
+    uint32_t reserved;
+    uint64_t length;                 /* bytes hashed so far */
+} __attribute__((aligned(32))) SHA1_Ctx_t, *SHA1_Ctx_p_t;
+
+typedef struct SHA1_CtxPool SHA1_CtxPool_t, *SHA1_CtxPool_p_t;
+
+typedef struct SHA1_CtxTable {
+    size_t capacity;
+    SHA1_WORD_t *hash[5];            /* hash[k][i]: word k of stream i */
+    uint64_t *length;
+    uint8_t (*buffer)[SHA1_BLOCK_SIZE];
+} SHA1_CtxTable_t, *SHA1_CtxTable_p_t;
+
+typedef struct SHA1_CtxUpdate {
+    size_t id;                       /* stream index in the table */
+    const uint8_t *data;
+    size_t len;
+} SHA1_CtxUpdate_t, *SHA1_CtxUpdate_p_t;
+
+/*
+ * CTX INIT
+ * Start a new message in ctx_p.
+ */
+void SHA1_ctx_init(SHA1_Ctx_p_t ctx_p);
+
+/*
+ * CTX UPDATE
+ * Hash the next len bytes of the message.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED (see
+ *  SHA1_set_collision_detection)
+ */
+SHA1_ERRCODE SHA1_ctx_update(SHA1_Ctx_p_t ctx_p, const uint8_t *data, size_t len);
+
+/*
+ * UPDATE IOV
+ * As SHA1_ctx_update on the concatenation of cnt segments (a header,
+ * body and trailer, say), without building it: whole blocks are
+ * compressed in place in each segment, and only a block split between
+ * segments is assembled in the context's buffer. Empty segments are
+ * skipped.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_BAD_INPUT if cnt < 0 (nothing is hashed), or
+ *  SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_update_iov(SHA1_Ctx_p_t ctx_p, const struct iovec *iov, int cnt);
+
+/*
+ * CTX FINAL
+ * Pad the message and write its digest. ctx_p must be initialized again
+ * before reuse.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_ctx_final(SHA1_Ctx_p_t ctx_p, SHA1_DIGEST_t digest);
+
+/*
+ * CTX POOL CREATE
+ * Returns
+ *  an empty pool, or NULL if it could not be allocated
+ */
+SHA1_CtxPool_p_t SHA1_ctx_pool_create(void);
+
+/*
+ * CTX POOL DESTROY
+ * Free the pool and every context allocated from it.
+ */
+void SHA1_ctx_pool_destroy(SHA1_CtxPool_p_t pool_p);
+
+/*
+ * CTX ALLOC
+ * Take an initialized context from the pool. Pools are not locked: use
+ * one per thread, or serialize calls.
+ *
+ * Returns
+ *  the context, or NULL if a new slab could not be allocated
+ */
+SHA1_Ctx_p_t SHA1_ctx_alloc(SHA1_CtxPool_p_t pool_p);
+
+/*
+ * CTX FREE
+ * Give a context back to the pool it came from.
+ */
+void SHA1_ctx_free(SHA1_CtxPool_p_t pool_p, SHA1_Ctx_p_t ctx_p);
+
+/*
+ * CTX TABLE CREATE
+ * Allocate a table of capacity streams, each initialized.
+ *
+ * Returns
+ *  the table, or NULL if it could not be allocated
+ */
+SHA1_CtxTable_p_t SHA1_ctx_table_create(size_t capacity);
+
+/*
+ * CTX TABLE DESTROY
+ */
+void SHA1_ctx_table_destroy(SHA1_CtxTable_p_t table_p);
+
+/*
+ * CTX TABLE RESET
+ * Start a new message in stream id.
+ */
+void SHA1_ctx_table_reset(SHA1_CtxTable_p_t table_p, size_t id);
+
+/*
+ * CTX TABLE UPDATE
+ * Apply count updates, each hashing the next bytes of one stream, with
+ * whole blocks of different streams compressed side by side in the
+ * multi-buffer kernel. A stream may appear only once per call.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED if any update was flagged
+ */
+SHA1_ERRCODE SHA1_ctx_table_update(SHA1_CtxTable_p_t table_p, const SHA1_CtxUpdate_t *updates,
+                                   size_t count);
+
+/*
+ * CTX TABLE FINAL
+ * Pad stream id and write its digest; the stream must be reset before
+ * reuse.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_ctx_table_final(SHA1_CtxTable_p_t table_p, size_t id, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_CTX_H_ */
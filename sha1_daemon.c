@@ -0,0 +1,652 @@
+/*
+ * Local hashing daemon batching small requests across clients
+ */
+
+#define _GNU_SOURCE
+#include "sha1_daemon.h"
+#include "sha1_mb.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct daemon_client {
+    struct daemon_client *next;  /* all clients */
+    int fd;
+    int dead;                    /* hung up; freed once nothing is in flight */
+    size_t in_flight;            /* jobs in the manager */
+    const uint8_t *region;       /* registered shared region, read-only */
+    size_t region_len;
+    SHA1_DaemonReply_t *out;     /* replies waiting for socket space */
+    size_t out_head;
+    size_t out_count;
+    size_t out_cap;
+} daemon_client_t;
+
+typedef struct daemon_job {
+    SHA1_Job_t job;
+    struct daemon_job *next;     /* free list */
+    daemon_client_t *client_p;
+    uint64_t id;
+    uint8_t *copy;               /* inline payload */
+} daemon_job_t;
+
+typedef struct daemon_state {
+    const SHA1_DaemonOptions_t *options_p;
+    SHA1_DaemonResult_p_t result_p;
+    SHA1_JobManager_t mgr;
+    int epoll_fd;
+    size_t n_queued;             /* jobs in the manager */
+    int64_t deadline_ns;         /* when the current batch must go */
+    daemon_job_t *free_jobs;
+    daemon_client_t *clients;
+    size_t n_dead;               /* clients waiting to be freed */
+    uint8_t *msg;                /* receive buffer */
+} daemon_state_t;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * CLIENTS
+ */
+
+static void client_free(daemon_client_t *client_p)
+{
+    if (!client_p->dead)
+    {
+        close(client_p->fd);
+    }
+    if (client_p->region != NULL)
+    {
+        munmap((void *)client_p->region, client_p->region_len);
+    }
+    free(client_p->out);
+    free(client_p);
+}
+
+static void client_hangup(daemon_state_t *state_p, daemon_client_t *client_p)
+{
+    if (client_p->dead)
+    {
+        return;
+    }
+    epoll_ctl(state_p->epoll_fd, EPOLL_CTL_DEL, client_p->fd, NULL);
+    close(client_p->fd);
+    client_p->dead = 1;
+    state_p->n_dead++;
+}
+
+/*
+ * Free the clients that hung up and have nothing in flight; only done
+ * between events, so no caller still holds one
+ */
+static void clients_sweep(daemon_state_t *state_p)
+{
+    daemon_client_t **link_pp = &state_p->clients;
+
+    while (state_p->n_dead > 0 && *link_pp != NULL)
+    {
+        daemon_client_t *client_p = *link_pp;
+
+        if (client_p->dead && client_p->in_flight == 0)
+        {
+            *link_pp = client_p->next;
+            client_free(client_p);
+            state_p->n_dead--;
+        }
+        else
+        {
+            link_pp = &client_p->next;
+        }
+    }
+}
+
+/*
+ * Send what is queued; returns 0 if the client must be dropped
+ */
+static int client_drain(daemon_state_t *state_p, daemon_client_t *client_p)
+{
+    while (client_p->out_count > 0)
+    {
+        ssize_t n = send(client_p->fd, &client_p->out[client_p->out_head],
+                         sizeof(SHA1_DaemonReply_t), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client_p->out_head = (client_p->out_head + 1) % client_p->out_cap;
+        client_p->out_count--;
+    }
+
+    /* nothing left: stop asking for EPOLLOUT */
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client_p };
+    epoll_ctl(state_p->epoll_fd, EPOLL_CTL_MOD, client_p->fd, &ev);
+    return 1;
+}
+
+static void client_reply(daemon_state_t *state_p, daemon_client_t *client_p, uint64_t id,
+                         SHA1_ERRCODE status, const SHA1_DIGEST_t digest)
+{
+    SHA1_DaemonReply_t reply;
+
+    if (client_p->dead)
+    {
+        return;
+    }
+    memset(&reply, 0, sizeof(reply));
+    reply.id = id;
+    reply.status = (uint32_t)status;
+    if (digest != NULL)
+    {
+        memcpy(reply.digest, digest, SHA1_DIGEST_SIZE);
+    }
+
+    if (client_p->out_count == 0 &&
+        send(client_p->fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(reply))
+    {
+        return;
+    }
+    if (client_p->out_count == 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        client_hangup(state_p, client_p);
+        return;
+    }
+
+    /*
+     * Socket full: queue it and wait for EPOLLOUT
+     */
+    if (client_p->out_count == client_p->out_cap)
+    {
+        size_t cap = client_p->out_cap ? client_p->out_cap * 2 : 64;
+        SHA1_DaemonReply_t *out = malloc(cap * sizeof(*out));
+
+        if (out == NULL)
+        {
+            client_hangup(state_p, client_p);
+            return;
+        }
+        for (size_t i = 0; i < client_p->out_count; i++)
+        {
+            out[i] = client_p->out[(client_p->out_head + i) % client_p->out_cap];
+        }
+        free(client_p->out);
+        client_p->out = out;
+        client_p->out_head = 0;
+        client_p->out_cap = cap;
+    }
+    client_p->out[(client_p->out_head + client_p->out_count) % client_p->out_cap] = reply;
+    if (client_p->out_count++ == 0)
+    {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = client_p };
+        epoll_ctl(state_p->epoll_fd, EPOLL_CTL_MOD, client_p->fd, &ev);
+    }
+}
+
+/*
+ * JOBS
+ */
+
+static void job_done(daemon_state_t *state_p, SHA1_Job_t *job)
+{
+    daemon_job_t *dj_p = (daemon_job_t *)job;
+    daemon_client_t *client_p = dj_p->client_p;
+
+    state_p->n_queued--;
+    client_reply(state_p, client_p, dj_p->id, job->err, job->digest);
+    client_p->in_flight--;
+    free(dj_p->copy);
+    dj_p->copy = NULL;
+    dj_p->next = state_p->free_jobs;
+    state_p->free_jobs = dj_p;
+}
+
+static void submit(daemon_state_t *state_p, daemon_client_t *client_p, uint64_t id,
+                   const uint8_t *data, size_t len, uint8_t *copy)
+{
+    daemon_job_t *dj_p = state_p->free_jobs;
+    SHA1_Job_t *done;
+
+    if (dj_p != NULL)
+    {
+        state_p->free_jobs = dj_p->next;
+    }
+    else if ((dj_p = calloc(1, sizeof(*dj_p))) == NULL)
+    {
+        free(copy);
+        client_reply(state_p, client_p, id, SHA1_ALLOC_ERROR, NULL);
+        return;
+    }
+    dj_p->client_p = client_p;
+    dj_p->id = id;
+    dj_p->copy = copy;
+    dj_p->job.buffer = data;
+    dj_p->job.len = len;
+    dj_p->job.flags = SHA1_JOB_ENTIRE;
+
+    if (state_p->n_queued++ == 0)
+    {
+        state_p->deadline_ns = now_ns() + (int64_t)state_p->options_p->budget_us * 1000;
+    }
+    if (__builtin_popcount(state_p->mgr.busy) + 1 == state_p->mgr.n_lanes)
+    {
+        state_p->result_p->n_full_batches++;
+    }
+    client_p->in_flight++;
+    state_p->result_p->n_requests++;
+    state_p->result_p->bytes += len;
+
+    done = SHA1_mgr_submit(&state_p->mgr, &dj_p->job);
+    if (done != NULL)
+    {
+        job_done(state_p, done);
+    }
+}
+
+/*
+ * Run the partial batch and send every reply
+ */
+static void flush(daemon_state_t *state_p)
+{
+    SHA1_Job_t *done;
+
+    while ((done = SHA1_mgr_flush(&state_p->mgr)) != NULL)
+    {
+        job_done(state_p, done);
+    }
+}
+
+/*
+ * REQUESTS
+ */
+
+static void reject(daemon_state_t *state_p, daemon_client_t *client_p, uint64_t id)
+{
+    state_p->result_p->n_rejected++;
+    client_reply(state_p, client_p, id, SHA1_BAD_INPUT, NULL);
+}
+
+/*
+ * Map a client's region. The memfd must be sealed against shrinking and
+ * growing and hold len bytes: otherwise the client could truncate it
+ * under the mapping and kill the daemon with SIGBUS.
+ */
+static void do_register(daemon_state_t *state_p, daemon_client_t *client_p,
+                        const SHA1_DaemonRequest_t *req, int fd)
+{
+    struct stat st;
+    void *region;
+    int seals = fd >= 0 ? fcntl(fd, F_GET_SEALS) : -1;
+
+    if (fd < 0 || client_p->in_flight > 0 || req->len == 0 || req->len > SIZE_MAX ||
+        seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW) ||
+        fstat(fd, &st) != 0 || req->len > (uint64_t)st.st_size)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        reject(state_p, client_p, req->id);
+        return;
+    }
+    region = mmap(NULL, (size_t)req->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        reject(state_p, client_p, req->id);
+        return;
+    }
+    if (client_p->region != NULL)
+    {
+        munmap((void *)client_p->region, client_p->region_len);
+    }
+    client_p->region = region;
+    client_p->region_len = (size_t)req->len;
+    client_reply(state_p, client_p, req->id, SHA1_SUCCESS, NULL);
+}
+
+/*
+ * Read every request waiting on the client's socket
+ */
+static void client_read(daemon_state_t *state_p, daemon_client_t *client_p)
+{
+    while (!client_p->dead)
+    {
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct iovec iov = { state_p->msg, sizeof(SHA1_DaemonRequest_t) + SHA1_DAEMON_MAX_INLINE };
+        struct msghdr msg = { 0 };
+        SHA1_DaemonRequest_t req;
+        struct cmsghdr *cmsg;
+        int fd = -1;
+        ssize_t n;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        n = recvmsg(client_p->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            client_hangup(state_p, client_p);
+            return;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+
+        if ((size_t)n < sizeof(req) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            reject(state_p, client_p, 0);
+            continue;
+        }
+        memcpy(&req, state_p->msg, sizeof(req));
+
+        if (req.op == SHA1_DAEMON_REGISTER)
+        {
+            do_register(state_p, client_p, &req, fd);
+            continue;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        if (req.op == SHA1_DAEMON_HASH_INLINE && req.len == (uint64_t)n - sizeof(req))
+        {
+            uint8_t *copy = malloc(req.len ? req.len : 1);
+
+            if (copy == NULL)
+            {
+                client_reply(state_p, client_p, req.id, SHA1_ALLOC_ERROR, NULL);
+                continue;
+            }
+            memcpy(copy, state_p->msg + sizeof(req), req.len);
+            submit(state_p, client_p, req.id, copy, req.len, copy);
+        }
+        else if (req.op == SHA1_DAEMON_HASH_REGION && client_p->region != NULL &&
+                 req.offset <= client_p->region_len &&
+                 req.len <= client_p->region_len - req.offset)
+        {
+            submit(state_p, client_p, req.id, client_p->region + req.offset, req.len, NULL);
+        }
+        else
+        {
+            reject(state_p, client_p, req.id);
+        }
+    }
+}
+
+/*
+ * SOCKET
+ */
+
+/*
+ * Remove what is left at socket_path by a daemon that is gone: only a
+ * socket, and only if nothing answers on it. Anything else there (a
+ * file, a live daemon) is EADDRINUSE.
+ */
+static int remove_stale_socket(const struct sockaddr_un *addr_p)
+{
+    struct stat st;
+    int fd, alive;
+
+    if (lstat(addr_p->sun_path, &st) != 0)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode))
+    {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    alive = connect(fd, (const struct sockaddr *)addr_p, sizeof(*addr_p)) == 0 ||
+            errno != ECONNREFUSED;
+    close(fd);
+    if (alive)
+    {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    return unlink(addr_p->sun_path);
+}
+
+static int listen_on(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (remove_stale_socket(&addr) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * DAEMON
+ */
+SHA1_ERRCODE SHA1_daemon(const char *socket_path, const SHA1_DaemonOptions_t *options_p,
+                         SHA1_DaemonResult_p_t result_p)
+{
+    daemon_state_t state;
+    struct epoll_event events[SHA1_DAEMON_MAX_EVENTS];
+    struct epoll_event ev;
+    sigset_t signals, old_signals;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int listen_fd = -1;
+    int signal_fd = -1;
+    int running = 1;
+
+    memset(result_p, 0, sizeof(*result_p));
+    memset(&state, 0, sizeof(state));
+    state.options_p = options_p;
+    state.result_p = result_p;
+    state.msg = malloc(sizeof(SHA1_DaemonRequest_t) + SHA1_DAEMON_MAX_INLINE);
+    if (state.msg == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    SHA1_mgr_init(&state.mgr);
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    listen_fd = listen_on(socket_path);
+    if (state.epoll_fd < 0 || signal_fd < 0 || listen_fd < 0)
+    {
+        err = SHA1_IO_ERROR;
+        goto out;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &signal_fd;
+    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    while (running)
+    {
+        int timeout = -1;
+        int n;
+
+        /*
+         * Wait for more requests only as long as the oldest queued one
+         * may still wait
+         */
+        if (state.n_queued > 0)
+        {
+            int64_t left = state.deadline_ns - now_ns();
+
+            timeout = left <= 0 ? 0 : (int)((left + 999999) / 1000000);
+            if (left > 0 && left < 1000000)
+            {
+                timeout = 0; /* below epoll's resolution: poll, then flush */
+            }
+        }
+        n = epoll_wait(state.epoll_fd, events, SHA1_DAEMON_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            err = SHA1_IO_ERROR;
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == &signal_fd)
+            {
+                struct signalfd_siginfo info;
+
+                /* consume it, or it is delivered once the mask is restored */
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    running = 0;
+                }
+            }
+            else if (events[i].data.ptr == &listen_fd)
+            {
+                int fd;
+
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                {
+                    daemon_client_t *client_p = calloc(1, sizeof(*client_p));
+
+                    if (client_p == NULL)
+                    {
+                        close(fd);
+                        continue;
+                    }
+                    client_p->fd = fd;
+                    client_p->next = state.clients;
+                    state.clients = client_p;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = client_p;
+                    epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+                    result_p->n_clients++;
+                }
+            }
+            else
+            {
+                daemon_client_t *client_p = events[i].data.ptr;
+
+                if (client_p->dead)
+                {
+                    continue;
+                }
+                if ((events[i].events & EPOLLOUT) && !client_drain(&state, client_p))
+                {
+                    client_hangup(&state, client_p);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    client_read(&state, client_p);
+                }
+            }
+        }
+
+        if (state.n_queued > 0 && now_ns() >= state.deadline_ns)
+        {
+            result_p->n_deadline_flushes++;
+            flush(&state);
+        }
+        clients_sweep(&state);
+    }
+    flush(&state);
+
+out:
+    if (err == SHA1_IO_ERROR)
+    {
+        int saved_errno = errno;
+
+        fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, socket_path, strerror(errno));
+        errno = saved_errno;
+    }
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    if (signal_fd >= 0)
+    {
+        close(signal_fd);
+    }
+    if (state.epoll_fd >= 0)
+    {
+        close(state.epoll_fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    while (state.clients != NULL)
+    {
+        daemon_client_t *next = state.clients->next;
+
+        client_free(state.clients);
+        state.clients = next;
+    }
+    while (state.free_jobs != NULL)
+    {
+        daemon_job_t *next = state.free_jobs->next;
+
+        free(state.free_jobs);
+        state.free_jobs = next;
+    }
+    free(state.msg);
+    return err;
+}
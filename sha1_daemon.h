@@ -0,0 +1,89 @@
+/* SHA1 hashing daemon header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_DAEMON_H_
+#define _SHA1_DAEMON_H_
+
+/*
+ * A local hashing service, so that many processes each hashing a few
+ * small payloads together fill the lanes of a multi-buffer kernel.
+ *
+ * The daemon listens on a Unix domain SOCK_SEQPACKET socket and runs a
+ * single event loop feeding one job manager (sha1_mb.h) with the
+ * requests of every client. Lanes are compressed as soon as they are all
+ * busy; otherwise the batch waits for more requests for at most
+ * budget_us microseconds after its first request arrived, and is then
+ * flushed. Each digest is sent back as soon as its job completes, so
+ * replies can arrive out of order; the request id says which is which.
+ *
+ * A payload travels either inline, copied in the request message (up to
+ * SHA1_DAEMON_MAX_INLINE bytes), or by reference into a shared region:
+ * the client passes a memfd once with SCM_RIGHTS (SHA1_DAEMON_REGISTER),
+ * sealed with F_SEAL_SHRINK and F_SEAL_GROW and at least len bytes
+ * long, the daemon maps it read-only, and later requests name an offset and
+ * length in it, so the payload is never copied. The client must leave
+ * the bytes alone until their reply has arrived. sha1_client.h wraps
+ * all of this.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_DAEMON_MAX_INLINE  (64 * 1024) /* largest payload sent in the message */
+#define SHA1_DAEMON_BUDGET_US   50          /* default batching delay */
+#define SHA1_DAEMON_MAX_EVENTS  64
+
+typedef enum _sha1_daemon_op
+{
+    SHA1_DAEMON_REGISTER = 1,    /* map the region passed with SCM_RIGHTS, len bytes */
+    SHA1_DAEMON_HASH_INLINE,     /* hash the len bytes after the request */
+    SHA1_DAEMON_HASH_REGION      /* hash len bytes at offset in the region */
+} SHA1_DAEMON_OP;
+
+/*
+ * Wire format, native byte order (both ends are on one host)
+ */
+typedef struct SHA1_DaemonRequest {
+    uint32_t op;                 /* SHA1_DAEMON_OP */
+    uint32_t reserved;
+    uint64_t id;                 /* echoed in the reply */
+    uint64_t offset;             /* SHA1_DAEMON_HASH_REGION */
+    uint64_t len;
+} SHA1_DaemonRequest_t, *SHA1_DaemonRequest_p_t;
+
+typedef struct SHA1_DaemonReply {
+    uint64_t id;
+    uint32_t status;             /* SHA1_ERRCODE */
+    uint8_t digest[SHA1_DIGEST_SIZE];
+} SHA1_DaemonReply_t, *SHA1_DaemonReply_p_t;
+
+typedef struct SHA1_DaemonOptions {
+    const char *prog_name;       /* prefix for diagnostics on stderr */
+    unsigned budget_us;          /* longest a request waits for company */
+} SHA1_DaemonOptions_t, *SHA1_DaemonOptions_p_t;
+
+typedef struct SHA1_DaemonResult {
+    size_t n_clients;            /* connections accepted */
+    size_t n_requests;           /* payloads hashed */
+    size_t n_rejected;           /* malformed requests */
+    size_t n_full_batches;       /* compressed because every lane was busy */
+    size_t n_deadline_flushes;   /* flushed when the budget ran out */
+    uint64_t bytes;
+} SHA1_DaemonResult_t, *SHA1_DaemonResult_p_t;
+
+/*
+ * DAEMON
+ * Serve requests on a socket bound at socket_path until SIGINT or
+ * SIGTERM, then remove it. A stale socket there, one nobody answers on,
+ * is replaced; anything else (a file, a live daemon) is EADDRINUSE. Both
+ * signals are blocked in the calling thread while serving.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) if the socket cannot be set
+ *  up, or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_daemon(const char *socket_path, const SHA1_DaemonOptions_t *options_p,
+                         SHA1_DaemonResult_p_t result_p);
+
+#endif /* _SHA1_DAEMON_H_ */
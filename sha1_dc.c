@@ -0,0 +1,911 @@
+/*
+ * SHA1 collision detection
+ */
+
+#include "sha1_dc.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1DC_X86 1
+#endif
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * DISTURBANCE VECTORS
+ *
+ * I(K,b):  DV[K..K+15] is zero except DV[K+15] = 2^b
+ * II(K,b): DV[K..K+15] is zero except DV[K+1] = DV[K+3] = 2^(31+b),
+ *          DV[K+15] = 2^b
+ * and the rest of DV[-5..79] follows from the expansion recurrence.
+ */
+static const struct {
+    uint8_t type, K, b;
+} dv_params[SHA1DC_N_DVS] = {
+    {1, 43, 0}, {1, 44, 0}, {1, 45, 0}, {1, 46, 0}, {1, 46, 2}, {1, 47, 0},
+    {1, 47, 2}, {1, 48, 0}, {1, 48, 2}, {1, 49, 0}, {1, 49, 2}, {1, 50, 0},
+    {1, 50, 2}, {1, 51, 0}, {1, 51, 2}, {1, 52, 0},
+    {2, 45, 0}, {2, 46, 0}, {2, 46, 2}, {2, 47, 0}, {2, 48, 0}, {2, 49, 0},
+    {2, 49, 2}, {2, 50, 0}, {2, 50, 2}, {2, 51, 0}, {2, 51, 2}, {2, 52, 0},
+    {2, 53, 0}, {2, 54, 0}, {2, 55, 0}, {2, 56, 0}
+};
+
+typedef struct dv_info {
+    int testt;               /* step at which both states are equal */
+    int first_t;             /* last step below testt with dm[t] != 0 */
+    SHA1_WORD_t dm[80];      /* message XOR difference */
+    SHA1_WORD_t dv[85];      /* dv[t + 5] = DV[t], t = -5 .. 79 */
+} dv_info_t;
+
+/*
+ * UNAVOIDABLE BIT CONDITIONS
+ *
+ * Along a DV's path every state and message difference is a signed
+ * difference on the bits the DV gives it, and each step adds them up to
+ * zero mod 2^32. The sign of a message bit's difference is its value in
+ * the block (a 0 can only become 1), so some sums force relations
+ * between message bits: W[w1] bit b1 ^ W[w2] bit b2 == parity, or a bit
+ * equal to parity alone. These are found by enumerating every sign
+ * assignment of each step's equation (the boolean function's output
+ * differences left free) and chaining the relations forced between two
+ * signs across steps. Only steps DC_UBC_FIRST .. DC_UBC_LAST are used:
+ * attacks leave the DV path in the first round for their non-linear
+ * part and at the very end, where the output difference is cancelled,
+ * and a margin of a few steps is kept on both sides.
+ */
+#define DC_UBC_FIRST 24
+#define DC_UBC_LAST  72
+#define DC_UBC_VARS  16          /* most signs enumerated per step */
+#define DC_UBC_FREE  8           /* most free boolean-function outputs */
+#define DC_MAX_UBCS  1024
+#define DC_NO_WORD   0xFF        /* w2 of a condition on one bit */
+
+typedef struct dc_ubc {
+    uint32_t dvs;            /* DVs that require this condition */
+    uint8_t w1, b1, w2, b2;
+    uint8_t parity;
+} dc_ubc_t;
+
+static dv_info_t dv_table[SHA1DC_N_DVS];
+static dc_ubc_t dc_ubcs[DC_MAX_UBCS];
+static int dc_n_ubcs = 0;
+static uint32_t dc_all_dvs = 0;     /* DVs whose conditions were derived */
+static pthread_once_t dv_once = PTHREAD_ONCE_INIT;
+
+#ifdef SHA1DC_X86
+/*
+ * The conditions laid out for scan_avx2: word indexes with DC_NO_WORD
+ * as the zero word 80, left shifts that bring each bit to the top, the
+ * parity in the top bit; padded with conditions on no DV to a multiple
+ * of eight
+ */
+typedef struct dc_lane_ubc {
+    int32_t w1, w2;
+    int32_t shift1, shift2;
+    uint32_t parity;
+    uint32_t dvs;
+} dc_lane_ubc_t;
+
+static dc_lane_ubc_t dc_lane_ubcs[DC_MAX_UBCS + 8];
+static int dc_n_lane_ubcs = 0;
+#endif
+
+static size_t scan_scalar(const uint8_t *data, size_t n_blocks);
+#ifdef SHA1DC_X86
+__attribute__((target("avx2"))) static size_t scan_avx2(const uint8_t *data, size_t n_blocks);
+#endif
+static size_t (*dc_scan)(const uint8_t *data, size_t n_blocks) = scan_scalar;
+
+static const SHA1_WORD_t constants_K[4] = {
+    0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+};
+
+static inline SHA1_WORD_t f_t(int t, SHA1_WORD_t B, SHA1_WORD_t C, SHA1_WORD_t D)
+{
+    if (t < 20) return (B & C) | ((~B) & D);
+    if (t < 40) return B ^ C ^ D;
+    if (t < 60) return (B & C) | (B & D) | (C & D);
+    return B ^ C ^ D;
+}
+
+/*
+ * Sign nodes: 0 is the constant (a 0 bit, a + sign); then the sign of
+ * every DV bit of A after steps -5 .. 79, then of every message bit.
+ * A node's value is 1 for a - sign, which for a message bit is its value.
+ */
+#define NODE_ONE     0
+#define NODE_A(t, b) (1 + ((t) + 5) * 32 + (b))
+#define NODE_W(t, b) (1 + 85 * 32 + (t) * 32 + (b))
+#define N_NODES      (1 + 85 * 32 + 80 * 32)
+
+typedef struct ubc_graph {
+    uint16_t parent[N_NODES];
+    uint8_t parity[N_NODES];     /* value ^ value of parent */
+} ubc_graph_t;
+
+static int graph_find(ubc_graph_t *graph_p, int node, int *parity_p)
+{
+    int parity = 0;
+    int root = node;
+
+    while (graph_p->parent[root] != root)
+    {
+        parity ^= graph_p->parity[root];
+        root = graph_p->parent[root];
+    }
+    *parity_p = parity;
+    return root;
+}
+
+static void graph_union(ubc_graph_t *graph_p, int u, int v, int parity)
+{
+    int pu, pv;
+    int ru = graph_find(graph_p, u, &pu);
+    int rv = graph_find(graph_p, v, &pv);
+
+    if (ru == rv)
+    {
+        return;
+    }
+    if (ru < rv) /* the constant, or the lowest node, stays the root */
+    {
+        int r = ru;
+
+        ru = rv;
+        rv = r;
+    }
+    graph_p->parent[ru] = (uint16_t)rv;
+    graph_p->parity[ru] = (uint8_t)(pu ^ pv ^ parity);
+}
+
+static int compare_words(const void *a, const void *b)
+{
+    SHA1_WORD_t x = *(const SHA1_WORD_t *)a, y = *(const SHA1_WORD_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Add to graph the relations step t's equation forces between signs:
+ *   S^5(dA[t-1]) + df + S^30(dA[t-5]) + dW[t] - dA[t] == 0
+ * Returns 0 if the equation has no solution at all.
+ */
+static int ubc_step(const dv_info_t *info, int t, ubc_graph_t *graph_p)
+{
+    const SHA1_WORD_t *dv = info->dv + 5;
+    int node[4 * 32], pos[4 * 32], sign[4 * 32];
+    int n = 0;
+    SHA1_WORD_t x = dv[t - 2], y = ROTL(dv[t - 3], 30), z = ROTL(dv[t - 4], 30);
+    int xor_round = (t >= 20 && t < 40) || t >= 60;
+    SHA1_WORD_t free_bits = xor_round ? x ^ y ^ z : x | y | z;
+    int n_free = __builtin_popcount(free_bits);
+    SHA1_WORD_t *sums;
+    size_t n_sums = 1;
+    uint32_t first = 0, varies = 0, differs[4 * 32];
+    int found = 0;
+
+#define UBC_TERMS(word, node_of, rot, s)                                    \
+    for (int b = 0; b < 32; b++)                                            \
+    {                                                                       \
+        if ((word) >> b & 1)                                                \
+        {                                                                   \
+            node[n] = (node_of);                                            \
+            pos[n] = (b + (rot)) & 31;                                      \
+            sign[n++] = (s);                                                \
+        }                                                                   \
+    }
+    UBC_TERMS(dv[t - 1], NODE_A(t - 1, b), 5, 1);
+    UBC_TERMS(dv[t - 5], NODE_A(t - 5, b), 30, 1);
+    UBC_TERMS(info->dm[t], NODE_W(t, b), 0, 1);
+    UBC_TERMS(dv[t], NODE_A(t, b), 0, -1);
+#undef UBC_TERMS
+
+    if (n + n_free > DC_UBC_VARS || n_free > DC_UBC_FREE)
+    {
+        return 1; /* too dense to enumerate: nothing derived */
+    }
+
+    /*
+     * Every sum the free outputs can make: +-1 each in XOR rounds, where
+     * a flipped input always flips the output, and -1, 0 or +1 in IF and
+     * MAJ rounds, where it can be absorbed
+     */
+    for (int i = 0; i < n_free; i++)
+    {
+        n_sums *= xor_round ? 2 : 3;
+    }
+    sums = malloc(n_sums * sizeof(*sums));
+    if (sums == NULL)
+    {
+        return 1;
+    }
+    for (size_t k = 0; k < n_sums; k++)
+    {
+        SHA1_WORD_t sum = 0;
+        size_t digits = k;
+
+        for (int b = 0; b < 32; b++)
+        {
+            if (free_bits >> b & 1)
+            {
+                int d = (int)(digits % (xor_round ? 2 : 3));
+
+                digits /= xor_round ? 2 : 3;
+                sum += d == 0 ? ((SHA1_WORD_t)1 << b) : d == 1 ? -((SHA1_WORD_t)1 << b) : 0;
+            }
+        }
+        sums[k] = sum;
+    }
+    qsort(sums, n_sums, sizeof(*sums), compare_words);
+
+    /*
+     * Bit i of an assignment is the sign of term i (1 for -); for each
+     * solution d = assignment ^ first, the terms whose sign differs from
+     * term i's relative to the first solution are collected in differs[i]
+     */
+    memset(differs, 0, sizeof(differs));
+    for (uint32_t a = 0; a < (1u << n); a++)
+    {
+        SHA1_WORD_t need = 0;
+        uint32_t d;
+
+        for (int i = 0; i < n; i++)
+        {
+            SHA1_WORD_t term = (SHA1_WORD_t)1 << pos[i];
+
+            need -= ((a >> i & 1) ? -term : term) * (SHA1_WORD_t)sign[i];
+        }
+        if (bsearch(&need, sums, n_sums, sizeof(*sums), compare_words) == NULL)
+        {
+            continue;
+        }
+        if (!found)
+        {
+            first = a;
+            found = 1;
+        }
+        d = a ^ first;
+        varies |= d;
+        for (int i = 0; i < n; i++)
+        {
+            differs[i] |= (d >> i & 1) ? ~d : d;
+        }
+    }
+    free(sums);
+
+    for (int i = 0; found && i < n; i++)
+    {
+        if (!(varies >> i & 1))
+        {
+            graph_union(graph_p, node[i], NODE_ONE, (int)(first >> i & 1));
+        }
+        for (int j = i + 1; j < n; j++)
+        {
+            if (!(differs[i] >> j & 1))
+            {
+                graph_union(graph_p, node[i], node[j], (int)((first >> i ^ first >> j) & 1));
+            }
+        }
+    }
+    return found;
+}
+
+/*
+ * The sign nodes of step t's equation, as ubc_step collects them
+ */
+static int ubc_nodes(const dv_info_t *info, int t, int node[4 * 32])
+{
+    const SHA1_WORD_t *dv = info->dv + 5;
+    int n = 0;
+
+    for (int b = 0; b < 32; b++)
+    {
+        if (dv[t - 1] >> b & 1) node[n++] = NODE_A(t - 1, b);
+        if (dv[t - 5] >> b & 1) node[n++] = NODE_A(t - 5, b);
+        if (info->dm[t] >> b & 1) node[n++] = NODE_W(t, b);
+        if (dv[t] >> b & 1) node[n++] = NODE_A(t, b);
+    }
+    return n;
+}
+
+static SHA1_WORD_t ubc_random(uint64_t *state_p)
+{
+    *state_p ^= *state_p << 13;
+    *state_p ^= *state_p >> 7;
+    *state_p ^= *state_p << 17;
+    return (SHA1_WORD_t)*state_p;
+}
+
+/*
+ * Check the relations ubc_step derived for step t against SHA-1 itself:
+ * run the step on random states A (A[j] after step t - j) and message
+ * words, and on the same inputs XORed with the DV's differences; where
+ * the two results differ by exactly dv[t], every relation must hold
+ * between the bit values of the first run. Returns 0 if one does not.
+ */
+#define DC_CHECK_SAMPLES 8
+#define DC_CHECK_TRIES   4096
+
+static int ubc_check_step(const dv_info_t *info, int t, ubc_graph_t *graph_p,
+                          const int *node, int n, uint64_t *seed_p)
+{
+    const SHA1_WORD_t *dv = info->dv + 5;
+    int samples = 0;
+
+    for (int k = 0; k < DC_CHECK_TRIES && samples < DC_CHECK_SAMPLES; k++)
+    {
+        SHA1_WORD_t A[6], B[6], W = ubc_random(seed_p);
+
+        for (int j = 1; j <= 5; j++)
+        {
+            A[j] = ubc_random(seed_p);
+            B[j] = A[j] ^ dv[t - j];
+        }
+        A[0] = ROTL(A[1], 5) + f_t(t, A[2], ROTL(A[3], 30), ROTL(A[4], 30)) + ROTL(A[5], 30) + W;
+        B[0] = ROTL(B[1], 5) + f_t(t, B[2], ROTL(B[3], 30), ROTL(B[4], 30)) + ROTL(B[5], 30) +
+               (W ^ info->dm[t]);
+        if ((A[0] ^ B[0]) != dv[t])
+        {
+            continue;
+        }
+        samples++;
+
+#define UBC_VALUE(x)                                                        \
+    ((x) == NODE_ONE ? 0 :                                                  \
+     (x) >= NODE_W(0, 0) ? (int)(W >> ((x) - NODE_W(0, 0)) % 32 & 1) :      \
+     (int)(A[t - ((x) - 1) / 32 + 5] >> ((x) - 1) % 32 & 1))
+        for (int i = 0; i < n; i++)
+        {
+            int parity;
+            int root = graph_find(graph_p, node[i], &parity);
+
+            if ((UBC_VALUE(node[i]) ^ parity) != UBC_VALUE(root))
+            {
+                return 0;
+            }
+        }
+#undef UBC_VALUE
+    }
+    return 1;
+}
+
+/*
+ * Conditions per DV while deriving, before they are merged
+ */
+#define DC_MAX_DV_UBCS 64
+
+typedef struct dv_ubcs {
+    int n;
+    dc_ubc_t ubc[DC_MAX_DV_UBCS];
+} dv_ubcs_t;
+
+/*
+ * Add one condition to the table, or its DVs to an equal one
+ */
+static void ubc_add(const dc_ubc_t *new_p)
+{
+    for (int k = 0; k < dc_n_ubcs; k++)
+    {
+        dc_ubc_t *ubc_p = &dc_ubcs[k];
+
+        if (ubc_p->w1 == new_p->w1 && ubc_p->b1 == new_p->b1 && ubc_p->w2 == new_p->w2 &&
+            ubc_p->b2 == new_p->b2 && ubc_p->parity == new_p->parity)
+        {
+            ubc_p->dvs |= new_p->dvs;
+            return;
+        }
+    }
+    if (dc_n_ubcs < DC_MAX_UBCS)
+    {
+        dc_ubcs[dc_n_ubcs++] = *new_p;
+    }
+}
+
+/*
+ * Derive the conditions of one DV: every message bit whose sign ended up
+ * in a group with the constant or another message bit is tied to the
+ * group's lowest such node. Returns 0 if none could be derived.
+ */
+static int ubc_derive(int dv_index, dv_ubcs_t *out_p)
+{
+    const dv_info_t *info = &dv_table[dv_index];
+    ubc_graph_t *graph_p = malloc(2 * sizeof(*graph_p));
+    ubc_graph_t *step_p = graph_p + 1;     /* one step's relations */
+    int16_t base[N_NODES];
+    uint64_t seed = 0x9E3779B97F4A7C15ull + (uint64_t)dv_index;
+
+    out_p->n = 0;
+    if (graph_p == NULL)
+    {
+        return 0;
+    }
+    for (int i = 0; i < N_NODES; i++)
+    {
+        graph_p->parent[i] = step_p->parent[i] = (uint16_t)i;
+        graph_p->parity[i] = step_p->parity[i] = 0;
+        base[i] = -1;
+    }
+
+    /*
+     * Each step is derived on its own and checked before it is chained
+     * in; a DV with a step that has no solution, or whose relations a
+     * sample contradicts, is left to recompression
+     */
+    for (int t = DC_UBC_FIRST; t <= DC_UBC_LAST; t++)
+    {
+        int node[4 * 32];
+        int n = ubc_nodes(info, t, node);
+
+        if (!ubc_step(info, t, step_p) || !ubc_check_step(info, t, step_p, node, n, &seed))
+        {
+            free(graph_p);
+            return 0;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int parity;
+            int root = graph_find(step_p, node[i], &parity);
+
+            if (root != node[i])
+            {
+                graph_union(graph_p, node[i], root, parity);
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            step_p->parent[node[i]] = (uint16_t)node[i];
+            step_p->parity[node[i]] = 0;
+        }
+    }
+
+    base[NODE_ONE] = NODE_ONE;
+    for (int t = 0; t < 80; t++)
+    {
+        for (int b = 0; b < 31; b++) /* the sign of bit 31 is meaningless */
+        {
+            int parity, parity_base;
+            int root = graph_find(graph_p, NODE_W(t, b), &parity);
+            dc_ubc_t *ubc_p = &out_p->ubc[out_p->n];
+
+            if (base[root] < 0)
+            {
+                base[root] = (int16_t)NODE_W(t, b);
+                continue;
+            }
+            if (out_p->n == DC_MAX_DV_UBCS)
+            {
+                continue;
+            }
+            graph_find(graph_p, base[root], &parity_base);
+            ubc_p->dvs = 1u << dv_index;
+            ubc_p->w1 = (uint8_t)t;
+            ubc_p->b1 = (uint8_t)b;
+            ubc_p->w2 = DC_NO_WORD;
+            ubc_p->b2 = 0;
+            if (base[root] != NODE_ONE)
+            {
+                ubc_p->w2 = (uint8_t)((base[root] - NODE_W(0, 0)) / 32);
+                ubc_p->b2 = (uint8_t)((base[root] - NODE_W(0, 0)) % 32);
+            }
+            ubc_p->parity = (uint8_t)(parity ^ parity_base);
+            out_p->n++;
+        }
+    }
+    free(graph_p);
+    return 1;
+}
+
+/*
+ * Derive every DV's conditions and merge them into the table round
+ * robin, so that the DVs a block fails all fail early in the scan
+ */
+static void build_ubcs(void)
+{
+    dv_ubcs_t *per_dv = malloc(SHA1DC_N_DVS * sizeof(*per_dv));
+    int longest = 0;
+
+    if (per_dv == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < SHA1DC_N_DVS; i++)
+    {
+        if (ubc_derive(i, &per_dv[i]))
+        {
+            dc_all_dvs |= 1u << i;
+        }
+        if (per_dv[i].n > longest)
+        {
+            longest = per_dv[i].n;
+        }
+    }
+    for (int k = 0; k < longest; k++)
+    {
+        for (int i = 0; i < SHA1DC_N_DVS; i++)
+        {
+            if (k < per_dv[i].n)
+            {
+                ubc_add(&per_dv[i].ubc[k]);
+            }
+        }
+    }
+    free(per_dv);
+}
+
+static void build_tables(void)
+{
+    for (int i = 0; i < SHA1DC_N_DVS; i++)
+    {
+        dv_info_t *info = &dv_table[i];
+        SHA1_WORD_t *dv = info->dv + 5; /* dv[t] valid for t = -5 .. 79 */
+        int K = dv_params[i].K;
+        int b = dv_params[i].b;
+        int t;
+
+        for (t = -5; t < 80; t++)
+        {
+            dv[t] = 0;
+        }
+        dv[K + 15] = (SHA1_WORD_t)1 << b;
+        if (dv_params[i].type == 2)
+        {
+            dv[K + 1] = dv[K + 3] = (SHA1_WORD_t)1 << ((31 + b) & 31);
+        }
+
+        /* forwards, and backwards via W[t] = S^-1(W[t+16]) ^ W[t+13] ^ W[t+8] ^ W[t+2] */
+        for (t = K + 16; t < 80; t++)
+        {
+            dv[t] = ROTL(dv[t - 3] ^ dv[t - 8] ^ dv[t - 14] ^ dv[t - 16], 1);
+        }
+        for (t = K - 1; t >= -5; t--)
+        {
+            dv[t] = ROTR(dv[t + 16], 1) ^ dv[t + 13] ^ dv[t + 8] ^ dv[t + 2];
+        }
+
+        /*
+         * A disturbance in step t is corrected in steps t+1 .. t+5
+         * (bits rotated by 5, 0, 30, 30, 30); the DV words before step 0
+         * count too
+         */
+        for (t = 0; t < 80; t++)
+        {
+            info->dm[t] = dv[t] ^ ROTL(dv[t - 1], 5) ^ dv[t - 2] ^ ROTL(dv[t - 3], 30) ^
+                          ROTL(dv[t - 4], 30) ^ ROTL(dv[t - 5], 30);
+        }
+
+        /*
+         * testt: the states agree where the 5 preceding DV words are 0
+         */
+        info->testt = 65;
+        if ((dv[53] | dv[54] | dv[55] | dv[56] | dv[57]) == 0)
+        {
+            info->testt = 58;
+        }
+        for (t = info->testt - 1; t > 0 && info->dm[t] == 0; t--)
+            ;
+        info->first_t = t;
+    }
+
+    build_ubcs();
+
+#ifdef SHA1DC_X86
+    for (int k = 0; k < dc_n_ubcs || k % 8 != 0; k++)
+    {
+        dc_lane_ubc_t *lane_p = &dc_lane_ubcs[k];
+
+        if (k < dc_n_ubcs)
+        {
+            const dc_ubc_t *ubc_p = &dc_ubcs[k];
+
+            lane_p->w1 = ubc_p->w1;
+            lane_p->w2 = ubc_p->w2 == DC_NO_WORD ? 80 : ubc_p->w2;
+            lane_p->shift1 = 31 - ubc_p->b1;
+            lane_p->shift2 = 31 - ubc_p->b2;
+            lane_p->parity = (uint32_t)ubc_p->parity << 31;
+            lane_p->dvs = ubc_p->dvs;
+        }
+        else
+        {
+            lane_p->w1 = lane_p->w2 = 80;
+            lane_p->shift1 = lane_p->shift2 = 0;
+            lane_p->parity = 0;
+            lane_p->dvs = 0;
+        }
+        dc_n_lane_ubcs = k + 1;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        dc_scan = scan_avx2;
+    }
+#endif
+}
+
+void SHA1DC_init(void)
+{
+    pthread_once(&dv_once, build_tables);
+}
+
+/*
+ * Recompression, as SHA1DC does it: the sibling block W ^ dm shares our
+ * state at testt. Run it back from there to its chaining value and
+ * forward to its output; the block is half of a collision if that
+ * output is ours. Between first_t and testt dm is 0, so the sibling's
+ * states there are ours and the backward run starts at first_t.
+ */
+static int recompress(const dv_info_t *info, const SHA1_WORD_t ihv_out[5],
+                      const SHA1_WORD_t W[80], const SHA1_WORD_t Q[SHA1DC_N_Q])
+{
+    const SHA1_WORD_t *Qt = Q + 4; /* Qt[t] for t = -4 .. 80 */
+    int T = info->testt;
+    int t = info->first_t;
+    SHA1_WORD_t q1 = Qt[t + 1], q0 = Qt[t], qm1 = Qt[t - 1], qm2 = Qt[t - 2], qm3 = Qt[t - 3];
+    SHA1_WORD_t ihv2[5], A, B, C, D, E, temp_word;
+
+    for (; t >= 0; t--)
+    {
+        E = q1 - ROTL(q0, 5) - f_t(t, qm1, ROTL(qm2, 30), ROTL(qm3, 30)) -
+            (W[t] ^ info->dm[t]) - constants_K[t / 20];
+
+        q1 = q0;
+        q0 = qm1;
+        qm1 = qm2;
+        qm2 = qm3;
+        qm3 = ROTR(E, 30);
+    }
+
+    /* the window now holds the sibling's Q[0] .. Q[-4] */
+    ihv2[0] = q1;
+    ihv2[1] = q0;
+    ihv2[2] = ROTL(qm1, 30);
+    ihv2[3] = ROTL(qm2, 30);
+    ihv2[4] = ROTL(qm3, 30);
+
+    A = Qt[T];
+    B = Qt[T - 1];
+    C = ROTL(Qt[T - 2], 30);
+    D = ROTL(Qt[T - 3], 30);
+    E = ROTL(Qt[T - 4], 30);
+    for (t = T; t < 80; t++)
+    {
+        temp_word = ROTL(A, 5) + f_t(t, B, C, D) + E + (W[t] ^ info->dm[t]) +
+                    constants_K[t / 20];
+        E = D;
+        D = C;
+        C = ROTL(B, 30);
+        B = A;
+        A = temp_word;
+    }
+
+    return ihv2[0] + A == ihv_out[0] && ihv2[1] + B == ihv_out[1] &&
+           ihv2[2] + C == ihv_out[2] && ihv2[3] + D == ihv_out[3] &&
+           ihv2[4] + E == ihv_out[4];
+}
+
+/*
+ * The DVs whose conditions all hold for a block, plus any whose
+ * conditions could not be derived
+ */
+static uint32_t ubc_filter(const SHA1_WORD_t W[80])
+{
+    uint32_t mask = ~(uint32_t)0 >> (32 - SHA1DC_N_DVS);
+
+    for (int k = 0; k < dc_n_ubcs && (mask & dc_all_dvs) != 0; k++)
+    {
+        const dc_ubc_t *ubc_p = &dc_ubcs[k];
+        SHA1_WORD_t bit;
+
+        if ((mask & ubc_p->dvs) == 0)
+        {
+            continue;
+        }
+        bit = W[ubc_p->w1] >> ubc_p->b1 ^ ubc_p->parity;
+        if (ubc_p->w2 != DC_NO_WORD)
+        {
+            bit ^= W[ubc_p->w2] >> ubc_p->b2;
+        }
+        if (bit & 1)
+        {
+            mask &= ~ubc_p->dvs;
+        }
+    }
+
+    return mask;
+}
+
+int SHA1DC_check_block(const SHA1_WORD_t ihv_out[5], const SHA1_WORD_t W[80],
+                       const SHA1_WORD_t Q[SHA1DC_N_Q])
+{
+    uint32_t mask;
+    int found = 0;
+
+    SHA1DC_init();
+
+    mask = ubc_filter(W);
+    while (mask != 0)
+    {
+        int i = __builtin_ctz(mask);
+
+        mask &= mask - 1;
+        found |= recompress(&dv_table[i], ihv_out, W, Q);
+    }
+
+    return found;
+}
+
+static size_t scan_scalar(const uint8_t *data, size_t n_blocks)
+{
+    SHA1_WORD_t W[80];
+    size_t i;
+
+    for (i = 0; i < n_blocks; i++, data += 64)
+    {
+        for (int t = 0; t < 16; t++)
+        {
+            W[t] = (SHA1_WORD_t)data[t * 4] << 24 | (SHA1_WORD_t)data[t * 4 + 1] << 16 |
+                   (SHA1_WORD_t)data[t * 4 + 2] << 8 | (SHA1_WORD_t)data[t * 4 + 3];
+        }
+        for (int t = 16; t < 80; t++)
+        {
+            W[t] = ROTL(W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16], 1);
+        }
+        if (ubc_filter(W) != 0)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#ifdef SHA1DC_X86
+/*
+ * Eight blocks at a time, one per lane: the message words are gathered
+ * and expanded side by side, and every condition is tested in all lanes
+ * at once, without branches, until no lane has a DV left. Each bit is
+ * moved to the sign bit and spread over the lane, so a failed condition
+ * clears its DVs from that lane's mask.
+ */
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t *data, size_t n_blocks)
+{
+    const __m256i index = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i W[81]; /* W[80] stays zero: the second bit of a one-bit condition */
+    size_t i;
+
+    W[80] = _mm256_setzero_si256();
+    for (i = 0; i + 8 <= n_blocks; i += 8, data += 8 * 64)
+    {
+        __m256i mask = _mm256_set1_epi32((int)dc_all_dvs);
+
+        for (int t = 0; t < 16; t++)
+        {
+            W[t] = _mm256_i32gather_epi32((const int *)data + t, index, 4);
+            W[t] = _mm256_shuffle_epi8(W[t], bswap);
+        }
+        for (int t = 16; t < 80; t++)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(W[t - 3], W[t - 8]),
+                                         _mm256_xor_si256(W[t - 14], W[t - 16]));
+
+            W[t] = _mm256_or_si256(_mm256_slli_epi32(x, 1), _mm256_srli_epi32(x, 31));
+        }
+
+        for (int k = 0; k < dc_n_lane_ubcs; k += 8)
+        {
+            for (int j = k; j < k + 8; j++)
+            {
+                const dc_lane_ubc_t *lane_p = &dc_lane_ubcs[j];
+                __m256i bit;
+
+                bit = _mm256_xor_si256(
+                    _mm256_sllv_epi32(W[lane_p->w1], _mm256_set1_epi32(lane_p->shift1)),
+                    _mm256_sllv_epi32(W[lane_p->w2], _mm256_set1_epi32(lane_p->shift2)));
+                bit = _mm256_srai_epi32(_mm256_xor_si256(bit, _mm256_set1_epi32((int)lane_p->parity)), 31);
+                mask = _mm256_andnot_si256(_mm256_and_si256(bit, _mm256_set1_epi32((int)lane_p->dvs)), mask);
+            }
+            if (_mm256_testz_si256(mask, mask))
+            {
+                break;
+            }
+        }
+
+        if (!_mm256_testz_si256(mask, mask))
+        {
+            __m256i none = _mm256_cmpeq_epi32(mask, _mm256_setzero_si256());
+
+            return i + (size_t)__builtin_ctz(~_mm256_movemask_ps(_mm256_castsi256_ps(none)) & 0xFF);
+        }
+    }
+
+    return i + scan_scalar(data, n_blocks - i);
+}
+#endif
+
+size_t SHA1DC_scan(const uint8_t *data, size_t n_blocks)
+{
+    SHA1DC_init();
+
+    if (dc_all_dvs != ~(uint32_t)0 >> (32 - SHA1DC_N_DVS))
+    {
+        return 0; /* some DV is recompressed on every block */
+    }
+
+    return dc_scan(data, n_blocks);
+}
+
+/*
+ * SELF-TEST
+ * The two colliding block pairs of the SHAttered PDFs (Stevens et al.,
+ * 2017), from the chaining value both files share after their 192-byte
+ * prefix. The second block of each pair is a near-collision block on
+ * DV II(52,0) and must be detected; the first blocks, and the second
+ * block of one pair after the first of the other, must not. No real
+ * collision exists on the other DVs; for them, as for this one, the
+ * check on their derived conditions (see ubc_derive) must have passed.
+ */
+int SHA1DC_self_test(void)
+{
+    static const SHA1_WORD_t ihv_prefix[5] = {
+        0x4ea96269, 0x7c876e26, 0x74d107f0, 0xfec67984, 0x14f5bf45
+    };
+    static const SHA1_WORD_t ihv_collision[5] = {
+        0x1eacb25e, 0xd5970d10, 0xf1736963, 0x5771bc3a, 0x17b48ac5
+    };
+    static const uint8_t blocks[2][2][64] = {
+        { {
+            0x7f, 0x46, 0xdc, 0x93, 0xa6, 0xb6, 0x7e, 0x01, 0x3b, 0x02, 0x9a, 0xaa,
+            0x1d, 0xb2, 0x56, 0x0b, 0x45, 0xca, 0x67, 0xd6, 0x88, 0xc7, 0xf8, 0x4b,
+            0x8c, 0x4c, 0x79, 0x1f, 0xe0, 0x2b, 0x3d, 0xf6, 0x14, 0xf8, 0x6d, 0xb1,
+            0x69, 0x09, 0x01, 0xc5, 0x6b, 0x45, 0xc1, 0x53, 0x0a, 0xfe, 0xdf, 0xb7,
+            0x60, 0x38, 0xe9, 0x72, 0x72, 0x2f, 0xe7, 0xad, 0x72, 0x8f, 0x0e, 0x49,
+            0x04, 0xe0, 0x46, 0xc2
+        }, {
+            0x30, 0x57, 0x0f, 0xe9, 0xd4, 0x13, 0x98, 0xab, 0xe1, 0x2e, 0xf5, 0xbc,
+            0x94, 0x2b, 0xe3, 0x35, 0x42, 0xa4, 0x80, 0x2d, 0x98, 0xb5, 0xd7, 0x0f,
+            0x2a, 0x33, 0x2e, 0xc3, 0x7f, 0xac, 0x35, 0x14, 0xe7, 0x4d, 0xdc, 0x0f,
+            0x2c, 0xc1, 0xa8, 0x74, 0xcd, 0x0c, 0x78, 0x30, 0x5a, 0x21, 0x56, 0x64,
+            0x61, 0x30, 0x97, 0x89, 0x60, 0x6b, 0xd0, 0xbf, 0x3f, 0x98, 0xcd, 0xa8,
+            0x04, 0x46, 0x29, 0xa1
+        } },
+        { {
+            0x73, 0x46, 0xdc, 0x91, 0x66, 0xb6, 0x7e, 0x11, 0x8f, 0x02, 0x9a, 0xb6,
+            0x21, 0xb2, 0x56, 0x0f, 0xf9, 0xca, 0x67, 0xcc, 0xa8, 0xc7, 0xf8, 0x5b,
+            0xa8, 0x4c, 0x79, 0x03, 0x0c, 0x2b, 0x3d, 0xe2, 0x18, 0xf8, 0x6d, 0xb3,
+            0xa9, 0x09, 0x01, 0xd5, 0xdf, 0x45, 0xc1, 0x4f, 0x26, 0xfe, 0xdf, 0xb3,
+            0xdc, 0x38, 0xe9, 0x6a, 0xc2, 0x2f, 0xe7, 0xbd, 0x72, 0x8f, 0x0e, 0x45,
+            0xbc, 0xe0, 0x46, 0xd2
+        }, {
+            0x3c, 0x57, 0x0f, 0xeb, 0x14, 0x13, 0x98, 0xbb, 0x55, 0x2e, 0xf5, 0xa0,
+            0xa8, 0x2b, 0xe3, 0x31, 0xfe, 0xa4, 0x80, 0x37, 0xb8, 0xb5, 0xd7, 0x1f,
+            0x0e, 0x33, 0x2e, 0xdf, 0x93, 0xac, 0x35, 0x00, 0xeb, 0x4d, 0xdc, 0x0d,
+            0xec, 0xc1, 0xa8, 0x64, 0x79, 0x0c, 0x78, 0x2c, 0x76, 0x21, 0x56, 0x60,
+            0xdd, 0x30, 0x97, 0x91, 0xd0, 0x6b, 0xd0, 0xaf, 0x3f, 0x98, 0xcd, 0xa4,
+            0xbc, 0x46, 0x29, 0xb1
+        } }
+    };
+    int enabled = SHA1_get_collision_detection();
+    int ok = 1;
+
+    SHA1_set_collision_detection(1);
+    for (int m = 0; m < 2; m++)
+    {
+        SHA1_WORD_t hash[5], mixed[5];
+
+        memcpy(hash, ihv_prefix, sizeof(hash));
+        ok &= SHA1_process_blocks(hash, blocks[m][0], 1) == SHA1_SUCCESS;
+        memcpy(mixed, hash, sizeof(mixed));
+        ok &= SHA1_process_blocks(hash, blocks[m][1], 1) == SHA1_COLLISION_DETECTED;
+        ok &= memcmp(hash, ihv_collision, sizeof(hash)) == 0;
+        ok &= SHA1_process_blocks(mixed, blocks[1 - m][1], 1) == SHA1_SUCCESS;
+    }
+    SHA1_set_collision_detection(enabled);
+    ok &= dc_all_dvs == ~(uint32_t)0 >> (32 - SHA1DC_N_DVS);
+
+    return ok;
+}
@@ -0,0 +1,102 @@
+/* SHA1 collision detection header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_DC_H_
+#define _SHA1_DC_H_
+
+/*
+ * Counter-cryptanalysis in the style of SHA1DC (Stevens & Shumow), as
+ * used by git: for every compressed block, decide whether it could be
+ * the last near-collision block of an identical- or chosen-prefix
+ * collision attack, without slowing down ordinary input much.
+ *
+ * All published practical SHA-1 attacks use one of 32 disturbance
+ * vectors (DVs), types I(K,b) and II(K,b). A DV fixes, for the final
+ * block, a message difference dm (a linear function of the DV) and a
+ * step testt (58 or 65) where the two compression states are equal.
+ * For a candidate block the sibling block W ^ dm is therefore run
+ * backwards from the real state at step testt; if that sibling reaches
+ * a chaining value that, compressed forwards, gives the same output,
+ * the block is one half of a collision.
+ *
+ * Running all 32 sibling computations in full would cost ~32 extra
+ * compressions. Instead each DV is first filtered, as in SHA1DC, by its
+ * unavoidable bit conditions: relations between message bits (W bit i
+ * of step t, alone or XORed with another) that every message following
+ * the DV's differential path over steps 24..72 must satisfy, whatever
+ * the path does outside the linear region. An ordinary block fails one
+ * of them for every DV after about 34 bit tests on average; a DV whose
+ * conditions all hold (about one block in 300) is recompressed in full.
+ * The conditions only involve the message, so SHA1DC_scan tests eight
+ * blocks at a time with AVX2 where available, and the blocks no DV
+ * survives are compressed by the ordinary kernels: only the rare
+ * candidate needs the step-by-step states of SHA1DC_check_block.
+ *
+ * The DV tables and their bit conditions are derived at run time from
+ * the DV definitions on first use: the conditions by solving, step by
+ * step, the signed state-update equation over the DV's difference bits
+ * and chaining the forced sign relations through the register and
+ * message words they share. Each step's relations are checked against
+ * the step itself before they are chained: on random states and message
+ * words that follow the DV's differences into the step, and come out
+ * with exactly its difference, they must all hold. A DV that fails is
+ * recompressed on every block, and fails SHA1DC_self_test.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1DC_N_DVS 32
+
+/*
+ * Q is the A register after every step, offset by 4: Q[t + 4] holds A
+ * after step t - 1 for t = -4 .. 80, where Q[0..4] are derived from the
+ * chaining value as the rotated E, D, C and plain B, A.
+ */
+#define SHA1DC_N_Q 85
+
+/*
+ * INIT
+ * Build the DV tables. Called automatically; safe to call repeatedly
+ * and from several threads.
+ */
+void SHA1DC_init(void);
+
+/*
+ * CHECK BLOCK
+ * Test one compressed block for a collision.
+ *
+ * Parameters
+ *  ihv_out: chaining value after the block
+ *  W: the 80-word message schedule of the block
+ *  Q: A after every step (see above)
+ *
+ * Returns
+ *  nonzero if the block is part of a collision
+ */
+int SHA1DC_check_block(const SHA1_WORD_t ihv_out[5], const SHA1_WORD_t W[80],
+                       const SHA1_WORD_t Q[SHA1DC_N_Q]);
+
+/*
+ * SCAN
+ * Find the first of n_blocks consecutive blocks on which some DV's
+ * conditions all hold, i.e. that SHA1DC_check_block must see.
+ *
+ * Returns
+ *  the number of leading blocks that cannot be part of a collision
+ */
+size_t SHA1DC_scan(const uint8_t *data, size_t n_blocks);
+
+/*
+ * SELF-TEST
+ * Compress the colliding blocks of the SHAttered PDFs with collision
+ * detection on (restoring the previous setting afterwards).
+ *
+ * Returns
+ *  nonzero if exactly the two near-collision blocks were detected, and
+ *  the conditions of all 32 DVs were derived and passed their check
+ */
+int SHA1DC_self_test(void);
+
+#endif /* _SHA1_DC_H_ */
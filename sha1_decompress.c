@@ -0,0 +1,422 @@
+/*
+ * Hashing of gzip and zstd input, decompression overlapped with hashing
+ */
+
+#include "sha1_decompress.h"
+#include "sha1_ctx.h"
+#include "sha1_file.h"
+#include "sha1_ring.h"
+#include "sha1_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#if SHA1_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * The ring (sha1_ring.h), and the producer's input and result, published
+ * with the last slot. A slot of length 0 ends the stream.
+ */
+typedef struct decompress_ring {
+    SHA1_Ring_t ring;
+    int cancel;                     /* the consumer gave up */
+    int fd;
+    uint8_t *in;                    /* compressed input, SHA1_FILE_CHUNK bytes */
+    SHA1_ERRCODE err;
+    int err_errno;
+} decompress_ring_t;
+
+/*
+ * PRODUCER
+ */
+
+static ssize_t read_input(decompress_ring_t *ring_p, size_t offset)
+{
+    ssize_t n;
+
+    if (__atomic_load_n(&ring_p->cancel, __ATOMIC_RELAXED))
+    {
+        ring_p->err = SHA1_GENERIC_ERROR;
+        return -1;
+    }
+    do
+    {
+        n = read(ring_p->fd, ring_p->in + offset, SHA1_FILE_CHUNK - offset);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+    {
+        ring_p->err = SHA1_IO_ERROR;
+        ring_p->err_errno = errno;
+    }
+    return n;
+}
+
+static void inflate_gzip(decompress_ring_t *ring_p, size_t have)
+{
+    z_stream zs;
+    int member_end = 0;
+    int padding = 0;
+    int eof = 0;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    {
+        ring_p->err = SHA1_ALLOC_ERROR;
+        return;
+    }
+    zs.next_in = ring_p->in;
+    zs.avail_in = (uInt)have;
+    zs.next_out = SHA1_ring_slot(&ring_p->ring);
+    zs.avail_out = SHA1_DECOMPRESS_SLOT;
+
+    for (;;)
+    {
+        if (zs.avail_out == 0)
+        {
+            SHA1_ring_push(&ring_p->ring, SHA1_DECOMPRESS_SLOT);
+            zs.next_out = SHA1_ring_slot(&ring_p->ring);
+            zs.avail_out = SHA1_DECOMPRESS_SLOT;
+        }
+        if (zs.avail_in == 0 && !eof)
+        {
+            ssize_t n = read_input(ring_p, 0);
+
+            if (n < 0)
+            {
+                break;
+            }
+            eof = n == 0;
+            zs.next_in = ring_p->in;
+            zs.avail_in = (uInt)n;
+        }
+
+        /*
+         * Another gzip member may follow the one just finished, or zero
+         * padding up to the end (tape blocks, dd conv=sync), which gzip
+         * ignores; a member never starts with a zero byte
+         */
+        if (member_end)
+        {
+            while (zs.avail_in > 0 && *zs.next_in == 0)
+            {
+                zs.next_in++;
+                zs.avail_in--;
+                padding = 1;
+            }
+            if (zs.avail_in == 0)
+            {
+                if (eof)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (padding)
+            {
+                ring_p->err = SHA1_BAD_INPUT; /* data after the padding */
+                break;
+            }
+            inflateReset(&zs);
+            member_end = 0;
+        }
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            member_end = 1;
+        }
+        else if (ret == Z_BUF_ERROR)
+        {
+            if (eof && zs.avail_in == 0 && zs.avail_out > 0)
+            {
+                ring_p->err = SHA1_BAD_INPUT; /* truncated */
+                break;
+            }
+        }
+        else if (ret != Z_OK)
+        {
+            ring_p->err = ret == Z_MEM_ERROR ? SHA1_ALLOC_ERROR : SHA1_BAD_INPUT;
+            break;
+        }
+    }
+
+    if (zs.avail_out < SHA1_DECOMPRESS_SLOT)
+    {
+        SHA1_ring_push(&ring_p->ring, SHA1_DECOMPRESS_SLOT - zs.avail_out);
+    }
+    inflateEnd(&zs);
+}
+
+#if SHA1_ZSTD
+static void inflate_zstd(decompress_ring_t *ring_p, size_t have)
+{
+    ZSTD_DStream *zd = ZSTD_createDStream();
+    ZSTD_inBuffer zin = { ring_p->in, have, 0 };
+    ZSTD_outBuffer zout;
+    size_t last = 1;                /* hint of the last call that made progress */
+    int eof = 0;
+
+    if (zd == NULL)
+    {
+        ring_p->err = SHA1_ALLOC_ERROR;
+        return;
+    }
+    ZSTD_initDStream(zd);
+    zout.dst = SHA1_ring_slot(&ring_p->ring);
+    zout.size = SHA1_DECOMPRESS_SLOT;
+    zout.pos = 0;
+
+    for (;;)
+    {
+        size_t ret, in_pos, out_pos;
+
+        if (zout.pos == zout.size)
+        {
+            SHA1_ring_push(&ring_p->ring, zout.pos);
+            zout.dst = SHA1_ring_slot(&ring_p->ring);
+            zout.pos = 0;
+        }
+        if (zin.pos == zin.size && !eof)
+        {
+            ssize_t n = read_input(ring_p, 0);
+
+            if (n < 0)
+            {
+                break;
+            }
+            eof = n == 0;
+            zin.size = (size_t)n;
+            zin.pos = 0;
+        }
+
+        in_pos = zin.pos;
+        out_pos = zout.pos;
+        ret = ZSTD_decompressStream(zd, &zout, &zin);
+        if (ZSTD_isError(ret))
+        {
+            ring_p->err = SHA1_BAD_INPUT;
+            break;
+        }
+        if (zin.pos != in_pos || zout.pos != out_pos)
+        {
+            last = ret;
+        }
+
+        /*
+         * With all input consumed and room to spare, the decoder has
+         * flushed everything; a nonzero hint from the last call that did
+         * anything means a frame is unfinished (an idle call after a
+         * complete frame asks for the next frame's header)
+         */
+        if (eof && zin.pos == zin.size && zout.pos < zout.size)
+        {
+            if (last != 0)
+            {
+                ring_p->err = SHA1_BAD_INPUT;
+            }
+            break;
+        }
+    }
+
+    if (zout.pos > 0)
+    {
+        SHA1_ring_push(&ring_p->ring, zout.pos);
+    }
+    ZSTD_freeDStream(zd);
+}
+#endif
+
+static void *decompress_main(void *arg)
+{
+    decompress_ring_t *ring_p = arg;
+    size_t have = 0;
+
+    /*
+     * Enough of the input to recognise the format
+     */
+    while (have < 4)
+    {
+        ssize_t n = read_input(ring_p, have);
+
+        if (n <= 0)
+        {
+            break;
+        }
+        have += (size_t)n;
+    }
+
+    if (ring_p->err != SHA1_SUCCESS)
+    {
+        /* nothing more to do */
+    }
+    else if (have >= 2 && ring_p->in[0] == 0x1f && ring_p->in[1] == 0x8b)
+    {
+        inflate_gzip(ring_p, have);
+    }
+#if SHA1_ZSTD
+    else if (have >= 4 && ring_p->in[0] == 0x28 && ring_p->in[1] == 0xb5 &&
+             ring_p->in[2] == 0x2f && ring_p->in[3] == 0xfd)
+    {
+        inflate_zstd(ring_p, have);
+    }
+#endif
+    else
+    {
+        ring_p->err = SHA1_BAD_INPUT;
+    }
+
+    /*
+     * The end marker publishes err with it
+     */
+    SHA1_ring_slot(&ring_p->ring);
+    SHA1_ring_push(&ring_p->ring, 0);
+    return NULL;
+}
+
+/*
+ * DECOMPRESS FD
+ */
+SHA1_ERRCODE SHA1_decompress_fd(int fd, SHA1_DecompressSink_t sink, void *arg)
+{
+    decompress_ring_t *ring_p;
+    pthread_t thread;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    ring_p = aligned_alloc(64, (sizeof(*ring_p) + 63) & ~(size_t)63);
+    if (ring_p == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    memset(ring_p, 0, sizeof(*ring_p));
+    ring_p->fd = fd;
+    if (SHA1_ring_init(&ring_p->ring, SHA1_DECOMPRESS_SLOTS, SHA1_DECOMPRESS_SLOT,
+                       SHA1_DECOMPRESS_SPIN) != SHA1_SUCCESS)
+    {
+        free(ring_p);
+        return SHA1_ALLOC_ERROR;
+    }
+    if (posix_memalign((void **)&ring_p->in, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        SHA1_ring_free(&ring_p->ring);
+        free(ring_p);
+        return SHA1_ALLOC_ERROR;
+    }
+
+    if (pthread_create(&thread, NULL, decompress_main, ring_p) != 0)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out;
+    }
+
+    /*
+     * Hand the slots to sink as they fill, until the end marker. Once
+     * sink fails the producer is told to stop and the rest is drained.
+     */
+    for (;;)
+    {
+        size_t len;
+        const uint8_t *slot = SHA1_ring_peek(&ring_p->ring, &len);
+
+        if (len == 0)
+        {
+            break;
+        }
+        if (err == SHA1_SUCCESS)
+        {
+            err = sink(arg, slot, len);
+            if (err != SHA1_SUCCESS)
+            {
+                __atomic_store_n(&ring_p->cancel, 1, __ATOMIC_RELAXED);
+            }
+        }
+        SHA1_ring_pop(&ring_p->ring);
+    }
+    pthread_join(thread, NULL);
+
+    if (err == SHA1_SUCCESS)
+    {
+        err = ring_p->err;
+        errno = ring_p->err_errno;
+    }
+
+out:
+    free(ring_p->in);
+    SHA1_ring_free(&ring_p->ring);
+    free(ring_p);
+    return err;
+}
+
+typedef struct hash_sink {
+    SHA1_Ctx_t ctx;
+    int collision;
+} hash_sink_t;
+
+static SHA1_ERRCODE hash_sink(void *arg, const uint8_t *data, size_t len)
+{
+    hash_sink_t *sink_p = arg;
+
+    if (SHA1_ctx_update(&sink_p->ctx, data, len) == SHA1_COLLISION_DETECTED)
+    {
+        sink_p->collision = 1;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * HASH COMPRESSED FD
+ */
+SHA1_ERRCODE SHA1_hash_compressed_fd(int fd, SHA1_DIGEST_t digest)
+{
+    hash_sink_t sink;
+    SHA1_ERRCODE err;
+    SHA1_STATS_TIMER(start);
+
+    SHA1_ctx_init(&sink.ctx);
+    sink.collision = 0;
+    err = SHA1_decompress_fd(fd, hash_sink, &sink);
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_ctx_final(&sink.ctx, digest);
+        if (err == SHA1_SUCCESS && sink.collision)
+        {
+            err = SHA1_COLLISION_DETECTED;
+        }
+#if SHA1_STATS
+        if (SHA1_STATS_ON())
+        {
+            SHA1_stats_record_message(sink.ctx.length, SHA1_stats_now() - start);
+        }
+#endif
+    }
+
+    return err;
+}
+
+/*
+ * HASH COMPRESSED FILE
+ */
+SHA1_ERRCODE SHA1_hash_compressed_file(const char *path, SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err;
+    int saved_errno;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    err = SHA1_hash_compressed_fd(fd, digest);
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return err;
+}
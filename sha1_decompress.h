@@ -0,0 +1,70 @@
+/* SHA1 compressed input header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_DECOMPRESS_H_
+#define _SHA1_DECOMPRESS_H_
+
+/*
+ * Hash the uncompressed contents of gzip or zstd data without writing
+ * it anywhere.
+ *
+ * A decompression thread inflates into a ring of SHA1_DECOMPRESS_SLOTS
+ * buffers of SHA1_DECOMPRESS_SLOT bytes (sized to stay in L2 between
+ * the two threads) while the calling thread hashes the slots already
+ * filled. The ring (sha1_ring.h) is single-producer single-consumer
+ * and lock-free: each side only advances its own counter. A side that
+ * finds the ring full or empty spins briefly (not at all on a single
+ * CPU) and then sleeps on a condition variable, which the other side
+ * only signals when someone is asleep.
+ *
+ * The format is recognised by its magic number. Concatenated gzip
+ * members are hashed as one stream, and zero bytes after the last one
+ * are ignored, as gzip -d does. zstd needs libzstd: build with
+ * ZSTD=-DSHA1_ZSTD=1.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_DECOMPRESS_SLOT  (32 * 1024) /* bytes per ring slot */
+#define SHA1_DECOMPRESS_SLOTS 8
+#define SHA1_DECOMPRESS_SPIN  1024        /* polls before sleeping */
+
+typedef SHA1_ERRCODE (*SHA1_DecompressSink_t)(void *arg, const uint8_t *data, size_t len);
+
+/*
+ * DECOMPRESS FD
+ * Decompress everything readable from fd on a second thread, passing
+ * the output to sink in pieces of up to SHA1_DECOMPRESS_SLOT bytes (in
+ * order, on the calling thread). A sink that returns anything but
+ * SHA1_SUCCESS stops the decompression, and that code is returned.
+ *
+ * Returns
+ *  SHA1_SUCCESS, the sink's error, SHA1_IO_ERROR (errno set),
+ *  SHA1_BAD_INPUT for data that is corrupt, truncated or in no
+ *  supported format, or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_decompress_fd(int fd, SHA1_DecompressSink_t sink, void *arg);
+
+/*
+ * HASH COMPRESSED FD
+ * Decompress everything readable from fd and hash the result.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_BAD_INPUT for data
+ *  that is corrupt, truncated or in no supported format,
+ *  SHA1_ALLOC_ERROR or SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_hash_compressed_fd(int fd, SHA1_DIGEST_t digest);
+
+/*
+ * HASH COMPRESSED FILE
+ * Open path read-only and hash its uncompressed contents.
+ *
+ * Returns
+ *  as SHA1_hash_compressed_fd
+ */
+SHA1_ERRCODE SHA1_hash_compressed_file(const char *path, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_DECOMPRESS_H_ */
@@ -0,0 +1,626 @@
+/*
+ * Duplicate file finder: size, then edge digest, then full digest
+ */
+
+#define _GNU_SOURCE
+#include "sha1_dedup.h"
+#include "sha1_file.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Entries handed to a worker per trip to the shared counter
+ */
+#define DEDUP_BATCH 16
+
+typedef struct dedup_entry {
+    char *path;
+    size_t order;            /* position in the walk, for stable output */
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    size_t n_names;          /* names of this inode: this and the next n - 1 */
+    int failed;              /* could not be hashed; out of the running */
+    int complete;            /* digest covers the whole file */
+    SHA1_DIGEST_t digest;    /* edge digest, then full digest */
+} dedup_entry_t;
+
+typedef struct dedup_list {
+    dedup_entry_t *entries;
+    size_t n_entries;
+    size_t cap;
+} dedup_list_t;
+
+typedef struct dedup_job {
+    dedup_entry_t **work;
+    size_t n_work;
+    size_t next;             /* next unclaimed entry, atomic */
+    const SHA1_DedupOptions_t *options_p;
+    SHA1_Writer_p_t writer_p;
+    pthread_mutex_t lock;    /* guards writer_p and stderr */
+    uint64_t bytes_read;     /* atomic */
+    size_t n_unreadable;     /* atomic */
+    void (*pass)(struct dedup_job *, dedup_entry_t *, uint8_t *);
+} dedup_job_t;
+
+/*
+ * STAGE 1: walk and group by size
+ */
+
+static void walk_error(const SHA1_DedupOptions_t *options_p, SHA1_DedupResult_p_t result_p,
+                       const char *path)
+{
+    fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, path, strerror(errno));
+    result_p->n_unreadable++;
+}
+
+static SHA1_ERRCODE walk(dedup_list_t *list_p, const char *path, const SHA1_DedupOptions_t *options_p,
+                         SHA1_DedupResult_p_t result_p)
+{
+    dedup_entry_t *entry_p;
+    struct stat st;
+
+    if (lstat(path, &st) != 0)
+    {
+        walk_error(options_p, result_p, path);
+        return SHA1_SUCCESS;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        size_t path_len = strlen(path);
+        SHA1_ERRCODE err = SHA1_SUCCESS;
+        struct dirent *de;
+        DIR *dir = opendir(path);
+
+        if (dir == NULL)
+        {
+            walk_error(options_p, result_p, path);
+            return SHA1_SUCCESS;
+        }
+        while (err == SHA1_SUCCESS && (de = readdir(dir)) != NULL)
+        {
+            size_t child_len;
+            char *child;
+
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            {
+                continue;
+            }
+            child_len = path_len + strlen(de->d_name) + 2;
+            child = malloc(child_len);
+            if (child == NULL)
+            {
+                err = SHA1_ALLOC_ERROR;
+                break;
+            }
+            snprintf(child, child_len, "%s%s%s", path,
+                     path_len > 0 && path[path_len - 1] == '/' ? "" : "/", de->d_name);
+            err = walk(list_p, child, options_p, result_p);
+            free(child);
+        }
+        closedir(dir);
+        return err;
+    }
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        return SHA1_SUCCESS;
+    }
+
+    if (list_p->n_entries == list_p->cap)
+    {
+        size_t cap = list_p->cap ? list_p->cap * 2 : 1024;
+        dedup_entry_t *grown = realloc(list_p->entries, cap * sizeof(dedup_entry_t));
+
+        if (grown == NULL)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        list_p->entries = grown;
+        list_p->cap = cap;
+    }
+
+    entry_p = &list_p->entries[list_p->n_entries];
+
+    memset(entry_p, 0, sizeof(*entry_p));
+    entry_p->path = strdup(path);
+    if (entry_p->path == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    entry_p->order = list_p->n_entries++;
+    entry_p->size = (uint64_t)st.st_size;
+    entry_p->dev = st.st_dev;
+    entry_p->ino = st.st_ino;
+
+    result_p->n_files++;
+    result_p->bytes_total += entry_p->size;
+    return SHA1_SUCCESS;
+}
+
+static int compare_size_inode(const void *a, const void *b)
+{
+    const dedup_entry_t *x = a, *y = b;
+
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    if (x->dev != y->dev)   return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)   return x->ino < y->ino ? -1 : 1;
+    if (x->order != y->order) return x->order < y->order ? -1 : 1;
+    return 0;
+}
+
+static int compare_inode(const void *a, const void *b)
+{
+    const dedup_entry_t *x = *(dedup_entry_t * const *)a, *y = *(dedup_entry_t * const *)b;
+
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Largest files first, then by digest, each set in walk order
+ */
+static int compare_digest(const void *a, const void *b)
+{
+    const dedup_entry_t *x = *(dedup_entry_t * const *)a, *y = *(dedup_entry_t * const *)b;
+    int c;
+
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    c = memcmp(x->digest, y->digest, SHA1_DIGEST_SIZE);
+    if (c != 0) return c;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int same_digest(const dedup_entry_t *x, const dedup_entry_t *y)
+{
+    return x->size == y->size && memcmp(x->digest, y->digest, SHA1_DIGEST_SIZE) == 0;
+}
+
+/*
+ * STAGES 2 AND 3: hashing
+ */
+
+static void hash_failed(dedup_job_t *job_p, dedup_entry_t *entry_p, const char *why)
+{
+    entry_p->failed = 1;
+    __atomic_fetch_add(&job_p->n_unreadable, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&job_p->lock);
+    SHA1_writer_flush(job_p->writer_p);
+    fprintf(stderr, "%s: %s: %s\n", job_p->options_p->prog_name, entry_p->path, why);
+    pthread_mutex_unlock(&job_p->lock);
+}
+
+static int open_noatime(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+
+    if (fd < 0)
+    {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    return fd;
+}
+
+/*
+ * Read exactly len bytes at offset; a file that got shorter since it
+ * was sized is an error (EIO)
+ */
+static int pread_full(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, offset);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            if (n == 0)
+            {
+                errno = EIO;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void edge_pass(dedup_job_t *job_p, dedup_entry_t *entry_p, uint8_t *buf)
+{
+    SHA1_SHA1Object_t sha1;
+    size_t len;
+    int fd = open_noatime(entry_p->path);
+
+    if (fd < 0)
+    {
+        hash_failed(job_p, entry_p, strerror(errno));
+        return;
+    }
+
+    /*
+     * Both ends: the whole file if they overlap or touch
+     */
+    if (entry_p->size <= 2 * SHA1_DEDUP_EDGE)
+    {
+        len = (size_t)entry_p->size;
+        if (pread_full(fd, buf, len, 0) != 0)
+        {
+            hash_failed(job_p, entry_p, strerror(errno));
+            close(fd);
+            return;
+        }
+        entry_p->complete = 1;
+    }
+    else
+    {
+        len = 2 * SHA1_DEDUP_EDGE;
+        if (pread_full(fd, buf, SHA1_DEDUP_EDGE, 0) != 0 ||
+            pread_full(fd, buf + SHA1_DEDUP_EDGE, SHA1_DEDUP_EDGE,
+                       (off_t)(entry_p->size - SHA1_DEDUP_EDGE)) != 0)
+        {
+            hash_failed(job_p, entry_p, strerror(errno));
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+    __atomic_fetch_add(&job_p->bytes_read, len, __ATOMIC_RELAXED);
+
+    if (SHA1_process_buffer(buf, len, &sha1) == SHA1_COLLISION_DETECTED && entry_p->complete)
+    {
+        hash_failed(job_p, entry_p, "SHA-1 collision attack detected");
+        return;
+    }
+    SHA1_get_digest(&sha1, entry_p->digest);
+}
+
+static void full_pass(dedup_job_t *job_p, dedup_entry_t *entry_p, uint8_t *buf)
+{
+    SHA1_ERRCODE err = SHA1_hash_file_buffered(entry_p->path, buf, SHA1_FILE_CHUNK, entry_p->digest);
+
+    if (err == SHA1_COLLISION_DETECTED)
+    {
+        hash_failed(job_p, entry_p, "SHA-1 collision attack detected");
+        return;
+    }
+    if (err != SHA1_SUCCESS)
+    {
+        hash_failed(job_p, entry_p, strerror(errno));
+        return;
+    }
+    entry_p->complete = 1;
+    __atomic_fetch_add(&job_p->bytes_read, entry_p->size, __ATOMIC_RELAXED);
+}
+
+static void *dedup_worker(void *arg)
+{
+    dedup_job_t *job_p = arg;
+    uint8_t *buf = NULL;
+
+    if (posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        return (void *)1;
+    }
+
+    for (;;)
+    {
+        size_t first = __atomic_fetch_add(&job_p->next, DEDUP_BATCH, __ATOMIC_RELAXED);
+        size_t last = first + DEDUP_BATCH;
+
+        if (first >= job_p->n_work)
+        {
+            break;
+        }
+        if (last > job_p->n_work)
+        {
+            last = job_p->n_work;
+        }
+        for (size_t i = first; i < last; i++)
+        {
+            job_p->pass(job_p, job_p->work[i], buf);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Run pass over the n_work entries of work, in inode order, on
+ * n_threads threads counting the calling one
+ */
+static SHA1_ERRCODE run_pass(dedup_job_t *job_p, dedup_entry_t **work, size_t n_work,
+                             void (*pass)(dedup_job_t *, dedup_entry_t *, uint8_t *), int n_threads)
+{
+    pthread_t *threads;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int started = 0;
+
+    if (n_work == 0)
+    {
+        return SHA1_SUCCESS;
+    }
+    if ((size_t)n_threads > (n_work + DEDUP_BATCH - 1) / DEDUP_BATCH)
+    {
+        n_threads = (int)((n_work + DEDUP_BATCH - 1) / DEDUP_BATCH);
+    }
+    threads = calloc((size_t)n_threads, sizeof(*threads));
+    if (threads == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+
+    qsort(work, n_work, sizeof(*work), compare_inode);
+    job_p->work = work;
+    job_p->n_work = n_work;
+    job_p->next = 0;
+    job_p->pass = pass;
+
+    for (int i = 1; i < n_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, dedup_worker, job_p) != 0)
+        {
+            break; /* carry on with fewer workers */
+        }
+        started++;
+    }
+
+    if (dedup_worker(job_p) != NULL)
+    {
+        err = SHA1_ALLOC_ERROR;
+    }
+    for (int i = 1; i <= started; i++)
+    {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        if (ret != NULL)
+        {
+            err = SHA1_ALLOC_ERROR;
+        }
+    }
+
+    free(threads);
+    return err;
+}
+
+/*
+ * OUTPUT
+ */
+
+/*
+ * Append name as one single-quoted shell word
+ */
+static void put_shell_word(SHA1_Writer_p_t writer_p, const char *name)
+{
+    SHA1_writer_put(writer_p, "'", 1);
+    for (const char *quote; (quote = strchr(name, '\'')) != NULL; name = quote + 1)
+    {
+        SHA1_writer_put(writer_p, name, (size_t)(quote - name));
+        SHA1_writer_put(writer_p, "'\\''", 4);
+    }
+    SHA1_writer_put(writer_p, name, strlen(name));
+    SHA1_writer_put(writer_p, "'", 1);
+}
+
+static SHA1_ERRCODE put_set(SHA1_Writer_p_t writer_p, SHA1_DEDUP_SUGGEST suggest,
+                            dedup_entry_t **set, size_t n)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    const char *eol = writer_p->zero_terminated ? "\0" : "\n";
+
+    for (size_t i = 0; i < n && err == SHA1_SUCCESS; i++)
+    {
+        for (size_t j = 0; j < set[i]->n_names && err == SHA1_SUCCESS; j++)
+        {
+            const dedup_entry_t *name_p = set[i] + j;
+
+            if (suggest == SHA1_DEDUP_LIST)
+            {
+                err = SHA1_writer_put_digest(writer_p, set[i]->digest, name_p->path, SHA1_FORMAT_TEXT);
+                continue;
+            }
+
+            /* names of the first inode are already links to it */
+            if (i == 0)
+            {
+                continue;
+            }
+
+            /* neither kind of link crosses file systems */
+            if (name_p->dev != set[0]->dev)
+            {
+                SHA1_writer_put(writer_p, "# other file system: ", 21);
+            }
+            if (suggest == SHA1_DEDUP_HARDLINK)
+            {
+                SHA1_writer_put(writer_p, "ln -f -- ", 9);
+            }
+            else
+            {
+                SHA1_writer_put(writer_p, "cp --reflink=always -- ", 23);
+            }
+            put_shell_word(writer_p, set[0]->path);
+            SHA1_writer_put(writer_p, " ", 1);
+            put_shell_word(writer_p, name_p->path);
+            err = SHA1_writer_put(writer_p, eol, 1);
+        }
+    }
+
+    return err != SHA1_SUCCESS ? err : SHA1_writer_put(writer_p, eol, 1);
+}
+
+/*
+ * DEDUP
+ */
+SHA1_ERRCODE SHA1_dedup(const char *const *paths, int n_paths, const SHA1_DedupOptions_t *options_p,
+                        SHA1_Writer_p_t writer_p, SHA1_DedupResult_p_t result_p)
+{
+    dedup_list_t list = { 0 };
+    dedup_entry_t **work = NULL;
+    dedup_job_t job;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int n_threads = options_p->n_threads;
+    size_t n_work;
+
+    memset(result_p, 0, sizeof(*result_p));
+    memset(&job, 0, sizeof(job));
+    job.options_p = options_p;
+    job.writer_p = writer_p;
+    pthread_mutex_init(&job.lock, NULL);
+
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+
+    /*
+     * STEP 1
+     * collect files; group by size, dropping extra names of one inode
+     */
+    for (int i = 0; i < n_paths && err == SHA1_SUCCESS; i++)
+    {
+        err = walk(&list, paths[i], options_p, result_p);
+    }
+    if (err != SHA1_SUCCESS)
+    {
+        goto out;
+    }
+    work = malloc((list.n_entries ? list.n_entries : 1) * sizeof(*work));
+    if (work == NULL)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out;
+    }
+    qsort(list.entries, list.n_entries, sizeof(dedup_entry_t), compare_size_inode);
+
+    n_work = 0;
+    for (size_t lo = 0, hi; lo < list.n_entries; lo = hi)
+    {
+        size_t first = n_work;
+
+        for (hi = lo; hi < list.n_entries && list.entries[hi].size == list.entries[lo].size; hi++)
+        {
+            if (hi == lo || list.entries[hi].dev != list.entries[hi - 1].dev ||
+                list.entries[hi].ino != list.entries[hi - 1].ino)
+            {
+                work[n_work++] = &list.entries[hi];
+            }
+            work[n_work - 1]->n_names++;
+        }
+        if (n_work - first < 2)
+        {
+            n_work = first;
+        }
+    }
+
+    /*
+     * STEP 2
+     * edge digests of every file whose size is shared
+     */
+    result_p->n_edge_hashed = n_work;
+    err = run_pass(&job, work, n_work, edge_pass, n_threads);
+    if (err != SHA1_SUCCESS)
+    {
+        goto out;
+    }
+
+    /*
+     * STEP 3
+     * full digests of the files whose edges still collide
+     */
+    qsort(work, n_work, sizeof(*work), compare_digest);
+    {
+        size_t n_full = 0, n_kept = 0;
+
+        for (size_t lo = 0, hi; lo < n_work; lo = hi)
+        {
+            size_t n_ok = 0;
+
+            for (hi = lo; hi < n_work && same_digest(work[hi], work[lo]); hi++)
+            {
+                n_ok += !work[hi]->failed;
+            }
+            for (size_t i = lo; i < hi && n_ok >= 2; i++)
+            {
+                if (!work[i]->failed)
+                {
+                    work[n_kept++] = work[i];
+                    n_full += !work[i]->complete;
+                }
+            }
+        }
+        n_work = n_kept;
+
+        /* the incomplete ones go to the front for the full pass */
+        for (size_t i = 0, j = 0; i < n_work; i++)
+        {
+            if (!work[i]->complete)
+            {
+                dedup_entry_t *swap = work[j];
+
+                work[j++] = work[i];
+                work[i] = swap;
+            }
+        }
+        result_p->n_full_hashed = n_full;
+        err = run_pass(&job, work, n_full, full_pass, n_threads);
+        if (err != SHA1_SUCCESS)
+        {
+            goto out;
+        }
+    }
+
+    /*
+     * STEP 4
+     * report the sets, largest files first
+     */
+    qsort(work, n_work, sizeof(*work), compare_digest);
+    for (size_t lo = 0, hi; lo < n_work && err == SHA1_SUCCESS; lo = hi)
+    {
+        size_t n_set = 0;
+
+        for (hi = lo; hi < n_work && same_digest(work[hi], work[lo]); hi++)
+        {
+            if (!work[hi]->failed)
+            {
+                work[lo + n_set++] = work[hi];
+            }
+        }
+        if (n_set < 2)
+        {
+            continue;
+        }
+        result_p->n_sets++;
+        result_p->n_duplicates += n_set - 1;
+        result_p->bytes_duplicate += (n_set - 1) * work[lo]->size;
+        err = put_set(writer_p, options_p->suggest, work + lo, n_set);
+    }
+
+out:
+    result_p->bytes_read = job.bytes_read;
+    result_p->n_unreadable += job.n_unreadable;
+    pthread_mutex_destroy(&job.lock);
+    for (size_t i = 0; i < list.n_entries; i++)
+    {
+        free(list.entries[i].path);
+    }
+    free(list.entries);
+    free(work);
+    return err;
+}
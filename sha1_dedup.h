@@ -0,0 +1,75 @@
+/* SHA1 duplicate file finder header file */
+
+#include "sha1.h"
+#include "sha1_output.h"
+
+#ifndef _SHA1_DEDUP_H_
+#define _SHA1_DEDUP_H_
+
+/*
+ * Find sets of identical files while reading as little data as possible.
+ *
+ *   1. walk the given files and directories (recursively, not following
+ *      symbolic links) and group regular, non-empty files by size;
+ *      every inode is hashed once, however many names it has;
+ *   2. for every file whose size is shared, hash the first and last
+ *      SHA1_DEDUP_EDGE bytes (the whole file if it is not larger than
+ *      both together, which is then its real digest);
+ *   3. only files whose size and edge digest both still collide are
+ *      hashed in full.
+ *
+ * Stages 2 and 3 run on n_threads workers, each visiting its files in
+ * (device, inode) order. Duplicate sets are written one file per line
+ * in sha1sum format (every name of every inode), sets separated by an
+ * empty line, or as shell commands that replace every copy by a hard
+ * link or reflink of the first one.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_DEDUP_EDGE (4 * 1024) /* bytes hashed at each end in stage 2 */
+
+typedef enum _sha1_dedup_suggest
+{
+    SHA1_DEDUP_LIST = 0,     /* list the sets */
+    SHA1_DEDUP_HARDLINK,     /* ln -f commands */
+    SHA1_DEDUP_REFLINK       /* cp --reflink=always commands */
+} SHA1_DEDUP_SUGGEST;
+
+typedef struct SHA1_DedupOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    int n_threads;           /* workers; <= 0 means one per online CPU */
+    SHA1_DEDUP_SUGGEST suggest;
+} SHA1_DedupOptions_t, *SHA1_DedupOptions_p_t;
+
+typedef struct SHA1_DedupResult {
+    size_t n_files;          /* regular non-empty files found */
+    size_t n_unreadable;     /* files or directories that could not be read */
+    size_t n_edge_hashed;    /* files that reached stage 2 */
+    size_t n_full_hashed;    /* files hashed in full in stage 3 */
+    uint64_t bytes_total;    /* size of all files found */
+    uint64_t bytes_read;     /* bytes actually read */
+    size_t n_sets;           /* duplicate sets */
+    size_t n_duplicates;     /* inodes beyond the first of each set */
+    uint64_t bytes_duplicate;/* their size, reclaimable by linking */
+} SHA1_DedupResult_t, *SHA1_DedupResult_p_t;
+
+/*
+ * DEDUP
+ * Find and report duplicates among paths.
+ *
+ * Parameters
+ *  paths: n_paths files or directories
+ *  options_p: see above
+ *  writer_p: output
+ *  result_p: counts, overwritten
+ *
+ * Returns
+ *  SHA1_SUCCESS (unreadable files are reported on stderr and counted),
+ *  SHA1_IO_ERROR if writing the output failed, or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_dedup(const char *const *paths, int n_paths, const SHA1_DedupOptions_t *options_p,
+                        SHA1_Writer_p_t writer_p, SHA1_DedupResult_p_t result_p);
+
+#endif /* _SHA1_DEDUP_H_ */
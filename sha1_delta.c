@@ -0,0 +1,529 @@
+/*
+ * rsync-style block signatures and delta matching
+ */
+
+#include "sha1_delta.h"
+#include "sha1_mb.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEADER_SIZE  16 /* magic, version, block size */
+#define RECORD_SIZE  (4 + SHA1_DIGEST_SIZE)
+#define TRAILER_SIZE 8  /* file size */
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+/*
+ * Fill buf from fd unless end of file comes first
+ */
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t n = read(fd, buf + got, len - got);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+uint32_t SHA1_weak_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t s1 = 0, s2 = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        s1 += data[i];
+        s2 += s1;
+    }
+    return (s1 & 0xFFFF) | s2 << 16;
+}
+
+/*
+ * SIGNATURE WRITE
+ * A chunk of whole blocks at a time: weak checksums in one pass, every
+ * block submitted to the job manager as a message of its own, the
+ * lanes flushed, and the chunk's records written
+ */
+SHA1_ERRCODE SHA1_signature_write(int fd, uint32_t block_size, SHA1_Writer_p_t writer_p,
+                                  uint64_t *n_blocks_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    SHA1_JobManager_t mgr;
+    size_t per_chunk, chunk;
+    uint8_t header[HEADER_SIZE], trailer[TRAILER_SIZE];
+    uint64_t file_size = 0;
+    uint8_t *buf, *records;
+    SHA1_Job_t *jobs;
+
+    *n_blocks_p = 0;
+    if (block_size == 0 || block_size > SHA1_DELTA_MAX_BLOCK)
+    {
+        return SHA1_BAD_INPUT;
+    }
+    per_chunk = block_size >= SHA1_DELTA_CHUNK ? 1 : SHA1_DELTA_CHUNK / block_size;
+    chunk = per_chunk * block_size;
+    buf = malloc(chunk);
+    records = malloc(per_chunk * RECORD_SIZE);
+    jobs = calloc(per_chunk, sizeof(*jobs));
+    if (buf == NULL || records == NULL || jobs == NULL)
+    {
+        free(buf);
+        free(records);
+        free(jobs);
+        return SHA1_ALLOC_ERROR;
+    }
+
+    memcpy(header, SHA1_DELTA_MAGIC, 8);
+    put_le32(header + 8, SHA1_DELTA_VERSION);
+    put_le32(header + 12, block_size);
+    err = SHA1_writer_put(writer_p, (const char *)header, sizeof(header));
+    SHA1_mgr_init(&mgr);
+
+    while (err == SHA1_SUCCESS)
+    {
+        ssize_t have = read_full(fd, buf, chunk);
+        size_t n;
+
+        if (have < 0)
+        {
+            err = SHA1_IO_ERROR;
+            break;
+        }
+        n = ((size_t)have + block_size - 1) / block_size;
+        if (*n_blocks_p + n >= UINT32_MAX)
+        {
+            err = SHA1_BAD_INPUT;
+            break;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t len = (size_t)have - i * block_size < block_size ? (size_t)have - i * block_size
+                                                                      : block_size;
+
+            put_le32(records + i * RECORD_SIZE, SHA1_weak_checksum(buf + i * block_size, len));
+            jobs[i].buffer = buf + i * block_size;
+            jobs[i].len = len;
+            jobs[i].flags = SHA1_JOB_ENTIRE;
+            SHA1_mgr_submit(&mgr, &jobs[i]);
+        }
+        while (SHA1_mgr_flush(&mgr) != NULL)
+        {
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            memcpy(records + i * RECORD_SIZE + 4, jobs[i].digest, SHA1_DIGEST_SIZE);
+        }
+        err = SHA1_writer_put(writer_p, (const char *)records, n * RECORD_SIZE);
+
+        *n_blocks_p += n;
+        file_size += (uint64_t)have;
+        if ((size_t)have < chunk)
+        {
+            break;
+        }
+    }
+
+    if (err == SHA1_SUCCESS)
+    {
+        put_le32(trailer, (uint32_t)file_size);
+        put_le32(trailer + 4, (uint32_t)(file_size >> 32));
+        err = SHA1_writer_put(writer_p, (const char *)trailer, sizeof(trailer));
+    }
+    free(buf);
+    free(records);
+    free(jobs);
+    return err;
+}
+
+/*
+ * SIGNATURE READ
+ */
+static uint32_t bucket(const SHA1_Signature_t *sig_p, uint32_t weak)
+{
+    return ((weak ^ (weak >> 15)) * 0x2C1B3C6Du) & sig_p->mask;
+}
+
+SHA1_ERRCODE SHA1_signature_read(int fd, SHA1_Signature_p_t sig_p)
+{
+    uint8_t *data = NULL;
+    size_t size = 0, cap = 0;
+    uint64_t n;
+    uint32_t n_slots = 16;
+
+    memset(sig_p, 0, sizeof(*sig_p));
+    for (;;)
+    {
+        ssize_t got;
+
+        if (cap - size < 65536)
+        {
+            uint8_t *grown = realloc(data, cap ? cap * 2 : 1u << 20);
+
+            if (grown == NULL)
+            {
+                free(data);
+                return SHA1_ALLOC_ERROR;
+            }
+            data = grown;
+            cap = cap ? cap * 2 : 1u << 20;
+        }
+        got = read_full(fd, data + size, cap - size);
+        if (got < 0)
+        {
+            free(data);
+            return SHA1_IO_ERROR;
+        }
+        size += (size_t)got;
+        if (size < cap)
+        {
+            break;
+        }
+    }
+
+    if (size < HEADER_SIZE + TRAILER_SIZE || (size - HEADER_SIZE - TRAILER_SIZE) % RECORD_SIZE ||
+        memcmp(data, SHA1_DELTA_MAGIC, 8) != 0 || get_le32(data + 8) != SHA1_DELTA_VERSION)
+    {
+        free(data);
+        return SHA1_BAD_INPUT;
+    }
+    n = (size - HEADER_SIZE - TRAILER_SIZE) / RECORD_SIZE;
+    sig_p->block_size = get_le32(data + 12);
+    sig_p->file_size = get_le64(data + size - TRAILER_SIZE);
+    if (sig_p->block_size == 0 || sig_p->block_size > SHA1_DELTA_MAX_BLOCK || n >= UINT32_MAX ||
+        n != (sig_p->file_size + sig_p->block_size - 1) / sig_p->block_size)
+    {
+        free(data);
+        return SHA1_BAD_INPUT;
+    }
+    sig_p->n_blocks = (uint32_t)n;
+
+    while (n_slots < n && n_slots < (1u << 31))
+    {
+        n_slots *= 2;
+    }
+    sig_p->mask = n_slots - 1;
+    sig_p->weak = malloc((n > 0 ? n : 1) * sizeof(*sig_p->weak));
+    sig_p->strong = malloc((n > 0 ? n : 1) * sizeof(*sig_p->strong));
+    sig_p->next = malloc((n > 0 ? n : 1) * sizeof(*sig_p->next));
+    sig_p->head = calloc(n_slots, sizeof(*sig_p->head));
+    if (sig_p->weak == NULL || sig_p->strong == NULL || sig_p->next == NULL || sig_p->head == NULL)
+    {
+        free(data);
+        SHA1_signature_free(sig_p);
+        return SHA1_ALLOC_ERROR;
+    }
+
+    /*
+     * Inserted last to first, so chains run in block order
+     */
+    for (uint32_t i = sig_p->n_blocks; i-- > 0; )
+    {
+        const uint8_t *record = data + HEADER_SIZE + (size_t)i * RECORD_SIZE;
+        uint32_t b;
+
+        sig_p->weak[i] = get_le32(record);
+        memcpy(sig_p->strong[i], record + 4, SHA1_DIGEST_SIZE);
+        b = bucket(sig_p, sig_p->weak[i]);
+        sig_p->next[i] = sig_p->head[b];
+        sig_p->head[b] = i + 1;
+    }
+    free(data);
+    return SHA1_SUCCESS;
+}
+
+void SHA1_signature_free(SHA1_Signature_p_t sig_p)
+{
+    free(sig_p->weak);
+    free(sig_p->strong);
+    free(sig_p->head);
+    free(sig_p->next);
+    memset(sig_p, 0, sizeof(*sig_p));
+}
+
+/*
+ * DELTA MATCH
+ */
+typedef struct match_state {
+    const SHA1_Signature_t *sig_p;
+    SHA1_delta_fn_t emit;
+    void *arg;
+    SHA1_DeltaResult_p_t result_p;
+    SHA1_DeltaOp_t copy;     /* run of old blocks not yet emitted */
+    int copy_pending;
+} match_state_t;
+
+static SHA1_ERRCODE flush_copy(match_state_t *state_p)
+{
+    if (!state_p->copy_pending)
+    {
+        return SHA1_SUCCESS;
+    }
+    state_p->copy_pending = 0;
+    state_p->result_p->n_copies++;
+    return state_p->emit(state_p->arg, &state_p->copy);
+}
+
+static SHA1_ERRCODE emit_copy(match_state_t *state_p, uint64_t offset, uint32_t block, size_t len)
+{
+    SHA1_DeltaOp_t *copy_p = &state_p->copy;
+    SHA1_ERRCODE err;
+
+    state_p->result_p->bytes_copied += len;
+    if (state_p->copy_pending &&
+        copy_p->block + copy_p->length / state_p->sig_p->block_size == block &&
+        copy_p->length % state_p->sig_p->block_size == 0)
+    {
+        copy_p->length += len;
+        return SHA1_SUCCESS;
+    }
+    err = flush_copy(state_p);
+    copy_p->type = SHA1_DELTA_COPY;
+    copy_p->offset = offset;
+    copy_p->length = len;
+    copy_p->block = block;
+    copy_p->data = NULL;
+    state_p->copy_pending = 1;
+    return err;
+}
+
+static SHA1_ERRCODE emit_literal(match_state_t *state_p, uint64_t offset, const uint8_t *data,
+                                 size_t len)
+{
+    SHA1_DeltaOp_t op = { SHA1_DELTA_LITERAL, offset, len, 0, data };
+    SHA1_ERRCODE err;
+
+    if (len == 0)
+    {
+        return SHA1_SUCCESS;
+    }
+    err = flush_copy(state_p);
+    return err != SHA1_SUCCESS ? err : state_p->emit(state_p->arg, &op);
+}
+
+/*
+ * The block the window at data matches, or -1. The window's SHA-1 is
+ * computed only if some block has its weak checksum, and at most once;
+ * the block that would extend the current copy is tried first.
+ */
+static int64_t find_block(match_state_t *state_p, uint32_t weak, const uint8_t *data, size_t len)
+{
+    const SHA1_Signature_t *sig_p = state_p->sig_p;
+    SHA1_DIGEST_t strong;
+    int have_strong = 0;
+    int hit = 0;
+    uint64_t expected = UINT64_MAX;
+
+    if (state_p->copy_pending && state_p->copy.length % sig_p->block_size == 0)
+    {
+        expected = state_p->copy.block + state_p->copy.length / sig_p->block_size;
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t b = pass == 0 ? (expected < sig_p->n_blocks ? (uint32_t)expected + 1 : 0)
+                               : sig_p->head[bucket(sig_p, weak)];
+
+        while (b != 0)
+        {
+            uint32_t i = b - 1;
+            uint64_t block_len = i + 1 < sig_p->n_blocks ? sig_p->block_size :
+                                 sig_p->file_size - (uint64_t)i * sig_p->block_size;
+
+            b = pass == 0 ? 0 : sig_p->next[i];
+            if (sig_p->weak[i] != weak || block_len != len || (pass == 1 && i == expected))
+            {
+                continue;
+            }
+            hit = 1;
+            if (!have_strong)
+            {
+                SHA1_SHA1Object_t sha1;
+
+                SHA1_process_buffer(data, len, &sha1);
+                SHA1_get_digest(&sha1, strong);
+                have_strong = 1;
+            }
+            if (memcmp(strong, sig_p->strong[i], SHA1_DIGEST_SIZE) == 0)
+            {
+                state_p->result_p->n_weak_hits++;
+                return i;
+            }
+        }
+    }
+    if (hit)
+    {
+        state_p->result_p->n_weak_hits++;
+        state_p->result_p->n_false_hits++;
+    }
+    return -1;
+}
+
+SHA1_ERRCODE SHA1_delta_match(int fd, const SHA1_Signature_t *sig_p, SHA1_delta_fn_t emit,
+                              void *arg, SHA1_DeltaResult_p_t result_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    match_state_t state;
+    size_t bs = sig_p->block_size;
+    size_t cap = (SHA1_DELTA_CHUNK > bs ? SHA1_DELTA_CHUNK : bs) + bs + 1;
+    size_t have = 0;         /* bytes in buf */
+    size_t w = 0;            /* window start */
+    size_t l = 0;            /* start of the literal bytes not yet emitted */
+    uint64_t base = 0;       /* file offset of buf[0] */
+    uint32_t s1 = 0, s2 = 0; /* weak checksum of the window, unmasked */
+    int weak_valid = 0;
+    int eof = 0;
+    uint8_t *buf = malloc(cap);
+
+    memset(result_p, 0, sizeof(*result_p));
+    if (buf == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    memset(&state, 0, sizeof(state));
+    state.sig_p = sig_p;
+    state.emit = emit;
+    state.arg = arg;
+    state.result_p = result_p;
+
+    while (err == SHA1_SUCCESS)
+    {
+        int64_t block;
+
+        /*
+         * The window and the byte after it, for rolling, unless the file
+         * ends first; room is made by emitting the pending literal and
+         * moving the window to the front
+         */
+        if (have - w < bs + 1 && !eof)
+        {
+            ssize_t n;
+
+            if (have == cap)
+            {
+                err = emit_literal(&state, base + l, buf + l, w - l);
+                memmove(buf, buf + w, have - w);
+                base += w;
+                have -= w;
+                l = w = 0;
+                if (err != SHA1_SUCCESS)
+                {
+                    break;
+                }
+            }
+            n = read(fd, buf + have, cap - have);
+            if (n < 0)
+            {
+                if (errno != EINTR)
+                {
+                    err = SHA1_IO_ERROR;
+                }
+                continue;
+            }
+            eof = n == 0;
+            have += (size_t)n;
+            continue;
+        }
+        if (have - w < bs || bs > sig_p->file_size)
+        {
+            break;
+        }
+
+        if (!weak_valid)
+        {
+            s1 = s2 = 0;
+            for (size_t i = 0; i < bs; i++)
+            {
+                s1 += buf[w + i];
+                s2 += s1;
+            }
+            weak_valid = 1;
+        }
+
+        block = find_block(&state, (s1 & 0xFFFF) | s2 << 16, buf + w, bs);
+        if (block >= 0)
+        {
+            err = emit_literal(&state, base + l, buf + l, w - l);
+            if (err == SHA1_SUCCESS)
+            {
+                err = emit_copy(&state, base + w, (uint32_t)block, bs);
+            }
+            w += bs;
+            l = w;
+            weak_valid = 0;
+            continue;
+        }
+        if (have - w == bs)
+        {
+            break; /* end of file right after this window */
+        }
+        s1 = s1 - buf[w] + buf[w + bs];
+        s2 = s2 - (uint32_t)bs * buf[w] + s1;
+        w++;
+    }
+
+    /*
+     * What is left is shorter than a block (or the file ended on an
+     * unmatched window): it may still be the old file's short last block
+     */
+    if (err == SHA1_SUCCESS)
+    {
+        size_t rest = have - w;
+        uint64_t last_len = sig_p->n_blocks > 0 ?
+            sig_p->file_size - (uint64_t)(sig_p->n_blocks - 1) * bs : 0;
+
+        if (rest > 0 && rest == last_len && rest < bs &&
+            find_block(&state, SHA1_weak_checksum(buf + w, rest), buf + w, rest) >= 0)
+        {
+            err = emit_literal(&state, base + l, buf + l, w - l);
+            if (err == SHA1_SUCCESS)
+            {
+                err = emit_copy(&state, base + w, sig_p->n_blocks - 1, rest);
+            }
+        }
+        else
+        {
+            err = emit_literal(&state, base + l, buf + l, have - l);
+        }
+        result_p->bytes = base + have;
+    }
+    if (err == SHA1_SUCCESS)
+    {
+        err = flush_copy(&state);
+    }
+    free(buf);
+    return err;
+}
@@ -0,0 +1,135 @@
+/* SHA1 rsync-style block signature and delta header file */
+
+#include "sha1.h"
+#include "sha1_output.h"
+
+#ifndef _SHA1_DELTA_H_
+#define _SHA1_DELTA_H_
+
+/*
+ * The two halves of rsync's algorithm, as streaming stages.
+ *
+ * Signature: the old file is cut into blocks of block_size bytes (the
+ * last one may be shorter) and every block gets rsync's weak rolling
+ * checksum and its SHA-1. Blocks are independent messages, so a chunk
+ * of them at a time is submitted to the multi-buffer job manager
+ * (sha1_mb.h) and hashed in its SIMD lanes. The signature is written as
+ * it is produced:
+ *
+ *   "SHA1SIG\0", version and block_size (u32 each),
+ *   per block: weak (u32) and SHA-1 (20 bytes),
+ *   the old file's size (u64),
+ *
+ * all little-endian, so it can travel between machines.
+ *
+ * Delta: the new file is read through a buffer once, with the weak
+ * checksum of a block_size window rolled one byte at a time. Only when
+ * the weak checksum is found in the signature is the window's SHA-1
+ * computed, and a block is matched only if that agrees too; the window
+ * then jumps past the block. The result is a sequence of operations,
+ * copies of runs of old blocks and literal new bytes, that rebuild the
+ * new file from the old one.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_DELTA_MAGIC     "SHA1SIG"      /* with its NUL, 8 bytes */
+#define SHA1_DELTA_VERSION   1
+#define SHA1_DELTA_BLOCK     2048           /* default block size */
+#define SHA1_DELTA_MAX_BLOCK (1u << 24)
+#define SHA1_DELTA_CHUNK     (1024 * 1024)  /* bytes read at a time */
+
+typedef struct SHA1_Signature {
+    uint32_t block_size;
+    uint64_t file_size;
+    uint32_t n_blocks;
+    uint32_t *weak;
+    SHA1_DIGEST_t *strong;
+
+    /*
+     * Blocks by weak checksum: chains of block index + 1, 0 ends
+     */
+    uint32_t *head;
+    uint32_t *next;
+    uint32_t mask;
+} SHA1_Signature_t, *SHA1_Signature_p_t;
+
+typedef enum _sha1_delta_op
+{
+    SHA1_DELTA_COPY = 0,     /* length bytes of old blocks from block on */
+    SHA1_DELTA_LITERAL       /* length new bytes at data */
+} SHA1_DELTA_OP;
+
+typedef struct SHA1_DeltaOp {
+    int type;                /* SHA1_DELTA_OP */
+    uint64_t offset;         /* where the bytes go in the new file */
+    uint64_t length;
+    uint64_t block;          /* copies: first old block */
+    const uint8_t *data;     /* literals: valid during the callback only */
+} SHA1_DeltaOp_t, *SHA1_DeltaOp_p_t;
+
+/*
+ * Called with the operations in order; anything but SHA1_SUCCESS stops
+ * the delta with that error
+ */
+typedef SHA1_ERRCODE (*SHA1_delta_fn_t)(void *arg, const SHA1_DeltaOp_t *op_p);
+
+typedef struct SHA1_DeltaResult {
+    uint64_t bytes;          /* new file size */
+    uint64_t bytes_copied;   /* covered by old blocks */
+    uint64_t n_copies;       /* copy operations */
+    uint64_t n_weak_hits;    /* windows whose weak checksum was in the signature */
+    uint64_t n_false_hits;   /* of which the SHA-1 did not match */
+} SHA1_DeltaResult_t, *SHA1_DeltaResult_p_t;
+
+/*
+ * WEAK CHECKSUM
+ * rsync's rolling checksum of len bytes: s1 = sum of the bytes, s2 =
+ * sum of the running s1, each mod 2^16, as s1 | s2 << 16.
+ */
+uint32_t SHA1_weak_checksum(const uint8_t *data, size_t len);
+
+/*
+ * SIGNATURE WRITE
+ * Read fd to end of file and write its signature to writer_p as it
+ * goes (the caller flushes).
+ *
+ * Returns
+ *  SHA1_SUCCESS; SHA1_BAD_INPUT for a block size of 0 or over
+ *  SHA1_DELTA_MAX_BLOCK, or a file of 2^32 - 1 blocks or more;
+ *  SHA1_IO_ERROR (errno set) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_signature_write(int fd, uint32_t block_size, SHA1_Writer_p_t writer_p,
+                                  uint64_t *n_blocks_p);
+
+/*
+ * SIGNATURE READ
+ * Load a signature written by SHA1_signature_write and index it.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_BAD_INPUT if it is malformed, SHA1_IO_ERROR
+ *  (errno set) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_signature_read(int fd, SHA1_Signature_p_t sig_p);
+
+/*
+ * SIGNATURE FREE
+ */
+void SHA1_signature_free(SHA1_Signature_p_t sig_p);
+
+/*
+ * DELTA MATCH
+ * Read fd to end of file and pass emit the operations that rebuild it
+ * from the file sig_p describes. Adjacent old blocks are merged into
+ * one copy; a long literal may come in several pieces, each under
+ * SHA1_DELTA_CHUNK plus two blocks.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_ALLOC_ERROR or the
+ *  error returned by emit
+ */
+SHA1_ERRCODE SHA1_delta_match(int fd, const SHA1_Signature_t *sig_p, SHA1_delta_fn_t emit,
+                              void *arg, SHA1_DeltaResult_p_t result_p);
+
+#endif /* _SHA1_DELTA_H_ */
@@ -0,0 +1,421 @@
+/*
+ * Hashing of files and file descriptors
+ */
+
+#define _GNU_SOURCE
+#include "sha1_file.h"
+#include "sha1_alg.h"
+#include "sha1_pipe.h"
+#include "sha1_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Nonzero while holes are skipped; see SHA1_file_set_sparse
+ */
+static int sha1_file_sparse = 0;
+
+void SHA1_file_set_sparse(int enable)
+{
+    sha1_file_sparse = enable;
+}
+
+/*
+ * Nonzero while files go through AF_ALG; see SHA1_file_set_afalg
+ */
+static int sha1_file_afalg = 0;
+
+void SHA1_file_set_afalg(int enable)
+{
+    sha1_file_afalg = enable;
+}
+
+/*
+ * Read fd to end of file, compressing out of buf
+ */
+static SHA1_ERRCODE hash_fd_dense(int fd, uint8_t *buf, size_t buf_size, SHA1_DIGEST_t digest)
+{
+    SHA1_SHA1Object_t sha1;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    uint64_t msg_length = 0; /* total bytes read */
+    size_t have = 0;         /* bytes waiting in buf */
+    int collision = 0;       /* a block was flagged by collision detection */
+    SHA1_STATS_TIMER(start);
+    SHA1_STATS_TIMER(phase); /* start of the current read or compress */
+
+    SHA1_init_hash(&sha1);
+
+    for (;;)
+    {
+        size_t n_blocks;
+        ssize_t n = read(fd, buf + have, buf_size - have);
+
+        SHA1_STATS_ELAPSED(phase, io_ns);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            err = SHA1_IO_ERROR;
+            break;
+        }
+        if (n == 0)
+        {
+            err = SHA1_process_final(&sha1, buf, have, msg_length);
+            SHA1_STATS_ELAPSED(phase, compress_ns);
+            break;
+        }
+
+        msg_length += (uint64_t)n;
+        have += (size_t)n;
+
+        /*
+         * Compress the whole blocks in place, keep the (< 64 byte) rest
+         * at the front of the buffer for the next read
+         */
+        n_blocks = have / SHA1_BLOCK_SIZE;
+        if (SHA1_process_blocks(sha1.temp_hash, buf, n_blocks) == SHA1_COLLISION_DETECTED)
+        {
+            collision = 1;
+        }
+        if (have % SHA1_BLOCK_SIZE)
+        {
+            memmove(buf, buf + n_blocks * SHA1_BLOCK_SIZE, have % SHA1_BLOCK_SIZE);
+        }
+        have %= SHA1_BLOCK_SIZE;
+        SHA1_STATS_ELAPSED(phase, compress_ns);
+    }
+
+    if (err == SHA1_SUCCESS && collision)
+    {
+        err = SHA1_COLLISION_DETECTED;
+    }
+    if (err == SHA1_SUCCESS || err == SHA1_COLLISION_DETECTED)
+    {
+        SHA1_get_digest(&sha1, digest);
+    }
+#if SHA1_STATS
+    if (SHA1_STATS_ON())
+    {
+        SHA1_stats_record_message(msg_length, SHA1_stats_now() - start);
+    }
+#endif
+    return err;
+}
+
+/*
+ * SPARSE HASHING
+ *
+ * The file is walked with SEEK_DATA/SEEK_HOLE: data extents are read
+ * with pread(2) and compressed as usual, holes are fed to the zero-block
+ * kernel without any I/O. Filesystem holes start and end on block
+ * boundaries, so apart from a partial block left over from the extent
+ * before, a hole is whole 64-byte blocks.
+ */
+typedef struct sparse_state {
+    SHA1_SHA1Object_t sha1;
+    uint8_t *buf;
+    size_t buf_size;
+    size_t have;                 /* bytes of a partial block at buf */
+    uint64_t msg_length;
+    int collision;
+} sparse_state_t;
+
+static void sparse_blocks(sparse_state_t *state_p)
+{
+    size_t n_blocks = state_p->have / SHA1_BLOCK_SIZE;
+
+    if (SHA1_process_blocks(state_p->sha1.temp_hash, state_p->buf, n_blocks) ==
+        SHA1_COLLISION_DETECTED)
+    {
+        state_p->collision = 1;
+    }
+    if (state_p->have % SHA1_BLOCK_SIZE)
+    {
+        memmove(state_p->buf, state_p->buf + n_blocks * SHA1_BLOCK_SIZE,
+                state_p->have % SHA1_BLOCK_SIZE);
+    }
+    state_p->have %= SHA1_BLOCK_SIZE;
+}
+
+static void sparse_zeros(sparse_state_t *state_p, uint64_t len)
+{
+    size_t fill;
+    SHA1_STATS_TIMER(phase);
+
+    state_p->msg_length += len;
+
+    /*
+     * Complete the partial block first, then the whole zero blocks, and
+     * leave the rest as a partial block of zeros
+     */
+    if (state_p->have > 0)
+    {
+        fill = SHA1_BLOCK_SIZE - state_p->have;
+        if (fill > len)
+        {
+            fill = (size_t)len;
+        }
+        memset(state_p->buf + state_p->have, 0, fill);
+        state_p->have += fill;
+        len -= fill;
+        if (state_p->have < SHA1_BLOCK_SIZE)
+        {
+            SHA1_STATS_ELAPSED(phase, compress_ns);
+            return;
+        }
+        sparse_blocks(state_p);
+    }
+    if (SHA1_process_zero_blocks(state_p->sha1.temp_hash, len / SHA1_BLOCK_SIZE) ==
+        SHA1_COLLISION_DETECTED)
+    {
+        state_p->collision = 1;
+    }
+    state_p->have = (size_t)(len % SHA1_BLOCK_SIZE);
+    memset(state_p->buf, 0, state_p->have);
+    SHA1_STATS_ELAPSED(phase, compress_ns);
+}
+
+/*
+ * Read [offset, end) into the buffer and compress it; stops early at end
+ * of file, setting *eof_p
+ */
+static SHA1_ERRCODE sparse_data(sparse_state_t *state_p, int fd, off_t offset, off_t end,
+                                int *eof_p)
+{
+    SHA1_STATS_TIMER(phase);
+
+    while (offset < end)
+    {
+        size_t want = state_p->buf_size - state_p->have;
+        ssize_t n;
+
+        if ((uint64_t)(end - offset) < want)
+        {
+            want = (size_t)(end - offset);
+        }
+        n = pread(fd, state_p->buf + state_p->have, want, offset);
+        SHA1_STATS_ELAPSED(phase, io_ns);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return SHA1_IO_ERROR;
+        }
+        if (n == 0)
+        {
+            *eof_p = 1; /* truncated under us */
+            break;
+        }
+
+        offset += n;
+        state_p->msg_length += (uint64_t)n;
+        state_p->have += (size_t)n;
+        sparse_blocks(state_p);
+        SHA1_STATS_ELAPSED(phase, compress_ns);
+    }
+    return SHA1_SUCCESS;
+}
+
+static SHA1_ERRCODE hash_fd_sparse(int fd, off_t offset, off_t size, uint8_t *buf,
+                                   size_t buf_size, SHA1_DIGEST_t digest)
+{
+    sparse_state_t state;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int eof = 0;
+    SHA1_STATS_TIMER(start);
+
+    memset(&state, 0, sizeof(state));
+    state.buf = buf;
+    state.buf_size = buf_size;
+    SHA1_init_hash(&state.sha1);
+
+    while (offset < size && !eof)
+    {
+        off_t data = lseek(fd, offset, SEEK_DATA);
+        off_t hole;
+
+        if (data < 0)
+        {
+            if (errno != ENXIO)
+            {
+                err = SHA1_IO_ERROR;
+                break;
+            }
+            data = size; /* nothing but a hole up to the end */
+        }
+        if (data > size)
+        {
+            data = size;
+        }
+        if (data > offset)
+        {
+            sparse_zeros(&state, (uint64_t)(data - offset));
+        }
+        if (data >= size)
+        {
+            break;
+        }
+
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0 || hole > size)
+        {
+            hole = size;
+        }
+        err = sparse_data(&state, fd, data, hole, &eof);
+        if (err != SHA1_SUCCESS)
+        {
+            break;
+        }
+        offset = hole;
+    }
+
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_process_final(&state.sha1, state.buf, state.have, state.msg_length);
+    }
+    if (err == SHA1_SUCCESS && state.collision)
+    {
+        err = SHA1_COLLISION_DETECTED;
+    }
+    if (err == SHA1_SUCCESS || err == SHA1_COLLISION_DETECTED)
+    {
+        SHA1_get_digest(&state.sha1, digest);
+    }
+#if SHA1_STATS
+    if (SHA1_STATS_ON())
+    {
+        SHA1_stats_record_message(state.msg_length, SHA1_stats_now() - start);
+    }
+#endif
+    return err;
+}
+
+/*
+ * Only regular files with fewer blocks allocated than their size implies
+ * have holes worth looking for, and only where SEEK_DATA works (ENXIO:
+ * nothing but hole from offset on)
+ */
+static int has_holes(int fd, off_t *offset_p, off_t *size_p)
+{
+    struct stat st;
+    off_t offset;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (uint64_t)st.st_blocks * 512 >= (uint64_t)st.st_size)
+    {
+        return 0;
+    }
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || (lseek(fd, offset, SEEK_DATA) < 0 && errno != ENXIO))
+    {
+        return 0;
+    }
+    *offset_p = offset;
+    *size_p = st.st_size;
+    return 1;
+}
+
+/*
+ * Pipes and sockets have no size and no end until the writer is done:
+ * they are read on a thread of their own (sha1_pipe.h)
+ */
+static int is_stream(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+SHA1_ERRCODE SHA1_hash_fd_buffered(int fd, uint8_t *buf, size_t buf_size,
+                                   SHA1_DIGEST_t digest)
+{
+    off_t offset, size;
+
+    if (buf_size < SHA1_BLOCK_SIZE)
+    {
+        return SHA1_BAD_INPUT;
+    }
+    if (sha1_file_sparse && has_holes(fd, &offset, &size))
+    {
+        return hash_fd_sparse(fd, offset, size, buf, buf_size, digest);
+    }
+    if (sha1_file_afalg && !SHA1_get_collision_detection())
+    {
+        SHA1_ERRCODE err = SHA1_alg_hash_fd(fd, digest);
+
+        if (err != SHA1_GENERIC_ERROR)
+        {
+            return err;
+        }
+    }
+    if (is_stream(fd))
+    {
+        return SHA1_hash_pipe(fd, digest);
+    }
+    return hash_fd_dense(fd, buf, buf_size, digest);
+}
+
+SHA1_ERRCODE SHA1_hash_fd(int fd, SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err;
+    uint8_t *buf = NULL;
+    int saved_errno;
+
+    /*
+     * Page-aligned so reads land on whole pages
+     */
+    if (posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+
+    err = SHA1_hash_fd_buffered(fd, buf, SHA1_FILE_CHUNK, digest);
+
+    saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+
+    return err;
+}
+
+SHA1_ERRCODE SHA1_hash_file(const char *path, SHA1_DIGEST_t digest)
+{
+    return SHA1_hash_file_buffered(path, NULL, 0, digest);
+}
+
+SHA1_ERRCODE SHA1_hash_file_buffered(const char *path, uint8_t *buf, size_t buf_size,
+                                     SHA1_DIGEST_t digest)
+{
+    SHA1_ERRCODE err;
+    int saved_errno;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (buf != NULL)
+    {
+        err = SHA1_hash_fd_buffered(fd, buf, buf_size, digest);
+    }
+    else
+    {
+        err = SHA1_hash_fd(fd, digest);
+    }
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    return err;
+}
@@ -0,0 +1,82 @@
+/* SHA1 file hashing header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_FILE_H_
+#define _SHA1_FILE_H_
+
+/*
+ * Hash whole files of any size. Data is read in large chunks and every
+ * whole block is compressed directly out of the read buffer (see
+ * SHA1_process_blocks); only the final partial block is copied.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_FILE_CHUNK (256 * 1024) /* bytes per read(2) */
+
+/*
+ * SET SPARSE
+ * While enabled, regular files with holes are hashed extent by extent
+ * (SEEK_DATA/SEEK_HOLE): holes are never read, but compressed as zero
+ * blocks from a precomputed schedule (SHA1_process_zero_blocks). The
+ * digest is the same either way. Files without holes, and filesystems
+ * that cannot report them, are read as usual. Off by default; a
+ * process-wide setting, like collision detection.
+ */
+void SHA1_file_set_sparse(int enable);
+
+/*
+ * SET AFALG
+ * While enabled, files are hashed by the Linux kernel's sha1 through
+ * AF_ALG, spliced in without a copy to user space (sha1_alg.h), rather
+ * than by the in-process kernels. Sparse files with holes (see
+ * SHA1_file_set_sparse), collision detection, and descriptors that
+ * cannot be spliced stay in process, as does everything when AF_ALG is
+ * not available. Off by default; process-wide.
+ */
+void SHA1_file_set_afalg(int enable);
+
+/*
+ * HASH FD
+ * Hash everything readable from fd, up to end of file. Pipes and
+ * sockets are streamed through SHA1_hash_pipe (sha1_pipe.h), with the
+ * reading on a second thread; AF_ALG, when enabled, takes them first.
+ *
+ * Parameters
+ *  fd: open file descriptor
+ *  digest: output digest
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_hash_fd(int fd, SHA1_DIGEST_t digest);
+
+/*
+ * HASH FD BUFFERED
+ * As SHA1_hash_fd, but reads into the caller's buf (at least 64 bytes;
+ * ideally page-aligned and SHA1_FILE_CHUNK long) instead of allocating
+ * one. Meant for workers that hash many files back to back.
+ */
+SHA1_ERRCODE SHA1_hash_fd_buffered(int fd, uint8_t *buf, size_t buf_size,
+                                   SHA1_DIGEST_t digest);
+
+/*
+ * HASH FILE
+ * Open path read-only and hash its contents.
+ *
+ * Returns
+ *  as SHA1_hash_fd; SHA1_IO_ERROR with errno set if the open failed
+ */
+SHA1_ERRCODE SHA1_hash_file(const char *path, SHA1_DIGEST_t digest);
+
+/*
+ * HASH FILE BUFFERED
+ * As SHA1_hash_file, reading through the caller's buf (see
+ * SHA1_hash_fd_buffered). A NULL buf falls back to SHA1_hash_file.
+ */
+SHA1_ERRCODE SHA1_hash_file_buffered(const char *path, uint8_t *buf, size_t buf_size,
+                                     SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_FILE_H_ */
@@ -0,0 +1,195 @@
+/*
+ * Hex encoding and decoding of SHA1 digests
+ */
+
+#include "sha1_hex.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_HEX_X86 1
+#endif
+
+static const char hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+/*
+ * Value of a hex character, -1 for anything else
+ */
+static int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+
+    c |= 0x20; /* fold 'A'-'F' onto 'a'-'f' */
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+/*
+ * SCALAR VERSIONS
+ */
+static void digest_to_hex_scalar(const SHA1_DIGEST_t digest, char *hex)
+{
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+    {
+        hex[i * 2]     = hex_digits[digest[i] >> 4];
+        hex[i * 2 + 1] = hex_digits[digest[i] & 0xF];
+    }
+}
+
+static SHA1_ERRCODE hex_to_digest_scalar(const char *hex, SHA1_DIGEST_t digest)
+{
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+    {
+        int hi = hex_value((unsigned char)hex[i * 2]);
+        int lo = hex_value((unsigned char)hex[i * 2 + 1]);
+
+        if ((hi | lo) < 0)
+        {
+            return SHA1_BAD_INPUT;
+        }
+        digest[i] = (uint8_t)(hi << 4 | lo);
+    }
+
+    return SHA1_SUCCESS;
+}
+
+#ifdef SHA1_HEX_X86
+
+/*
+ * SSSE3 VERSIONS
+ *
+ * Encoding splits every byte into its two nibbles, looks both up in a
+ * 16-entry table with PSHUFB and interleaves them back in order. 16
+ * digest bytes go through one register; the last 4 go through a second.
+ *
+ * Decoding classifies 16 characters at once as digit / letter, computes
+ * their nibble values, and joins adjacent nibbles with PMADDUBSW
+ * (hi * 16 + lo). The 40 characters are covered by three overlapping
+ * 16-character loads at offsets 0, 16 and 24.
+ */
+__attribute__((target("ssse3")))
+static __m128i hex_encode_16(__m128i bytes, __m128i *high_half)
+{
+    const __m128i lut  = _mm_loadu_si128((const __m128i *)hex_digits);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i lo = _mm_and_si128(bytes, mask);
+
+    hi = _mm_shuffle_epi8(lut, hi);
+    lo = _mm_shuffle_epi8(lut, lo);
+
+    *high_half = _mm_unpackhi_epi8(hi, lo);
+    return _mm_unpacklo_epi8(hi, lo);
+}
+
+__attribute__((target("ssse3")))
+static void digest_to_hex_ssse3(const SHA1_DIGEST_t digest, char *hex)
+{
+    __m128i first, second, tail_hi;
+    uint32_t tail;
+
+    first = hex_encode_16(_mm_loadu_si128((const __m128i *)digest), &second);
+    _mm_storeu_si128((__m128i *)hex, first);
+    _mm_storeu_si128((__m128i *)(hex + 16), second);
+
+    memcpy(&tail, digest + 16, sizeof(tail));
+    first = hex_encode_16(_mm_cvtsi32_si128((int)tail), &tail_hi);
+    _mm_storel_epi64((__m128i *)(hex + 32), first);
+}
+
+__attribute__((target("ssse3")))
+static int hex_decode_16(const char *hex, uint8_t *out)
+{
+    const __m128i chars  = _mm_loadu_si128((const __m128i *)hex);
+    const __m128i nine   = _mm_set1_epi8(9);
+    const __m128i five   = _mm_set1_epi8(5);
+    const __m128i ten    = _mm_set1_epi8(10);
+    const __m128i weight = _mm_set1_epi16(0x0110); /* bytes {16, 1} */
+    __m128i digit, alpha, is_digit, is_alpha, value;
+
+    /* unsigned range checks: x <= n  <=>  min(x, n) == x */
+    digit    = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+    alpha    = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)),
+                            _mm_set1_epi8('a'));
+    is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, five), alpha);
+
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xFFFF)
+    {
+        return 0;
+    }
+
+    value = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                         _mm_andnot_si128(is_digit, _mm_add_epi8(alpha, ten)));
+    value = _mm_maddubs_epi16(value, weight);
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(value, value));
+
+    return 1;
+}
+
+__attribute__((target("ssse3")))
+static SHA1_ERRCODE hex_to_digest_ssse3(const char *hex, SHA1_DIGEST_t digest)
+{
+    if (!hex_decode_16(hex, digest) ||
+        !hex_decode_16(hex + 16, digest + 8) ||
+        !hex_decode_16(hex + 24, digest + 12))
+    {
+        return SHA1_BAD_INPUT;
+    }
+
+    return SHA1_SUCCESS;
+}
+
+#endif /* SHA1_HEX_X86 */
+
+/*
+ * DISPATCH
+ */
+static int have_ssse3(void)
+{
+#ifdef SHA1_HEX_X86
+    static int cached = -1;
+
+    if (cached < 0)
+    {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+void SHA1_digest_to_hex(const SHA1_DIGEST_t digest, char *hex)
+{
+#ifdef SHA1_HEX_X86
+    if (have_ssse3())
+    {
+        digest_to_hex_ssse3(digest, hex);
+        return;
+    }
+#endif
+    digest_to_hex_scalar(digest, hex);
+}
+
+SHA1_ERRCODE SHA1_hex_to_digest(const char *hex, SHA1_DIGEST_t digest)
+{
+#ifdef SHA1_HEX_X86
+    if (have_ssse3())
+    {
+        return hex_to_digest_ssse3(hex, digest);
+    }
+#endif
+    return hex_to_digest_scalar(hex, digest);
+}
@@ -0,0 +1,48 @@
+/* SHA1 hex encoding header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_HEX_H_
+#define _SHA1_HEX_H_
+
+/*
+ * Conversion between the 20-byte digest and its 40-character hex form.
+ *
+ * Both directions have a scalar table-driven version and an SSSE3
+ * version; the SSSE3 version is selected at run time when the CPU
+ * supports it. Neither direction NUL-terminates or expects a NUL, so
+ * both can work in place inside larger buffers (output lines, mapped
+ * manifests).
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_HEX_SIZE 40 /* characters per hex digest */
+
+/*
+ * DIGEST TO HEX
+ * Write the 40 lower-case hex characters for digest to hex. hex is not
+ * NUL-terminated.
+ *
+ * Parameters
+ *  digest: 20-byte digest
+ *  hex: output, at least 40 bytes
+ */
+void SHA1_digest_to_hex(const SHA1_DIGEST_t digest, char *hex);
+
+/*
+ * HEX TO DIGEST
+ * Parse exactly 40 hex characters (either case) into a 20-byte digest.
+ * Characters past the 40th are not read.
+ *
+ * Parameters
+ *  hex: pointer to 40 hex characters
+ *  digest: output digest
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_BAD_INPUT if any character is not a hex digit
+ */
+SHA1_ERRCODE SHA1_hex_to_digest(const char *hex, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_HEX_H_ */
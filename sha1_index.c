@@ -0,0 +1,537 @@
+/*
+ * Sorted, mmap-able digest index with fan-out table and Bloom filter
+ */
+
+#define _GNU_SOURCE
+#include "sha1_index.h"
+#include "sha1_hex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_HEADER_SIZE  64
+#define INDEX_FANOUT_SIZE  (256 * 4)
+#define BLOOM_BLOCK_BITS   512
+#define BLOOM_MAX_K        16
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+/*
+ * BLOOM FILTER
+ *
+ * Digest bytes 4..11 pick the block, bytes 12..19 give the two halves of
+ * a double hash for the k bit positions inside it; byte 0 is left to
+ * the fan-out.
+ */
+
+static const uint8_t *bloom_block(const uint8_t *bloom, uint64_t n_blocks, const SHA1_DIGEST_t digest)
+{
+    uint64_t h = get_le64(digest + 4);
+
+    return bloom + (uint64_t)(((unsigned __int128)h * n_blocks) >> 64) * (BLOOM_BLOCK_BITS / 8);
+}
+
+static void bloom_add(uint8_t *bloom, uint64_t n_blocks, uint32_t k, const SHA1_DIGEST_t digest)
+{
+    uint8_t *block = (uint8_t *)bloom_block(bloom, n_blocks, digest);
+    uint32_t h1 = get_le32(digest + 12);
+    uint32_t h2 = get_le32(digest + 16) | 1;
+
+    for (uint32_t i = 0; i < k; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+
+        block[bit / 8] |= (uint8_t)(1u << (bit % 8));
+    }
+}
+
+static int bloom_test(const uint8_t *bloom, uint64_t n_blocks, uint32_t k, const SHA1_DIGEST_t digest)
+{
+    const uint8_t *block = bloom_block(bloom, n_blocks, digest);
+    uint32_t h1 = get_le32(digest + 12);
+    uint32_t h2 = get_le32(digest + 16) | 1;
+
+    for (uint32_t i = 0; i < k; i++)
+    {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+
+        if (!(block[bit / 8] & (1u << (bit % 8))))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * READING LISTS
+ */
+
+/*
+ * INDEX READ LIST
+ */
+SHA1_ERRCODE SHA1_index_read_list(const char *path, SHA1_DIGEST_t **digests_p, size_t *count_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    const char *map, *p, *end;
+    size_t cap = *count_p;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return SHA1_IO_ERROR;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return SHA1_SUCCESS;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return SHA1_IO_ERROR;
+    }
+    madvise((void *)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    end = map + st.st_size;
+    for (p = map; p < end; )
+    {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        const char *q = p;
+
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+
+        /* a quoted CSV field, or sha1sum's escaped-name marker */
+        if (q < eol && (*q == '"' || *q == '\\'))
+        {
+            q++;
+        }
+        /*
+         * The digest must end there too: a longer hex string, such as a
+         * SHA-256, is no SHA-1 with something after it
+         */
+        if (eol - q >= SHA1_HEX_SIZE &&
+            (eol - q == SHA1_HEX_SIZE || memchr(" \t\",\r", q[SHA1_HEX_SIZE], 5) != NULL))
+        {
+            SHA1_DIGEST_t digest;
+
+            if (SHA1_hex_to_digest(q, digest) == SHA1_SUCCESS)
+            {
+                if (*count_p == cap)
+                {
+                    SHA1_DIGEST_t *grown;
+
+                    cap = cap ? cap * 2 : 4096;
+                    grown = realloc(*digests_p, cap * sizeof(SHA1_DIGEST_t));
+                    if (grown == NULL)
+                    {
+                        err = SHA1_ALLOC_ERROR;
+                        break;
+                    }
+                    *digests_p = grown;
+                }
+                memcpy((*digests_p)[(*count_p)++], digest, SHA1_DIGEST_SIZE);
+            }
+        }
+        p = eol + 1;
+    }
+
+    munmap((void *)map, (size_t)st.st_size);
+    return err;
+}
+
+/*
+ * BUILDING
+ */
+
+static int digest_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, SHA1_DIGEST_SIZE);
+}
+
+/*
+ * Sort digests: one counting-sort pass on the first two bytes, which
+ * leaves buckets of a few thousand even for hundreds of millions of
+ * digests, then qsort per bucket. Returns the number of unique digests,
+ * which are left at the front of digests.
+ */
+static size_t sort_unique(SHA1_DIGEST_t *digests, size_t count)
+{
+    size_t *start = calloc(65536 + 1, sizeof(size_t));
+    SHA1_DIGEST_t *sorted = malloc(count * sizeof(SHA1_DIGEST_t));
+    size_t n_unique = 0;
+
+    if (start == NULL || sorted == NULL)
+    {
+        /* not enough memory for the radix pass: qsort everything */
+        free(start);
+        free(sorted);
+        qsort(digests, count, sizeof(SHA1_DIGEST_t), digest_cmp);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            start[(digests[i][0] << 8 | digests[i][1]) + 1]++;
+        }
+        for (size_t b = 0; b < 65536; b++)
+        {
+            start[b + 1] += start[b];
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(sorted[start[digests[i][0] << 8 | digests[i][1]]++], digests[i], SHA1_DIGEST_SIZE);
+        }
+        /* start[b] is now the end of bucket b */
+        for (size_t b = 0, lo = 0; b < 65536; lo = start[b++])
+        {
+            qsort(sorted + lo, start[b] - lo, sizeof(SHA1_DIGEST_t), digest_cmp);
+        }
+        memcpy(digests, sorted, count * sizeof(SHA1_DIGEST_t));
+        free(sorted);
+        free(start);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (n_unique == 0 || memcmp(digests[n_unique - 1], digests[i], SHA1_DIGEST_SIZE) != 0)
+        {
+            memmove(digests[n_unique++], digests[i], SHA1_DIGEST_SIZE);
+        }
+    }
+    return n_unique;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * INDEX BUILD
+ */
+SHA1_ERRCODE SHA1_index_build(const char *path, SHA1_DIGEST_t *digests, size_t count,
+                              unsigned bloom_bits)
+{
+    uint8_t header[INDEX_HEADER_SIZE] = { 0 };
+    uint8_t fanout[INDEX_FANOUT_SIZE];
+    uint64_t bloom_blocks = 0;
+    uint32_t bloom_k = 0;
+    uint8_t *bloom = NULL;
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path;
+    int saved_errno;
+    int ok;
+    int fd;
+
+    count = sort_unique(digests, count);
+    if (count > UINT32_MAX)
+    {
+        return SHA1_BAD_INPUT;
+    }
+
+    if (bloom_bits > 0 && count > 0)
+    {
+        bloom_blocks = ((uint64_t)count * bloom_bits + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+        bloom_k = (bloom_bits * 693 + 500) / 1000; /* bits * ln 2 */
+        bloom_k = bloom_k < 1 ? 1 : bloom_k > BLOOM_MAX_K ? BLOOM_MAX_K : bloom_k;
+        bloom = calloc(bloom_blocks, BLOOM_BLOCK_BITS / 8);
+        if (bloom == NULL)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            bloom_add(bloom, bloom_blocks, bloom_k, digests[i]);
+        }
+    }
+
+    memcpy(header, SHA1_INDEX_MAGIC, sizeof(SHA1_INDEX_MAGIC));
+    put_le32(header + 8, SHA1_INDEX_VERSION);
+    put_le32(header + 12, bloom_k);
+    put_le64(header + 16, count);
+    put_le64(header + 24, bloom_blocks);
+
+    for (unsigned b = 0, i = 0; b < 256; b++)
+    {
+        while (i < count && digests[i][0] == b)
+        {
+            i++;
+        }
+        put_le32(fanout + 4 * b, i);
+    }
+
+    tmp_path = malloc(tmp_len);
+    if (tmp_path == NULL)
+    {
+        free(bloom);
+        return SHA1_ALLOC_ERROR;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ok = fd >= 0 &&
+         write_all(fd, header, sizeof(header)) == 0 &&
+         write_all(fd, bloom, bloom_blocks * (BLOOM_BLOCK_BITS / 8)) == 0 &&
+         write_all(fd, fanout, sizeof(fanout)) == 0 &&
+         write_all(fd, digests, count * sizeof(SHA1_DIGEST_t)) == 0;
+    if (fd >= 0 && close(fd) < 0)
+    {
+        ok = 0;
+    }
+    if (ok && rename(tmp_path, path) < 0)
+    {
+        ok = 0;
+    }
+    if (!ok)
+    {
+        saved_errno = errno;
+        if (fd >= 0)
+        {
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        free(bloom);
+        errno = saved_errno;
+        return SHA1_IO_ERROR;
+    }
+
+    free(tmp_path);
+    free(bloom);
+    return SHA1_SUCCESS;
+}
+
+/*
+ * LOOKUP
+ */
+
+/*
+ * INDEX OPEN
+ */
+SHA1_ERRCODE SHA1_index_open(const char *path, SHA1_Index_p_t index_p)
+{
+    const uint8_t *map;
+    uint64_t bloom_bytes, need;
+    struct stat st;
+    int fd;
+
+    memset(index_p, 0, sizeof(*index_p));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return SHA1_IO_ERROR;
+    }
+    if ((uint64_t)st.st_size < INDEX_HEADER_SIZE + INDEX_FANOUT_SIZE)
+    {
+        close(fd);
+        return SHA1_BAD_INPUT;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return SHA1_IO_ERROR;
+    }
+
+    index_p->map = map;
+    index_p->map_size = (size_t)st.st_size;
+    index_p->bloom_k = get_le32(map + 12);
+    index_p->count = get_le64(map + 16);
+    index_p->bloom_blocks = get_le64(map + 24);
+
+    bloom_bytes = index_p->bloom_blocks * (BLOOM_BLOCK_BITS / 8);
+    need = INDEX_HEADER_SIZE + bloom_bytes + INDEX_FANOUT_SIZE + index_p->count * SHA1_DIGEST_SIZE;
+    if (memcmp(map, SHA1_INDEX_MAGIC, sizeof(SHA1_INDEX_MAGIC)) != 0 ||
+        get_le32(map + 8) != SHA1_INDEX_VERSION ||
+        index_p->count > UINT32_MAX ||
+        index_p->bloom_blocks > (uint64_t)st.st_size / (BLOOM_BLOCK_BITS / 8) ||
+        index_p->bloom_k > BLOOM_MAX_K ||
+        (index_p->bloom_k == 0) != (index_p->bloom_blocks == 0) ||
+        need != (uint64_t)st.st_size)
+    {
+        SHA1_index_close(index_p);
+        return SHA1_BAD_INPUT;
+    }
+
+    if (index_p->bloom_blocks > 0)
+    {
+        index_p->bloom = map + INDEX_HEADER_SIZE;
+    }
+    for (int b = 0; b < 256; b++)
+    {
+        index_p->fanout[b] = get_le32(map + INDEX_HEADER_SIZE + bloom_bytes + 4 * b);
+        if (index_p->fanout[b] > index_p->count || (b > 0 && index_p->fanout[b] < index_p->fanout[b - 1]))
+        {
+            SHA1_index_close(index_p);
+            return SHA1_BAD_INPUT;
+        }
+    }
+    index_p->digests = map + INDEX_HEADER_SIZE + bloom_bytes + INDEX_FANOUT_SIZE;
+
+    /* lookups land on random pages: no read-ahead */
+    madvise((void *)map, index_p->map_size, MADV_RANDOM);
+
+    return SHA1_SUCCESS;
+}
+
+/*
+ * INDEX CLOSE
+ */
+void SHA1_index_close(SHA1_Index_p_t index_p)
+{
+    if (index_p->map != NULL)
+    {
+        munmap((void *)index_p->map, index_p->map_size);
+    }
+    memset(index_p, 0, sizeof(*index_p));
+}
+
+/*
+ * Digest bytes 1..8 as a big-endian number: within one fan-out bucket
+ * the digests are sorted by it
+ */
+static uint64_t interp_key(const uint8_t *digest)
+{
+    uint64_t key = 0;
+
+    for (int i = 1; i <= 8; i++)
+    {
+        key = key << 8 | digest[i];
+    }
+    return key;
+}
+
+/*
+ * INDEX CONTAINS
+ */
+int SHA1_index_contains(const SHA1_Index_t *index_p, const SHA1_DIGEST_t digest)
+{
+    uint64_t key = interp_key(digest);
+    size_t lo, hi;
+
+    if (index_p->bloom != NULL &&
+        !bloom_test(index_p->bloom, index_p->bloom_blocks, index_p->bloom_k, digest))
+    {
+        return 0;
+    }
+
+    lo = digest[0] == 0 ? 0 : index_p->fanout[digest[0] - 1];
+    hi = index_p->fanout[digest[0]];
+
+    /*
+     * The digests are uniform, so interpolation lands within a few
+     * entries of the target in one or two probes, where binary search
+     * would take ~log2(count / 256) probes on as many cache lines. A few
+     * probes at most, so a skewed index degrades to binary search.
+     */
+    for (int probe = 0; hi - lo > 8 && probe < 4; probe++)
+    {
+        const uint8_t *first = index_p->digests + lo * SHA1_DIGEST_SIZE;
+        const uint8_t *last = index_p->digests + (hi - 1) * SHA1_DIGEST_SIZE;
+        uint64_t k_lo = interp_key(first);
+        uint64_t k_hi = interp_key(last);
+        size_t mid;
+        int c;
+
+        if (key < k_lo || key > k_hi)
+        {
+            return 0;
+        }
+        mid = lo + (size_t)((unsigned __int128)(key - k_lo) * (hi - 1 - lo) /
+                           ((unsigned __int128)(k_hi - k_lo) + 1));
+        c = memcmp(index_p->digests + mid * SHA1_DIGEST_SIZE, digest, SHA1_DIGEST_SIZE);
+        if (c == 0)
+        {
+            return 1;
+        }
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = memcmp(index_p->digests + mid * SHA1_DIGEST_SIZE, digest, SHA1_DIGEST_SIZE);
+
+        if (c == 0)
+        {
+            return 1;
+        }
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/* SHA1 digest index header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_INDEX_H_
+#define _SHA1_INDEX_H_
+
+/*
+ * A file of known digests (NSRL-style hash sets, lists of known-bad
+ * files) laid out for lookup straight out of mmap, with no load step.
+ *
+ * Layout, integers little-endian:
+ *
+ *   0     header, 64 bytes: magic "SHA1IDX\0", version (u32), Bloom
+ *         probes k (u32, 0 = no filter), digest count (u64), Bloom
+ *         blocks (u64), zero padding
+ *   64    blocked Bloom filter: 64-byte blocks, each key setting k bits
+ *         in one block, so a negative lookup costs one cache line
+ *   ...   fan-out table, 256 u32: entry b counts the digests whose first
+ *         byte is <= b, as in git's pack .idx
+ *   ...   the digests, 20 bytes each, sorted and unique
+ *
+ * A lookup tests the filter (if any), then binary-searches the fan-out
+ * bucket of the digest's first byte. SHA-1 output is uniform, so the
+ * digest's own bytes serve as the filter's hash values.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_INDEX_MAGIC        "SHA1IDX"    /* with its NUL, 8 bytes */
+#define SHA1_INDEX_VERSION      1
+#define SHA1_INDEX_BLOOM_BITS   10           /* default filter bits per digest */
+
+typedef struct SHA1_Index {
+    const uint8_t *map;      /* the whole file */
+    size_t map_size;
+    uint64_t count;
+    uint32_t fanout[256];
+    const uint8_t *digests;  /* count * 20 bytes */
+    const uint8_t *bloom;    /* NULL without a filter */
+    uint64_t bloom_blocks;
+    uint32_t bloom_k;
+} SHA1_Index_t, *SHA1_Index_p_t;
+
+/*
+ * INDEX READ LIST
+ * Collect the digests of a text file with one digest per line: sha1sum
+ * or TEST_SHA1 output, bare hex lists, or CSV whose first field is the
+ * (optionally quoted) SHA-1, as in the NSRL RDS. Lines that do not start
+ * with a digest followed by a space, tab, quote, comma or the end of the
+ * line are skipped, so a SHA-256 list yields nothing.
+ *
+ * Parameters
+ *  path: list file
+ *  digests_p: array to append to, grown with realloc (may start NULL)
+ *  count_p: entries in *digests_p, updated
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_index_read_list(const char *path, SHA1_DIGEST_t **digests_p, size_t *count_p);
+
+/*
+ * INDEX BUILD
+ * Sort and deduplicate digests (in place) and write them as an index
+ * file, replacing path atomically.
+ *
+ * Parameters
+ *  path: index file to write
+ *  digests: count digests, reordered
+ *  bloom_bits: Bloom filter bits per digest, 0 for no filter
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_ALLOC_ERROR, or
+ *  SHA1_BAD_INPUT if there are more digests than the fan-out can count
+ */
+SHA1_ERRCODE SHA1_index_build(const char *path, SHA1_DIGEST_t *digests, size_t count,
+                              unsigned bloom_bits);
+
+/*
+ * INDEX OPEN
+ * Map an index file read-only and check its header.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) or SHA1_BAD_INPUT if the file
+ *  is not a valid index
+ */
+SHA1_ERRCODE SHA1_index_open(const char *path, SHA1_Index_p_t index_p);
+
+/*
+ * INDEX CLOSE
+ */
+void SHA1_index_close(SHA1_Index_p_t index_p);
+
+/*
+ * INDEX CONTAINS
+ * Returns
+ *  nonzero if digest is in the index
+ */
+int SHA1_index_contains(const SHA1_Index_t *index_p, const SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_INDEX_H_ */
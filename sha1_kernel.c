@@ -0,0 +1,1285 @@
+/*
+ * SIMD compression kernels, self-test and dispatch
+ */
+
+#include "sha1_kernel.h"
+#include "sha1_stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_KERNEL_X86 1
+#endif
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/*
+ * STEPS ON PRECOMPUTED W + K
+ *
+ * The SIMD kernels below only vectorise the message schedule; the 80
+ * steps themselves are a serial dependency chain and stay scalar. They
+ * are fully unrolled with the registers renamed instead of shifted, and
+ * read W[t] + K[t] from wk, where the words of step t are found at
+ * wk[(t / 4) * stride + t % 4] (stride 4 for one block; a multiple of
+ * 4 when several blocks' schedules are interleaved group by group).
+ */
+#define WK(t) wk[((t) >> 2) * stride + ((t) & 3)]
+
+#define STEP_F1(a, b, c, d, e, t) \
+    e += ROTL(a, 5) + (d ^ (b & (c ^ d))) + WK(t); b = ROTL(b, 30)
+#define STEP_F2(a, b, c, d, e, t) \
+    e += ROTL(a, 5) + (b ^ c ^ d) + WK(t); b = ROTL(b, 30)
+#define STEP_F3(a, b, c, d, e, t) \
+    e += ROTL(a, 5) + ((b & c) | (d & (b | c))) + WK(t); b = ROTL(b, 30)
+
+#define FIVE_STEPS(F, t)                  \
+    F(A, B, C, D, E, (t));                \
+    F(E, A, B, C, D, (t) + 1);            \
+    F(D, E, A, B, C, (t) + 2);            \
+    F(C, D, E, A, B, (t) + 3);            \
+    F(B, C, D, E, A, (t) + 4)
+
+__attribute__((always_inline))
+static inline void steps_wk(SHA1_WORD_t hash[5], const SHA1_WORD_t *wk, size_t stride)
+{
+    SHA1_WORD_t A = hash[0], B = hash[1], C = hash[2], D = hash[3], E = hash[4];
+
+    FIVE_STEPS(STEP_F1, 0);  FIVE_STEPS(STEP_F1, 5);
+    FIVE_STEPS(STEP_F1, 10); FIVE_STEPS(STEP_F1, 15);
+    FIVE_STEPS(STEP_F2, 20); FIVE_STEPS(STEP_F2, 25);
+    FIVE_STEPS(STEP_F2, 30); FIVE_STEPS(STEP_F2, 35);
+    FIVE_STEPS(STEP_F3, 40); FIVE_STEPS(STEP_F3, 45);
+    FIVE_STEPS(STEP_F3, 50); FIVE_STEPS(STEP_F3, 55);
+    FIVE_STEPS(STEP_F2, 60); FIVE_STEPS(STEP_F2, 65);
+    FIVE_STEPS(STEP_F2, 70); FIVE_STEPS(STEP_F2, 75);
+
+    hash[0] += A;
+    hash[1] += B;
+    hash[2] += C;
+    hash[3] += D;
+    hash[4] += E;
+}
+
+/*
+ * ALL-ZERO BLOCKS
+ *
+ * Every schedule word of an all-zero block is an XOR of zeros, so
+ * W[t] + K[t] is just K[t] and can be a constant table: the steps run
+ * with no loads from the message and no schedule work at all.
+ */
+#define K4(k)  k, k, k, k
+#define K20(k) K4(k), K4(k), K4(k), K4(k), K4(k)
+
+static const SHA1_WORD_t zero_wk[80] = {
+    K20(0x5A827999), K20(0x6ED9EBA1), K20(0x8F1BBCDC), K20(0xCA62C1D6)
+};
+
+static void compress_zeros_scalar(SHA1_WORD_t hash[5], uint64_t n_blocks)
+{
+    for (; n_blocks > 0; n_blocks--)
+    {
+        steps_wk(hash, zero_wk, 4);
+    }
+}
+
+#ifdef SHA1_KERNEL_X86
+
+/*
+ * K for each group of four steps (t / 4 = 0..19)
+ */
+#define K_GROUP(g) ((g) < 5 ? 0x5A827999 : (g) < 10 ? 0x6ED9EBA1 : \
+                    (g) < 15 ? 0x8F1BBCDC : 0xCA62C1D6)
+
+/*
+ * SCHEDULE
+ *
+ * Every kernel computes the schedule one group of four words at a time,
+ * exactly as SHA1_expand_schedule in sha1.c: for words t .. t + 3,
+ *
+ *   w = (W[t-3..t] with W[t] = 0) ^ W[t-8..] ^ W[t-14..] ^ W[t-16..]
+ *   w = S^1(w), then W[t+3] ^= S^1(W[t])
+ *
+ * Wider registers hold the same group for 2 (AVX2) or 4 (AVX-512)
+ * blocks, one block per 128-bit lane; all the shifts involved work
+ * within 128-bit lanes, so the code is the same with a wider type.
+ */
+__attribute__((always_inline, target("ssse3")))
+static inline void compress_one_ssse3(SHA1_WORD_t hash[5], const uint8_t *data)
+{
+    const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    SHA1_WORD_t wk[80] __attribute__((aligned(16)));
+    const size_t stride = 4;
+    __m128i w[20];
+
+    for (int g = 0; g < 4; g++)
+    {
+        w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), bswap);
+    }
+    for (int g = 4; g < 20; g++)
+    {
+        __m128i x, r;
+
+        x = _mm_srli_si128(w[g - 1], 4);
+        x = _mm_xor_si128(x, w[g - 2]);
+        x = _mm_xor_si128(x, _mm_alignr_epi8(w[g - 3], w[g - 4], 8));
+        x = _mm_xor_si128(x, w[g - 4]);
+        x = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31));
+        r = _mm_slli_si128(x, 12);
+        w[g] = _mm_xor_si128(x, _mm_or_si128(_mm_slli_epi32(r, 1), _mm_srli_epi32(r, 31)));
+    }
+    for (int g = 0; g < 20; g++)
+    {
+        _mm_store_si128((__m128i *)&wk[g * 4],
+                        _mm_add_epi32(w[g], _mm_set1_epi32((int)K_GROUP(g))));
+    }
+
+    steps_wk(hash, wk, stride);
+}
+
+__attribute__((target("ssse3")))
+static void compress_ssse3(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
+{
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        compress_one_ssse3(hash, data);
+    }
+}
+
+__attribute__((target("avx2")))
+static void compress_avx2(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
+{
+    const __m256i bswap = _mm256_broadcastsi128_si256(
+        _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+    SHA1_WORD_t wk[2 * 80] __attribute__((aligned(32)));
+    const size_t stride = 8;
+
+    for (; n_blocks >= 2; n_blocks -= 2, data += 128)
+    {
+        __m256i w[20];
+
+        for (int g = 0; g < 4; g++)
+        {
+            w[g] = _mm256_shuffle_epi8(
+                _mm256_loadu2_m128i((const __m128i *)(data + 64 + 16 * g),
+                                    (const __m128i *)(data + 16 * g)), bswap);
+        }
+        for (int g = 4; g < 20; g++)
+        {
+            __m256i x, r;
+
+            x = _mm256_srli_si256(w[g - 1], 4);
+            x = _mm256_xor_si256(x, w[g - 2]);
+            x = _mm256_xor_si256(x, _mm256_alignr_epi8(w[g - 3], w[g - 4], 8));
+            x = _mm256_xor_si256(x, w[g - 4]);
+            x = _mm256_or_si256(_mm256_slli_epi32(x, 1), _mm256_srli_epi32(x, 31));
+            r = _mm256_slli_si256(x, 12);
+            w[g] = _mm256_xor_si256(x, _mm256_or_si256(_mm256_slli_epi32(r, 1),
+                                                       _mm256_srli_epi32(r, 31)));
+        }
+        for (int g = 0; g < 20; g++)
+        {
+            _mm256_store_si256((__m256i *)&wk[g * 8],
+                               _mm256_add_epi32(w[g], _mm256_set1_epi32((int)K_GROUP(g))));
+        }
+
+        steps_wk(hash, wk, stride);
+        steps_wk(hash, wk + 4, stride);
+    }
+
+    /*
+     * An odd block goes through the same code inlined here, so it is
+     * VEX-encoded too and the upper halves never need clearing
+     */
+    if (n_blocks)
+    {
+        compress_one_ssse3(hash, data);
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void compress_avx512(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
+{
+    const __m512i bswap = _mm512_broadcast_i32x4(
+        _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+    SHA1_WORD_t wk[4 * 80] __attribute__((aligned(64)));
+    const size_t stride = 16;
+
+    for (; n_blocks >= 4; n_blocks -= 4, data += 256)
+    {
+        __m512i w[20];
+
+        for (int g = 0; g < 4; g++)
+        {
+            __m512i x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)(data + 16 * g)));
+
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(data + 64 + 16 * g)), 1);
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(data + 128 + 16 * g)), 2);
+            x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(data + 192 + 16 * g)), 3);
+            w[g] = _mm512_shuffle_epi8(x, bswap);
+        }
+        for (int g = 4; g < 20; g++)
+        {
+            __m512i x;
+
+            x = _mm512_bsrli_epi128(w[g - 1], 4);
+            x = _mm512_xor_si512(x, w[g - 2]);
+            x = _mm512_xor_si512(x, _mm512_alignr_epi8(w[g - 3], w[g - 4], 8));
+            x = _mm512_xor_si512(x, w[g - 4]);
+            x = _mm512_rol_epi32(x, 1);
+            w[g] = _mm512_xor_si512(x, _mm512_rol_epi32(_mm512_bslli_epi128(x, 12), 1));
+        }
+        for (int g = 0; g < 20; g++)
+        {
+            _mm512_store_si512((__m512i *)&wk[g * 16],
+                               _mm512_add_epi32(w[g], _mm512_set1_epi32((int)K_GROUP(g))));
+        }
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            steps_wk(hash, wk + 4 * lane, stride);
+        }
+    }
+
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        compress_one_ssse3(hash, data);
+    }
+}
+
+/*
+ * SHA-NI
+ *
+ * SHA1RNDS4 runs four steps on ABCD given E + W for them; SHA1NEXTE
+ * derives the next E from the old A and adds the next four words;
+ * SHA1MSG1, XOR and SHA1MSG2 compute the next four schedule words in
+ * three stages spread over the three groups before they are needed.
+ * msg[i % 4] holds the words of group i; E alternates between e[0] and
+ * e[1].
+ */
+#define SHANI_GROUP(i)                                                          \
+    do {                                                                        \
+        if ((i) < 4)                                                            \
+        {                                                                       \
+            msg[(i) & 3] = _mm_shuffle_epi8(                                        \
+                _mm_loadu_si128((const __m128i *)(data + 16 * (i))), bswap);    \
+        }                                                                       \
+        if ((i) == 0)                                                           \
+        {                                                                       \
+            e[0] = _mm_add_epi32(e[0], msg[0]);                                 \
+        }                                                                       \
+        else                                                                    \
+        {                                                                       \
+            e[(i) & 1] = _mm_sha1nexte_epu32(e[(i) & 1], msg[(i) & 3]);         \
+        }                                                                       \
+        e[((i) + 1) & 1] = abcd;                                                \
+        if ((i) >= 3 && (i) <= 18)                                              \
+        {                                                                       \
+            msg[((i) + 1) & 3] = _mm_sha1msg2_epu32(msg[((i) + 1) & 3], msg[(i) & 3]); \
+        }                                                                       \
+        abcd = _mm_sha1rnds4_epu32(abcd, e[(i) & 1], (i) / 5);                  \
+        if ((i) >= 1 && (i) <= 16)                                              \
+        {                                                                       \
+            msg[((i) + 3) & 3] = _mm_sha1msg1_epu32(msg[((i) + 3) & 3], msg[(i) & 3]); \
+        }                                                                       \
+        if ((i) >= 2 && (i) <= 17)                                              \
+        {                                                                       \
+            msg[((i) + 2) & 3] = _mm_xor_si128(msg[((i) + 2) & 3], msg[(i) & 3]); \
+        }                                                                       \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void compress_shani(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks)
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i abcd, abcd_save, e_save, e[2], msg[4];
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)hash), 0x1B);
+    e[0] = _mm_set_epi32((int)hash[4], 0, 0, 0);
+
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        abcd_save = abcd;
+        e_save = e[0];
+
+        SHANI_GROUP(0);  SHANI_GROUP(1);  SHANI_GROUP(2);  SHANI_GROUP(3);
+        SHANI_GROUP(4);  SHANI_GROUP(5);  SHANI_GROUP(6);  SHANI_GROUP(7);
+        SHANI_GROUP(8);  SHANI_GROUP(9);  SHANI_GROUP(10); SHANI_GROUP(11);
+        SHANI_GROUP(12); SHANI_GROUP(13); SHANI_GROUP(14); SHANI_GROUP(15);
+        SHANI_GROUP(16); SHANI_GROUP(17); SHANI_GROUP(18); SHANI_GROUP(19);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)hash, _mm_shuffle_epi32(abcd, 0x1B));
+    hash[4] = (SHA1_WORD_t)_mm_extract_epi32(e[0], 3);
+}
+
+/*
+ * SHANI_GROUP with every message word zero: SHA1MSG1/2 would only
+ * produce zeros, and SHA1NEXTE adds nothing but the rotated E
+ */
+#define SHANI_ZERO_GROUP(i)                                                     \
+    do {                                                                        \
+        if ((i) > 0)                                                            \
+        {                                                                       \
+            e[(i) & 1] = _mm_sha1nexte_epu32(e[(i) & 1], zero);                 \
+        }                                                                       \
+        e[((i) + 1) & 1] = abcd;                                                \
+        abcd = _mm_sha1rnds4_epu32(abcd, e[(i) & 1], (i) / 5);                  \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void compress_zeros_shani(SHA1_WORD_t hash[5], uint64_t n_blocks)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i abcd, abcd_save, e_save, e[2];
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)hash), 0x1B);
+    e[0] = _mm_set_epi32((int)hash[4], 0, 0, 0);
+
+    for (; n_blocks > 0; n_blocks--)
+    {
+        abcd_save = abcd;
+        e_save = e[0];
+
+        SHANI_ZERO_GROUP(0);  SHANI_ZERO_GROUP(1);  SHANI_ZERO_GROUP(2);  SHANI_ZERO_GROUP(3);
+        SHANI_ZERO_GROUP(4);  SHANI_ZERO_GROUP(5);  SHANI_ZERO_GROUP(6);  SHANI_ZERO_GROUP(7);
+        SHANI_ZERO_GROUP(8);  SHANI_ZERO_GROUP(9);  SHANI_ZERO_GROUP(10); SHANI_ZERO_GROUP(11);
+        SHANI_ZERO_GROUP(12); SHANI_ZERO_GROUP(13); SHANI_ZERO_GROUP(14); SHANI_ZERO_GROUP(15);
+        SHANI_ZERO_GROUP(16); SHANI_ZERO_GROUP(17); SHANI_ZERO_GROUP(18); SHANI_ZERO_GROUP(19);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)hash, _mm_shuffle_epi32(abcd, 0x1B));
+    hash[4] = (SHA1_WORD_t)_mm_extract_epi32(e[0], 3);
+}
+
+/*
+ * MULTI-BUFFER KERNELS
+ *
+ * v[t] below is word t of the current block of every lane: lane i's
+ * 64 bytes are loaded as two rows of eight words and the 8x8 tiles are
+ * transposed so that each vector holds one word position across lanes.
+ * The 80 steps are then the scalar steps on vectors, with the schedule
+ * kept as a 16-entry ring.
+ */
+__attribute__((always_inline, target("avx2")))
+static inline void transpose_8x8(__m256i r[8])
+{
+    __m256i t[8], u[8];
+
+    for (int i = 0; i < 8; i += 2)
+    {
+        t[i]     = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4)
+    {
+        u[i]     = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        r[i]     = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+/*
+ * Words 0..15 of the current block of lanes first .. first + 7, byte
+ * swapped, into v[0..15]
+ */
+__attribute__((always_inline, target("avx2")))
+static inline void load_words_x8(__m256i v[16], const uint8_t *const *data, int first)
+{
+    const __m256i bswap = _mm256_broadcastsi128_si256(
+        _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+
+    for (int half = 0; half < 2; half++)
+    {
+        __m256i r[8];
+
+        for (int lane = 0; lane < 8; lane++)
+        {
+            r[lane] = _mm256_loadu_si256((const __m256i *)(data[first + lane] + 32 * half));
+        }
+        transpose_8x8(r);
+        for (int i = 0; i < 8; i++)
+        {
+            v[8 * half + i] = _mm256_shuffle_epi8(r[i], bswap);
+        }
+    }
+}
+
+/*
+ * One step on vectors; VADD, VXOR, VROTL, VF1..VF3 and VSET1 are
+ * defined for the register width of the kernel using it
+ */
+#define MB_W(t)                                                             \
+    ((t) < 16 ? v[(t) & 15] :                                               \
+     (v[(t) & 15] = VROTL(VXOR(VXOR(v[((t) - 3) & 15], v[((t) - 8) & 15]),   \
+                               VXOR(v[((t) - 14) & 15], v[(t) & 15])), 1)))
+
+#define MB_STEP(F, k, a, b, c, d, e, t)                                     \
+    e = VADD(VADD(e, VROTL(a, 5)), VADD(F(b, c, d), VADD(MB_W(t), k)));     \
+    b = VROTL(b, 30)
+
+#define MB_FIVE(F, k, t)                                                    \
+    MB_STEP(F, k, A, B, C, D, E, (t));                                      \
+    MB_STEP(F, k, E, A, B, C, D, (t) + 1);                                  \
+    MB_STEP(F, k, D, E, A, B, C, (t) + 2);                                  \
+    MB_STEP(F, k, C, D, E, A, B, (t) + 3);                                  \
+    MB_STEP(F, k, B, C, D, E, A, (t) + 4)
+
+#define MB_STEPS()                                                          \
+    do {                                                                    \
+        const VEC k1 = VSET1(0x5A827999), k2 = VSET1(0x6ED9EBA1);            \
+        const VEC k3 = VSET1(0x8F1BBCDC), k4 = VSET1(0xCA62C1D6);            \
+        MB_FIVE(VF1, k1, 0);  MB_FIVE(VF1, k1, 5);                          \
+        MB_FIVE(VF1, k1, 10); MB_FIVE(VF1, k1, 15);                         \
+        MB_FIVE(VF2, k2, 20); MB_FIVE(VF2, k2, 25);                         \
+        MB_FIVE(VF2, k2, 30); MB_FIVE(VF2, k2, 35);                         \
+        MB_FIVE(VF3, k3, 40); MB_FIVE(VF3, k3, 45);                         \
+        MB_FIVE(VF3, k3, 50); MB_FIVE(VF3, k3, 55);                         \
+        MB_FIVE(VF2, k4, 60); MB_FIVE(VF2, k4, 65);                         \
+        MB_FIVE(VF2, k4, 70); MB_FIVE(VF2, k4, 75);                         \
+    } while (0)
+
+#define VEC __m256i
+#define VADD _mm256_add_epi32
+#define VXOR _mm256_xor_si256
+#define VSET1(x) _mm256_set1_epi32((int)(x))
+#define VROTL(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define VF1(b, c, d) VXOR(d, _mm256_and_si256(b, VXOR(c, d)))
+#define VF2(b, c, d) VXOR(VXOR(b, c), d)
+#define VF3(b, c, d) _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+__attribute__((target("avx2")))
+static void mb_compress_avx2(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES],
+                             const uint8_t *data[SHA1_MB_MAX_LANES],
+                             unsigned active, size_t n_blocks)
+{
+    __m256i h[5], v[16];
+
+    (void)active;
+    for (int k = 0; k < 5; k++)
+    {
+        h[k] = _mm256_load_si256((const __m256i *)state[k]);
+    }
+
+    for (; n_blocks > 0; n_blocks--)
+    {
+        __m256i A = h[0], B = h[1], C = h[2], D = h[3], E = h[4];
+
+        load_words_x8(v, data, 0);
+        for (int lane = 0; lane < 8; lane++)
+        {
+            data[lane] += 64;
+        }
+
+        MB_STEPS();
+
+        h[0] = VADD(h[0], A);
+        h[1] = VADD(h[1], B);
+        h[2] = VADD(h[2], C);
+        h[3] = VADD(h[3], D);
+        h[4] = VADD(h[4], E);
+    }
+
+    for (int k = 0; k < 5; k++)
+    {
+        _mm256_store_si256((__m256i *)state[k], h[k]);
+    }
+}
+
+#undef VEC
+#undef VADD
+#undef VXOR
+#undef VSET1
+#undef VROTL
+#undef VF1
+#undef VF2
+#undef VF3
+
+#define VEC __m512i
+#define VADD _mm512_add_epi32
+#define VXOR _mm512_xor_si512
+#define VSET1(x) _mm512_set1_epi32((int)(x))
+#define VROTL(x, n) _mm512_rol_epi32(x, n)
+#define VF1(b, c, d) _mm512_ternarylogic_epi32(b, c, d, 0xCA) /* b ? c : d */
+#define VF2(b, c, d) _mm512_ternarylogic_epi32(b, c, d, 0x96) /* b ^ c ^ d */
+#define VF3(b, c, d) _mm512_ternarylogic_epi32(b, c, d, 0xE8) /* majority */
+
+__attribute__((target("avx512f,avx512bw")))
+static void mb_compress_avx512(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES],
+                               const uint8_t *data[SHA1_MB_MAX_LANES],
+                               unsigned active, size_t n_blocks)
+{
+    __m512i h[5], v[16];
+
+    (void)active;
+    for (int k = 0; k < 5; k++)
+    {
+        h[k] = _mm512_load_si512((const void *)state[k]);
+    }
+
+    for (; n_blocks > 0; n_blocks--)
+    {
+        __m512i A = h[0], B = h[1], C = h[2], D = h[3], E = h[4];
+        __m256i lo[16], hi[16];
+
+        load_words_x8(lo, data, 0);
+        load_words_x8(hi, data, 8);
+        for (int t = 0; t < 16; t++)
+        {
+            v[t] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[t]), hi[t], 1);
+        }
+        for (int lane = 0; lane < 16; lane++)
+        {
+            data[lane] += 64;
+        }
+
+        MB_STEPS();
+
+        h[0] = VADD(h[0], A);
+        h[1] = VADD(h[1], B);
+        h[2] = VADD(h[2], C);
+        h[3] = VADD(h[3], D);
+        h[4] = VADD(h[4], E);
+    }
+
+    for (int k = 0; k < 5; k++)
+    {
+        _mm512_store_si512((void *)state[k], h[k]);
+    }
+}
+
+#undef VEC
+#undef VADD
+#undef VXOR
+#undef VSET1
+#undef VROTL
+#undef VF1
+#undef VF2
+#undef VF3
+
+#endif /* SHA1_KERNEL_X86 */
+
+/*
+ * KERNEL TABLE
+ * In order of preference when measurements tie.
+ */
+static SHA1_Kernel_t kernels[] = {
+#ifdef SHA1_KERNEL_X86
+    { "shani",  SHA1_KERNEL_SHANI,  compress_shani,  0, 0, { 0 } },
+    { "avx512", SHA1_KERNEL_AVX512, compress_avx512, 0, 0, { 0 } },
+    { "avx2",   SHA1_KERNEL_AVX2,   compress_avx2,   0, 0, { 0 } },
+    { "ssse3",  SHA1_KERNEL_SSSE3,  compress_ssse3,  0, 0, { 0 } },
+#endif
+    { "scalar", SHA1_KERNEL_SCALAR, SHA1_compress_scalar, 1, 0, { 0 } },
+};
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+#define SCALAR_KERNEL (&kernels[N_KERNELS - 1])
+
+int sha1_kernels_ready = 0;
+const SHA1_Kernel_t *sha1_kernel_dispatch[SHA1_KERNEL_N_CLASSES];
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const char *kernels_forced = NULL; /* SHA1_KERNEL, if it was honoured */
+
+/*
+ * MULTI-BUFFER KERNEL TABLE
+ */
+static void mb_compress_serial(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES],
+                               const uint8_t *data[SHA1_MB_MAX_LANES],
+                               unsigned active, size_t n_blocks)
+{
+    /*
+     * Not SHA1_kernel_for: this also runs while the table is being set up
+     */
+    const SHA1_Kernel_t *kernel_p = sha1_kernel_dispatch[SHA1_kernel_class(n_blocks)];
+
+    for (int lane = 0; active != 0; lane++, active >>= 1)
+    {
+        SHA1_WORD_t hash[5];
+
+        if (!(active & 1))
+        {
+            continue;
+        }
+        for (int k = 0; k < 5; k++)
+        {
+            hash[k] = state[k][lane];
+        }
+        kernel_p->compress(hash, data[lane], n_blocks);
+        for (int k = 0; k < 5; k++)
+        {
+            state[k][lane] = hash[k];
+        }
+        data[lane] += n_blocks * 64;
+    }
+}
+
+static SHA1_MbKernel_t mb_kernels[] = {
+#ifdef SHA1_KERNEL_X86
+    { "avx512x16", SHA1_KERNEL_AVX512_X16, 16, mb_compress_avx512, 0, 0, 0 },
+    { "avx2x8",    SHA1_KERNEL_AVX2_X8,    8,  mb_compress_avx2,   0, 0, 0 },
+#endif
+    { "serial",    -1,                     8,  mb_compress_serial, 1, 0, 0 },
+};
+#define N_MB_KERNELS (sizeof(mb_kernels) / sizeof(mb_kernels[0]))
+#define SERIAL_MB_KERNEL (&mb_kernels[N_MB_KERNELS - 1])
+
+static const SHA1_MbKernel_t *mb_kernel_best = SERIAL_MB_KERNEL;
+static const char *mb_kernel_forced = NULL; /* SHA1_MB_KERNEL, if honoured */
+
+/*
+ * ZERO-BLOCK KERNEL TABLE
+ * Each is usable where the single-buffer kernel of the same name is.
+ */
+static SHA1_ZeroKernel_t zero_kernels[] = {
+#ifdef SHA1_KERNEL_X86
+    { "shani",  compress_zeros_shani,  0, 0, 0 },
+#endif
+    { "scalar", compress_zeros_scalar, 1, 0, 0 },
+};
+#define N_ZERO_KERNELS (sizeof(zero_kernels) / sizeof(zero_kernels[0]))
+#define SCALAR_ZERO_KERNEL (&zero_kernels[N_ZERO_KERNELS - 1])
+
+static const SHA1_ZeroKernel_t *zero_kernel_best = SCALAR_ZERO_KERNEL;
+
+static int cpu_supports(const char *name)
+{
+#ifdef SHA1_KERNEL_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "shani") == 0)
+    {
+        return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+    }
+    if (strcmp(name, "avx512x16") == 0)
+    {
+        name = "avx512";
+    }
+    if (strcmp(name, "avx2x8") == 0)
+    {
+        name = "avx2";
+    }
+    if (strcmp(name, "avx512") == 0)
+    {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+    if (strcmp(name, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(name, "ssse3") == 0)
+    {
+        return __builtin_cpu_supports("ssse3");
+    }
+#endif
+    return strcmp(name, "scalar") == 0 || strcmp(name, "serial") == 0;
+}
+
+/*
+ * Hash a whole message with one kernel, padding included
+ */
+static void kernel_hash(const SHA1_Kernel_t *kernel_p, const uint8_t *msg, size_t len,
+                        SHA1_DIGEST_t digest)
+{
+    SHA1_WORD_t hash[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t tail[128] = { 0 };
+    size_t n_blocks = len / 64, rest = len % 64;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+
+    kernel_p->compress(hash, msg, n_blocks);
+
+    memcpy(tail, msg + n_blocks * 64, rest);
+    tail[rest] = 0x80;
+    for (int i = 0; i < 8; i++)
+    {
+        tail[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    kernel_p->compress(hash, tail, tail_len / 64);
+
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4]     = hash[i] >> 24;
+        digest[i * 4 + 1] = hash[i] >> 16;
+        digest[i * 4 + 2] = hash[i] >> 8;
+        digest[i * 4 + 3] = hash[i];
+    }
+}
+
+/*
+ * SELF-TEST
+ * The RFC 3174 vectors of reference/test_driver.c (except the million
+ * "a"s, which would cost more than everything else here together), then
+ * every run of 1..17 blocks against the scalar kernel, which covers the
+ * odd blocks left over by the kernels that schedule 2 or 4 at a time.
+ */
+static int kernel_self_test(const SHA1_Kernel_t *kernel_p)
+{
+    static const struct {
+        const char *msg;
+        int repeat;
+        uint8_t digest[SHA1_DIGEST_SIZE];
+    } vectors[] = {
+        { "abc", 1,
+          { 0xA9, 0x99, 0x3E, 0x36, 0x47, 0x06, 0x81, 0x6A, 0xBA, 0x3E,
+            0x25, 0x71, 0x78, 0x50, 0xC2, 0x6C, 0x9C, 0xD0, 0xD8, 0x9D } },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+          { 0x84, 0x98, 0x3E, 0x44, 0x1C, 0x3B, 0xD2, 0x6E, 0xBA, 0xAE,
+            0x4A, 0xA1, 0xF9, 0x51, 0x29, 0xE5, 0xE5, 0x46, 0x70, 0xF1 } },
+        { "0123456701234567012345670123456701234567012345670123456701234567", 10,
+          { 0xDE, 0xA3, 0x56, 0xA2, 0xCD, 0xDD, 0x90, 0xC7, 0xA7, 0xEC,
+            0xED, 0xC5, 0xEB, 0xB5, 0x63, 0x93, 0x4F, 0x46, 0x04, 0x52 } },
+    };
+    uint8_t buf[17 * 64];
+    SHA1_DIGEST_t digest;
+
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++)
+    {
+        size_t len = strlen(vectors[v].msg);
+
+        for (int r = 0; r < vectors[v].repeat; r++)
+        {
+            memcpy(buf + r * len, vectors[v].msg, len);
+        }
+        kernel_hash(kernel_p, buf, len * vectors[v].repeat, digest);
+        if (memcmp(digest, vectors[v].digest, SHA1_DIGEST_SIZE) != 0)
+        {
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (uint8_t)(i * 167 + (i >> 8) * 13 + 1);
+    }
+    for (size_t n = 1; n <= 17; n++)
+    {
+        SHA1_WORD_t want[5] = { 1, 2, 3, 4, 5 }, got[5] = { 1, 2, 3, 4, 5 };
+
+        SHA1_compress_scalar(want, buf, n);
+        kernel_p->compress(got, buf, n);
+        if (memcmp(want, got, sizeof(want)) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Every lane on its own data, 1..3 blocks, against the scalar kernel
+ */
+static int mb_kernel_self_test(const SHA1_MbKernel_t *kernel_p)
+{
+    SHA1_WORD_t state[5][SHA1_MB_MAX_LANES] __attribute__((aligned(64)));
+    uint8_t buf[(SHA1_MB_MAX_LANES + 3) * 64];
+    const uint8_t *data[SHA1_MB_MAX_LANES];
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (uint8_t)(i * 251 + (i >> 6) * 17 + 3);
+    }
+
+    for (size_t n = 1; n <= 3; n++)
+    {
+        for (int lane = 0; lane < SHA1_MB_MAX_LANES; lane++)
+        {
+            for (int k = 0; k < 5; k++)
+            {
+                state[k][lane] = (SHA1_WORD_t)(lane * 5 + k) * 0x9E3779B9u;
+            }
+            data[lane] = buf + lane * 64;
+        }
+
+        kernel_p->compress(state, data, (1u << kernel_p->lanes) - 1, n);
+
+        for (int lane = 0; lane < kernel_p->lanes; lane++)
+        {
+            SHA1_WORD_t want[5];
+
+            for (int k = 0; k < 5; k++)
+            {
+                want[k] = (SHA1_WORD_t)(lane * 5 + k) * 0x9E3779B9u;
+            }
+            SHA1_compress_scalar(want, buf + lane * 64, n);
+            for (int k = 0; k < 5; k++)
+            {
+                if (state[k][lane] != want[k])
+                {
+                    return 0;
+                }
+            }
+            if (data[lane] != buf + lane * 64 + n * 64)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * BENCHMARK
+ * Time a kernel on each size class: calls of a typical size for the
+ * class, about 16 KiB per round (64 KiB for the largest class), best of
+ * three rounds. The whole tuning takes a few milliseconds.
+ */
+static void kernel_benchmark(SHA1_Kernel_t *kernel_p, const uint8_t *buf)
+{
+    static const size_t class_blocks[SHA1_KERNEL_N_CLASSES] = { 1, 4, 16, 128, 1024 };
+    SHA1_WORD_t warm[5] = { 0 };
+
+    /*
+     * Wide vector units take a moment to power up; without this the
+     * first class measured would pay for it
+     */
+    kernel_p->compress(warm, buf, 256);
+
+    for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+    {
+        size_t n_blocks = class_blocks[c];
+        size_t n_calls = n_blocks < 256 ? 256 / n_blocks : 1;
+        uint64_t best = UINT64_MAX;
+        SHA1_WORD_t hash[5] = { 0 };
+
+        for (int round = 0; round < 3; round++)
+        {
+            uint64_t start = now_ns(), elapsed;
+
+            for (size_t i = 0; i < n_calls; i++)
+            {
+                kernel_p->compress(hash, buf, n_blocks);
+            }
+            elapsed = now_ns() - start;
+            if (elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+        kernel_p->ns_per_block[c] = (double)best / (double)(n_calls * n_blocks);
+    }
+}
+
+/*
+ * All lanes busy, 16 blocks each, best of three
+ */
+static void mb_kernel_benchmark(SHA1_MbKernel_t *kernel_p, const uint8_t *buf)
+{
+    SHA1_WORD_t state[5][SHA1_MB_MAX_LANES] __attribute__((aligned(64))) = { { 0 } };
+    const uint8_t *data[SHA1_MB_MAX_LANES];
+    unsigned active = (1u << kernel_p->lanes) - 1;
+    uint64_t best = UINT64_MAX;
+
+    for (int round = 0; round < 4; round++)
+    {
+        uint64_t start, elapsed;
+
+        for (int lane = 0; lane < SHA1_MB_MAX_LANES; lane++)
+        {
+            data[lane] = buf + lane * 16 * 64;
+        }
+        start = now_ns();
+        kernel_p->compress(state, data, active, 16);
+        elapsed = now_ns() - start;
+        if (round > 0 && elapsed < best) /* round 0 warms up */
+        {
+            best = elapsed;
+        }
+    }
+    kernel_p->ns_per_block = (double)best / (double)(16 * kernel_p->lanes);
+}
+
+static void mb_kernels_setup(const uint8_t *buf)
+{
+    const char *env = getenv(SHA1_MB_KERNEL_ENV);
+
+    for (size_t k = 0; k < N_MB_KERNELS; k++)
+    {
+        mb_kernels[k].available = cpu_supports(mb_kernels[k].name);
+        mb_kernels[k].verified = mb_kernels[k].available && mb_kernel_self_test(&mb_kernels[k]);
+        if (mb_kernels[k].verified && buf != NULL)
+        {
+            mb_kernel_benchmark(&mb_kernels[k], buf);
+        }
+    }
+
+    if (env != NULL && *env != '\0' && strcmp(env, "auto") != 0)
+    {
+        for (size_t k = 0; k < N_MB_KERNELS; k++)
+        {
+            if (strcmp(mb_kernels[k].name, env) == 0 && mb_kernels[k].verified)
+            {
+                mb_kernel_best = &mb_kernels[k];
+                mb_kernel_forced = mb_kernels[k].name;
+                return;
+            }
+        }
+        fprintf(stderr, "%s=%s: no such usable kernel, choosing automatically\n",
+                SHA1_MB_KERNEL_ENV, env);
+    }
+
+    for (size_t k = 0; k < N_MB_KERNELS; k++)
+    {
+        if (mb_kernels[k].verified && mb_kernels[k].ns_per_block > 0 &&
+            mb_kernels[k].ns_per_block < mb_kernel_best->ns_per_block)
+        {
+            mb_kernel_best = &mb_kernels[k];
+        }
+    }
+}
+
+/*
+ * 1..3 zero blocks against the scalar kernel on real zero bytes
+ */
+static int zero_kernel_self_test(const SHA1_ZeroKernel_t *kernel_p)
+{
+    static const uint8_t zeros[3 * 64] = { 0 };
+
+    for (uint64_t n = 1; n <= 3; n++)
+    {
+        SHA1_WORD_t want[5] = { 1, 2, 3, 4, 5 }, got[5] = { 1, 2, 3, 4, 5 };
+
+        SHA1_compress_scalar(want, zeros, n);
+        kernel_p->compress(got, n);
+        if (memcmp(want, got, sizeof(want)) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * 256 blocks a round, best of three
+ */
+static void zero_kernel_benchmark(SHA1_ZeroKernel_t *kernel_p)
+{
+    SHA1_WORD_t hash[5] = { 0 };
+    uint64_t best = UINT64_MAX;
+
+    for (int round = 0; round < 3; round++)
+    {
+        uint64_t start = now_ns(), elapsed;
+
+        kernel_p->compress(hash, 256);
+        elapsed = now_ns() - start;
+        if (elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    kernel_p->ns_per_block = (double)best / 256.0;
+}
+
+/*
+ * A zero-block kernel is only a candidate if the kernel of the same name
+ * passed its own self-test and, when SHA1_KERNEL forces a kernel, is the
+ * forced one
+ */
+static void zero_kernels_setup(const SHA1_Kernel_t *forced_p)
+{
+    for (size_t k = 0; k < N_ZERO_KERNELS; k++)
+    {
+        const SHA1_Kernel_t *kernel_p = SHA1_kernel_by_name(zero_kernels[k].name);
+        SHA1_ZeroKernel_p_t zero_p = &zero_kernels[k];
+
+        zero_p->available = kernel_p != NULL && kernel_p->verified &&
+                            (forced_p == NULL || forced_p == kernel_p ||
+                             zero_p == SCALAR_ZERO_KERNEL);
+        zero_p->verified = zero_p->available && zero_kernel_self_test(zero_p);
+        if (zero_p->verified)
+        {
+            zero_kernel_benchmark(zero_p);
+        }
+    }
+
+    for (size_t k = 0; k < N_ZERO_KERNELS; k++)
+    {
+        if (zero_kernels[k].verified &&
+            (!zero_kernel_best->verified ||
+             zero_kernels[k].ns_per_block < zero_kernel_best->ns_per_block))
+        {
+            zero_kernel_best = &zero_kernels[k];
+        }
+    }
+}
+
+static void kernels_setup(void)
+{
+    const char *env = getenv(SHA1_KERNEL_ENV);
+    const SHA1_Kernel_t *forced_p = NULL;
+    uint8_t *buf;
+
+    for (size_t k = 0; k < N_KERNELS; k++)
+    {
+        kernels[k].available = cpu_supports(kernels[k].name);
+        kernels[k].verified = kernels[k].available && kernel_self_test(&kernels[k]);
+    }
+
+    if (env != NULL && *env != '\0' && strcmp(env, "auto") != 0)
+    {
+        forced_p = SHA1_kernel_by_name(env);
+        if (forced_p == NULL || !forced_p->verified)
+        {
+            fprintf(stderr, "%s=%s: %s, choosing automatically\n", SHA1_KERNEL_ENV, env,
+                    forced_p == NULL ? "no such kernel" :
+                    forced_p->available ? "kernel failed its self-test" :
+                    "not supported by this CPU");
+            forced_p = NULL;
+        }
+    }
+
+    /*
+     * Fall back on the scalar kernel for every class if the benchmark
+     * buffer cannot be had, or if the scalar kernel itself is wrong
+     * (nothing better to offer then)
+     */
+    for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+    {
+        sha1_kernel_dispatch[c] = forced_p != NULL ? forced_p : SCALAR_KERNEL;
+    }
+    if (forced_p != NULL)
+    {
+        kernels_forced = forced_p->name;
+    }
+
+    buf = malloc(1024 * 64);
+    if (buf != NULL)
+    {
+        for (size_t i = 0; i < 1024 * 64; i++)
+        {
+            buf[i] = (uint8_t)(i * 131 + 7);
+        }
+    }
+
+    if (buf != NULL && forced_p == NULL)
+    {
+        for (size_t k = 0; k < N_KERNELS; k++)
+        {
+            if (kernels[k].verified)
+            {
+                kernel_benchmark(&kernels[k], buf);
+            }
+        }
+
+        for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+        {
+            const SHA1_Kernel_t *best_p = NULL;
+
+            for (size_t k = 0; k < N_KERNELS; k++)
+            {
+                if (kernels[k].verified &&
+                    (best_p == NULL || kernels[k].ns_per_block[c] < best_p->ns_per_block[c]))
+                {
+                    best_p = &kernels[k];
+                }
+            }
+            if (best_p != NULL)
+            {
+                sha1_kernel_dispatch[c] = best_p;
+            }
+        }
+    }
+
+    /*
+     * After the single-buffer table, which the serial kernel runs on
+     */
+    mb_kernels_setup(buf);
+    free(buf);
+    zero_kernels_setup(forced_p);
+
+    __atomic_store_n(&sha1_kernels_ready, 1, __ATOMIC_RELEASE);
+}
+
+void SHA1_kernels_init(void)
+{
+    pthread_once(&kernels_once, kernels_setup);
+}
+
+const SHA1_MbKernel_t *SHA1_mb_kernel(void)
+{
+    SHA1_kernels_init();
+    return mb_kernel_best;
+}
+
+const SHA1_MbKernel_t *SHA1_mb_kernel_serial(void)
+{
+    SHA1_kernels_init();
+    return SERIAL_MB_KERNEL;
+}
+
+void SHA1_mb_compress(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES], const uint8_t *data[SHA1_MB_MAX_LANES],
+                      unsigned active, size_t n_blocks)
+{
+    const SHA1_MbKernel_t *kernel_p;
+    int n_active = __builtin_popcount(active);
+
+    if (active == 0)
+    {
+        return; /* no lane to copy data[] from, and nothing to do */
+    }
+    kernel_p = SHA1_mb_kernel();
+
+    /*
+     * With few lanes busy (typically while draining) the SIMD kernel
+     * would mostly compute idle lanes; the serial kernel wins once
+     * n_active single-buffer blocks cost less than one full-width call
+     */
+    if (kernel_p != SERIAL_MB_KERNEL &&
+        SERIAL_MB_KERNEL->ns_per_block * n_active < kernel_p->ns_per_block * kernel_p->lanes)
+    {
+        kernel_p = SERIAL_MB_KERNEL;
+    }
+
+    if (kernel_p != SERIAL_MB_KERNEL)
+    {
+        int any = __builtin_ctz(active);
+
+        for (int lane = 0; lane < kernel_p->lanes; lane++)
+        {
+            if (!(active & (1u << lane)))
+            {
+                data[lane] = data[any];
+            }
+        }
+    }
+
+    kernel_p->compress(state, data, active, n_blocks);
+
+    SHA1_STATS_ADD(blocks, n_blocks * n_active);
+    SHA1_STATS_ADD(kernel_blocks[kernel_p->id >= 0 ? kernel_p->id : SHA1_kernel_for(n_blocks)->id],
+                   n_blocks * n_active);
+}
+
+void SHA1_compress_zeros(SHA1_WORD_t hash[5], uint64_t n_blocks)
+{
+    if (__builtin_expect(!__atomic_load_n(&sha1_kernels_ready, __ATOMIC_ACQUIRE), 0))
+    {
+        SHA1_kernels_init();
+    }
+    zero_kernel_best->compress(hash, n_blocks);
+}
+
+const SHA1_Kernel_t *SHA1_kernel_by_name(const char *name)
+{
+    for (size_t k = 0; k < N_KERNELS; k++)
+    {
+        if (strcmp(kernels[k].name, name) == 0)
+        {
+            return &kernels[k];
+        }
+    }
+    return NULL;
+}
+
+void SHA1_kernels_print(FILE *fp)
+{
+    static const char *const class_names[SHA1_KERNEL_N_CLASSES] = {
+        "1", "2-7", "8-63", "64-1023", "1024+"
+    };
+
+    SHA1_kernels_init();
+
+    fprintf(fp, "kernel     self-test  ns/block by blocks per call:");
+    for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+    {
+        fprintf(fp, " %8s", class_names[c]);
+    }
+    fputc('\n', fp);
+
+    for (size_t k = 0; k < N_KERNELS; k++)
+    {
+        const SHA1_Kernel_t *kernel_p = &kernels[k];
+
+        fprintf(fp, "%-10s %-10s %29s", kernel_p->name,
+                !kernel_p->available ? "n/a" : kernel_p->verified ? "ok" : "FAILED", "");
+        for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+        {
+            if (kernel_p->ns_per_block[c] > 0)
+            {
+                fprintf(fp, " %8.1f", kernel_p->ns_per_block[c]);
+            }
+            else
+            {
+                fprintf(fp, " %8s", "-");
+            }
+        }
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "multi-buffer:");
+    for (size_t k = 0; k < N_MB_KERNELS; k++)
+    {
+        const SHA1_MbKernel_t *kernel_p = &mb_kernels[k];
+
+        fprintf(fp, " %s", kernel_p->name);
+        if (!kernel_p->available)
+        {
+            fprintf(fp, " n/a");
+        }
+        else if (!kernel_p->verified)
+        {
+            fprintf(fp, " FAILED");
+        }
+        else
+        {
+            fprintf(fp, " %.1f ns/block", kernel_p->ns_per_block);
+        }
+        fputc(k + 1 < N_MB_KERNELS ? ',' : '\n', fp);
+    }
+    fprintf(fp, "multi-buffer kernel%s: %s\n",
+            mb_kernel_forced != NULL ? " (forced by " SHA1_MB_KERNEL_ENV ")" : "",
+            mb_kernel_best->name);
+
+    fprintf(fp, "zero-block kernels:");
+    for (size_t k = 0; k < N_ZERO_KERNELS; k++)
+    {
+        const SHA1_ZeroKernel_t *kernel_p = &zero_kernels[k];
+
+        fprintf(fp, " %s", kernel_p->name);
+        if (!kernel_p->available)
+        {
+            fprintf(fp, " n/a");
+        }
+        else if (!kernel_p->verified)
+        {
+            fprintf(fp, " FAILED");
+        }
+        else
+        {
+            fprintf(fp, " %.1f ns/block", kernel_p->ns_per_block);
+        }
+        fputc(k + 1 < N_ZERO_KERNELS ? ',' : '\n', fp);
+    }
+    fprintf(fp, "zero-block kernel: %s\n", zero_kernel_best->name);
+
+    fprintf(fp, "dispatch%s:", kernels_forced != NULL ? " (forced by " SHA1_KERNEL_ENV ")" : "");
+    for (int c = 0; c < SHA1_KERNEL_N_CLASSES; c++)
+    {
+        fprintf(fp, " %s=%s", class_names[c], sha1_kernel_dispatch[c]->name);
+    }
+    fputc('\n', fp);
+}
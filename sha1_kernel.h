@@ -0,0 +1,203 @@
+/* SHA1 compression kernel header file */
+
+#include <stdio.h>
+#include "sha1.h"
+
+#ifndef _SHA1_KERNEL_H_
+#define _SHA1_KERNEL_H_
+
+/*
+ * Interchangeable implementations of the compression function, and the
+ * dispatch table SHA1_process_blocks uses to pick one per call.
+ *
+ *   scalar  the RFC 3174 steps in plain C (sha1.c), always available
+ *   ssse3   message schedule four words at a time with byte-swapping
+ *           PSHUFB, W + K precomputed; scalar steps
+ *   avx2    as ssse3, scheduling two blocks per 256-bit register
+ *   avx512  as ssse3, scheduling four blocks per 512-bit register
+ *   shani   the SHA extensions (SHA1RNDS4, SHA1NEXTE, SHA1MSG1/2)
+ *
+ * On first use every kernel the CPU supports is checked against the
+ * RFC 3174 test vectors and against the scalar kernel on 1..17 block
+ * runs; a kernel that fails is never used. The survivors are then timed
+ * on each size class (blocks per call) and the fastest one per class is
+ * installed. Setting SHA1_KERNEL to a kernel name forces that kernel for
+ * every class instead; "auto" or unset means measure.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_KERNEL_ENV "SHA1_KERNEL"
+
+/*
+ * Size classes, by blocks per call: 1, 2-7, 8-63, 64-1023, 1024+
+ */
+#define SHA1_KERNEL_N_CLASSES 5
+
+typedef void (*SHA1_compress_fn_t)(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks);
+
+typedef struct SHA1_Kernel {
+    const char *name;            /* as accepted by SHA1_KERNEL */
+    int id;                      /* SHA1_KERNEL value, for statistics */
+    SHA1_compress_fn_t compress; /* compress n_blocks blocks into hash */
+    int available;               /* the CPU has the instructions */
+    int verified;                /* passed the self-test */
+    double ns_per_block[SHA1_KERNEL_N_CLASSES]; /* measured, 0 if not */
+} SHA1_Kernel_t, *SHA1_Kernel_p_t;
+
+/*
+ * Internal state used by SHA1_kernel_for; not for direct use
+ */
+extern int sha1_kernels_ready;
+extern const SHA1_Kernel_t *sha1_kernel_dispatch[SHA1_KERNEL_N_CLASSES];
+
+/*
+ * SCALAR COMPRESS
+ * The portable kernel (sha1.c).
+ */
+void SHA1_compress_scalar(SHA1_WORD_t hash[5], const uint8_t *data, size_t n_blocks);
+
+/*
+ * INIT
+ * Self-test, benchmark and install the dispatch table. Runs once per
+ * process however often and from however many threads it is called;
+ * SHA1_kernel_for calls it on first use.
+ */
+void SHA1_kernels_init(void);
+
+/*
+ * KERNEL CLASS
+ * Size class of a call compressing n_blocks blocks.
+ */
+static inline int SHA1_kernel_class(size_t n_blocks)
+{
+    return n_blocks < 2 ? 0 : n_blocks < 8 ? 1 : n_blocks < 64 ? 2 : n_blocks < 1024 ? 3 : 4;
+}
+
+/*
+ * KERNEL FOR
+ * The kernel installed for calls of n_blocks blocks.
+ */
+static inline const SHA1_Kernel_t *SHA1_kernel_for(size_t n_blocks)
+{
+    if (__builtin_expect(!__atomic_load_n(&sha1_kernels_ready, __ATOMIC_ACQUIRE), 0))
+    {
+        SHA1_kernels_init();
+    }
+    return sha1_kernel_dispatch[SHA1_kernel_class(n_blocks)];
+}
+
+/*
+ * KERNEL BY NAME
+ * Look up a kernel by name, whether or not it is usable.
+ *
+ * Returns
+ *  the kernel, or NULL if no kernel has that name
+ */
+const SHA1_Kernel_t *SHA1_kernel_by_name(const char *name);
+
+/*
+ * MULTI-BUFFER KERNELS
+ *
+ * These compress one block of each of several independent messages at
+ * once, message i in 32-bit SIMD lane i, so that n messages cost about
+ * as much as one: the steps run on vectors of lanes instead of words.
+ *
+ *   avx2x8     8 lanes in 256-bit registers
+ *   avx512x16  16 lanes in 512-bit registers, with VPROLD/VPTERNLOGD
+ *   serial     no SIMD: the lanes one after another through the
+ *              single-buffer kernel installed above (8 lanes)
+ *
+ * State is kept as structure-of-arrays, state[word][lane]. Each kernel
+ * is self-tested against the scalar kernel and timed like the others;
+ * SHA1_mb_kernel returns the fastest per block, which may well be
+ * "serial" on a CPU with SHA-NI. SHA1_MB_KERNEL forces one by name.
+ */
+#define SHA1_MB_KERNEL_ENV "SHA1_MB_KERNEL"
+#define SHA1_MB_MAX_LANES  16
+
+/*
+ * Compress n_blocks blocks of every lane in the mask active, advancing
+ * data[lane] past them. The SIMD kernels also compute the lanes not in
+ * active, so every data[lane] must point at n_blocks readable blocks
+ * (callers point idle lanes at a busy lane's data); their state is junk
+ * afterwards.
+ */
+typedef void (*SHA1_mb_compress_fn_t)(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES],
+                                      const uint8_t *data[SHA1_MB_MAX_LANES],
+                                      unsigned active, size_t n_blocks);
+
+typedef struct SHA1_MbKernel {
+    const char *name;            /* as accepted by SHA1_MB_KERNEL */
+    int id;                      /* SHA1_KERNEL value; -1 for serial */
+    int lanes;                   /* messages per call */
+    SHA1_mb_compress_fn_t compress;
+    int available;
+    int verified;
+    double ns_per_block;         /* per block of one lane, all lanes busy */
+} SHA1_MbKernel_t, *SHA1_MbKernel_p_t;
+
+/*
+ * MB KERNEL
+ * The fastest verified multi-buffer kernel (or the forced one).
+ */
+const SHA1_MbKernel_t *SHA1_mb_kernel(void);
+
+/*
+ * MB KERNEL SERIAL
+ * The "serial" multi-buffer kernel, always usable.
+ */
+const SHA1_MbKernel_t *SHA1_mb_kernel_serial(void);
+
+/*
+ * MB COMPRESS
+ * Compress n_blocks blocks of every lane in active (at most
+ * SHA1_mb_kernel()->lanes lanes) with the fastest multi-buffer kernel,
+ * or with "serial" when too few lanes are active to pay for a SIMD
+ * call. data[] of idle lanes is overwritten. An empty active does
+ * nothing.
+ */
+void SHA1_mb_compress(SHA1_WORD_t state[5][SHA1_MB_MAX_LANES], const uint8_t *data[SHA1_MB_MAX_LANES],
+                      unsigned active, size_t n_blocks);
+
+/*
+ * ZERO-BLOCK KERNELS
+ *
+ * Compress n_blocks blocks of zero bytes without being given them. The
+ * schedule of an all-zero block is all zero, so these run the 80 steps
+ * on a precomputed W + K (which is just K) and skip the schedule:
+ *
+ *   shani   SHA1RNDS4/SHA1NEXTE on zero message words, no SHA1MSG1/2
+ *   scalar  the unrolled steps of the SIMD kernels on a constant table
+ *
+ * Each is self-tested against the scalar kernel on real zero blocks
+ * and timed; the fastest is used. SHA1_KERNEL, if set, restricts the
+ * choice to the forced kernel's counterpart (or scalar).
+ */
+typedef void (*SHA1_compress_zeros_fn_t)(SHA1_WORD_t hash[5], uint64_t n_blocks);
+
+typedef struct SHA1_ZeroKernel {
+    const char *name;            /* that of the kernel it stands in for */
+    SHA1_compress_zeros_fn_t compress;
+    int available;
+    int verified;
+    double ns_per_block;
+} SHA1_ZeroKernel_t, *SHA1_ZeroKernel_p_t;
+
+/*
+ * COMPRESS ZEROS
+ * Compress n_blocks all-zero blocks into hash with the fastest
+ * zero-block kernel. SHA1_process_zero_blocks is the counted,
+ * collision-detecting entry point.
+ */
+void SHA1_compress_zeros(SHA1_WORD_t hash[5], uint64_t n_blocks);
+
+/*
+ * PRINT
+ * Write every kernel's self-test result and timings, and the installed
+ * dispatch table, to fp.
+ */
+void SHA1_kernels_print(FILE *fp);
+
+#endif /* _SHA1_KERNEL_H_ */
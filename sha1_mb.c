@@ -0,0 +1,269 @@
+/*
+ * Multi-buffer job manager
+ */
+
+#include "sha1_mb.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A job's segment is compressed in up to three pieces: the block its
+ * leftover bytes make up with the start of the segment, the whole
+ * blocks of the segment in place, and, for the last segment, the one
+ * or two padded final blocks
+ */
+enum job_stage {
+    STAGE_PARTIAL = 0,
+    STAGE_BLOCKS,
+    STAGE_TAIL,
+    STAGE_DONE
+};
+
+/*
+ * Point *data_pp / *n_blocks_p at the next piece of the job to compress.
+ * Returns 0 once the segment is consumed; the job is then complete (and
+ * its digest set after a SHA1_JOB_LAST segment).
+ */
+static int job_next_segment(SHA1_Job_p_t job_p, const uint8_t **data_pp, size_t *n_blocks_p)
+{
+    switch (job_p->stage)
+    {
+        case STAGE_PARTIAL:
+            job_p->stage = STAGE_BLOCKS;
+            if (job_p->partial_len > 0)
+            {
+                size_t take = SHA1_BLOCK_SIZE - job_p->partial_len;
+
+                if (take > job_p->rest_len)
+                {
+                    take = job_p->rest_len;
+                }
+                memcpy(job_p->partial + job_p->partial_len, job_p->rest, take);
+                job_p->partial_len += take;
+                job_p->rest += take;
+                job_p->rest_len -= take;
+                if (job_p->partial_len == SHA1_BLOCK_SIZE)
+                {
+                    job_p->partial_len = 0;
+                    *data_pp = job_p->partial;
+                    *n_blocks_p = 1;
+                    return 1;
+                }
+            }
+            /* fall through */
+
+        case STAGE_BLOCKS:
+            job_p->stage = STAGE_TAIL;
+            if (job_p->rest_len >= SHA1_BLOCK_SIZE)
+            {
+                size_t n_blocks = job_p->rest_len / SHA1_BLOCK_SIZE;
+
+                *data_pp = job_p->rest;
+                *n_blocks_p = n_blocks;
+                job_p->rest += n_blocks * SHA1_BLOCK_SIZE;
+                job_p->rest_len -= n_blocks * SHA1_BLOCK_SIZE;
+                return 1;
+            }
+            /* fall through */
+
+        case STAGE_TAIL:
+            job_p->stage = STAGE_DONE;
+            memcpy(job_p->partial + job_p->partial_len, job_p->rest, job_p->rest_len);
+            job_p->partial_len += job_p->rest_len;
+            job_p->rest_len = 0;
+            if (job_p->flags & SHA1_JOB_LAST)
+            {
+                size_t len = job_p->partial_len < 56 ? SHA1_BLOCK_SIZE : 2 * SHA1_BLOCK_SIZE;
+                uint64_t bits = job_p->msg_length * 8;
+
+                job_p->partial[job_p->partial_len] = 0x80;
+                memset(job_p->partial + job_p->partial_len + 1, 0, len - job_p->partial_len - 1);
+                for (int i = 0; i < 8; i++)
+                {
+                    job_p->partial[len - 1 - i] = (uint8_t)(bits >> (8 * i));
+                }
+                job_p->partial_len = 0;
+                *data_pp = job_p->partial;
+                *n_blocks_p = len / SHA1_BLOCK_SIZE;
+                return 1;
+            }
+            /* fall through */
+
+        default:
+            if (job_p->flags & SHA1_JOB_LAST)
+            {
+                SHA1_SHA1Object_t sha1;
+
+                memcpy(sha1.temp_hash, job_p->hash, sizeof(sha1.temp_hash));
+                SHA1_get_digest(&sha1, job_p->digest);
+            }
+            job_p->status = SHA1_JOB_COMPLETED;
+            return 0;
+    }
+}
+
+static void push_done(SHA1_JobManager_p_t mgr_p, SHA1_Job_p_t job_p)
+{
+    unsigned cap = sizeof(mgr_p->done) / sizeof(mgr_p->done[0]);
+
+    mgr_p->done[(mgr_p->done_head + mgr_p->done_count) % cap] = job_p;
+    mgr_p->done_count++;
+}
+
+static SHA1_Job_p_t pop_done(SHA1_JobManager_p_t mgr_p)
+{
+    unsigned cap = sizeof(mgr_p->done) / sizeof(mgr_p->done[0]);
+    SHA1_Job_p_t job_p;
+
+    if (mgr_p->done_count == 0)
+    {
+        return NULL;
+    }
+    job_p = mgr_p->done[mgr_p->done_head];
+    mgr_p->done_head = (mgr_p->done_head + 1) % cap;
+    mgr_p->done_count--;
+    return job_p;
+}
+
+/*
+ * Lane's segment is finished: move its job on to the next piece, or
+ * retire it
+ */
+static void advance_lane(SHA1_JobManager_p_t mgr_p, int lane)
+{
+    SHA1_Job_p_t job_p = mgr_p->jobs[lane];
+
+    for (int k = 0; k < 5; k++)
+    {
+        job_p->hash[k] = mgr_p->state[k][lane];
+    }
+    if (job_next_segment(job_p, &mgr_p->data[lane], &mgr_p->blocks[lane]))
+    {
+        return;
+    }
+
+    mgr_p->busy &= ~(1u << lane);
+    mgr_p->jobs[lane] = NULL;
+    push_done(mgr_p, job_p);
+}
+
+/*
+ * Compress every busy lane as far as the shortest segment among them
+ */
+static void run_lanes(SHA1_JobManager_p_t mgr_p)
+{
+    unsigned busy = mgr_p->busy;
+    size_t n_blocks = SIZE_MAX;
+
+    for (int lane = 0; lane < mgr_p->n_lanes; lane++)
+    {
+        if ((busy & (1u << lane)) && mgr_p->blocks[lane] < n_blocks)
+        {
+            n_blocks = mgr_p->blocks[lane];
+        }
+    }
+
+    SHA1_mb_compress(mgr_p->state, mgr_p->data, busy, n_blocks);
+
+    for (int lane = 0; lane < mgr_p->n_lanes; lane++)
+    {
+        if (busy & (1u << lane))
+        {
+            mgr_p->blocks[lane] -= n_blocks;
+            if (mgr_p->blocks[lane] == 0)
+            {
+                advance_lane(mgr_p, lane);
+            }
+        }
+    }
+}
+
+void SHA1_mgr_init(SHA1_JobManager_p_t mgr_p)
+{
+    memset(mgr_p, 0, sizeof(*mgr_p));
+    mgr_p->n_lanes = SHA1_mb_kernel()->lanes;
+}
+
+SHA1_Job_p_t SHA1_mgr_submit(SHA1_JobManager_p_t mgr_p, SHA1_Job_p_t job_p)
+{
+    unsigned all = (1u << mgr_p->n_lanes) - 1;
+    const uint8_t *data;
+    size_t n_blocks;
+    int lane;
+
+    if (job_p->flags & SHA1_JOB_FIRST)
+    {
+        SHA1_SHA1Object_t sha1;
+
+        SHA1_init_hash(&sha1);
+        memcpy(job_p->hash, sha1.temp_hash, sizeof(job_p->hash));
+        job_p->msg_length = 0;
+        job_p->partial_len = 0;
+    }
+    job_p->rest = job_p->buffer;
+    job_p->rest_len = job_p->len;
+    job_p->msg_length += job_p->len;
+    job_p->stage = STAGE_PARTIAL;
+    job_p->status = SHA1_JOB_PROCESSING;
+    job_p->err = SHA1_SUCCESS;
+
+    /*
+     * Too short to fill a block: done already
+     */
+    if (!job_next_segment(job_p, &data, &n_blocks))
+    {
+        return job_p;
+    }
+
+    if (SHA1_get_collision_detection())
+    {
+        do
+        {
+            if (SHA1_process_blocks(job_p->hash, data, n_blocks) == SHA1_COLLISION_DETECTED)
+            {
+                job_p->err = SHA1_COLLISION_DETECTED;
+            }
+        } while (job_next_segment(job_p, &data, &n_blocks));
+
+        return job_p;
+    }
+
+    /*
+     * A previous submit may have returned a queued job instead of
+     * running; make room first
+     */
+    while (mgr_p->busy == all)
+    {
+        run_lanes(mgr_p);
+    }
+
+    lane = __builtin_ctz(~mgr_p->busy & all);
+    for (int k = 0; k < 5; k++)
+    {
+        mgr_p->state[k][lane] = job_p->hash[k];
+    }
+    mgr_p->data[lane] = data;
+    mgr_p->blocks[lane] = n_blocks;
+    mgr_p->jobs[lane] = job_p;
+    mgr_p->busy |= 1u << lane;
+
+    /*
+     * All lanes busy: run them until a job is done
+     */
+    while (mgr_p->busy == all)
+    {
+        run_lanes(mgr_p);
+    }
+
+    return pop_done(mgr_p);
+}
+
+SHA1_Job_p_t SHA1_mgr_flush(SHA1_JobManager_p_t mgr_p)
+{
+    while (mgr_p->done_count == 0 && mgr_p->busy != 0)
+    {
+        run_lanes(mgr_p);
+    }
+
+    return pop_done(mgr_p);
+}
@@ -0,0 +1,116 @@
+/* SHA1 multi-buffer job manager header file */
+
+#include "sha1.h"
+#include "sha1_kernel.h"
+
+#ifndef _SHA1_MB_H_
+#define _SHA1_MB_H_
+
+/*
+ * Submit/flush job manager in the style of isa-l_crypto's mb_mgr, so a
+ * single thread that produces hashing work one job at a time can still
+ * keep the lanes of a multi-buffer kernel (sha1_kernel.h) busy.
+ *
+ * A job is one message, hashed from one or more segments. For every
+ * segment the caller sets buffer, len and flags and submits the job;
+ * SHA1_JOB_FIRST starts a new message, SHA1_JOB_LAST finishes it (both
+ * for a message in one piece). The buffer must stay valid until the job
+ * is handed back.
+ *
+ * SHA1_mgr_submit puts the job in a free lane. Nothing is compressed
+ * until every lane is busy; then the lanes run together until at least
+ * one job is done with its segment, and a completed job is returned
+ * (not necessarily the one just submitted; NULL if none completed).
+ * SHA1_mgr_flush runs the lanes that are busy without waiting for the
+ * rest to fill and returns the next completed job, NULL once the manager
+ * is empty. Every submitted job comes back exactly once per submit, with
+ * status SHA1_JOB_COMPLETED; after a SHA1_JOB_LAST segment its digest
+ * is set.
+ *
+ * Bytes that do not fill a whole block are kept in the job between
+ * segments, and a segment too short to complete a block is finished on
+ * the spot. With collision detection on (SHA1_set_collision_detection),
+ * jobs are hashed at submit time by SHA1_process_blocks instead, since
+ * only the single-buffer path can detect collisions.
+ */
+
+typedef enum _sha1_job_flags
+{
+    SHA1_JOB_UPDATE = 0,     /* a middle segment */
+    SHA1_JOB_FIRST  = 1,     /* the first segment of a message */
+    SHA1_JOB_LAST   = 2,     /* the last segment: pad and produce digest */
+    SHA1_JOB_ENTIRE = 3      /* the whole message in one segment */
+} SHA1_JOB_FLAGS;
+
+typedef enum _sha1_job_status
+{
+    SHA1_JOB_IDLE = 0,       /* never submitted */
+    SHA1_JOB_PROCESSING,     /* owned by the manager */
+    SHA1_JOB_COMPLETED       /* handed back; segment consumed */
+} SHA1_JOB_STATUS;
+
+typedef struct SHA1_Job {
+    /*
+     * Set by the caller before every submit
+     */
+    const uint8_t *buffer;   /* this segment */
+    size_t len;
+    int flags;               /* SHA1_JOB_FLAGS */
+    void *user_data;         /* not touched by the manager */
+
+    /*
+     * Results
+     */
+    int status;              /* SHA1_JOB_STATUS */
+    SHA1_ERRCODE err;        /* SHA1_COLLISION_DETECTED, else SHA1_SUCCESS */
+    SHA1_DIGEST_t digest;    /* valid once a SHA1_JOB_LAST segment completed */
+
+    /*
+     * Internal, carried from segment to segment
+     */
+    SHA1_WORD_t hash[5];
+    uint64_t msg_length;     /* bytes submitted so far */
+    const uint8_t *rest;     /* unconsumed part of this segment */
+    size_t rest_len;
+    int stage;
+    uint32_t partial_len;    /* bytes waiting in partial */
+    uint8_t partial[2 * SHA1_BLOCK_SIZE]; /* leftover bytes, then padding */
+} SHA1_Job_t, *SHA1_Job_p_t;
+
+typedef struct SHA1_JobManager {
+    SHA1_WORD_t state[5][SHA1_MB_MAX_LANES] __attribute__((aligned(64)));
+    const uint8_t *data[SHA1_MB_MAX_LANES];  /* next block of each lane */
+    size_t blocks[SHA1_MB_MAX_LANES];        /* blocks left in its segment */
+    SHA1_Job_t *jobs[SHA1_MB_MAX_LANES];     /* job in each lane */
+    unsigned busy;                           /* mask of lanes with a job */
+    int n_lanes;
+    SHA1_Job_t *done[2 * SHA1_MB_MAX_LANES]; /* completed, not yet returned */
+    unsigned done_head;
+    unsigned done_count;
+} SHA1_JobManager_t, *SHA1_JobManager_p_t;
+
+/*
+ * MGR INIT
+ * Set up an empty manager using the fastest multi-buffer kernel.
+ */
+void SHA1_mgr_init(SHA1_JobManager_p_t mgr_p);
+
+/*
+ * MGR SUBMIT
+ * Hand a job's next segment to the manager.
+ *
+ * Returns
+ *  a completed job, or NULL
+ */
+SHA1_Job_p_t SHA1_mgr_submit(SHA1_JobManager_p_t mgr_p, SHA1_Job_p_t job_p);
+
+/*
+ * MGR FLUSH
+ * Make progress without new work.
+ *
+ * Returns
+ *  a completed job, or NULL once no job is left in the manager
+ */
+SHA1_Job_p_t SHA1_mgr_flush(SHA1_JobManager_p_t mgr_p);
+
+#endif /* _SHA1_MB_H_ */
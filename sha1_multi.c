@@ -0,0 +1,424 @@
+/*
+ * Single-pass multi-digest computation: SHA-1, CRC32C and SHA-256
+ */
+
+#include "sha1_multi.h"
+#include "sha1_file.h"
+#include "sha1_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * CRC32C
+ */
+#define CRC32C_POLY 0x82F63B78u /* reflected Castagnoli polynomial */
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_table_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    for (; len > 0 && ((uintptr_t)data & 7); len--)
+    {
+        crc64 = _mm_crc32_u8((uint32_t)crc64, *data++);
+    }
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    for (; len > 0; len--)
+    {
+        crc64 = _mm_crc32_u8((uint32_t)crc64, *data++);
+    }
+    return (uint32_t)crc64;
+}
+#endif
+
+/*
+ * SHA-256 (FIPS 180-4)
+ */
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress_scalar(uint32_t state[8], const uint8_t *data, size_t n_blocks)
+{
+    for (; n_blocks > 0; n_blocks--, data += SHA1_BLOCK_SIZE)
+    {
+        uint32_t w[64];
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int t = 0; t < 16; t++)
+        {
+            w[t] = (uint32_t)data[4 * t] << 24 | (uint32_t)data[4 * t + 1] << 16 |
+                   (uint32_t)data[4 * t + 2] << 8 | data[4 * t + 3];
+        }
+        for (int t = 16; t < 64; t++)
+        {
+            uint32_t s0 = ROR32(w[t - 15], 7) ^ ROR32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROR32(w[t - 2], 17) ^ ROR32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        for (int t = 0; t < 64; t++)
+        {
+            uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+                          ((e & f) ^ (~e & g)) + sha256_k[t] + w[t];
+            uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ * Four rounds of the SHA extensions: message words 4i..4i+3 are loaded
+ * (i < 4) or scheduled from the previous sixteen, kept as a ring of four
+ * vectors
+ */
+#define SHA256_SHANI_GROUP(i)                                                   \
+    do {                                                                        \
+        __m128i wk_;                                                            \
+        if ((i) < 4)                                                            \
+        {                                                                       \
+            msg[(i) & 3] = _mm_shuffle_epi8(                                    \
+                _mm_loadu_si128((const __m128i *)(data + 16 * (i))), bswap);    \
+        }                                                                       \
+        else                                                                    \
+        {                                                                       \
+            msg[(i) & 3] = _mm_sha256msg2_epu32(                                \
+                _mm_add_epi32(_mm_sha256msg1_epu32(msg[(i) & 3], msg[((i) + 1) & 3]), \
+                              _mm_alignr_epi8(msg[((i) + 3) & 3], msg[((i) + 2) & 3], 4)), \
+                msg[((i) + 3) & 3]);                                            \
+        }                                                                       \
+        wk_ = _mm_add_epi32(msg[(i) & 3],                                       \
+                            _mm_load_si128((const __m128i *)(sha256_k + 4 * (i)))); \
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk_);                          \
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk_, 0x0E)); \
+    } while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256_compress_shani(uint32_t state[8], const uint8_t *data, size_t n_blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i abef, cdgh, abef_save, cdgh_save, tmp, msg[4];
+
+    /*
+     * The round instructions want (A, B, E, F) and (C, D, G, H)
+     */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; n_blocks > 0; n_blocks--, data += SHA1_BLOCK_SIZE)
+    {
+        abef_save = abef;
+        cdgh_save = cdgh;
+
+        SHA256_SHANI_GROUP(0);  SHA256_SHANI_GROUP(1);  SHA256_SHANI_GROUP(2);  SHA256_SHANI_GROUP(3);
+        SHA256_SHANI_GROUP(4);  SHA256_SHANI_GROUP(5);  SHA256_SHANI_GROUP(6);  SHA256_SHANI_GROUP(7);
+        SHA256_SHANI_GROUP(8);  SHA256_SHANI_GROUP(9);  SHA256_SHANI_GROUP(10); SHA256_SHANI_GROUP(11);
+        SHA256_SHANI_GROUP(12); SHA256_SHANI_GROUP(13); SHA256_SHANI_GROUP(14); SHA256_SHANI_GROUP(15);
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif
+
+/*
+ * DISPATCH
+ */
+static pthread_once_t multi_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc32c_update)(uint32_t, const uint8_t *, size_t) = crc32c_table_update;
+static void (*sha256_compress)(uint32_t[8], const uint8_t *, size_t) = sha256_compress_scalar;
+
+static void multi_setup(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        }
+        crc32c_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_update = crc32c_sse42_update;
+    }
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1") &&
+        __builtin_cpu_supports("ssse3"))
+    {
+        sha256_compress = sha256_compress_shani;
+    }
+#endif
+}
+
+/*
+ * CRC32C
+ */
+uint32_t SHA1_crc32c(uint32_t crc, const uint8_t *data, size_t len)
+{
+    pthread_once(&multi_once, multi_setup);
+    return ~crc32c_update(~crc, data, len);
+}
+
+/*
+ * SHA-256 of the next len bytes, buffering the partial block in multi_p;
+ * multi_p->length still counts the bytes before these
+ */
+static void sha256_update(SHA1_Multi_p_t multi_p, const uint8_t *data, size_t len)
+{
+    size_t used = multi_p->length % SHA1_BLOCK_SIZE;
+    size_t n_blocks;
+
+    if (used > 0)
+    {
+        size_t take = SHA1_BLOCK_SIZE - used < len ? SHA1_BLOCK_SIZE - used : len;
+
+        memcpy(multi_p->sha256_buffer + used, data, take);
+        data += take;
+        len -= take;
+        if (used + take < SHA1_BLOCK_SIZE)
+        {
+            return;
+        }
+        sha256_compress(multi_p->sha256, multi_p->sha256_buffer, 1);
+    }
+
+    n_blocks = len / SHA1_BLOCK_SIZE;
+    sha256_compress(multi_p->sha256, data, n_blocks);
+    memcpy(multi_p->sha256_buffer, data + n_blocks * SHA1_BLOCK_SIZE, len % SHA1_BLOCK_SIZE);
+}
+
+/*
+ * MULTI INIT
+ */
+void SHA1_multi_init(SHA1_Multi_p_t multi_p, unsigned which)
+{
+    pthread_once(&multi_once, multi_setup);
+
+    SHA1_ctx_init(&multi_p->sha1);
+    memcpy(multi_p->sha256, sha256_init, sizeof(sha256_init));
+    multi_p->crc32c = 0xFFFFFFFFu;
+    multi_p->which = which;
+    multi_p->length = 0;
+}
+
+/*
+ * MULTI UPDATE
+ */
+SHA1_ERRCODE SHA1_multi_update(SHA1_Multi_p_t multi_p, const uint8_t *data, size_t len)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    while (len > 0)
+    {
+        size_t n = len < SHA1_MULTI_CHUNK ? len : SHA1_MULTI_CHUNK;
+
+        /*
+         * The first digest brings the chunk into L1; the others find
+         * it there
+         */
+        if ((multi_p->which & SHA1_MULTI_SHA1) &&
+            SHA1_ctx_update(&multi_p->sha1, data, n) == SHA1_COLLISION_DETECTED)
+        {
+            err = SHA1_COLLISION_DETECTED;
+        }
+        if (multi_p->which & SHA1_MULTI_CRC32C)
+        {
+            multi_p->crc32c = crc32c_update(multi_p->crc32c, data, n);
+        }
+        if (multi_p->which & SHA1_MULTI_SHA256)
+        {
+            sha256_update(multi_p, data, n);
+        }
+
+        multi_p->length += n;
+        data += n;
+        len -= n;
+    }
+
+    return err;
+}
+
+/*
+ * MULTI FINAL
+ */
+SHA1_ERRCODE SHA1_multi_final(SHA1_Multi_p_t multi_p, SHA1_MultiDigest_p_t digest_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    if (multi_p->which & SHA1_MULTI_SHA1)
+    {
+        err = SHA1_ctx_final(&multi_p->sha1, digest_p->sha1);
+    }
+    if (multi_p->which & SHA1_MULTI_CRC32C)
+    {
+        digest_p->crc32c = ~multi_p->crc32c;
+    }
+    if (multi_p->which & SHA1_MULTI_SHA256)
+    {
+        uint8_t tail[2 * SHA1_BLOCK_SIZE] = { 0 };
+        size_t used = multi_p->length % SHA1_BLOCK_SIZE;
+        size_t n_blocks = used < SHA1_BLOCK_SIZE - 8 ? 1 : 2;
+        uint64_t bits = multi_p->length * 8;
+
+        memcpy(tail, multi_p->sha256_buffer, used);
+        tail[used] = 0x80;
+        for (int i = 0; i < 8; i++)
+        {
+            tail[n_blocks * SHA1_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (8 * i));
+        }
+        sha256_compress(multi_p->sha256, tail, n_blocks);
+        for (int i = 0; i < 8; i++)
+        {
+            digest_p->sha256[4 * i] = (uint8_t)(multi_p->sha256[i] >> 24);
+            digest_p->sha256[4 * i + 1] = (uint8_t)(multi_p->sha256[i] >> 16);
+            digest_p->sha256[4 * i + 2] = (uint8_t)(multi_p->sha256[i] >> 8);
+            digest_p->sha256[4 * i + 3] = (uint8_t)multi_p->sha256[i];
+        }
+    }
+
+    return err;
+}
+
+/*
+ * MULTI HASH FILE
+ */
+SHA1_ERRCODE SHA1_multi_hash_fd(int fd, unsigned which, SHA1_MultiDigest_p_t digest_p)
+{
+    SHA1_Multi_t multi;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    uint8_t *buf = NULL;
+    int collision = 0;
+    int saved_errno;
+    SHA1_STATS_TIMER(start);
+    SHA1_STATS_TIMER(phase);
+
+    if (posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    SHA1_multi_init(&multi, which);
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, SHA1_FILE_CHUNK);
+
+        SHA1_STATS_ELAPSED(phase, io_ns);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            err = SHA1_IO_ERROR;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        if (SHA1_multi_update(&multi, buf, (size_t)n) == SHA1_COLLISION_DETECTED)
+        {
+            collision = 1;
+        }
+        SHA1_STATS_ELAPSED(phase, compress_ns);
+    }
+
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_multi_final(&multi, digest_p);
+        if (err == SHA1_SUCCESS && collision)
+        {
+            err = SHA1_COLLISION_DETECTED;
+        }
+#if SHA1_STATS
+        if (SHA1_STATS_ON())
+        {
+            SHA1_stats_record_message(multi.length, SHA1_stats_now() - start);
+        }
+#endif
+    }
+
+    saved_errno = errno;
+    free(buf);
+    errno = saved_errno;
+
+    return err;
+}
+
+SHA1_ERRCODE SHA1_multi_hash_file(const char *path, unsigned which, SHA1_MultiDigest_p_t digest_p)
+{
+    SHA1_ERRCODE err;
+    int saved_errno;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    err = SHA1_multi_hash_fd(fd, which, digest_p);
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    return err;
+}
@@ -0,0 +1,106 @@
+/* SHA1 multi-digest header file */
+
+#include "sha1.h"
+#include "sha1_ctx.h"
+
+#ifndef _SHA1_MULTI_H_
+#define _SHA1_MULTI_H_
+
+/*
+ * Compute SHA-1 and other checksums of the same bytes in one pass.
+ *
+ * Input is cut into SHA1_MULTI_CHUNK pieces, small enough to stay in L1
+ * while every selected digest runs over one in turn; files are read
+ * SHA1_FILE_CHUNK at a time, which stays in L2. Each byte therefore
+ * comes from main memory (or the page cache) once, however many digests
+ * are wanted.
+ *
+ * CRC32C (Castagnoli, as in iSCSI and ext4) uses the SSE4.2 crc32
+ * instruction when the CPU has it and a table otherwise; it runs at
+ * several times the speed of SHA-1, so a single dependency chain is
+ * enough. SHA-256 uses the SHA extensions when present.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_MULTI_CHUNK       (16 * 1024) /* bytes per digest before moving on */
+#define SHA256_DIGEST_SIZE     32
+#define SHA256_HEX_SIZE        64
+
+enum {
+    SHA1_MULTI_SHA1   = 1 << 0,
+    SHA1_MULTI_CRC32C = 1 << 1,
+    SHA1_MULTI_SHA256 = 1 << 2
+};
+
+typedef struct SHA1_Multi {
+    SHA1_Ctx_t sha1;
+    uint32_t sha256[8];
+    uint8_t sha256_buffer[SHA1_BLOCK_SIZE];
+    uint32_t crc32c;             /* running value, inverted */
+    unsigned which;              /* SHA1_MULTI_ flags */
+    uint64_t length;
+} SHA1_Multi_t, *SHA1_Multi_p_t;
+
+typedef struct SHA1_MultiDigest {
+    SHA1_DIGEST_t sha1;
+    uint32_t crc32c;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+} SHA1_MultiDigest_t, *SHA1_MultiDigest_p_t;
+
+/*
+ * MULTI INIT
+ * Start a message in multi_p for the digests in which.
+ */
+void SHA1_multi_init(SHA1_Multi_p_t multi_p, unsigned which);
+
+/*
+ * MULTI UPDATE
+ * Feed the next len bytes of the message to every selected digest.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED (see
+ *  SHA1_set_collision_detection)
+ */
+SHA1_ERRCODE SHA1_multi_update(SHA1_Multi_p_t multi_p, const uint8_t *data, size_t len);
+
+/*
+ * MULTI FINAL
+ * Write the selected digests; the others in digest_p are left alone.
+ * multi_p must be initialized again before reuse.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_multi_final(SHA1_Multi_p_t multi_p, SHA1_MultiDigest_p_t digest_p);
+
+/*
+ * MULTI HASH FD
+ * Compute the digests in which of everything readable from fd, up to
+ * end of file (a file, or standard input).
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_ALLOC_ERROR or
+ *  SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_multi_hash_fd(int fd, unsigned which, SHA1_MultiDigest_p_t digest_p);
+
+/*
+ * MULTI HASH FILE
+ * Open path read-only and compute the digests in which of its contents.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_ALLOC_ERROR or
+ *  SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_multi_hash_file(const char *path, unsigned which, SHA1_MultiDigest_p_t digest_p);
+
+/*
+ * CRC32C
+ * Continue the CRC32C crc of some earlier bytes over len more (start
+ * with crc 0).
+ */
+uint32_t SHA1_crc32c(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif /* _SHA1_MULTI_H_ */
@@ -0,0 +1,224 @@
+/*
+ * Buffered sha1sum-compatible output
+ */
+
+#include "sha1_output.h"
+#include "sha1_hex.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Write all of buf to fd, retrying on short writes and EINTR
+ */
+static SHA1_ERRCODE write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return SHA1_IO_ERROR;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return SHA1_SUCCESS;
+}
+
+SHA1_ERRCODE SHA1_writer_init(SHA1_Writer_p_t writer_p, int fd, size_t cap)
+{
+    if (cap == 0)
+    {
+        cap = SHA1_WRITER_DEFAULT_CAP;
+    }
+
+    writer_p->fd = fd;
+    writer_p->zero_terminated = 0;
+    writer_p->len = 0;
+    writer_p->cap = cap;
+    writer_p->buf = malloc(cap);
+
+    return writer_p->buf == NULL ? SHA1_ALLOC_ERROR : SHA1_SUCCESS;
+}
+
+SHA1_ERRCODE SHA1_writer_flush(SHA1_Writer_p_t writer_p)
+{
+    SHA1_ERRCODE err = write_all(writer_p->fd, writer_p->buf, writer_p->len);
+
+    writer_p->len = 0;
+    return err;
+}
+
+void SHA1_writer_free(SHA1_Writer_p_t writer_p)
+{
+    free(writer_p->buf);
+    writer_p->buf = NULL;
+    writer_p->len = writer_p->cap = 0;
+}
+
+/*
+ * Make room for need bytes, flushing if required. Returns nonzero if the
+ * bytes still do not fit (need > cap) and the caller must write directly.
+ */
+static int writer_reserve(SHA1_Writer_p_t writer_p, size_t need, SHA1_ERRCODE *err)
+{
+    *err = SHA1_SUCCESS;
+
+    if (writer_p->cap - writer_p->len >= need)
+    {
+        return 0;
+    }
+
+    *err = SHA1_writer_flush(writer_p);
+    return need > writer_p->cap;
+}
+
+SHA1_ERRCODE SHA1_writer_put(SHA1_Writer_p_t writer_p, const char *str, size_t len)
+{
+    SHA1_ERRCODE err;
+
+    if (writer_reserve(writer_p, len, &err))
+    {
+        return err != SHA1_SUCCESS ? err : write_all(writer_p->fd, str, len);
+    }
+
+    memcpy(writer_p->buf + writer_p->len, str, len);
+    writer_p->len += len;
+    return err;
+}
+
+int SHA1_name_needs_escape(const char *name)
+{
+    return strpbrk(name, "\\\n\r") != NULL;
+}
+
+SHA1_ERRCODE SHA1_writer_put_name(SHA1_Writer_p_t writer_p, const char *name)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    const char *run = name;
+
+    if (writer_p->zero_terminated)
+    {
+        return SHA1_writer_put(writer_p, name, strlen(name));
+    }
+
+    /*
+     * Copy runs of ordinary characters in one go, escaping in between
+     */
+    for (;;)
+    {
+        size_t plain = strcspn(run, "\\\n\r");
+        const char *escape;
+
+        err = SHA1_writer_put(writer_p, run, plain);
+        if (err != SHA1_SUCCESS || run[plain] == '\0')
+        {
+            return err;
+        }
+
+        escape = run[plain] == '\\' ? "\\\\" : run[plain] == '\n' ? "\\n" : "\\r";
+        err = SHA1_writer_put(writer_p, escape, 2);
+        if (err != SHA1_SUCCESS)
+        {
+            return err;
+        }
+        run += plain + 1;
+    }
+}
+
+SHA1_ERRCODE SHA1_writer_put_tag(SHA1_Writer_p_t writer_p, const char *algo, const char *hex,
+                                 size_t hex_len, const char *name)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    char eol = writer_p->zero_terminated ? '\0' : '\n';
+
+    if (!writer_p->zero_terminated && SHA1_name_needs_escape(name))
+    {
+        err = SHA1_writer_put(writer_p, "\\", 1);
+    }
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, algo, strlen(algo));
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, " (", 2);
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put_name(writer_p, name);
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, ") = ", 4);
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, hex, hex_len);
+    if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, &eol, 1);
+    return err;
+}
+
+SHA1_ERRCODE SHA1_writer_put_digest(SHA1_Writer_p_t writer_p, const SHA1_DIGEST_t digest,
+                                    const char *name, SHA1_FORMAT format)
+{
+    SHA1_ERRCODE err;
+    size_t name_len = strlen(name);
+    int escaped = !writer_p->zero_terminated && SHA1_name_needs_escape(name);
+    char eol = writer_p->zero_terminated ? '\0' : '\n';
+    char *out;
+
+    /*
+     * Slow path: escaped names, or a line too long for the buffer
+     */
+    if (escaped || writer_reserve(writer_p, name_len + SHA1_HEX_SIZE + 16, &err))
+    {
+        char hex[SHA1_HEX_SIZE];
+
+        SHA1_digest_to_hex(digest, hex);
+        err = SHA1_SUCCESS;
+        if (escaped)
+        {
+            err = SHA1_writer_put(writer_p, "\\", 1);
+        }
+        if (format == SHA1_FORMAT_TAG)
+        {
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, "SHA1 (", 6);
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put_name(writer_p, name);
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, ") = ", 4);
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, hex, SHA1_HEX_SIZE);
+        }
+        else
+        {
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, hex, SHA1_HEX_SIZE);
+            if (err == SHA1_SUCCESS)
+                err = SHA1_writer_put(writer_p, format == SHA1_FORMAT_BINARY ? " *" : "  ", 2);
+            if (err == SHA1_SUCCESS) err = SHA1_writer_put_name(writer_p, name);
+        }
+        if (err == SHA1_SUCCESS) err = SHA1_writer_put(writer_p, &eol, 1);
+        return err;
+    }
+    if (err != SHA1_SUCCESS)
+    {
+        return err;
+    }
+
+    /*
+     * Fast path: format the whole line in place
+     */
+    out = writer_p->buf + writer_p->len;
+    if (format == SHA1_FORMAT_TAG)
+    {
+        memcpy(out, "SHA1 (", 6);
+        memcpy(out + 6, name, name_len);
+        out += 6 + name_len;
+        memcpy(out, ") = ", 4);
+        SHA1_digest_to_hex(digest, out + 4);
+        out += 4 + SHA1_HEX_SIZE;
+    }
+    else
+    {
+        SHA1_digest_to_hex(digest, out);
+        out[SHA1_HEX_SIZE] = ' ';
+        out[SHA1_HEX_SIZE + 1] = format == SHA1_FORMAT_BINARY ? '*' : ' ';
+        memcpy(out + SHA1_HEX_SIZE + 2, name, name_len);
+        out += SHA1_HEX_SIZE + 2 + name_len;
+    }
+    *out++ = eol;
+    writer_p->len = (size_t)(out - writer_p->buf);
+
+    return SHA1_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* SHA1 output writer header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_OUTPUT_H_
+#define _SHA1_OUTPUT_H_
+
+/*
+ * Buffered writer for coreutils sha1sum-compatible lines.
+ *
+ * Lines are formatted straight into one large buffer which is handed to
+ * write(2) only when full (or on SHA1_writer_flush), so hashing many
+ * small files costs one system call per few thousand lines instead of
+ * several stdio calls per line.
+ *
+ * Formats, for digest D and file name N:
+ *
+ *   SHA1_FORMAT_TEXT:   "D  N"             (sha1sum, sha1sum -t)
+ *   SHA1_FORMAT_BINARY: "D *N"             (sha1sum -b)
+ *   SHA1_FORMAT_TAG:    "SHA1 (N) = D"     (sha1sum --tag)
+ *
+ * As in coreutils, a name containing a backslash, newline or carriage
+ * return has those written as the two-character sequences \\, \n and \r,
+ * and the whole line is prefixed with a single backslash, unless the
+ * writer is zero-terminated, in which case lines end in '\0' and names
+ * are written verbatim.
+ */
+
+typedef enum _sha1_format
+{
+    SHA1_FORMAT_TEXT = 0,
+    SHA1_FORMAT_BINARY = 1,
+    SHA1_FORMAT_TAG = 2
+} SHA1_FORMAT;
+
+typedef struct SHA1_Writer {
+    int fd;                  /* destination file descriptor */
+    int zero_terminated;     /* end lines with '\0', never escape */
+    size_t len;              /* bytes currently buffered */
+    size_t cap;              /* buffer capacity */
+    char *buf;               /* output buffer */
+} SHA1_Writer_t, *SHA1_Writer_p_t;
+
+/*
+ * Constants
+ */
+#define SHA1_WRITER_DEFAULT_CAP (256 * 1024)
+
+/*
+ * WRITER INIT
+ * Allocate a writer buffer of cap bytes (SHA1_WRITER_DEFAULT_CAP if 0)
+ * writing to fd.
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_writer_init(SHA1_Writer_p_t writer_p, int fd, size_t cap);
+
+/*
+ * WRITER PUT DIGEST
+ * Append one formatted digest line for name.
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_IO_ERROR if a flush failed
+ */
+SHA1_ERRCODE SHA1_writer_put_digest(SHA1_Writer_p_t writer_p, const SHA1_DIGEST_t digest,
+                                    const char *name, SHA1_FORMAT format);
+
+/*
+ * WRITER PUT TAG
+ * Append a BSD-style line "ALGO (name) = hex" for any digest, as
+ * sha256sum --tag and cksum -a print them.
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_IO_ERROR if a flush failed
+ */
+SHA1_ERRCODE SHA1_writer_put_tag(SHA1_Writer_p_t writer_p, const char *algo, const char *hex,
+                                 size_t hex_len, const char *name);
+
+/*
+ * WRITER PUT
+ * Append len raw bytes (status messages etc.).
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_IO_ERROR if a flush failed
+ */
+SHA1_ERRCODE SHA1_writer_put(SHA1_Writer_p_t writer_p, const char *str, size_t len);
+
+/*
+ * WRITER PUT NAME
+ * Append name, escaped as described above unless the writer is
+ * zero-terminated. Does not add the leading backslash marker; use
+ * SHA1_name_needs_escape to decide on that.
+ */
+SHA1_ERRCODE SHA1_writer_put_name(SHA1_Writer_p_t writer_p, const char *name);
+
+/*
+ * NAME NEEDS ESCAPE
+ * Nonzero if name contains a character sha1sum escapes.
+ */
+int SHA1_name_needs_escape(const char *name);
+
+/*
+ * WRITER FLUSH
+ * Write out everything buffered.
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_IO_ERROR
+ */
+SHA1_ERRCODE SHA1_writer_flush(SHA1_Writer_p_t writer_p);
+
+/*
+ * WRITER FREE
+ * Release the buffer. Does not flush.
+ */
+void SHA1_writer_free(SHA1_Writer_p_t writer_p);
+
+#endif /* _SHA1_OUTPUT_H_ */
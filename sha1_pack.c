@@ -0,0 +1,1363 @@
+/*
+ * Parallel verification of git packfiles
+ */
+
+#define _GNU_SOURCE
+#include "sha1_pack.h"
+#include "sha1_ctx.h"
+#include "sha1_hex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * Object types, as stored in the pack
+ */
+#define OBJ_COMMIT    1
+#define OBJ_TREE      2
+#define OBJ_BLOB      3
+#define OBJ_TAG       4
+#define OBJ_OFS_DELTA 6
+#define OBJ_REF_DELTA 7
+
+#define IS_DELTA(type) ((type) == OBJ_OFS_DELTA || (type) == OBJ_REF_DELTA)
+
+#define NO_BASE UINT32_MAX
+
+static const char *const type_names[8] = {
+    NULL, "commit", "tree", "blob", "tag", NULL, "ofs-delta", "ref-delta"
+};
+
+/*
+ * One object, in pack order
+ */
+typedef struct pack_object {
+    uint64_t offset;
+    uint64_t end;            /* of its packed bytes: the next object, or the trailer */
+    uint64_t size;           /* inflated size; of the delta data for deltas */
+    uint32_t idx;            /* position in the index: name and CRC */
+    uint32_t base;           /* position of the delta base, or NO_BASE */
+    uint32_t children;       /* deltas on it not yet verified (atomic) */
+    uint32_t depth;          /* delta chain length */
+    uint8_t type;
+    uint8_t header_len;      /* compressed data at offset + header_len */
+    uint8_t bad;             /* reported by the header pass */
+} pack_object_t;
+
+/*
+ * DELTA BASE CACHE
+ * Resolved objects with deltas still to come. An entry in use (refs > 0)
+ * is never freed; one dropped while in use is freed on its last release.
+ */
+typedef struct cache_entry {
+    uint32_t pos;
+    uint8_t type;
+    int refs;
+    int dead;                /* no longer in the table */
+    uint8_t *data;
+    size_t size;
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev, *lru_next; /* most recently used first */
+} cache_entry_t;
+
+typedef struct pack_cache {
+    pthread_mutex_t lock;
+    cache_entry_t **buckets;
+    size_t mask;
+    cache_entry_t *lru_head, *lru_tail;
+    size_t bytes;
+    size_t budget;
+} pack_cache_t;
+
+/*
+ * A resolved object: either held in the cache or owned
+ */
+typedef struct object_data {
+    const uint8_t *data;
+    size_t size;
+    uint8_t type;
+    cache_entry_t *entry_p;
+    uint8_t *owned;
+} object_data_t;
+
+typedef struct pack_job {
+    const SHA1_PackOptions_t *options_p;
+    const char *pack_path;
+    const uint8_t *pack;
+    size_t pack_size;
+    const uint8_t *idx;
+    size_t idx_size;
+    const uint8_t *names;    /* in the index */
+    const uint8_t *crcs;
+    uint32_t n_objects;
+    pack_object_t *objects;  /* by offset */
+    uint32_t *by_idx;        /* index position -> objects[] position */
+    pack_cache_t cache;
+    size_t next;             /* next object to claim (atomic) */
+    int alloc_failed;
+    int trailers_ok;         /* set by the hash lane */
+} pack_job_t;
+
+typedef struct pack_worker {
+    pack_job_t *job_p;
+    z_stream zs;
+    int zs_ready;
+    size_t n_bad;
+    size_t hits;
+    size_t misses;
+    uint64_t inflated;
+} pack_worker_t;
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_be64(const uint8_t *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+__attribute__((format(printf, 2, 3)))
+static void complain(const pack_job_t *job_p, const char *fmt, ...)
+{
+    va_list ap;
+
+    flockfile(stderr);
+    fprintf(stderr, "%s: %s: ", job_p->options_p->prog_name, job_p->pack_path);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
+
+static void complain_object(const pack_job_t *job_p, const pack_object_t *obj_p, const char *why)
+{
+    char hex[SHA1_HEX_SIZE];
+
+    SHA1_digest_to_hex(job_p->names + (size_t)obj_p->idx * SHA1_DIGEST_SIZE, hex);
+    complain(job_p, "object %.*s at offset %llu: %s", SHA1_HEX_SIZE, hex,
+             (unsigned long long)obj_p->offset, why);
+}
+
+/*
+ * Cache
+ */
+static SHA1_ERRCODE cache_init(pack_cache_t *cache_p, uint32_t n_objects, size_t budget)
+{
+    size_t n_buckets = 1024;
+
+    while (n_buckets < n_objects / 8 && n_buckets < (1u << 20))
+    {
+        n_buckets *= 2;
+    }
+    memset(cache_p, 0, sizeof(*cache_p));
+    cache_p->buckets = calloc(n_buckets, sizeof(*cache_p->buckets));
+    if (cache_p->buckets == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    cache_p->mask = n_buckets - 1;
+    cache_p->budget = budget;
+    pthread_mutex_init(&cache_p->lock, NULL);
+    return SHA1_SUCCESS;
+}
+
+static void cache_unlink(pack_cache_t *cache_p, cache_entry_t *entry_p)
+{
+    cache_entry_t **pp = &cache_p->buckets[entry_p->pos & cache_p->mask];
+
+    while (*pp != entry_p)
+    {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = entry_p->hash_next;
+
+    if (entry_p->lru_prev != NULL)
+    {
+        entry_p->lru_prev->lru_next = entry_p->lru_next;
+    }
+    else
+    {
+        cache_p->lru_head = entry_p->lru_next;
+    }
+    if (entry_p->lru_next != NULL)
+    {
+        entry_p->lru_next->lru_prev = entry_p->lru_prev;
+    }
+    else
+    {
+        cache_p->lru_tail = entry_p->lru_prev;
+    }
+    cache_p->bytes -= entry_p->size;
+    entry_p->dead = 1;
+}
+
+static void cache_touch(pack_cache_t *cache_p, cache_entry_t *entry_p)
+{
+    if (cache_p->lru_head == entry_p)
+    {
+        return;
+    }
+    entry_p->lru_prev->lru_next = entry_p->lru_next;
+    if (entry_p->lru_next != NULL)
+    {
+        entry_p->lru_next->lru_prev = entry_p->lru_prev;
+    }
+    else
+    {
+        cache_p->lru_tail = entry_p->lru_prev;
+    }
+    entry_p->lru_prev = NULL;
+    entry_p->lru_next = cache_p->lru_head;
+    cache_p->lru_head->lru_prev = entry_p;
+    cache_p->lru_head = entry_p;
+}
+
+static void entry_free(cache_entry_t *entry_p)
+{
+    free(entry_p->data);
+    free(entry_p);
+}
+
+static cache_entry_t *cache_get(pack_cache_t *cache_p, uint32_t pos)
+{
+    cache_entry_t *entry_p;
+
+    pthread_mutex_lock(&cache_p->lock);
+    for (entry_p = cache_p->buckets[pos & cache_p->mask]; entry_p != NULL;
+         entry_p = entry_p->hash_next)
+    {
+        if (entry_p->pos == pos)
+        {
+            entry_p->refs++;
+            cache_touch(cache_p, entry_p);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_p->lock);
+    return entry_p;
+}
+
+/*
+ * Take over data as the entry for pos, evicting unused entries from
+ * the cold end to make room. Returns the entry, referenced, or NULL if
+ * it cannot be made to fit (data then still belongs to the caller).
+ */
+static cache_entry_t *cache_put(pack_cache_t *cache_p, uint32_t pos, uint8_t type,
+                                uint8_t *data, size_t size)
+{
+    cache_entry_t *entry_p, *victim_p;
+
+    if (size > cache_p->budget || (entry_p = malloc(sizeof(*entry_p))) == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_p->lock);
+
+    /*
+     * Another worker may have built the same object meanwhile
+     */
+    for (cache_entry_t *other_p = cache_p->buckets[pos & cache_p->mask]; other_p != NULL;
+         other_p = other_p->hash_next)
+    {
+        if (other_p->pos == pos)
+        {
+            other_p->refs++;
+            cache_touch(cache_p, other_p);
+            pthread_mutex_unlock(&cache_p->lock);
+            free(entry_p);
+            free(data);
+            return other_p;
+        }
+    }
+
+    victim_p = cache_p->lru_tail;
+    while (cache_p->bytes + size > cache_p->budget && victim_p != NULL)
+    {
+        cache_entry_t *prev_p = victim_p->lru_prev;
+
+        if (victim_p->refs == 0)
+        {
+            cache_unlink(cache_p, victim_p);
+            entry_free(victim_p);
+        }
+        victim_p = prev_p;
+    }
+    if (cache_p->bytes + size > cache_p->budget)
+    {
+        pthread_mutex_unlock(&cache_p->lock);
+        free(entry_p);
+        return NULL;
+    }
+
+    entry_p->pos = pos;
+    entry_p->type = type;
+    entry_p->refs = 1;
+    entry_p->dead = 0;
+    entry_p->data = data;
+    entry_p->size = size;
+    entry_p->hash_next = cache_p->buckets[pos & cache_p->mask];
+    cache_p->buckets[pos & cache_p->mask] = entry_p;
+    entry_p->lru_prev = NULL;
+    entry_p->lru_next = cache_p->lru_head;
+    if (cache_p->lru_head != NULL)
+    {
+        cache_p->lru_head->lru_prev = entry_p;
+    }
+    else
+    {
+        cache_p->lru_tail = entry_p;
+    }
+    cache_p->lru_head = entry_p;
+    cache_p->bytes += size;
+
+    pthread_mutex_unlock(&cache_p->lock);
+    return entry_p;
+}
+
+static void cache_release(pack_cache_t *cache_p, cache_entry_t *entry_p)
+{
+    int free_it;
+
+    pthread_mutex_lock(&cache_p->lock);
+    free_it = --entry_p->refs == 0 && entry_p->dead;
+    pthread_mutex_unlock(&cache_p->lock);
+    if (free_it)
+    {
+        entry_free(entry_p);
+    }
+}
+
+/*
+ * The last delta on pos has been verified: it will not be needed again
+ */
+static void cache_drop(pack_cache_t *cache_p, uint32_t pos)
+{
+    cache_entry_t *entry_p;
+    int free_it = 0;
+
+    pthread_mutex_lock(&cache_p->lock);
+    for (entry_p = cache_p->buckets[pos & cache_p->mask]; entry_p != NULL;
+         entry_p = entry_p->hash_next)
+    {
+        if (entry_p->pos == pos)
+        {
+            cache_unlink(cache_p, entry_p);
+            free_it = entry_p->refs == 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_p->lock);
+    if (free_it)
+    {
+        entry_free(entry_p);
+    }
+}
+
+static void cache_destroy(pack_cache_t *cache_p)
+{
+    while (cache_p->lru_head != NULL)
+    {
+        cache_entry_t *entry_p = cache_p->lru_head;
+
+        cache_unlink(cache_p, entry_p);
+        entry_free(entry_p);
+    }
+    free(cache_p->buckets);
+    pthread_mutex_destroy(&cache_p->lock);
+}
+
+static void object_release(pack_job_t *job_p, object_data_t *od_p)
+{
+    if (od_p->entry_p != NULL)
+    {
+        cache_release(&job_p->cache, od_p->entry_p);
+    }
+    free(od_p->owned);
+    memset(od_p, 0, sizeof(*od_p));
+}
+
+/*
+ * INFLATE
+ * Inflate the packed data of objects[pos] into a new buffer of exactly
+ * its declared size.
+ */
+static SHA1_ERRCODE inflate_object(pack_worker_t *worker_p, const pack_object_t *obj_p,
+                                   uint8_t **out_pp, const char **why_p)
+{
+    const pack_job_t *job_p = worker_p->job_p;
+    const uint8_t *in = job_p->pack + obj_p->offset + obj_p->header_len;
+    size_t in_left = (size_t)(obj_p->end - obj_p->offset - obj_p->header_len);
+    size_t out_left = (size_t)obj_p->size + 1; /* room to notice a longer stream */
+    uint8_t *out, *outp;
+    int ret;
+
+    /*
+     * zlib cannot expand by more than about 1032:1; a larger size is a
+     * lie, and allocating it would be the first thing to fail
+     */
+    if (obj_p->size / 1032 > in_left + 64)
+    {
+        *why_p = "declared size is impossible for its packed size";
+        return SHA1_BAD_INPUT;
+    }
+    out = outp = malloc(out_left);
+    if (out == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+
+    if (!worker_p->zs_ready)
+    {
+        memset(&worker_p->zs, 0, sizeof(worker_p->zs));
+        if (inflateInit(&worker_p->zs) != Z_OK)
+        {
+            free(out);
+            return SHA1_ALLOC_ERROR;
+        }
+        worker_p->zs_ready = 1;
+    }
+    else
+    {
+        inflateReset(&worker_p->zs);
+    }
+
+    for (;;)
+    {
+        uInt in_chunk = in_left > UINT_MAX ? UINT_MAX : (uInt)in_left;
+        uInt out_chunk = out_left > UINT_MAX ? UINT_MAX : (uInt)out_left;
+        size_t consumed, produced;
+
+        worker_p->zs.next_in = (Bytef *)in;
+        worker_p->zs.avail_in = in_chunk;
+        worker_p->zs.next_out = outp;
+        worker_p->zs.avail_out = out_chunk;
+        ret = inflate(&worker_p->zs, Z_NO_FLUSH);
+        consumed = in_chunk - worker_p->zs.avail_in;
+        produced = out_chunk - worker_p->zs.avail_out;
+        in += consumed;
+        in_left -= consumed;
+        outp += produced;
+        out_left -= produced;
+
+        if (ret == Z_STREAM_END)
+        {
+            break;
+        }
+        if (ret != Z_OK || (consumed == 0 && produced == 0))
+        {
+            free(out);
+            *why_p = ret == Z_MEM_ERROR ? "out of memory" : "corrupt compressed data";
+            return ret == Z_MEM_ERROR ? SHA1_ALLOC_ERROR : SHA1_BAD_INPUT;
+        }
+    }
+
+    if ((uint64_t)(outp - out) != obj_p->size)
+    {
+        free(out);
+        *why_p = "inflated size differs from the header";
+        return SHA1_BAD_INPUT;
+    }
+    if (in_left != 0)
+    {
+        free(out);
+        *why_p = "trailing bytes after the compressed data";
+        return SHA1_BAD_INPUT;
+    }
+
+    worker_p->inflated += obj_p->size;
+    *out_pp = out;
+    return SHA1_SUCCESS;
+}
+
+static int delta_varint(const uint8_t **pp, const uint8_t *end, uint64_t *value_p)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t c;
+
+    do
+    {
+        if (*pp >= end || shift > 63)
+        {
+            return 0;
+        }
+        c = *(*pp)++;
+        value |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    *value_p = value;
+    return 1;
+}
+
+/*
+ * APPLY DELTA
+ * Rebuild an object from its base and a git delta: the two sizes, then
+ * copy (from the base) and insert (literal) instructions.
+ */
+static SHA1_ERRCODE apply_delta(const uint8_t *base, size_t base_size, const uint8_t *delta,
+                                size_t delta_size, uint8_t **out_pp, size_t *out_size_p,
+                                const char **why_p)
+{
+    const uint8_t *p = delta, *end = delta + delta_size;
+    uint64_t src_size, dst_size;
+    uint8_t *out, *q, *q_end;
+
+    if (!delta_varint(&p, end, &src_size) || !delta_varint(&p, end, &dst_size))
+    {
+        *why_p = "truncated delta";
+        return SHA1_BAD_INPUT;
+    }
+    if (src_size != base_size)
+    {
+        *why_p = "delta does not apply to its base (size differs)";
+        return SHA1_BAD_INPUT;
+    }
+    if (dst_size > SIZE_MAX - 1 || (out = malloc((size_t)dst_size + 1)) == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    q = out;
+    q_end = out + dst_size;
+
+    while (p < end)
+    {
+        uint8_t op = *p++;
+
+        if (op & 0x80)
+        {
+            uint64_t off = 0;
+            size_t len = 0;
+
+            for (int i = 0; i < 4; i++)
+            {
+                if (op & (1 << i))
+                {
+                    if (p >= end)
+                    {
+                        goto truncated;
+                    }
+                    off |= (uint64_t)*p++ << (8 * i);
+                }
+            }
+            for (int i = 0; i < 3; i++)
+            {
+                if (op & (0x10 << i))
+                {
+                    if (p >= end)
+                    {
+                        goto truncated;
+                    }
+                    len |= (size_t)*p++ << (8 * i);
+                }
+            }
+            if (len == 0)
+            {
+                len = 0x10000;
+            }
+            if (off > base_size || len > base_size - off || len > (size_t)(q_end - q))
+            {
+                free(out);
+                *why_p = "delta copies from outside its base";
+                return SHA1_BAD_INPUT;
+            }
+            memcpy(q, base + off, len);
+            q += len;
+        }
+        else if (op != 0)
+        {
+            if (op > end - p || op > q_end - q)
+            {
+                goto truncated;
+            }
+            memcpy(q, p, op);
+            p += op;
+            q += op;
+        }
+        else
+        {
+            free(out);
+            *why_p = "reserved delta opcode 0";
+            return SHA1_BAD_INPUT;
+        }
+    }
+
+    if (q != q_end)
+    {
+        free(out);
+        *why_p = "delta result has the wrong size";
+        return SHA1_BAD_INPUT;
+    }
+    *out_pp = out;
+    *out_size_p = (size_t)dst_size;
+    return SHA1_SUCCESS;
+
+truncated:
+    free(out);
+    *why_p = "truncated or overlong delta";
+    return SHA1_BAD_INPUT;
+}
+
+/*
+ * RESOLVE
+ * The full contents of objects[pos], from the cache or rebuilt from
+ * its delta chain (bases first). Kept in the cache if deltas still
+ * depend on it.
+ */
+static SHA1_ERRCODE resolve(pack_worker_t *worker_p, uint32_t pos, int depth,
+                            object_data_t *od_p, const char **why_p)
+{
+    pack_job_t *job_p = worker_p->job_p;
+    const pack_object_t *obj_p = &job_p->objects[pos];
+    cache_entry_t *entry_p;
+    uint8_t *raw, *data;
+    size_t size;
+    uint8_t type;
+    SHA1_ERRCODE err;
+
+    memset(od_p, 0, sizeof(*od_p));
+    if (depth > SHA1_PACK_MAX_DEPTH || obj_p->bad)
+    {
+        *why_p = "delta base is unusable";
+        return SHA1_BAD_INPUT;
+    }
+
+    entry_p = cache_get(&job_p->cache, pos);
+    if (entry_p != NULL)
+    {
+        worker_p->hits += depth > 0;
+        od_p->data = entry_p->data;
+        od_p->size = entry_p->size;
+        od_p->type = entry_p->type;
+        od_p->entry_p = entry_p;
+        return SHA1_SUCCESS;
+    }
+    worker_p->misses += depth > 0;
+
+    err = inflate_object(worker_p, obj_p, &raw, why_p);
+    if (err != SHA1_SUCCESS)
+    {
+        return err;
+    }
+
+    if (IS_DELTA(obj_p->type))
+    {
+        object_data_t base;
+
+        err = resolve(worker_p, obj_p->base, depth + 1, &base, why_p);
+        if (err == SHA1_BAD_INPUT)
+        {
+            *why_p = "delta base is unusable";
+        }
+        if (err == SHA1_SUCCESS)
+        {
+            err = apply_delta(base.data, base.size, raw, (size_t)obj_p->size, &data, &size,
+                              why_p);
+            type = base.type;
+            object_release(job_p, &base);
+        }
+        free(raw);
+        if (err != SHA1_SUCCESS)
+        {
+            return err;
+        }
+    }
+    else
+    {
+        data = raw;
+        size = (size_t)obj_p->size;
+        type = obj_p->type;
+    }
+
+    if (__atomic_load_n(&obj_p->children, __ATOMIC_RELAXED) > 0 &&
+        (entry_p = cache_put(&job_p->cache, pos, type, data, size)) != NULL)
+    {
+        od_p->data = entry_p->data;
+        od_p->size = entry_p->size;
+        od_p->type = entry_p->type;
+        od_p->entry_p = entry_p;
+    }
+    else
+    {
+        od_p->data = data;
+        od_p->size = size;
+        od_p->type = type;
+        od_p->owned = data;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * VERIFY OBJECT
+ * CRC32 of the packed bytes, then the name of the contents
+ */
+static void verify_object(pack_worker_t *worker_p, uint32_t pos)
+{
+    pack_job_t *job_p = worker_p->job_p;
+    pack_object_t *obj_p = &job_p->objects[pos];
+    const uint8_t *name = job_p->names + (size_t)obj_p->idx * SHA1_DIGEST_SIZE;
+    const char *why = NULL;
+    object_data_t od;
+    SHA1_ERRCODE err;
+
+    if (obj_p->bad)
+    {
+        goto done; /* already reported */
+    }
+
+    if (crc32_z(0, job_p->pack + obj_p->offset, (z_size_t)(obj_p->end - obj_p->offset)) !=
+        get_be32(job_p->crcs + (size_t)obj_p->idx * 4))
+    {
+        why = "CRC32 of the packed data does not match the index";
+    }
+    else if ((err = resolve(worker_p, pos, 0, &od, &why)) != SHA1_SUCCESS)
+    {
+        if (err == SHA1_ALLOC_ERROR)
+        {
+            __atomic_store_n(&job_p->alloc_failed, 1, __ATOMIC_RELAXED);
+            why = "out of memory";
+        }
+    }
+    else
+    {
+        char header[32];
+        int header_len;
+        SHA1_Ctx_t ctx;
+        SHA1_DIGEST_t digest;
+
+        header_len = snprintf(header, sizeof(header), "%s %zu", type_names[od.type], od.size);
+        SHA1_ctx_init(&ctx);
+        SHA1_ctx_update(&ctx, (const uint8_t *)header, (size_t)header_len + 1);
+        SHA1_ctx_update(&ctx, od.data, od.size);
+        SHA1_ctx_final(&ctx, digest);
+        object_release(job_p, &od);
+
+        if (memcmp(digest, name, SHA1_DIGEST_SIZE) != 0)
+        {
+            why = "contents do not match the object name";
+        }
+    }
+
+    if (why != NULL)
+    {
+        complain_object(job_p, obj_p, why);
+        worker_p->n_bad++;
+    }
+
+done:
+    if (IS_DELTA(obj_p->type) && obj_p->base != NO_BASE &&
+        __atomic_sub_fetch(&job_p->objects[obj_p->base].children, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        cache_drop(&job_p->cache, obj_p->base);
+    }
+}
+
+static void *pack_worker(void *arg)
+{
+    pack_worker_t *worker_p = arg;
+    pack_job_t *job_p = worker_p->job_p;
+
+    for (;;)
+    {
+        size_t first = __atomic_fetch_add(&job_p->next, SHA1_PACK_RUN, __ATOMIC_RELAXED);
+        size_t last = first + SHA1_PACK_RUN;
+
+        if (first >= job_p->n_objects)
+        {
+            break;
+        }
+        if (last > job_p->n_objects)
+        {
+            last = job_p->n_objects;
+        }
+        for (size_t pos = first; pos < last; pos++)
+        {
+            verify_object(worker_p, (uint32_t)pos);
+        }
+    }
+
+    if (worker_p->zs_ready)
+    {
+        inflateEnd(&worker_p->zs);
+        worker_p->zs_ready = 0;
+    }
+    return NULL;
+}
+
+/*
+ * HASH LANE
+ * The trailers: the pack's checksum of itself, which the index repeats,
+ * and the index's checksum of itself
+ */
+static void *hash_lane(void *arg)
+{
+    pack_job_t *job_p = arg;
+    SHA1_SHA1Object_t sha1;
+    SHA1_DIGEST_t digest;
+    int ok = 1;
+
+    SHA1_process_buffer(job_p->pack, job_p->pack_size - SHA1_DIGEST_SIZE, &sha1);
+    SHA1_get_digest(&sha1, digest);
+    if (memcmp(digest, job_p->pack + job_p->pack_size - SHA1_DIGEST_SIZE, SHA1_DIGEST_SIZE) != 0)
+    {
+        complain(job_p, "pack checksum mismatch");
+        ok = 0;
+    }
+    if (memcmp(job_p->pack + job_p->pack_size - SHA1_DIGEST_SIZE,
+               job_p->idx + job_p->idx_size - 2 * SHA1_DIGEST_SIZE, SHA1_DIGEST_SIZE) != 0)
+    {
+        complain(job_p, "index does not belong to this pack (pack checksum differs)");
+        ok = 0;
+    }
+
+    SHA1_process_buffer(job_p->idx, job_p->idx_size - SHA1_DIGEST_SIZE, &sha1);
+    SHA1_get_digest(&sha1, digest);
+    if (memcmp(digest, job_p->idx + job_p->idx_size - SHA1_DIGEST_SIZE, SHA1_DIGEST_SIZE) != 0)
+    {
+        complain(job_p, "index checksum mismatch");
+        ok = 0;
+    }
+
+    job_p->trailers_ok = ok;
+    return NULL;
+}
+
+static SHA1_ERRCODE map_file(const char *path, const uint8_t **map_pp, size_t *size_p)
+{
+    struct stat st;
+    int saved_errno;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    *map_pp = NULL;
+    if (fd < 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        goto fail;
+    }
+    *size_p = (size_t)st.st_size;
+    if (st.st_size > 0)
+    {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            goto fail;
+        }
+        *map_pp = map;
+    }
+    close(fd);
+    return SHA1_SUCCESS;
+
+fail:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return SHA1_IO_ERROR;
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    const pack_object_t *x = a, *y = b;
+
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/*
+ * Position in the index of the object named name, or -1
+ */
+static int64_t idx_lookup(const pack_job_t *job_p, const uint8_t *name)
+{
+    const uint8_t *fanout = job_p->idx + 8;
+    uint32_t lo = name[0] ? get_be32(fanout + 4 * (name[0] - 1)) : 0;
+    uint32_t hi = get_be32(fanout + 4 * name[0]);
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(job_p->names + (size_t)mid * SHA1_DIGEST_SIZE, name, SHA1_DIGEST_SIZE);
+
+        if (cmp == 0)
+        {
+            return mid;
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Position in objects[] of the object at offset, or NO_BASE
+ */
+static uint32_t offset_lookup(const pack_job_t *job_p, uint64_t offset)
+{
+    uint32_t lo = 0, hi = job_p->n_objects;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (job_p->objects[mid].offset == offset)
+        {
+            return mid;
+        }
+        if (job_p->objects[mid].offset < offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return NO_BASE;
+}
+
+/*
+ * READ INDEX
+ * Check the version 2 index layout and list the objects by offset
+ */
+static SHA1_ERRCODE read_index(pack_job_t *job_p)
+{
+    const uint8_t *idx = job_p->idx, *off32, *off64;
+    size_t n_large = 0, min_size;
+    uint32_t n;
+
+    if (job_p->idx_size < 8 + 256 * 4 + 2 * SHA1_DIGEST_SIZE ||
+        memcmp(idx, "\377tOc", 4) != 0 || get_be32(idx + 4) != 2)
+    {
+        complain(job_p, "not a version 2 pack index");
+        return SHA1_BAD_INPUT;
+    }
+    for (int i = 1; i < 256; i++)
+    {
+        if (get_be32(idx + 8 + 4 * i) < get_be32(idx + 8 + 4 * (i - 1)))
+        {
+            complain(job_p, "index fan-out table is not monotonic");
+            return SHA1_BAD_INPUT;
+        }
+    }
+    n = get_be32(idx + 8 + 255 * 4);
+    min_size = 8 + 256 * 4 + (size_t)n * (SHA1_DIGEST_SIZE + 4 + 4) + 2 * SHA1_DIGEST_SIZE;
+    if (job_p->idx_size < min_size)
+    {
+        complain(job_p, "index is truncated");
+        return SHA1_BAD_INPUT;
+    }
+
+    job_p->n_objects = n;
+    job_p->names = idx + 8 + 256 * 4;
+    job_p->crcs = job_p->names + (size_t)n * SHA1_DIGEST_SIZE;
+    off32 = job_p->crcs + (size_t)n * 4;
+    off64 = off32 + (size_t)n * 4;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        n_large += get_be32(off32 + 4 * i) >> 31;
+    }
+    if (job_p->idx_size != min_size + n_large * 8)
+    {
+        complain(job_p, "index has the wrong size for %u objects", n);
+        return SHA1_BAD_INPUT;
+    }
+
+    job_p->objects = calloc(n ? n : 1, sizeof(*job_p->objects));
+    job_p->by_idx = malloc((n ? n : 1) * sizeof(*job_p->by_idx));
+    if (job_p->objects == NULL || job_p->by_idx == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t o = get_be32(off32 + 4 * i);
+        uint64_t offset = o;
+
+        /*
+         * A corrupt index must not send us outside either mapping
+         */
+        if (o & 0x80000000u)
+        {
+            if ((o & 0x7FFFFFFFu) >= n_large)
+            {
+                complain(job_p, "index entry %u refers to large offset %u of %zu", i,
+                         o & 0x7FFFFFFFu, n_large);
+                return SHA1_BAD_INPUT;
+            }
+            offset = get_be64(off64 + 8 * (o & 0x7FFFFFFFu));
+        }
+        if (job_p->pack_size < SHA1_DIGEST_SIZE || offset >= job_p->pack_size - SHA1_DIGEST_SIZE)
+        {
+            complain(job_p, "index entry %u has offset %llu outside the pack", i,
+                     (unsigned long long)offset);
+            return SHA1_BAD_INPUT;
+        }
+        job_p->objects[i].offset = offset;
+        job_p->objects[i].idx = i;
+        job_p->objects[i].base = NO_BASE;
+    }
+    qsort(job_p->objects, n, sizeof(*job_p->objects), compare_offsets);
+    for (uint32_t pos = 0; pos < n; pos++)
+    {
+        job_p->by_idx[job_p->objects[pos].idx] = pos;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * READ HEADERS
+ * Type, size and delta base of every object, from the uncompressed
+ * headers alone; counts each object's deltas and chain length
+ */
+static SHA1_ERRCODE read_headers(pack_job_t *job_p, size_t *n_bad_p, size_t *n_deltas_p,
+                                 size_t *max_depth_p)
+{
+    uint64_t trailer = job_p->pack_size - SHA1_DIGEST_SIZE;
+
+    for (uint32_t pos = 0; pos < job_p->n_objects; pos++)
+    {
+        pack_object_t *obj_p = &job_p->objects[pos];
+        const uint8_t *p, *end;
+        uint64_t size;
+        int shift = 4;
+        uint8_t c;
+
+        obj_p->end = pos + 1 < job_p->n_objects ? job_p->objects[pos + 1].offset : trailer;
+        if (obj_p->offset < 12 || obj_p->offset >= obj_p->end || obj_p->end > trailer)
+        {
+            obj_p->bad = 1;
+            complain_object(job_p, obj_p, "offset outside the pack, or shared with another object");
+            continue;
+        }
+
+        p = job_p->pack + obj_p->offset;
+        end = job_p->pack + obj_p->end;
+        c = *p++;
+        obj_p->type = (c >> 4) & 7;
+        size = c & 15;
+        while ((c & 0x80) && p < end && shift < 64)
+        {
+            c = *p++;
+            size |= (uint64_t)(c & 0x7F) << shift;
+            shift += 7;
+        }
+        obj_p->size = size;
+
+        if (type_names[obj_p->type] == NULL)
+        {
+            obj_p->bad = 1;
+            complain_object(job_p, obj_p, "unknown object type");
+            continue;
+        }
+        if (obj_p->type == OBJ_OFS_DELTA)
+        {
+            uint64_t ofs;
+
+            c = p < end ? *p++ : 0x80;
+            ofs = c & 0x7F;
+            while ((c & 0x80) && p < end && ofs < (UINT64_C(1) << 56))
+            {
+                c = *p++;
+                ofs = ((ofs + 1) << 7) | (c & 0x7F);
+            }
+            if (!(c & 0x80) && ofs > 0 && ofs <= obj_p->offset)
+            {
+                obj_p->base = offset_lookup(job_p, obj_p->offset - ofs);
+            }
+        }
+        else if (obj_p->type == OBJ_REF_DELTA && end - p >= SHA1_DIGEST_SIZE)
+        {
+            int64_t i = idx_lookup(job_p, p);
+
+            if (i >= 0)
+            {
+                obj_p->base = job_p->by_idx[i];
+            }
+            p += SHA1_DIGEST_SIZE;
+        }
+        if (p >= end)
+        {
+            obj_p->bad = 1;
+            obj_p->base = NO_BASE;
+            complain_object(job_p, obj_p, "truncated object header");
+            continue;
+        }
+        obj_p->header_len = (uint8_t)(p - (job_p->pack + obj_p->offset));
+
+        if (IS_DELTA(obj_p->type))
+        {
+            (*n_deltas_p)++;
+            if (obj_p->base == NO_BASE || obj_p->base == pos)
+            {
+                obj_p->bad = 1;
+                obj_p->base = NO_BASE;
+                complain_object(job_p, obj_p, "delta base is not in the pack");
+                continue;
+            }
+            job_p->objects[obj_p->base].children++;
+        }
+    }
+
+    /*
+     * Chain lengths; a chain that never reaches a whole object is a loop
+     */
+    for (uint32_t pos = 0; pos < job_p->n_objects; pos++)
+    {
+        pack_object_t *obj_p = &job_p->objects[pos];
+        uint32_t at = pos, length = 0;
+
+        if (obj_p->bad || !IS_DELTA(obj_p->type))
+        {
+            continue;
+        }
+        while (at != NO_BASE && IS_DELTA(job_p->objects[at].type) &&
+               job_p->objects[at].depth == 0 && length <= SHA1_PACK_MAX_DEPTH)
+        {
+            at = job_p->objects[at].base;
+            length++;
+        }
+        if (length > SHA1_PACK_MAX_DEPTH)
+        {
+            obj_p->bad = 1;
+            complain_object(job_p, obj_p, "delta chain too long, or a loop");
+            continue;
+        }
+        if (at != NO_BASE)
+        {
+            length += job_p->objects[at].depth;
+        }
+        obj_p->depth = length;
+        if (length > *max_depth_p)
+        {
+            *max_depth_p = length;
+        }
+    }
+
+    for (uint32_t pos = 0; pos < job_p->n_objects; pos++)
+    {
+        *n_bad_p += job_p->objects[pos].bad;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * VERIFY PACK
+ */
+SHA1_ERRCODE SHA1_verify_pack(const char *path, const SHA1_PackOptions_t *options_p,
+                              SHA1_Writer_p_t writer_p, SHA1_PackResult_p_t result_p)
+{
+    pack_job_t job;
+    pack_worker_t *workers = NULL;
+    pthread_t *threads = NULL;
+    pthread_t lane;
+    int lane_started = 0;
+    size_t len = strlen(path), base_len;
+    char *pack_path = NULL, *idx_path = NULL;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int n_threads = options_p->n_threads;
+    int n_started = 1;
+    int saved_errno;
+
+    memset(result_p, 0, sizeof(*result_p));
+    memset(&job, 0, sizeof(job));
+    job.options_p = options_p;
+    job.pack_path = path;
+
+    /*
+     * STEP 1
+     * find and map both files
+     */
+    if (len > 5 && strcmp(path + len - 5, ".pack") == 0)
+    {
+        base_len = len - 5;
+    }
+    else if (len > 4 && strcmp(path + len - 4, ".idx") == 0)
+    {
+        base_len = len - 4;
+    }
+    else
+    {
+        complain(&job, "not a .pack or .idx file");
+        return SHA1_BAD_INPUT;
+    }
+    pack_path = malloc(base_len + 6);
+    idx_path = malloc(base_len + 5);
+    if (pack_path == NULL || idx_path == NULL)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out;
+    }
+    memcpy(pack_path, path, base_len);
+    strcpy(pack_path + base_len, ".pack");
+    memcpy(idx_path, path, base_len);
+    strcpy(idx_path + base_len, ".idx");
+    job.pack_path = pack_path;
+
+    if ((err = map_file(pack_path, &job.pack, &job.pack_size)) != SHA1_SUCCESS)
+    {
+        saved_errno = errno;
+        complain(&job, "%s", strerror(errno));
+        errno = saved_errno;
+        goto out;
+    }
+    if ((err = map_file(idx_path, &job.idx, &job.idx_size)) != SHA1_SUCCESS)
+    {
+        saved_errno = errno;
+        fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, idx_path, strerror(errno));
+        errno = saved_errno;
+        goto out;
+    }
+    if (job.pack_size > 0)
+    {
+        madvise((void *)job.pack, job.pack_size, MADV_WILLNEED);
+    }
+
+    /*
+     * STEP 2
+     * the index, the pack header and every object header
+     */
+    if ((err = read_index(&job)) != SHA1_SUCCESS)
+    {
+        goto out;
+    }
+    if (job.pack_size < 12 + SHA1_DIGEST_SIZE || memcmp(job.pack, "PACK", 4) != 0 ||
+        (get_be32(job.pack + 4) != 2 && get_be32(job.pack + 4) != 3))
+    {
+        complain(&job, "not a version 2 or 3 pack");
+        err = SHA1_BAD_INPUT;
+        goto out;
+    }
+    if (get_be32(job.pack + 8) != job.n_objects)
+    {
+        complain(&job, "pack holds %u objects, its index %u",
+                 get_be32(job.pack + 8), job.n_objects);
+        err = SHA1_BAD_INPUT;
+        goto out;
+    }
+    result_p->n_objects = job.n_objects;
+    err = read_headers(&job, &result_p->n_bad, &result_p->n_deltas, &result_p->max_depth);
+    if (err != SHA1_SUCCESS)
+    {
+        goto out;
+    }
+
+    /*
+     * STEP 3
+     * the trailer lane and the object workers, the calling thread
+     * being worker 0
+     */
+    err = cache_init(&job.cache, job.n_objects,
+                     options_p->cache_bytes ? options_p->cache_bytes : SHA1_PACK_CACHE_BYTES);
+    if (err != SHA1_SUCCESS)
+    {
+        goto out;
+    }
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+    if ((size_t)n_threads > job.n_objects / SHA1_PACK_RUN + 1)
+    {
+        n_threads = (int)(job.n_objects / SHA1_PACK_RUN + 1);
+    }
+    workers = calloc((size_t)n_threads, sizeof(*workers));
+    threads = calloc((size_t)n_threads, sizeof(*threads));
+    if (workers == NULL || threads == NULL)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out_cache;
+    }
+
+    lane_started = pthread_create(&lane, NULL, hash_lane, &job) == 0;
+    for (int i = 0; i < n_threads; i++)
+    {
+        workers[i].job_p = &job;
+    }
+    for (; n_started < n_threads; n_started++)
+    {
+        if (pthread_create(&threads[n_started], NULL, pack_worker, &workers[n_started]) != 0)
+        {
+            break;
+        }
+    }
+    pack_worker(&workers[0]);
+    for (int i = 1; i < n_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    if (lane_started)
+    {
+        pthread_join(lane, NULL);
+    }
+    else
+    {
+        hash_lane(&job);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        result_p->n_bad += workers[i].n_bad;
+        result_p->cache_hits += workers[i].hits;
+        result_p->cache_misses += workers[i].misses;
+        result_p->bytes_inflated += workers[i].inflated;
+    }
+    result_p->trailers_ok = job.trailers_ok;
+    if (job.alloc_failed)
+    {
+        err = SHA1_ALLOC_ERROR;
+    }
+    else if (result_p->n_bad > 0 || !job.trailers_ok)
+    {
+        err = SHA1_BAD_INPUT;
+    }
+
+out_cache:
+    cache_destroy(&job.cache);
+
+out:
+    if (err == SHA1_SUCCESS || err == SHA1_BAD_INPUT)
+    {
+        SHA1_writer_put(writer_p, job.pack_path, strlen(job.pack_path));
+        SHA1_writer_put(writer_p, err == SHA1_SUCCESS ? ": ok\n" : ": bad\n",
+                        err == SHA1_SUCCESS ? 5 : 6);
+    }
+    saved_errno = errno;
+    if (job.pack != NULL)
+    {
+        munmap((void *)job.pack, job.pack_size);
+    }
+    if (job.idx != NULL)
+    {
+        munmap((void *)job.idx, job.idx_size);
+    }
+    free(job.objects);
+    free(job.by_idx);
+    free(workers);
+    free(threads);
+    free(pack_path);
+    free(idx_path);
+    errno = saved_errno;
+    return err;
+}
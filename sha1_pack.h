@@ -0,0 +1,77 @@
+/* SHA1 git packfile verification header file */
+
+#include "sha1.h"
+#include "sha1_output.h"
+
+#ifndef _SHA1_PACK_H_
+#define _SHA1_PACK_H_
+
+/*
+ * Verify a git packfile against its index, as git verify-pack does, on
+ * every core.
+ *
+ * Both files are mapped. The index (version 2) gives every object's
+ * name, offset and CRC32; a first pass over the object headers alone,
+ * which are not compressed, finds each delta's base and how many deltas
+ * depend on every object. Workers then take the objects in pack order,
+ * a run at a time, and for each one check the CRC32 of its packed bytes,
+ * inflate it, resolve its delta chain and hash "<type> <size>\0<data>"
+ * against its name. Meanwhile one more thread hashes the whole pack for
+ * its trailer, and the index for its own.
+ *
+ * The index is not trusted: an offset pointing past its own large-offset
+ * table or outside the pack rejects the whole index before any object
+ * is read, as corrupt object headers in the pack reject that object.
+ *
+ * Resolved objects that other deltas still need are kept in a cache
+ * shared by the workers, bounded by cache_bytes (least recently used
+ * first out) and dropped as soon as their last delta has been applied,
+ * so a chain is inflated once however many objects hang off it. An
+ * evicted base is simply rebuilt when needed again.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_PACK_CACHE_BYTES (96 * 1024 * 1024) /* default delta base cache */
+#define SHA1_PACK_MAX_DEPTH   10000              /* deeper chains are refused (loops) */
+#define SHA1_PACK_RUN         64                 /* objects a worker claims at once */
+
+typedef struct SHA1_PackOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    int n_threads;           /* workers; <= 0 means one per online CPU */
+    size_t cache_bytes;      /* delta base cache; 0 means SHA1_PACK_CACHE_BYTES */
+} SHA1_PackOptions_t, *SHA1_PackOptions_p_t;
+
+typedef struct SHA1_PackResult {
+    size_t n_objects;        /* in the index */
+    size_t n_deltas;         /* stored as OFS_DELTA or REF_DELTA */
+    size_t n_bad;            /* corrupt, or not matching their name or CRC */
+    size_t max_depth;        /* longest delta chain */
+    size_t cache_hits;       /* delta bases found in the cache */
+    size_t cache_misses;     /* delta bases rebuilt */
+    uint64_t bytes_inflated;
+    int trailers_ok;         /* pack and index checksums match */
+} SHA1_PackResult_t, *SHA1_PackResult_p_t;
+
+/*
+ * VERIFY PACK
+ * Verify the pack at path, given as either its .pack or its .idx file
+ * (the other is found by changing the suffix). Every problem found is
+ * reported on stderr; "PATH: ok" or "PATH: bad" goes to writer_p.
+ *
+ * Parameters
+ *  path: the .pack or .idx file
+ *  options_p: options, see above
+ *  writer_p: output writer
+ *  result_p: counts for this pack
+ *
+ * Returns
+ *  SHA1_SUCCESS if the pack is intact, SHA1_BAD_INPUT if it is not,
+ *  SHA1_IO_ERROR (errno set) if a file cannot be opened or mapped, or
+ *  SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_verify_pack(const char *path, const SHA1_PackOptions_t *options_p,
+                              SHA1_Writer_p_t writer_p, SHA1_PackResult_p_t result_p);
+
+#endif /* _SHA1_PACK_H_ */
@@ -0,0 +1,567 @@
+/*
+ * Thread pool for hashing many buffers at once
+ */
+
+#define _GNU_SOURCE
+#include "sha1_parallel.h"
+#include "sha1_mb.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Calls with less than this much data in total are not worth waking
+ * the workers for
+ */
+#define POOL_MIN_PARALLEL_BYTES (64 * 1024)
+
+/*
+ * A thread's batch state: a job manager and a job per buffer of a batch
+ */
+typedef struct pool_arena {
+    SHA1_JobManager_t mgr;
+    SHA1_Job_t jobs[SHA1_POOL_BATCH];
+} __attribute__((aligned(64))) pool_arena_t;
+
+typedef struct pool_worker {
+    struct SHA1_Pool *pool_p;
+    pthread_t thread;
+    int cpu;                 /* CPU pinned to, -1 if not pinned */
+    unsigned seen;           /* last job generation taken part in */
+} __attribute__((aligned(64))) pool_worker_t;
+
+struct SHA1_Pool {
+    int n_workers;           /* threads besides the caller */
+    int started;             /* workers actually running */
+    pool_worker_t *workers;
+    pool_arena_t *caller_arena;
+
+    pthread_mutex_t submit;  /* one call at a time */
+    pthread_mutex_t lock;    /* guards generation, shutdown, active */
+    pthread_cond_t wake;     /* workers: new job or shutdown */
+    pthread_cond_t done;     /* caller: last worker finished */
+    unsigned generation;
+    int shutdown;
+    int active;              /* workers still on the current job */
+
+    /*
+     * Current job
+     */
+    const SHA1_Buffer_t *buffers;
+    SHA1_DIGEST_t *digests;
+    size_t *bounds;          /* batch b is buffers [bounds[b], bounds[b + 1]) */
+    size_t bounds_cap;
+    size_t n_batches;
+    size_t next_batch;       /* next unclaimed batch, atomic */
+    int collision;           /* a buffer was flagged, atomic */
+};
+
+/*
+ * NUMA PLACEMENT
+ */
+
+/*
+ * Node of a CPU from sysfs, 0 if there is no NUMA information
+ */
+static int cpu_node(int cpu)
+{
+    char path[64];
+    struct dirent *ent;
+    DIR *dir;
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strncmp(ent->d_name, "node", 4) == 0 &&
+            ent->d_name[4] >= '0' && ent->d_name[4] <= '9')
+        {
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/*
+ * Fill cpus[] with the CPUs this process may run on, ordered so that
+ * consecutive entries cycle through the NUMA nodes: the first CPU of
+ * every node, then the second of every node, and so on.
+ *
+ * Returns
+ *  the number of CPUs written
+ */
+static int numa_cpu_order(int *cpus, int max)
+{
+    cpu_set_t allowed;
+    int n = 0, max_node = 0, out = 0;
+    int *all, *nodes, *rank;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return 0;
+    }
+
+    /*
+     * all[i]: the i-th allowed CPU, nodes[i] its node, rank[i] its
+     * position among the allowed CPUs of that node
+     */
+    all = malloc(sizeof(int) * CPU_SETSIZE * 3);
+    if (all == NULL)
+    {
+        return 0;
+    }
+    nodes = all + CPU_SETSIZE;
+    rank = nodes + CPU_SETSIZE;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            int r = 0;
+
+            all[n] = cpu;
+            nodes[n] = cpu_node(cpu);
+            for (int j = 0; j < n; j++)
+            {
+                r += nodes[j] == nodes[n];
+            }
+            rank[n] = r;
+            if (nodes[n] > max_node)
+            {
+                max_node = nodes[n];
+            }
+            n++;
+        }
+    }
+
+    for (int r = 0; out < n && out < max; r++)
+    {
+        for (int node = 0; node <= max_node; node++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (nodes[i] == node && rank[i] == r && out < max)
+                {
+                    cpus[out++] = all[i];
+                }
+            }
+        }
+    }
+
+    free(all);
+    return out;
+}
+
+/*
+ * JOBS
+ */
+
+/*
+ * Hash every batch this thread can claim. A batch of several buffers
+ * goes through the arena's job manager, one buffer per lane; a batch of
+ * one (a big buffer, see make_batches) through the fastest
+ * single-buffer kernel, which beats one lane of a multi-buffer kernel.
+ */
+static void run_job(SHA1_Pool_p_t pool_p, pool_arena_t *arena)
+{
+    for (;;)
+    {
+        size_t b = __atomic_fetch_add(&pool_p->next_batch, 1, __ATOMIC_RELAXED);
+        size_t first, last;
+        SHA1_ERRCODE err = SHA1_SUCCESS;
+
+        if (b >= pool_p->n_batches)
+        {
+            break;
+        }
+        first = pool_p->bounds[b];
+        last = pool_p->bounds[b + 1];
+
+        if (last - first == 1)
+        {
+            SHA1_SHA1Object_t sha1;
+
+            err = SHA1_process_buffer(pool_p->buffers[first].data, pool_p->buffers[first].len,
+                                      &sha1);
+            SHA1_get_digest(&sha1, pool_p->digests[first]);
+        }
+        else
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                SHA1_Job_t *job_p = &arena->jobs[i - first];
+
+                job_p->buffer = pool_p->buffers[i].data;
+                job_p->len = pool_p->buffers[i].len;
+                job_p->flags = SHA1_JOB_ENTIRE;
+                SHA1_mgr_submit(&arena->mgr, job_p);
+            }
+            while (SHA1_mgr_flush(&arena->mgr) != NULL)
+            {
+            }
+            for (size_t i = first; i < last; i++)
+            {
+                const SHA1_Job_t *job_p = &arena->jobs[i - first];
+
+                memcpy(pool_p->digests[i], job_p->digest, SHA1_DIGEST_SIZE);
+                if (job_p->err == SHA1_COLLISION_DETECTED)
+                {
+                    err = SHA1_COLLISION_DETECTED;
+                }
+            }
+        }
+        if (err == SHA1_COLLISION_DETECTED)
+        {
+            __atomic_store_n(&pool_p->collision, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Allocate and first-touch a thread's arena
+ */
+static pool_arena_t *arena_create(void)
+{
+    pool_arena_t *arena = aligned_alloc(64, sizeof(pool_arena_t));
+
+    if (arena != NULL)
+    {
+        memset(arena, 0, sizeof(*arena));
+        SHA1_mgr_init(&arena->mgr);
+    }
+    return arena;
+}
+
+static void *pool_worker(void *arg)
+{
+    pool_worker_t *worker_p = arg;
+    SHA1_Pool_p_t pool_p = worker_p->pool_p;
+    pool_arena_t *arena;
+
+    if (worker_p->cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(worker_p->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    /*
+     * Allocated and first touched only after pinning, so the pages come
+     * from this CPU's node. A worker without an arena still follows the
+     * job protocol, it just claims no batches.
+     */
+    arena = arena_create();
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool_p->lock);
+        while (!pool_p->shutdown && pool_p->generation == worker_p->seen)
+        {
+            pthread_cond_wait(&pool_p->wake, &pool_p->lock);
+        }
+        if (pool_p->shutdown)
+        {
+            pthread_mutex_unlock(&pool_p->lock);
+            break;
+        }
+        worker_p->seen = pool_p->generation;
+        pthread_mutex_unlock(&pool_p->lock);
+
+        if (arena != NULL)
+        {
+            run_job(pool_p, arena);
+        }
+
+        pthread_mutex_lock(&pool_p->lock);
+        if (--pool_p->active == 0)
+        {
+            pthread_cond_signal(&pool_p->done);
+        }
+        pthread_mutex_unlock(&pool_p->lock);
+    }
+
+    free(arena);
+    return NULL;
+}
+
+/*
+ * Cut the buffers into batches; see sha1_parallel.h
+ */
+static int make_batches(SHA1_Pool_p_t pool_p, const SHA1_Buffer_t *buffers, size_t count)
+{
+    size_t n = 0, in_batch = 0, bytes = 0;
+
+    if (pool_p->bounds_cap < count + 1)
+    {
+        size_t *bounds = realloc(pool_p->bounds, (count + 1) * sizeof(size_t));
+
+        if (bounds == NULL)
+        {
+            return 0;
+        }
+        pool_p->bounds = bounds;
+        pool_p->bounds_cap = count + 1;
+    }
+
+    pool_p->bounds[0] = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        in_batch++;
+        bytes += buffers[i].len;
+        if (in_batch == SHA1_POOL_BATCH || bytes >= SHA1_POOL_BATCH_BYTES ||
+            (i + 1 < count && buffers[i + 1].len >= SHA1_POOL_BATCH_BYTES))
+        {
+            pool_p->bounds[++n] = i + 1;
+            in_batch = 0;
+            bytes = 0;
+        }
+    }
+    if (in_batch)
+    {
+        pool_p->bounds[++n] = count;
+    }
+    pool_p->n_batches = n;
+
+    return 1;
+}
+
+/*
+ * POOL
+ */
+SHA1_Pool_p_t SHA1_pool_create(int n_threads, int pin)
+{
+    SHA1_Pool_p_t pool_p;
+    int *cpus = NULL;
+    int n_cpus = 0;
+
+    if (n_threads <= 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n > 0 ? (int)n : 1;
+    }
+
+    pool_p = calloc(1, sizeof(*pool_p));
+    if (pool_p == NULL)
+    {
+        return NULL;
+    }
+    pool_p->n_workers = n_threads - 1;
+    pool_p->workers = aligned_alloc(64, (size_t)(pool_p->n_workers + 1) * sizeof(pool_worker_t));
+    pool_p->caller_arena = arena_create();
+    if (pool_p->workers == NULL || pool_p->caller_arena == NULL)
+    {
+        free(pool_p->workers);
+        free(pool_p->caller_arena);
+        free(pool_p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool_p->submit, NULL);
+    pthread_mutex_init(&pool_p->lock, NULL);
+    pthread_cond_init(&pool_p->wake, NULL);
+    pthread_cond_init(&pool_p->done, NULL);
+
+    if (pin && pool_p->n_workers > 0)
+    {
+        cpus = malloc(sizeof(int) * CPU_SETSIZE);
+        if (cpus != NULL)
+        {
+            n_cpus = numa_cpu_order(cpus, CPU_SETSIZE);
+        }
+    }
+
+    for (int i = 0; i < pool_p->n_workers; i++)
+    {
+        pool_worker_t *worker_p = &pool_p->workers[pool_p->started];
+
+        worker_p->pool_p = pool_p;
+        worker_p->seen = 0;
+        /*
+         * The caller runs wherever it likes; workers take the CPUs in
+         * node-interleaved order, wrapping round if there are more
+         * workers than CPUs
+         */
+        worker_p->cpu = n_cpus > 0 ? cpus[i % n_cpus] : -1;
+        if (pthread_create(&worker_p->thread, NULL, pool_worker, worker_p) != 0)
+        {
+            break; /* carry on with fewer workers */
+        }
+        pool_p->started++;
+    }
+
+    free(cpus);
+
+    if (!SHA1_pool_self_test(pool_p))
+    {
+        SHA1_pool_destroy(pool_p);
+        return NULL;
+    }
+    return pool_p;
+}
+
+void SHA1_pool_destroy(SHA1_Pool_p_t pool_p)
+{
+    if (pool_p == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_p->lock);
+    pool_p->shutdown = 1;
+    pthread_cond_broadcast(&pool_p->wake);
+    pthread_mutex_unlock(&pool_p->lock);
+
+    for (int i = 0; i < pool_p->started; i++)
+    {
+        pthread_join(pool_p->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool_p->done);
+    pthread_cond_destroy(&pool_p->wake);
+    pthread_mutex_destroy(&pool_p->lock);
+    pthread_mutex_destroy(&pool_p->submit);
+    free(pool_p->bounds);
+    free(pool_p->caller_arena);
+    free(pool_p->workers);
+    free(pool_p);
+}
+
+/*
+ * Hash on the calling thread alone
+ */
+static SHA1_ERRCODE hash_many_serial(const SHA1_Buffer_t *buffers, size_t count,
+                                     SHA1_DIGEST_t *digests)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    SHA1_SHA1Object_t sha1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (SHA1_process_buffer(buffers[i].data, buffers[i].len, &sha1) == SHA1_COLLISION_DETECTED)
+        {
+            err = SHA1_COLLISION_DETECTED;
+        }
+        SHA1_get_digest(&sha1, digests[i]);
+    }
+
+    return err;
+}
+
+SHA1_ERRCODE SHA1_pool_hash_many(SHA1_Pool_p_t pool_p, const SHA1_Buffer_t *buffers,
+                                 size_t count, SHA1_DIGEST_t *digests)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count && total < POOL_MIN_PARALLEL_BYTES; i++)
+    {
+        total += buffers[i].len;
+    }
+    if (count < 2 || total < POOL_MIN_PARALLEL_BYTES)
+    {
+        return hash_many_serial(buffers, count, digests);
+    }
+
+    pthread_mutex_lock(&pool_p->submit);
+
+    if (!make_batches(pool_p, buffers, count))
+    {
+        pthread_mutex_unlock(&pool_p->submit);
+        return hash_many_serial(buffers, count, digests);
+    }
+    pool_p->buffers = buffers;
+    pool_p->digests = digests;
+    pool_p->next_batch = 0;
+    pool_p->collision = 0;
+
+    pthread_mutex_lock(&pool_p->lock);
+    pool_p->generation++;
+    pool_p->active = pool_p->started;
+    pthread_cond_broadcast(&pool_p->wake);
+    pthread_mutex_unlock(&pool_p->lock);
+
+    run_job(pool_p, pool_p->caller_arena);
+
+    pthread_mutex_lock(&pool_p->lock);
+    while (pool_p->active > 0)
+    {
+        pthread_cond_wait(&pool_p->done, &pool_p->lock);
+    }
+    pthread_mutex_unlock(&pool_p->lock);
+
+    pthread_mutex_unlock(&pool_p->submit);
+
+    return pool_p->collision ? SHA1_COLLISION_DETECTED : SHA1_SUCCESS;
+}
+
+/*
+ * SELF-TEST
+ * Buffers of every length mod 64 at odd offsets, so batches mix short
+ * and long messages and lanes finish at different blocks, and one big
+ * buffer in the middle that makes a batch of its own
+ */
+#define SELF_TEST_COUNT 48
+#define SELF_TEST_BIG   (320 * 1024)
+
+int SHA1_pool_self_test(SHA1_Pool_p_t pool_p)
+{
+    SHA1_Buffer_t buffers[SELF_TEST_COUNT];
+    SHA1_DIGEST_t got[SELF_TEST_COUNT], want[SELF_TEST_COUNT];
+    uint8_t *data = malloc(SELF_TEST_BIG + SELF_TEST_COUNT * 7);
+    int ok;
+
+    if (data == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < SELF_TEST_BIG + SELF_TEST_COUNT * 7; i++)
+    {
+        data[i] = (uint8_t)(i * 167 + (i >> 8) * 13 + 1);
+    }
+    for (size_t i = 0; i < SELF_TEST_COUNT; i++)
+    {
+        buffers[i].data = data + i * 7;
+        buffers[i].len = i == SELF_TEST_COUNT / 2 ? SELF_TEST_BIG : (i * 1237) % 4500;
+    }
+
+    SHA1_pool_hash_many(pool_p, buffers, SELF_TEST_COUNT, got);
+    hash_many_serial(buffers, SELF_TEST_COUNT, want);
+    ok = memcmp(got, want, sizeof(got)) == 0;
+
+    free(data);
+    return ok;
+}
+
+/*
+ * DEFAULT POOL
+ */
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+static SHA1_Pool_p_t default_pool = NULL;
+
+static void default_pool_create(void)
+{
+    default_pool = SHA1_pool_create(0, 1);
+}
+
+SHA1_ERRCODE SHA1_hash_many_parallel(const SHA1_Buffer_t *buffers, size_t count,
+                                     SHA1_DIGEST_t *digests)
+{
+    pthread_once(&default_pool_once, default_pool_create);
+    if (default_pool == NULL)
+    {
+        return hash_many_serial(buffers, count, digests);
+    }
+    return SHA1_pool_hash_many(default_pool, buffers, count, digests);
+}
@@ -0,0 +1,96 @@
+/* SHA1 parallel hashing header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_PARALLEL_H_
+#define _SHA1_PARALLEL_H_
+
+/*
+ * Hash many independent in-memory buffers on all cores.
+ *
+ * A pool keeps its worker threads between calls. Each worker is pinned
+ * to one CPU, spreading workers over the NUMA nodes in turn, and after
+ * pinning allocates its own arena, a multi-buffer job manager
+ * (sha1_mb.h) and SHA1_POOL_BATCH jobs, so per-message state lives on
+ * the worker's node and nothing is ever allocated per message.
+ *
+ * The buffers of a call are cut into batches of consecutive buffers, at
+ * most SHA1_POOL_BATCH buffers or about SHA1_POOL_BATCH_BYTES bytes each,
+ * and workers claim whole batches from a shared counter. The buffers of
+ * a batch are hashed together, one per lane of the multi-buffer kernel,
+ * so small buffers travel in groups (one atomic per batch) and fill the
+ * lanes, while a big buffer is a batch of its own, hashed by the fastest
+ * single-buffer kernel, so it cannot hold up a whole batch of others
+ * behind it.
+ *
+ * A new pool is self-tested against SHA1_process_buffer before it is
+ * handed out.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_POOL_BATCH       16           /* buffers per batch, arena size */
+#define SHA1_POOL_BATCH_BYTES (256 * 1024) /* bytes after which a batch is closed */
+
+typedef struct SHA1_Buffer {
+    const uint8_t *data;
+    size_t len;
+} SHA1_Buffer_t, *SHA1_Buffer_p_t;
+
+typedef struct SHA1_Pool SHA1_Pool_t, *SHA1_Pool_p_t;
+
+/*
+ * POOL CREATE
+ * Start a pool.
+ *
+ * Parameters
+ *  n_threads: threads hashing per call, counting the calling thread;
+ *             <= 0 means one per online CPU
+ *  pin: nonzero to pin workers to CPUs, interleaved over NUMA nodes
+ *
+ * Returns
+ *  the pool, or NULL if it could not be allocated or failed its
+ *  self-test
+ */
+SHA1_Pool_p_t SHA1_pool_create(int n_threads, int pin);
+
+/*
+ * POOL DESTROY
+ * Stop the workers and free the pool. No call may be in progress.
+ */
+void SHA1_pool_destroy(SHA1_Pool_p_t pool_p);
+
+/*
+ * POOL HASH MANY
+ * Hash count buffers, digests[i] receiving the digest of buffers[i].
+ * The calling thread takes part. Calls on the same pool from several
+ * threads are served one after another.
+ *
+ * Returns
+ *  SHA1_SUCCESS, or SHA1_COLLISION_DETECTED if collision detection is
+ *  on and flagged any buffer (every digest is still computed)
+ */
+SHA1_ERRCODE SHA1_pool_hash_many(SHA1_Pool_p_t pool_p, const SHA1_Buffer_t *buffers,
+                                 size_t count, SHA1_DIGEST_t *digests);
+
+/*
+ * POOL SELF-TEST
+ * Hash a fixed set of buffers of mixed sizes on the pool and compare
+ * every digest with SHA1_process_buffer's.
+ *
+ * Returns
+ *  nonzero if all digests agree
+ */
+int SHA1_pool_self_test(SHA1_Pool_p_t pool_p);
+
+/*
+ * HASH MANY PARALLEL
+ * SHA1_pool_hash_many on a process-wide pool with one pinned thread per
+ * online CPU, started by the first call. If that pool cannot be started
+ * the buffers are hashed on the calling thread alone.
+ */
+SHA1_ERRCODE SHA1_hash_many_parallel(const SHA1_Buffer_t *buffers, size_t count,
+                                     SHA1_DIGEST_t *digests);
+
+#endif /* _SHA1_PARALLEL_H_ */
@@ -0,0 +1,165 @@
+/*
+ * Hashing of pipes, reading overlapped with compression
+ */
+
+#define _GNU_SOURCE
+#include "sha1_pipe.h"
+#include "sha1_ctx.h"
+#include "sha1_ring.h"
+#include "sha1_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The ring (sha1_ring.h), and the reader's result, published with the
+ * last slot. A slot shorter than SHA1_PIPE_SLOT ends the stream.
+ */
+typedef struct pipe_ring {
+    SHA1_Ring_t ring;
+    int fd;
+    SHA1_ERRCODE err;
+    int err_errno;
+} pipe_ring_t;
+
+/*
+ * READER
+ * Fills each slot completely before handing it over, so the hasher
+ * wakes once per slot however small the producer's writes are. Only the
+ * last slot is short (possibly empty): end of file or an error.
+ */
+static void *pipe_reader(void *arg)
+{
+    pipe_ring_t *ring_p = arg;
+    size_t have;
+
+    do
+    {
+        uint8_t *slot = SHA1_ring_slot(&ring_p->ring);
+
+        for (have = 0; have < SHA1_PIPE_SLOT; )
+        {
+            ssize_t n = read(ring_p->fd, slot + have, SHA1_PIPE_SLOT - have);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                ring_p->err = SHA1_IO_ERROR;
+                ring_p->err_errno = errno;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            have += (size_t)n;
+        }
+        SHA1_ring_push(&ring_p->ring, have);
+    } while (have == SHA1_PIPE_SLOT);
+    return NULL;
+}
+
+/*
+ * Let the producer run SHA1_PIPE_SIZE ahead, or as far as allowed:
+ * beyond fs.pipe-max-size, or over the per-user total, F_SETPIPE_SZ
+ * fails and half the size is tried. Not a pipe: nothing to do.
+ */
+static void grow_pipe(int fd)
+{
+    int size = fcntl(fd, F_GETPIPE_SZ);
+
+    for (int want = SHA1_PIPE_SIZE; size >= 0 && want > size; want /= 2)
+    {
+        if (fcntl(fd, F_SETPIPE_SZ, want) >= 0)
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * HASH PIPE
+ */
+SHA1_ERRCODE SHA1_hash_pipe(int fd, SHA1_DIGEST_t digest)
+{
+    pipe_ring_t *ring_p;
+    pthread_t thread;
+    SHA1_Ctx_t ctx;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int collision = 0;
+    SHA1_STATS_TIMER(start);
+    SHA1_STATS_TIMER(phase);
+
+    ring_p = aligned_alloc(64, (sizeof(*ring_p) + 63) & ~(size_t)63);
+    if (ring_p == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    memset(ring_p, 0, sizeof(*ring_p));
+    ring_p->fd = fd;
+    if (SHA1_ring_init(&ring_p->ring, SHA1_PIPE_SLOTS, SHA1_PIPE_SLOT, SHA1_PIPE_SPIN) != SHA1_SUCCESS)
+    {
+        free(ring_p);
+        return SHA1_ALLOC_ERROR;
+    }
+    grow_pipe(fd);
+    SHA1_ctx_init(&ctx);
+
+    if (pthread_create(&thread, NULL, pipe_reader, ring_p) != 0)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out;
+    }
+
+    /*
+     * Compress the slots as they fill, up to the short one
+     */
+    for (;;)
+    {
+        size_t len;
+        const uint8_t *slot = SHA1_ring_peek(&ring_p->ring, &len);
+
+        SHA1_STATS_ELAPSED(phase, io_ns);
+        if (SHA1_ctx_update(&ctx, slot, len) == SHA1_COLLISION_DETECTED)
+        {
+            collision = 1;
+        }
+        SHA1_STATS_ELAPSED(phase, compress_ns);
+        SHA1_ring_pop(&ring_p->ring);
+        if (len < SHA1_PIPE_SLOT)
+        {
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+
+    err = ring_p->err;
+    if (err == SHA1_SUCCESS)
+    {
+        err = SHA1_ctx_final(&ctx, digest);
+    }
+    if (err == SHA1_SUCCESS && collision)
+    {
+        err = SHA1_COLLISION_DETECTED;
+    }
+#if SHA1_STATS
+    if (SHA1_STATS_ON())
+    {
+        SHA1_stats_record_message(ctx.length, SHA1_stats_now() - start);
+    }
+#endif
+
+out:
+    SHA1_ring_free(&ring_p->ring);
+    if (err == SHA1_IO_ERROR)
+    {
+        errno = ring_p->err_errno;
+    }
+    free(ring_p);
+    return err;
+}
@@ -0,0 +1,51 @@
+/* SHA1 pipe streaming header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_PIPE_H_
+#define _SHA1_PIPE_H_
+
+/*
+ * Hash a pipe or socket (stdin in "producer | TEST_SHA1 -") as it is
+ * written, in constant memory and without knowing its size.
+ *
+ * The pipe buffer is first enlarged to SHA1_PIPE_SIZE with F_SETPIPE_SZ
+ * (or as far as fs.pipe-max-size and the per-user limit allow), so the
+ * producer can run that far ahead without blocking. A reader thread then
+ * drains the pipe into a ring of SHA1_PIPE_SLOTS page-aligned buffers of
+ * SHA1_PIPE_SLOT bytes while the calling thread compresses the slots
+ * already filled with the streaming context (sha1_ctx.h), so the copy
+ * out of the pipe and the compression overlap. The ring is the one
+ * sha1_decompress.c uses (sha1_ring.h): single producer, single
+ * consumer, lock-free, sleeping on a condition variable only when full
+ * or empty.
+ *
+ * Data is copied out of the pipe once, by read(2). vmsplice(2) from a
+ * pipe into user memory copies too, so it would gain nothing here; the
+ * zero-copy route is AF_ALG (sha1_alg.h), which splices the pipe
+ * straight into the kernel's hash.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_PIPE_SIZE  (1024 * 1024) /* requested pipe buffer */
+#define SHA1_PIPE_SLOT  (256 * 1024)  /* bytes per ring slot */
+#define SHA1_PIPE_SLOTS 8
+#define SHA1_PIPE_SPIN  1024          /* polls before sleeping */
+
+/*
+ * HASH PIPE
+ * Hash everything readable from fd, up to end of file.
+ *
+ * Parameters
+ *  fd: open file descriptor, normally a pipe or socket
+ *  digest: output digest
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set), SHA1_ALLOC_ERROR or
+ *  SHA1_COLLISION_DETECTED
+ */
+SHA1_ERRCODE SHA1_hash_pipe(int fd, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_PIPE_H_ */
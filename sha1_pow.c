@@ -0,0 +1,606 @@
+/*
+ * Proof-of-work nonce search
+ */
+
+#define _GNU_SOURCE
+#include "sha1_pow.h"
+#include "sha1_ctx.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define POW_BATCH 4096 /* nonces per kernel call, between checks for a solution */
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define K_STEP(t) ((t) < 20 ? 0x5A827999u : (t) < 40 ? 0x6ED9EBA1u : \
+                   (t) < 60 ? 0x8F1BBCDCu : 0xCA62C1D6u)
+
+/*
+ * Schedule words that depend on words 11 and 12 of the block: bit t of
+ * the mask for t < 64, and every word from 64 on
+ */
+#define POW_VAR_MASK  UINT64_C(0xFFFFFFFFFED81800)
+#define POW_VARIES(t) ((t) >= 64 || ((POW_VAR_MASK >> (t)) & 1))
+
+/*
+ * The final block for one value of the nonce's high 32 bits
+ */
+typedef struct pow_block {
+    SHA1_WORD_t hash_in[5];  /* chaining value into the final block */
+    SHA1_WORD_t state[5];    /* A..E after steps 0..10 */
+    SHA1_WORD_t c[80];       /* schedule with words 11 and 12 zeroed */
+    SHA1_WORD_t ck[80];      /* c[t] + K[t] */
+} pow_block_t;
+
+/*
+ * Index of the first of the count nonces lo, lo + 1, ... whose first
+ * digest word has no bit of mask set, or count
+ */
+typedef uint32_t (*pow_kernel_fn_t)(const pow_block_t *block_p, uint32_t lo, uint32_t count,
+                                    uint32_t mask);
+
+typedef struct pow_kernel {
+    const char *name;
+    pow_kernel_fn_t search;
+    int lanes;
+    int available;
+    int verified;
+    double rate;             /* nonces per second, one thread */
+} pow_kernel_t;
+
+/*
+ * KERNELS
+ *
+ * One body for every width, on GCC vector types: VEC holds the same
+ * 32-bit word of LANES consecutive nonces. Words 11 and 12 are the hex
+ * digits of the low 32 bits (digit n is n + '0', plus 39 from 10 on to
+ * reach 'a'); the steps start at 11 from the precomputed state, and the
+ * nonce-dependent part of the schedule is expanded only where it is not
+ * identically zero (POW_VARIES, constant once the loops are unrolled).
+ * Only A is kept after step 79.
+ */
+#define POW_HEX(n, s)  ((((n) >> (s)) & 0xF) + '0' + (((((n) >> (s)) & 0xF) + 6) >> 4) * 39)
+
+#define POW_KERNEL(NAME, TARGET, VEC, LANES)                                        \
+TARGET                                                                              \
+static uint32_t NAME(const pow_block_t *block_p, uint32_t lo, uint32_t count,       \
+                     uint32_t mask)                                                 \
+{                                                                                   \
+    VEC lane;                                                                       \
+                                                                                    \
+    for (int i = 0; i < (LANES); i++)                                               \
+    {                                                                               \
+        lane[i] = (uint32_t)i;                                                      \
+    }                                                                               \
+    for (uint32_t first = 0; first < count; first += (LANES))                       \
+    {                                                                               \
+        VEC n = lane + (lo + first);                                                \
+        VEC v[80];                                                                  \
+        VEC A, B, C, D, E, h0;                                                      \
+                                                                                    \
+        _Pragma("GCC unroll 16")                                                    \
+        for (int t = 0; t < 16; t++)                                                \
+        {                                                                           \
+            v[t] = lane * 0;                                                        \
+        }                                                                           \
+        v[11] = POW_HEX(n, 28) << 24 | POW_HEX(n, 24) << 16 |                       \
+                POW_HEX(n, 20) << 8 | POW_HEX(n, 16);                               \
+        v[12] = POW_HEX(n, 12) << 24 | POW_HEX(n, 8) << 16 |                        \
+                POW_HEX(n, 4) << 8 | POW_HEX(n, 0);                                 \
+                                                                                    \
+        A = lane * 0 + block_p->state[0];                                           \
+        B = lane * 0 + block_p->state[1];                                           \
+        C = lane * 0 + block_p->state[2];                                           \
+        D = lane * 0 + block_p->state[3];                                           \
+        E = lane * 0 + block_p->state[4];                                           \
+                                                                                    \
+        _Pragma("GCC unroll 80")                                                    \
+        for (int t = 11; t < 80; t++)                                               \
+        {                                                                           \
+            VEC f, wk, tmp;                                                         \
+                                                                                    \
+            if (t >= 16)                                                            \
+            {                                                                       \
+                v[t] = POW_VARIES(t) ?                                              \
+                    ROTL(v[t - 3] ^ v[t - 8] ^ v[t - 14] ^ v[t - 16], 1) : lane * 0; \
+            }                                                                       \
+            wk = POW_VARIES(t) ? (v[t] ^ block_p->c[t]) + K_STEP(t)                 \
+                               : lane * 0 + block_p->ck[t];                         \
+            f = t < 20 ? D ^ (B & (C ^ D)) :                                        \
+                t < 40 || t >= 60 ? B ^ C ^ D : (B & C) | (D & (B | C));            \
+            tmp = ROTL(A, 5) + f + E + wk;                                          \
+            E = D;                                                                  \
+            D = C;                                                                  \
+            C = ROTL(B, 30);                                                        \
+            B = A;                                                                  \
+            A = tmp;                                                                \
+        }                                                                           \
+                                                                                    \
+        h0 = A + block_p->hash_in[0];                                               \
+        for (int i = 0; i < (LANES); i++)                                           \
+        {                                                                           \
+            if (!(h0[i] & mask) && first + (uint32_t)i < count)                     \
+            {                                                                       \
+                return first + (uint32_t)i;                                         \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+    return count;                                                                   \
+}
+
+typedef uint32_t pow_v4_t __attribute__((vector_size(16)));
+POW_KERNEL(pow_search_vec4, , pow_v4_t, 4)
+
+#if defined(__x86_64__)
+typedef uint32_t pow_v8_t __attribute__((vector_size(32)));
+typedef uint32_t pow_v16_t __attribute__((vector_size(64)));
+POW_KERNEL(pow_search_avx2, __attribute__((target("avx2"))), pow_v8_t, 8)
+POW_KERNEL(pow_search_avx512, __attribute__((target("avx512f"))), pow_v16_t, 16)
+#endif
+
+/*
+ * KERNEL TABLE
+ * Widest first; vec4 is plain SSE2 on x86-64 and generic code elsewhere
+ */
+static pow_kernel_t pow_kernels[] = {
+#if defined(__x86_64__)
+    { "avx512x16", pow_search_avx512, 16, 0, 0, 0 },
+    { "avx2x8",    pow_search_avx2,   8,  0, 0, 0 },
+#endif
+    { "vec4",      pow_search_vec4,   4,  1, 0, 0 },
+};
+#define N_POW_KERNELS (sizeof(pow_kernels) / sizeof(pow_kernels[0]))
+
+static pthread_once_t pow_once = PTHREAD_ONCE_INIT;
+static const pow_kernel_t *pow_kernel_best = &pow_kernels[N_POW_KERNELS - 1];
+
+/*
+ * A search: the prefix and everything derived from its length
+ */
+typedef struct pow_job {
+    const pow_kernel_t *kernel_p;
+    SHA1_Ctx_t prefix;       /* midstate; the last prefix_len % 64 bytes in its buffer */
+    size_t prefix_len;
+    size_t suffix_len;
+    unsigned bits;
+    uint32_t mask;           /* of h0 bits that must be zero */
+    uint64_t start;
+    uint64_t limit;          /* nonces to try, counted from start */
+    uint64_t next_unit;      /* atomic */
+    uint64_t best;           /* smallest solving offset from start (atomic) */
+    uint64_t tries;          /* atomic */
+} pow_job_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Suffix length: the nonce digits, padded so that the message ends at
+ * byte 52 of its final block
+ */
+static size_t suffix_length(size_t prefix_len)
+{
+    size_t end = (prefix_len + SHA1_POW_NONCE_DIGITS) % 64;
+
+    return SHA1_POW_NONCE_DIGITS + (52 + 64 - end) % 64;
+}
+
+size_t SHA1_pow_suffix(size_t prefix_len, uint64_t nonce, char *suffix)
+{
+    size_t len = suffix_length(prefix_len);
+    size_t pad = len - SHA1_POW_NONCE_DIGITS;
+
+    memset(suffix, '0', pad);
+    for (int i = 0; i < SHA1_POW_NONCE_DIGITS; i++)
+    {
+        suffix[pad + i] = "0123456789abcdef"[(nonce >> (4 * (SHA1_POW_NONCE_DIGITS - 1 - i))) & 0xF];
+    }
+    suffix[len] = '\0';
+    return len;
+}
+
+unsigned SHA1_leading_zero_bits(const SHA1_DIGEST_t digest)
+{
+    unsigned bits = 0;
+
+    for (int i = 0; i < SHA1_DIGEST_SIZE; i++)
+    {
+        if (digest[i] != 0)
+        {
+            return bits + (unsigned)__builtin_clz(digest[i]) - 24;
+        }
+        bits += 8;
+    }
+    return bits;
+}
+
+int SHA1_pow_check(const uint8_t *stamp, size_t len, unsigned bits)
+{
+    SHA1_SHA1Object_t sha1;
+    SHA1_DIGEST_t digest;
+
+    SHA1_process_buffer(stamp, len, &sha1);
+    SHA1_get_digest(&sha1, digest);
+    return SHA1_leading_zero_bits(digest) >= bits;
+}
+
+static void job_init(pow_job_t *job_p, const uint8_t *prefix, size_t prefix_len, unsigned bits)
+{
+    memset(job_p, 0, sizeof(*job_p));
+    SHA1_ctx_init(&job_p->prefix);
+    SHA1_ctx_update(&job_p->prefix, prefix, prefix_len);
+    job_p->prefix_len = prefix_len;
+    job_p->suffix_len = suffix_length(prefix_len);
+    job_p->bits = bits;
+    job_p->mask = bits >= 32 ? UINT32_MAX : bits == 0 ? 0 : ~(UINT32_MAX >> bits);
+    job_p->best = UINT64_MAX;
+}
+
+/*
+ * PREPARE
+ * The final block and its constant work for nonces hi << 32 ..
+ */
+static void prepare(const pow_job_t *job_p, uint32_t hi, pow_block_t *block_p)
+{
+    uint8_t tail[128] = { 0 };
+    char suffix[SHA1_POW_MAX_SUFFIX + 1];
+    size_t rest = job_p->prefix_len % 64;
+    size_t total = rest + job_p->suffix_len + 12; /* 0x80, 3 zeros, length: a multiple of 64 */
+    uint64_t bits = (uint64_t)(job_p->prefix_len + job_p->suffix_len) * 8;
+    const uint8_t *final;
+    SHA1_WORD_t A, B, C, D, E;
+
+    memcpy(tail, job_p->prefix.buffer, rest);
+    SHA1_pow_suffix(job_p->prefix_len, (uint64_t)hi << 32, suffix);
+    memcpy(tail + rest, suffix, job_p->suffix_len);
+    tail[rest + job_p->suffix_len] = 0x80;
+    for (int i = 0; i < 8; i++)
+    {
+        tail[total - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+
+    memcpy(block_p->hash_in, job_p->prefix.hash, sizeof(block_p->hash_in));
+    if (total > 64)
+    {
+        SHA1_process_blocks(block_p->hash_in, tail, 1);
+    }
+    final = tail + total - 64;
+
+    for (int t = 0; t < 16; t++)
+    {
+        block_p->c[t] = (SHA1_WORD_t)final[4 * t] << 24 | (SHA1_WORD_t)final[4 * t + 1] << 16 |
+                        (SHA1_WORD_t)final[4 * t + 2] << 8 | final[4 * t + 3];
+    }
+    block_p->c[11] = 0;
+    block_p->c[12] = 0;
+    for (int t = 16; t < 80; t++)
+    {
+        block_p->c[t] = ROTL(block_p->c[t - 3] ^ block_p->c[t - 8] ^ block_p->c[t - 14] ^
+                             block_p->c[t - 16], 1);
+    }
+    for (int t = 0; t < 80; t++)
+    {
+        block_p->ck[t] = block_p->c[t] + K_STEP(t);
+    }
+
+    A = block_p->hash_in[0];
+    B = block_p->hash_in[1];
+    C = block_p->hash_in[2];
+    D = block_p->hash_in[3];
+    E = block_p->hash_in[4];
+    for (int t = 0; t < 11; t++)
+    {
+        SHA1_WORD_t tmp = ROTL(A, 5) + (D ^ (B & (C ^ D))) + E + block_p->ck[t];
+
+        E = D;
+        D = C;
+        C = ROTL(B, 30);
+        B = A;
+        A = tmp;
+    }
+    block_p->state[0] = A;
+    block_p->state[1] = B;
+    block_p->state[2] = C;
+    block_p->state[3] = D;
+    block_p->state[4] = E;
+}
+
+/*
+ * Digest of prefix || suffix(nonce), the slow way
+ */
+static void nonce_digest(const pow_job_t *job_p, uint64_t nonce, SHA1_DIGEST_t digest)
+{
+    SHA1_Ctx_t ctx = job_p->prefix;
+    char suffix[SHA1_POW_MAX_SUFFIX + 1];
+
+    SHA1_pow_suffix(job_p->prefix_len, nonce, suffix);
+    SHA1_ctx_update(&ctx, (const uint8_t *)suffix, job_p->suffix_len);
+    SHA1_ctx_final(&ctx, digest);
+}
+
+static void *pow_worker(void *arg)
+{
+    pow_job_t *job_p = arg;
+    pow_block_t block;
+    int have_block = 0;
+    uint32_t block_hi = 0;
+    uint64_t tries = 0;
+
+    for (;;)
+    {
+        uint64_t unit = __atomic_fetch_add(&job_p->next_unit, 1, __ATOMIC_RELAXED);
+        uint64_t off, end;
+
+        if (unit >= job_p->limit / SHA1_POW_UNIT + (job_p->limit % SHA1_POW_UNIT != 0))
+        {
+            break;
+        }
+        off = unit * SHA1_POW_UNIT;
+        end = job_p->limit - off < SHA1_POW_UNIT ? job_p->limit : off + SHA1_POW_UNIT;
+        if (off >= __atomic_load_n(&job_p->best, __ATOMIC_RELAXED))
+        {
+            break; /* a smaller solution is already known */
+        }
+
+        while (off < end && off < __atomic_load_n(&job_p->best, __ATOMIC_RELAXED))
+        {
+            uint64_t nonce = job_p->start + off;
+            uint32_t hi = (uint32_t)(nonce >> 32), lo = (uint32_t)nonce;
+            uint64_t chunk = end - off;
+            uint32_t i;
+
+            if (chunk > POW_BATCH)
+            {
+                chunk = POW_BATCH;
+            }
+            if (chunk > (uint64_t)UINT32_MAX - lo + 1)
+            {
+                chunk = (uint64_t)UINT32_MAX - lo + 1; /* hi changes after this */
+            }
+            if (!have_block || hi != block_hi)
+            {
+                prepare(job_p, hi, &block);
+                have_block = 1;
+                block_hi = hi;
+            }
+
+            i = job_p->kernel_p->search(&block, lo, (uint32_t)chunk, job_p->mask);
+            if (i == chunk)
+            {
+                tries += chunk;
+                off += chunk;
+                continue;
+            }
+            tries += i + 1;
+
+            /*
+             * h0 passed; the rest of the digest matters past 32 bits
+             */
+            if (job_p->bits > 32)
+            {
+                SHA1_DIGEST_t digest;
+
+                nonce_digest(job_p, nonce + i, digest);
+                if (SHA1_leading_zero_bits(digest) < job_p->bits)
+                {
+                    off += i + 1;
+                    continue;
+                }
+            }
+            for (uint64_t best = __atomic_load_n(&job_p->best, __ATOMIC_RELAXED);
+                 off + i < best &&
+                 !__atomic_compare_exchange_n(&job_p->best, &best, off + i, 0,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED); )
+            {
+            }
+            break;
+        }
+    }
+
+    __atomic_fetch_add(&job_p->tries, tries, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * SELF-TEST
+ * Against the digests of whole messages, for prefixes that put the
+ * final block alone or after a block of padding digits, a mask that a
+ * few nonces in each batch pass, and a batch that ends mid-vector
+ */
+static int pow_self_test(const pow_kernel_t *kernel_p)
+{
+    static const size_t prefix_lens[] = { 0, 5, 36, 37, 63, 100 };
+    uint8_t prefix[100];
+    pow_job_t job;
+    pow_block_t block;
+
+    for (size_t i = 0; i < sizeof(prefix); i++)
+    {
+        prefix[i] = (uint8_t)('A' + i % 26);
+    }
+    for (size_t p = 0; p < sizeof(prefix_lens) / sizeof(prefix_lens[0]); p++)
+    {
+        uint32_t hi = 0x9ABCDEF0u, lo = 0xFFFFFF00u - (uint32_t)p * 4096;
+
+        job_init(&job, prefix, prefix_lens[p], 4);
+        prepare(&job, hi, &block);
+
+        for (uint32_t from = 0; from < 200; )
+        {
+            uint32_t want = 200 - from, got;
+
+            for (uint32_t i = 0; i < 200 - from; i++)
+            {
+                SHA1_DIGEST_t digest;
+
+                nonce_digest(&job, ((uint64_t)hi << 32) + lo + from + i, digest);
+                if (SHA1_leading_zero_bits(digest) >= 4)
+                {
+                    want = i;
+                    break;
+                }
+            }
+            got = kernel_p->search(&block, lo + from, 200 - from, job.mask);
+            if (got != want)
+            {
+                return 0;
+            }
+            from += want + 1;
+        }
+        if (kernel_p->search(&block, lo, 37, UINT32_MAX) != 37)
+        {
+            return 0; /* h0 == 0 in the first 37: possible, but not for these */
+        }
+    }
+    return 1;
+}
+
+static void pow_setup(void)
+{
+    pow_job_t job;
+    pow_block_t block;
+
+    job_init(&job, (const uint8_t *)"benchmark", 9, 32);
+    prepare(&job, 0, &block);
+
+    for (size_t k = 0; k < N_POW_KERNELS; k++)
+    {
+        pow_kernel_t *kernel_p = &pow_kernels[k];
+        double best = 0;
+
+#if defined(__x86_64__)
+        if (strcmp(kernel_p->name, "avx512x16") == 0)
+        {
+            kernel_p->available = __builtin_cpu_supports("avx512f");
+        }
+        else if (strcmp(kernel_p->name, "avx2x8") == 0)
+        {
+            kernel_p->available = __builtin_cpu_supports("avx2");
+        }
+#endif
+        kernel_p->verified = kernel_p->available && pow_self_test(kernel_p);
+        if (!kernel_p->verified)
+        {
+            continue;
+        }
+
+        /*
+         * Best of three runs of 64 Ki nonces, after one to warm up
+         */
+        for (int round = 0; round < 4; round++)
+        {
+            double start = now_s(), elapsed;
+
+            kernel_p->search(&block, 0, 1u << 16, UINT32_MAX);
+            elapsed = now_s() - start;
+            if (round > 0 && elapsed > 0 && (1u << 16) / elapsed > best)
+            {
+                best = (1u << 16) / elapsed;
+            }
+        }
+        kernel_p->rate = best;
+        if (!pow_kernel_best->verified || kernel_p->rate > pow_kernel_best->rate)
+        {
+            pow_kernel_best = kernel_p;
+        }
+    }
+}
+
+/*
+ * POW SOLVE
+ */
+SHA1_ERRCODE SHA1_pow_solve(const uint8_t *prefix, size_t prefix_len,
+                            const SHA1_PowOptions_t *options_p, SHA1_PowResult_p_t result_p)
+{
+    pow_job_t job;
+    pthread_t *threads;
+    int n_threads = options_p->n_threads;
+    int n_started = 1;
+    double start;
+
+    memset(result_p, 0, sizeof(*result_p));
+    if (options_p->bits > 8 * SHA1_DIGEST_SIZE)
+    {
+        return SHA1_BAD_INPUT;
+    }
+    pthread_once(&pow_once, pow_setup);
+
+    job_init(&job, prefix, prefix_len, options_p->bits);
+    job.kernel_p = pow_kernel_best;
+    job.start = options_p->start;
+    job.limit = options_p->max_tries ? options_p->max_tries : UINT64_MAX;
+    result_p->kernel = job.kernel_p->name;
+
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+    threads = calloc((size_t)n_threads, sizeof(*threads));
+    if (threads == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+
+    start = now_s();
+    for (; n_started < n_threads; n_started++)
+    {
+        if (pthread_create(&threads[n_started], NULL, pow_worker, &job) != 0)
+        {
+            break;
+        }
+    }
+    pow_worker(&job);
+    for (int i = 1; i < n_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    result_p->seconds = now_s() - start;
+    free(threads);
+
+    result_p->tries = job.tries;
+    if (job.best != UINT64_MAX)
+    {
+        result_p->found = 1;
+        result_p->nonce = job.start + job.best;
+        SHA1_pow_suffix(prefix_len, result_p->nonce, result_p->suffix);
+    }
+    return SHA1_SUCCESS;
+}
+
+void SHA1_pow_print(FILE *fp)
+{
+    pthread_once(&pow_once, pow_setup);
+
+    fprintf(fp, "pow kernels:");
+    for (size_t k = 0; k < N_POW_KERNELS; k++)
+    {
+        const pow_kernel_t *kernel_p = &pow_kernels[k];
+
+        fprintf(fp, " %s", kernel_p->name);
+        if (!kernel_p->available)
+        {
+            fprintf(fp, " n/a");
+        }
+        else if (!kernel_p->verified)
+        {
+            fprintf(fp, " FAILED");
+        }
+        else
+        {
+            fprintf(fp, " %.1f M/s", kernel_p->rate / 1e6);
+        }
+        fputc(k + 1 < N_POW_KERNELS ? ',' : '\n', fp);
+    }
+    fprintf(fp, "pow kernel: %s\n", pow_kernel_best->name);
+}
@@ -0,0 +1,100 @@
+/* SHA1 proof-of-work header file */
+
+#include <stdio.h>
+#include "sha1.h"
+
+#ifndef _SHA1_POW_H_
+#define _SHA1_POW_H_
+
+/*
+ * Hashcash-style proof of work: find a suffix for a given prefix such
+ * that SHA-1(prefix || suffix) starts with at least bits zero bits.
+ *
+ * The suffix is a nonce in hexadecimal, zero-padded on the left to a
+ * length that depends only on the prefix length: long enough that the
+ * last 8 digits (the low 32 bits of the nonce) are bytes 44..51 of the
+ * final block, i.e. message words 11 and 12, followed directly by the
+ * padding. Everything else about a search is then fixed per value of
+ * the high 32 bits:
+ *
+ *   - the chaining value into the final block (the prefix midstate,
+ *     plus any block of padding digits);
+ *   - the state after steps 0..10, which read only constant words;
+ *   - the schedule: it is linear, so W = expand(constant words) ^
+ *     expand(words 11, 12), and the first term is computed once. Of the
+ *     second, words 16..18, 21 and 24 are zero and cost nothing.
+ *
+ * Kernels evaluate one nonce per SIMD lane (4, 8 or 16 lanes) and only
+ * ever compute the first digest word, h0 + A: a lane whose leading bits
+ * are not zero is rejected there, without the other four words. The few
+ * candidates left are checked in full. Threads claim runs of
+ * SHA1_POW_UNIT nonces in order, and the search returns the smallest
+ * solving nonce at or above start, whatever the number of threads.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_POW_NONCE_DIGITS 16                          /* hex digits of the nonce */
+#define SHA1_POW_MAX_SUFFIX   (SHA1_POW_NONCE_DIGITS + 63) /* with left padding */
+#define SHA1_POW_UNIT         (1u << 20)                  /* nonces claimed at once */
+
+typedef struct SHA1_PowOptions {
+    unsigned bits;           /* leading zero bits wanted, at most 160 */
+    int n_threads;           /* <= 0 means one per online CPU */
+    uint64_t start;          /* first nonce tried */
+    uint64_t max_tries;      /* give up after this many nonces; 0 means never */
+} SHA1_PowOptions_t, *SHA1_PowOptions_p_t;
+
+typedef struct SHA1_PowResult {
+    int found;
+    uint64_t nonce;
+    char suffix[SHA1_POW_MAX_SUFFIX + 1]; /* NUL-terminated, if found */
+    uint64_t tries;          /* nonces evaluated, over all threads */
+    double seconds;          /* wall-clock time of the search */
+    const char *kernel;      /* name of the kernel used */
+} SHA1_PowResult_t, *SHA1_PowResult_p_t;
+
+/*
+ * POW SOLVE
+ * Search for the smallest nonce >= options_p->start whose suffix makes
+ * prefix a solution.
+ *
+ * Returns
+ *  SHA1_SUCCESS (result_p->found says whether max_tries ran out first),
+ *  SHA1_BAD_INPUT for more than 160 bits, or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_pow_solve(const uint8_t *prefix, size_t prefix_len,
+                            const SHA1_PowOptions_t *options_p, SHA1_PowResult_p_t result_p);
+
+/*
+ * POW SUFFIX
+ * Write the suffix for nonce after a prefix of prefix_len bytes to
+ * suffix (at least SHA1_POW_MAX_SUFFIX + 1 bytes, NUL-terminated).
+ *
+ * Returns
+ *  its length
+ */
+size_t SHA1_pow_suffix(size_t prefix_len, uint64_t nonce, char *suffix);
+
+/*
+ * LEADING ZERO BITS
+ * Number of zero bits at the start of digest (0..160).
+ */
+unsigned SHA1_leading_zero_bits(const SHA1_DIGEST_t digest);
+
+/*
+ * POW CHECK
+ * Nonzero if the digest of the len bytes at stamp starts with at least
+ * bits zero bits. Any stamp may be checked, not only solver output.
+ */
+int SHA1_pow_check(const uint8_t *stamp, size_t len, unsigned bits);
+
+/*
+ * POW KERNEL NAMES
+ * Write the kernels available, their self-test result and measured
+ * rate, and the one in use, to fp.
+ */
+void SHA1_pow_print(FILE *fp);
+
+#endif /* _SHA1_POW_H_ */
@@ -0,0 +1,442 @@
+/*
+ * Hashing of byte ranges of a file
+ */
+
+#define _GNU_SOURCE
+#include "sha1_range.h"
+#include "sha1_ctx.h"
+#include "sha1_mb.h"
+#include "sha1_stats.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALIGN_DOWN(x) ((x) & ~(uint64_t)(SHA1_RANGE_ALIGN - 1))
+#define ALIGN_UP(x)   ALIGN_DOWN((x) + SHA1_RANGE_ALIGN - 1)
+
+/*
+ * A window read once for the ranges order[first .. first + count)
+ */
+typedef struct span {
+    uint64_t start;
+    uint64_t end;
+    size_t first;
+    size_t count;
+} span_t;
+
+typedef struct sort_key {
+    uint64_t offset;
+    size_t index;
+} sort_key_t;
+
+typedef struct range_job {
+    int fd;
+    SHA1_Range_p_t ranges;
+    size_t *order;           /* indices of the ranges to read, by offset */
+    SHA1_Job_t *jobs;        /* one per range */
+    span_t *spans;
+    size_t n_spans;
+    size_t next_span;        /* atomic */
+    uint64_t bytes_read;     /* atomic */
+} range_job_t;
+
+/*
+ * PARSE RANGE
+ */
+static int parse_number(const char **s_p, uint64_t *value_p)
+{
+    const char *s = *s_p;
+    char *end;
+    unsigned long long value;
+
+    if (!isdigit((unsigned char)*s))
+    {
+        return 0;
+    }
+    errno = 0;
+    value = strtoull(s, &end, 0);
+    if (errno != 0)
+    {
+        return 0;
+    }
+    if (*end != '\0' && strchr("KMGT", *end) != NULL)
+    {
+        int shift = 10 * (int)(strchr("KMGT", *end) - "KMGT" + 1);
+
+        if (value > (UINT64_MAX >> shift))
+        {
+            return 0;
+        }
+        value <<= shift;
+        end++;
+    }
+    *value_p = value;
+    *s_p = end;
+    return 1;
+}
+
+SHA1_ERRCODE SHA1_parse_range(const char *spec, SHA1_Range_p_t range_p)
+{
+    uint64_t a, b;
+    char sep;
+
+    if (!parse_number(&spec, &a))
+    {
+        return SHA1_BAD_INPUT;
+    }
+    sep = *spec++;
+    if ((sep != '+' && sep != '-') || !parse_number(&spec, &b) || *spec != '\0')
+    {
+        return SHA1_BAD_INPUT;
+    }
+    if (sep == '-' && (b < a || b == UINT64_MAX))
+    {
+        return SHA1_BAD_INPUT;
+    }
+    memset(range_p, 0, sizeof(*range_p));
+    range_p->offset = a;
+    range_p->length = sep == '+' ? b : b - a + 1;
+    return SHA1_SUCCESS;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    const sort_key_t *ka = a, *kb = b;
+
+    return ka->offset < kb->offset ? -1 : ka->offset > kb->offset;
+}
+
+static int compare_span_size(const void *a, const void *b)
+{
+    const span_t *sa = a, *sb = b;
+    uint64_t la = sa->end - sa->start, lb = sb->end - sb->start;
+
+    return la > lb ? -1 : la < lb; /* largest first */
+}
+
+/*
+ * HASH SPAN
+ * Read the span a chunk at a time and feed every range that overlaps
+ * the chunk; each chunk is fully hashed (flushed) before the buffer is
+ * reused
+ */
+static void hash_span(range_job_t *job_p, const span_t *span_p, uint8_t *buf,
+                      SHA1_JobManager_p_t mgr_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int err_errno = 0;
+    size_t first = span_p->first, last = span_p->first + span_p->count;
+    uint64_t pos = span_p->start;  /* everything before has been hashed */
+    uint64_t bytes_read = 0;
+    SHA1_STATS_TIMER(start);
+    SHA1_STATS_TIMER(phase);
+
+    posix_fadvise(job_p->fd, (off_t)span_p->start, (off_t)(span_p->end - span_p->start),
+                  POSIX_FADV_SEQUENTIAL);
+
+    while (pos < span_p->end)
+    {
+        size_t n = span_p->end - pos < SHA1_RANGE_CHUNK ? (size_t)(span_p->end - pos)
+                                                          : SHA1_RANGE_CHUNK;
+        size_t got = 0;
+
+        /*
+         * Let the kernel fetch the next chunk while this one is hashed
+         */
+        if (pos + n < span_p->end)
+        {
+            uint64_t next = span_p->end - pos - n;
+
+            posix_fadvise(job_p->fd, (off_t)(pos + n),
+                          (off_t)(next < SHA1_RANGE_CHUNK ? next : SHA1_RANGE_CHUNK),
+                          POSIX_FADV_WILLNEED);
+        }
+
+        while (got < n)
+        {
+            ssize_t r = pread(job_p->fd, buf + got, n - got, (off_t)(pos + got));
+
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                err = SHA1_IO_ERROR;
+                err_errno = errno;
+                break;
+            }
+            if (r == 0)
+            {
+                break; /* end of file: the span was rounded up past it */
+            }
+            got += (size_t)r;
+        }
+        SHA1_STATS_ELAPSED(phase, io_ns);
+        bytes_read += got;
+
+        for (size_t k = first; k < last; k++)
+        {
+            SHA1_Range_p_t range_p = &job_p->ranges[job_p->order[k]];
+            SHA1_Job_p_t rjob_p = &job_p->jobs[job_p->order[k]];
+            uint64_t range_end = range_p->offset + range_p->length;
+            uint64_t seg_start, seg_end;
+
+            if (range_p->offset >= pos + got)
+            {
+                break; /* this one and the rest start later */
+            }
+            if (range_end <= pos)
+            {
+                continue;
+            }
+            seg_start = range_p->offset > pos ? range_p->offset : pos;
+            seg_end = range_end < pos + got ? range_end : pos + got;
+            rjob_p->buffer = buf + (seg_start - pos);
+            rjob_p->len = (size_t)(seg_end - seg_start);
+            rjob_p->flags = (seg_start == range_p->offset ? SHA1_JOB_FIRST : SHA1_JOB_UPDATE) |
+                            (seg_end == range_end ? SHA1_JOB_LAST : 0);
+            SHA1_mgr_submit(mgr_p, rjob_p);
+        }
+        while (SHA1_mgr_flush(mgr_p) != NULL)
+        {
+        }
+        SHA1_STATS_ELAPSED(phase, compress_ns);
+
+        pos += got;
+        while (first < last && job_p->ranges[job_p->order[first]].offset +
+                               job_p->ranges[job_p->order[first]].length <= pos)
+        {
+            first++;
+        }
+        if (err != SHA1_SUCCESS || got < n)
+        {
+            break;
+        }
+    }
+
+    /*
+     * Ranges that end before the point reached are done; the others
+     * hit a read error, or the file shrank under them
+     */
+    for (size_t k = span_p->first; k < last; k++)
+    {
+        SHA1_Range_p_t range_p = &job_p->ranges[job_p->order[k]];
+        SHA1_Job_p_t rjob_p = &job_p->jobs[job_p->order[k]];
+
+        if (range_p->offset + range_p->length <= pos)
+        {
+            range_p->err = rjob_p->err;
+            memcpy(range_p->digest, rjob_p->digest, SHA1_DIGEST_SIZE);
+        }
+        else
+        {
+            range_p->err = err != SHA1_SUCCESS ? err : SHA1_BAD_INPUT;
+            range_p->err_errno = err_errno;
+        }
+#if SHA1_STATS
+        if (SHA1_STATS_ON() && range_p->err == SHA1_SUCCESS)
+        {
+            SHA1_stats_record_message(range_p->length, SHA1_stats_now() - start);
+        }
+#endif
+    }
+    __atomic_fetch_add(&job_p->bytes_read, bytes_read, __ATOMIC_RELAXED);
+}
+
+static void *range_worker(void *arg)
+{
+    range_job_t *job_p = arg;
+    SHA1_JobManager_t mgr;
+    uint8_t *buf = NULL;
+
+    /*
+     * Without a buffer, leave the spans to the other threads
+     */
+    if (posix_memalign((void **)&buf, SHA1_RANGE_ALIGN, SHA1_RANGE_CHUNK) != 0)
+    {
+        return NULL;
+    }
+    SHA1_mgr_init(&mgr);
+
+    for (;;)
+    {
+        size_t s = __atomic_fetch_add(&job_p->next_span, 1, __ATOMIC_RELAXED);
+
+        if (s >= job_p->n_spans)
+        {
+            break;
+        }
+        hash_span(job_p, &job_p->spans[s], buf, &mgr);
+    }
+    free(buf);
+    return NULL;
+}
+
+/*
+ * HASH RANGES
+ */
+SHA1_ERRCODE SHA1_hash_ranges(int fd, SHA1_Range_p_t ranges, size_t n,
+                              const SHA1_RangeOptions_t *options_p, SHA1_RangeResult_p_t result_p)
+{
+    range_job_t job;
+    sort_key_t *keys;
+    pthread_t *threads = NULL;
+    struct stat st;
+    uint64_t file_size;
+    size_t n_read = 0;
+    int n_threads = options_p->n_threads;
+    int n_started = 1;
+
+    memset(result_p, 0, sizeof(*result_p));
+    if (fstat(fd, &st) != 0)
+    {
+        return SHA1_IO_ERROR;
+    }
+    file_size = S_ISREG(st.st_mode) ? (uint64_t)st.st_size : UINT64_MAX; /* devices: trust pread */
+
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.ranges = ranges;
+    job.order = malloc((n > 0 ? n : 1) * sizeof(*job.order));
+    job.jobs = calloc(n > 0 ? n : 1, sizeof(*job.jobs));
+    job.spans = malloc((n > 0 ? n : 1) * sizeof(*job.spans));
+    keys = malloc((n > 0 ? n : 1) * sizeof(*keys));
+    if (job.order == NULL || job.jobs == NULL || job.spans == NULL || keys == NULL)
+    {
+        free(job.order);
+        free(job.jobs);
+        free(job.spans);
+        free(keys);
+        return SHA1_ALLOC_ERROR;
+    }
+
+    /*
+     * Empty and impossible ranges are settled here; a range stays
+     * SHA1_ALLOC_ERROR if no thread could take its span
+     */
+    for (size_t i = 0; i < n; i++)
+    {
+        SHA1_Range_p_t range_p = &ranges[i];
+
+        range_p->err_errno = 0;
+        if (range_p->length == 0)
+        {
+            SHA1_Ctx_t ctx;
+
+            SHA1_ctx_init(&ctx);
+            SHA1_ctx_final(&ctx, range_p->digest);
+            range_p->err = SHA1_SUCCESS;
+        }
+        else if (range_p->offset + range_p->length < range_p->offset ||
+                 range_p->offset + range_p->length > file_size)
+        {
+            range_p->err = SHA1_BAD_INPUT;
+        }
+        else
+        {
+            range_p->err = SHA1_ALLOC_ERROR;
+            keys[n_read].offset = range_p->offset;
+            keys[n_read].index = i;
+            n_read++;
+            result_p->bytes_requested += range_p->length;
+        }
+    }
+    qsort(keys, n_read, sizeof(*keys), compare_keys);
+
+    /*
+     * Merge ranges whose aligned windows touch or overlap
+     */
+    for (size_t k = 0; k < n_read; k++)
+    {
+        const SHA1_Range_t *range_p = &ranges[keys[k].index];
+        uint64_t start = ALIGN_DOWN(range_p->offset);
+        uint64_t end = ALIGN_UP(range_p->offset + range_p->length);
+        span_t *span_p = job.n_spans > 0 ? &job.spans[job.n_spans - 1] : NULL;
+
+        if (end > file_size || end < start)
+        {
+            end = file_size; /* rounded past end of file (or of 2^64) */
+        }
+        job.order[k] = keys[k].index;
+        if (span_p != NULL && start <= span_p->end)
+        {
+            span_p->count++;
+            if (end > span_p->end)
+            {
+                span_p->end = end;
+            }
+            continue;
+        }
+        span_p = &job.spans[job.n_spans++];
+        span_p->start = start;
+        span_p->end = end;
+        span_p->first = k;
+        span_p->count = 1;
+    }
+    free(keys);
+    qsort(job.spans, job.n_spans, sizeof(*job.spans), compare_span_size);
+
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+    if ((size_t)n_threads > job.n_spans)
+    {
+        n_threads = job.n_spans > 0 ? (int)job.n_spans : 1;
+    }
+    if (n_threads > 1)
+    {
+        threads = calloc((size_t)n_threads, sizeof(*threads));
+    }
+    for (; threads != NULL && n_started < n_threads; n_started++)
+    {
+        if (pthread_create(&threads[n_started], NULL, range_worker, &job) != 0)
+        {
+            break;
+        }
+    }
+    range_worker(&job);
+    for (int i = 1; i < n_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    result_p->n_spans = job.n_spans;
+    result_p->bytes_read = job.bytes_read;
+    free(job.order);
+    free(job.jobs);
+    free(job.spans);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (ranges[i].err != SHA1_SUCCESS)
+        {
+            if (ranges[i].err == SHA1_IO_ERROR)
+            {
+                errno = ranges[i].err_errno;
+            }
+            return ranges[i].err;
+        }
+    }
+    return SHA1_SUCCESS;
+}
+
+SHA1_ERRCODE SHA1_hash_range(int fd, uint64_t offset, uint64_t length, SHA1_DIGEST_t digest)
+{
+    SHA1_Range_t range = { offset, length, SHA1_SUCCESS, 0, { 0 } };
+    SHA1_RangeOptions_t options = { 1 };
+    SHA1_RangeResult_t result;
+    SHA1_ERRCODE err = SHA1_hash_ranges(fd, &range, 1, &options, &result);
+
+    memcpy(digest, range.digest, SHA1_DIGEST_SIZE);
+    return err;
+}
@@ -0,0 +1,81 @@
+/* SHA1 byte-range hashing header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_RANGE_H_
+#define _SHA1_RANGE_H_
+
+/*
+ * SHA-1 of byte ranges [offset, offset + length) of a file (HTTP range
+ * checks, partial downloads), reading nothing outside them.
+ *
+ * Ranges are sorted and merged into spans wherever they share a page,
+ * so overlapping or adjacent ranges are read once. A span is read front
+ * to back with pread(2) in page-aligned chunks of SHA1_RANGE_CHUNK, the
+ * next chunk announced to the kernel (POSIX_FADV_WILLNEED) while the
+ * current one is hashed. Every range active in a chunk is fed to the
+ * multi-buffer job manager (sha1_mb.h), so many overlapping ranges are
+ * hashed in the SIMD lanes together. Spans are spread over threads,
+ * largest first; one range is inherently sequential and takes a single
+ * thread however long it is.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_RANGE_CHUNK (4 * 1024 * 1024) /* bytes per pread(2) */
+#define SHA1_RANGE_ALIGN 4096              /* reads start and end on this boundary */
+
+typedef struct SHA1_Range {
+    uint64_t offset;
+    uint64_t length;
+    SHA1_ERRCODE err;        /* out: SHA1_SUCCESS, SHA1_BAD_INPUT if past end of file,
+                              * SHA1_IO_ERROR or SHA1_COLLISION_DETECTED */
+    int err_errno;           /* out: errno of the read that failed, with SHA1_IO_ERROR */
+    SHA1_DIGEST_t digest;    /* out */
+} SHA1_Range_t, *SHA1_Range_p_t;
+
+typedef struct SHA1_RangeOptions {
+    int n_threads;           /* <= 0 means one per online CPU */
+} SHA1_RangeOptions_t, *SHA1_RangeOptions_p_t;
+
+typedef struct SHA1_RangeResult {
+    size_t n_spans;          /* separate windows read */
+    uint64_t bytes_requested; /* sum of the range lengths */
+    uint64_t bytes_read;     /* after merging and alignment */
+} SHA1_RangeResult_t, *SHA1_RangeResult_p_t;
+
+/*
+ * PARSE RANGE
+ * Parse "OFFSET+LENGTH" or "FIRST-LAST" (inclusive, as in an HTTP Range
+ * header). Numbers are decimal, or hex with 0x, and may end in K, M, G
+ * or T (powers of 1024).
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_BAD_INPUT
+ */
+SHA1_ERRCODE SHA1_parse_range(const char *spec, SHA1_Range_p_t range_p);
+
+/*
+ * HASH RANGES
+ * Hash n ranges of the regular file open at fd. Each range gets its own
+ * digest and error code; fd's file offset is not used or changed.
+ *
+ * Returns
+ *  SHA1_SUCCESS if every range was hashed, else the error of the first
+ *  range that failed; SHA1_IO_ERROR (errno set) if fd cannot be
+ *  examined, or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_hash_ranges(int fd, SHA1_Range_p_t ranges, size_t n,
+                              const SHA1_RangeOptions_t *options_p, SHA1_RangeResult_p_t result_p);
+
+/*
+ * HASH RANGE
+ * One range, on the calling thread.
+ *
+ * Returns
+ *  as SHA1_hash_ranges
+ */
+SHA1_ERRCODE SHA1_hash_range(int fd, uint64_t offset, uint64_t length, SHA1_DIGEST_t digest);
+
+#endif /* _SHA1_RANGE_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Single-producer single-consumer buffer ring
+ */
+
+#include "sha1_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Wait until *counter is no longer seen, the other side's counter
+ */
+static void ring_wait(SHA1_Ring_p_t ring_p, const uint64_t *counter, uint64_t seen)
+{
+    for (int i = 0; i < ring_p->spin; i++)
+    {
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen)
+        {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    pthread_mutex_lock(&ring_p->lock);
+    __atomic_add_fetch(&ring_p->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(counter, __ATOMIC_SEQ_CST) == seen)
+    {
+        pthread_cond_wait(&ring_p->cond, &ring_p->lock);
+    }
+    __atomic_sub_fetch(&ring_p->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring_p->lock);
+}
+
+/*
+ * Advance our own counter, waking the other side if it sleeps (see
+ * sha1_ring.h for why no wakeup is lost)
+ */
+static void ring_advance(SHA1_Ring_p_t ring_p, uint64_t *counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring_p->sleepers, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&ring_p->lock);
+        pthread_cond_broadcast(&ring_p->cond);
+        pthread_mutex_unlock(&ring_p->lock);
+    }
+}
+
+/*
+ * RING INIT
+ */
+SHA1_ERRCODE SHA1_ring_init(SHA1_Ring_p_t ring_p, size_t n_slots, size_t slot_size, int spin)
+{
+    memset(ring_p, 0, sizeof(*ring_p));
+    ring_p->n_slots = n_slots;
+    ring_p->slot_size = slot_size;
+    ring_p->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? spin : 0;
+    ring_p->len = calloc(n_slots, sizeof(*ring_p->len));
+    if (ring_p->len == NULL || posix_memalign((void **)&ring_p->data, 4096, n_slots * slot_size) != 0)
+    {
+        free(ring_p->len);
+        return SHA1_ALLOC_ERROR;
+    }
+    pthread_mutex_init(&ring_p->lock, NULL);
+    pthread_cond_init(&ring_p->cond, NULL);
+    return SHA1_SUCCESS;
+}
+
+/*
+ * RING FREE
+ */
+void SHA1_ring_free(SHA1_Ring_p_t ring_p)
+{
+    pthread_cond_destroy(&ring_p->cond);
+    pthread_mutex_destroy(&ring_p->lock);
+    free(ring_p->data);
+    free(ring_p->len);
+}
+
+/*
+ * RING SLOT
+ */
+uint8_t *SHA1_ring_slot(SHA1_Ring_p_t ring_p)
+{
+    uint64_t tail;
+
+    while (ring_p->head - (tail = __atomic_load_n(&ring_p->tail, __ATOMIC_ACQUIRE)) ==
+           ring_p->n_slots)
+    {
+        ring_wait(ring_p, &ring_p->tail, tail);
+    }
+    return ring_p->data + (ring_p->head % ring_p->n_slots) * ring_p->slot_size;
+}
+
+/*
+ * RING PUSH
+ */
+void SHA1_ring_push(SHA1_Ring_p_t ring_p, size_t len)
+{
+    ring_p->len[ring_p->head % ring_p->n_slots] = len;
+    ring_advance(ring_p, &ring_p->head);
+}
+
+/*
+ * RING PEEK
+ */
+const uint8_t *SHA1_ring_peek(SHA1_Ring_p_t ring_p, size_t *len_p)
+{
+    uint64_t tail = ring_p->tail;
+
+    while (__atomic_load_n(&ring_p->head, __ATOMIC_ACQUIRE) == tail)
+    {
+        ring_wait(ring_p, &ring_p->head, tail);
+    }
+    *len_p = ring_p->len[tail % ring_p->n_slots];
+    return ring_p->data + (tail % ring_p->n_slots) * ring_p->slot_size;
+}
+
+/*
+ * RING POP
+ */
+void SHA1_ring_pop(SHA1_Ring_p_t ring_p)
+{
+    ring_advance(ring_p, &ring_p->tail);
+}
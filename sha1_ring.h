@@ -0,0 +1,83 @@
+/* SHA1 buffer ring header file */
+
+#include <pthread.h>
+#include "sha1.h"
+
+#ifndef _SHA1_RING_H_
+#define _SHA1_RING_H_
+
+/*
+ * The ring of buffers between one producer thread and one consumer,
+ * shared by the decompressing (sha1_decompress.h) and pipe (sha1_pipe.h)
+ * readers and the thread that hashes what they hand over.
+ *
+ * The producer owns head and the consumer tail; slot i % n_slots holds
+ * data while tail <= i < head. Each counter has a cache line to itself,
+ * so the two sides never write to the same line. A side that finds the
+ * ring full or empty polls the other's counter spin times, then sleeps
+ * on a condition variable; a side that advances its counter wakes it
+ * only if it announced that it sleeps. The counter store and the load of
+ * that announcement are both sequentially consistent, so either the
+ * sleeper sees the new count or the other side sees the sleeper, and no
+ * wakeup is lost.
+ *
+ * The slot lengths, and anything else the producer writes before it
+ * pushes a slot, are visible to the consumer once it has the slot.
+ */
+
+typedef struct SHA1_Ring {
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    int sleepers __attribute__((aligned(64)));
+    int spin;                       /* polls before sleeping */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t n_slots;
+    size_t slot_size;
+    size_t *len;                    /* bytes in each slot */
+    uint8_t *data;                  /* n_slots * slot_size bytes, page-aligned */
+} SHA1_Ring_t, *SHA1_Ring_p_t;
+
+/*
+ * RING INIT
+ * Set up an empty ring. The ring itself must be 64-byte aligned. The
+ * sides only spin when there is another CPU to make progress meanwhile.
+ *
+ * Returns
+ *  SHA1_SUCCESS or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_ring_init(SHA1_Ring_p_t ring_p, size_t n_slots, size_t slot_size, int spin);
+
+/*
+ * RING FREE
+ * Release what SHA1_ring_init allocated, once both sides are done.
+ */
+void SHA1_ring_free(SHA1_Ring_p_t ring_p);
+
+/*
+ * RING SLOT
+ * Producer: wait for a free slot and return it (slot_size bytes).
+ */
+uint8_t *SHA1_ring_slot(SHA1_Ring_p_t ring_p);
+
+/*
+ * RING PUSH
+ * Producer: hand the slot from SHA1_ring_slot, holding len bytes, over
+ * to the consumer.
+ */
+void SHA1_ring_push(SHA1_Ring_p_t ring_p, size_t len);
+
+/*
+ * RING PEEK
+ * Consumer: wait for the next filled slot and return it, with its
+ * length in *len_p.
+ */
+const uint8_t *SHA1_ring_peek(SHA1_Ring_p_t ring_p, size_t *len_p);
+
+/*
+ * RING POP
+ * Consumer: give the slot from SHA1_ring_peek back to the producer.
+ */
+void SHA1_ring_pop(SHA1_Ring_p_t ring_p);
+
+#endif /* _SHA1_RING_H_ */
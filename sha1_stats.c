@@ -0,0 +1,260 @@
+/*
+ * Per-thread hashing statistics
+ */
+
+#include "sha1_stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+int sha1_stats_on = 0;
+__thread SHA1_Stats_t *sha1_stats_tls = NULL;
+
+/*
+ * One thread's counters, padded to whole cache lines so neighbouring
+ * threads never write to the same line
+ */
+typedef struct stats_slot {
+    SHA1_Stats_t stats;
+    struct stats_slot *next;
+} __attribute__((aligned(64))) stats_slot_t;
+
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_slot_t *slots_head = NULL;
+static stats_slot_t **slots_tail = &slots_head;
+
+/*
+ * A slot that could not be allocated: counting goes here, shared, rather
+ * than failing the hash
+ */
+static stats_slot_t overflow_slot;
+
+SHA1_Stats_t *SHA1_stats_register(void)
+{
+    stats_slot_t *slot_p = aligned_alloc(64, sizeof(stats_slot_t));
+
+    if (slot_p == NULL)
+    {
+        sha1_stats_tls = &overflow_slot.stats;
+        return sha1_stats_tls;
+    }
+    memset(slot_p, 0, sizeof(*slot_p));
+
+    /*
+     * Slots live until exit: a thread that finished hashing still counts
+     */
+    pthread_mutex_lock(&slots_lock);
+    *slots_tail = slot_p;
+    slots_tail = &slot_p->next;
+    pthread_mutex_unlock(&slots_lock);
+
+    sha1_stats_tls = &slot_p->stats;
+    return sha1_stats_tls;
+}
+
+void SHA1_stats_enable(int enable)
+{
+#if SHA1_STATS
+    sha1_stats_on = enable;
+#else
+    (void)enable;
+#endif
+}
+
+void SHA1_stats_record_message(uint64_t msg_length, uint64_t latency_ns)
+{
+    SHA1_Stats_t *stats_p;
+    int bucket = 0;
+
+    if (!SHA1_STATS_ON())
+    {
+        return;
+    }
+
+    stats_p = SHA1_stats_local();
+    stats_p->messages++;
+    stats_p->bytes += msg_length;
+
+    if (msg_length <= SHA1_STATS_SHORT_MESSAGE)
+    {
+        if (latency_ns != 0)
+        {
+            bucket = 63 - __builtin_clzll(latency_ns);
+        }
+        if (bucket >= SHA1_STATS_HIST_BUCKETS)
+        {
+            bucket = SHA1_STATS_HIST_BUCKETS - 1;
+        }
+        stats_p->short_messages++;
+        stats_p->short_latency[bucket]++;
+    }
+}
+
+static void add_stats(SHA1_Stats_t *sum_p, const SHA1_Stats_t *stats_p)
+{
+    sum_p->messages += stats_p->messages;
+    sum_p->bytes += stats_p->bytes;
+    sum_p->blocks += stats_p->blocks;
+    for (int k = 0; k < SHA1_KERNEL_COUNT; k++)
+    {
+        sum_p->kernel_blocks[k] += stats_p->kernel_blocks[k];
+    }
+    sum_p->io_ns += stats_p->io_ns;
+    sum_p->compress_ns += stats_p->compress_ns;
+    sum_p->short_messages += stats_p->short_messages;
+    for (int i = 0; i < SHA1_STATS_HIST_BUCKETS; i++)
+    {
+        sum_p->short_latency[i] += stats_p->short_latency[i];
+    }
+}
+
+size_t SHA1_stats_collect(SHA1_Stats_t *per_thread, size_t max, SHA1_Stats_t *total_p)
+{
+    size_t n = 0;
+
+    if (total_p != NULL)
+    {
+        memset(total_p, 0, sizeof(*total_p));
+    }
+
+    pthread_mutex_lock(&slots_lock);
+    for (stats_slot_t *slot_p = slots_head; slot_p != NULL; slot_p = slot_p->next)
+    {
+        if (n < max)
+        {
+            per_thread[n] = slot_p->stats;
+        }
+        if (total_p != NULL)
+        {
+            add_stats(total_p, &slot_p->stats);
+        }
+        n++;
+    }
+    pthread_mutex_unlock(&slots_lock);
+
+    if (total_p != NULL)
+    {
+        add_stats(total_p, &overflow_slot.stats);
+    }
+
+    return n;
+}
+
+void SHA1_stats_reset(void)
+{
+    pthread_mutex_lock(&slots_lock);
+    for (stats_slot_t *slot_p = slots_head; slot_p != NULL; slot_p = slot_p->next)
+    {
+        memset(&slot_p->stats, 0, sizeof(slot_p->stats));
+    }
+    memset(&overflow_slot.stats, 0, sizeof(overflow_slot.stats));
+    pthread_mutex_unlock(&slots_lock);
+}
+
+const char *SHA1_stats_kernel_name(int kernel)
+{
+    static const char *const names[SHA1_KERNEL_COUNT] = {
+        [SHA1_KERNEL_SCALAR] = "scalar",
+        [SHA1_KERNEL_DC] = "dc",
+        [SHA1_KERNEL_SSSE3] = "ssse3",
+        [SHA1_KERNEL_AVX2] = "avx2",
+        [SHA1_KERNEL_AVX512] = "avx512",
+        [SHA1_KERNEL_SHANI] = "shani",
+        [SHA1_KERNEL_AVX2_X8] = "avx2x8",
+        [SHA1_KERNEL_AVX512_X16] = "avx512x16",
+        [SHA1_KERNEL_ZERO] = "zero",
+        [SHA1_KERNEL_AFALG] = "afalg",
+    };
+
+    if (kernel < 0 || kernel >= SHA1_KERNEL_COUNT || names[kernel] == NULL)
+    {
+        return "unknown";
+    }
+    return names[kernel];
+}
+
+/*
+ * One line of counters: messages, bytes, blocks by kernel, time split
+ */
+static void print_line(FILE *fp, const char *label, const SHA1_Stats_t *stats_p)
+{
+    double io_ms = stats_p->io_ns / 1e6;
+    double compress_ms = stats_p->compress_ns / 1e6;
+
+    fprintf(fp, "%-10s %llu messages, %llu bytes, %llu blocks (",
+            label,
+            (unsigned long long)stats_p->messages,
+            (unsigned long long)stats_p->bytes,
+            (unsigned long long)stats_p->blocks);
+    for (int k = 0, first = 1; k < SHA1_KERNEL_COUNT; k++)
+    {
+        if (stats_p->kernel_blocks[k] == 0)
+        {
+            continue;
+        }
+        fprintf(fp, "%s%s %llu", first ? "" : ", ", SHA1_stats_kernel_name(k),
+                (unsigned long long)stats_p->kernel_blocks[k]);
+        first = 0;
+    }
+    fprintf(fp, "), io %.3f ms, compress %.3f ms", io_ms, compress_ms);
+    if (stats_p->compress_ns != 0)
+    {
+        fprintf(fp, " (%.1f MB/s)", stats_p->blocks * 64.0 * 1e3 / stats_p->compress_ns);
+    }
+    fputc('\n', fp);
+}
+
+void SHA1_stats_print(FILE *fp)
+{
+    SHA1_Stats_t total;
+    SHA1_Stats_t *per_thread = NULL;
+    size_t n_threads, n_alloc = 0;
+
+#if !SHA1_STATS
+    fprintf(fp, "statistics not compiled in (built with SHA1_STATS=0)\n");
+    return;
+#endif
+
+    n_threads = SHA1_stats_collect(NULL, 0, NULL);
+    if (n_threads > 1)
+    {
+        per_thread = calloc(n_threads, sizeof(SHA1_Stats_t));
+        n_alloc = per_thread != NULL ? n_threads : 0;
+    }
+    n_threads = SHA1_stats_collect(per_thread, n_alloc, &total);
+
+    print_line(fp, "total:", &total);
+    if (per_thread != NULL)
+    {
+        /* threads that started hashing in between are in the total only */
+        for (size_t i = 0; i < n_threads && i < n_alloc; i++)
+        {
+            char label[32];
+
+            snprintf(label, sizeof(label), "thread %zu:", i);
+            print_line(fp, label, &per_thread[i]);
+        }
+        free(per_thread);
+    }
+
+    if (total.short_messages == 0)
+    {
+        return;
+    }
+
+    /*
+     * Histogram rows between the first and last non-empty bucket
+     */
+    int lo = 0, hi = SHA1_STATS_HIST_BUCKETS - 1;
+
+    while (total.short_latency[lo] == 0) lo++;
+    while (total.short_latency[hi] == 0) hi--;
+
+    fprintf(fp, "latency of %llu messages <= %d bytes:\n",
+            (unsigned long long)total.short_messages, SHA1_STATS_SHORT_MESSAGE);
+    for (int i = lo; i <= hi; i++)
+    {
+        fprintf(fp, "  %12llu - %12llu ns  %llu\n",
+                i ? 1ull << i : 0ull, (2ull << i) - 1, (unsigned long long)total.short_latency[i]);
+    }
+}
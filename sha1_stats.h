@@ -0,0 +1,176 @@
+/* SHA1 statistics header file */
+
+#include <stdio.h>
+#include <time.h>
+#include "sha1.h"
+
+#ifndef _SHA1_STATS_H_
+#define _SHA1_STATS_H_
+
+/*
+ * Hot-path counters, cheap enough to leave compiled into production
+ * builds. Every thread that hashes gets its own cache-line aligned
+ * SHA1_Stats_t on first use, so counting never shares a line between
+ * threads and needs no atomics; SHA1_stats_collect sums them.
+ *
+ * Counting is off until SHA1_stats_enable(1). While it is off the cost
+ * is one predictable branch per call into the library (not per block).
+ * Building with -DSHA1_STATS=0 removes even that: the macros below
+ * expand to nothing and the API reports no threads.
+ *
+ * Counters are updated without synchronisation; collect them after the
+ * hashing threads are done (or accept slightly stale numbers).
+ */
+
+#ifndef SHA1_STATS
+#define SHA1_STATS 1
+#endif
+
+/*
+ * Constants
+ */
+#define SHA1_STATS_HIST_BUCKETS  32   /* bucket i counts latencies in [2^i, 2^(i+1)) ns */
+#define SHA1_STATS_SHORT_MESSAGE 4096 /* messages up to this many bytes go in the histogram */
+
+/*
+ * Compression kernels, for per-kernel block counts
+ */
+typedef enum _sha1_kernel
+{
+    SHA1_KERNEL_SCALAR = 0,  /* plain RFC 3174 compression */
+    SHA1_KERNEL_DC,          /* compression with collision detection */
+    SHA1_KERNEL_SSSE3,       /* the SIMD kernels of sha1_kernel.h */
+    SHA1_KERNEL_AVX2,
+    SHA1_KERNEL_AVX512,
+    SHA1_KERNEL_SHANI,
+    SHA1_KERNEL_AVX2_X8,     /* multi-buffer kernels */
+    SHA1_KERNEL_AVX512_X16,
+    SHA1_KERNEL_ZERO,        /* all-zero blocks from a precomputed schedule */
+    SHA1_KERNEL_AFALG,       /* the Linux kernel's sha1, through AF_ALG */
+    SHA1_KERNEL_COUNT
+} SHA1_KERNEL;
+
+typedef struct SHA1_Stats {
+    uint64_t messages;       /* complete messages (buffers, files) hashed */
+    uint64_t bytes;          /* message bytes, excluding padding */
+    uint64_t blocks;         /* 64-byte blocks compressed, including padding */
+    uint64_t kernel_blocks[SHA1_KERNEL_COUNT]; /* blocks, by kernel */
+    uint64_t io_ns;          /* time spent in read(2) */
+    uint64_t compress_ns;    /* time spent compressing */
+    uint64_t short_messages; /* messages of <= SHA1_STATS_SHORT_MESSAGE bytes */
+    uint64_t short_latency[SHA1_STATS_HIST_BUCKETS]; /* their latency, log2 ns */
+} SHA1_Stats_t, *SHA1_Stats_p_t;
+
+/*
+ * Internal state used by the macros below; not for direct use
+ */
+extern int sha1_stats_on;
+extern __thread SHA1_Stats_t *sha1_stats_tls;
+SHA1_Stats_t *SHA1_stats_register(void);
+
+static inline SHA1_Stats_t *SHA1_stats_local(void)
+{
+    SHA1_Stats_t *stats_p = sha1_stats_tls;
+
+    return stats_p != NULL ? stats_p : SHA1_stats_register();
+}
+
+static inline uint64_t SHA1_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Instrumentation macros
+ *
+ *  SHA1_STATS_ON(): nonzero while counting is enabled
+ *  SHA1_STATS_ADD(field, n): add n to a field of this thread's counters
+ *  SHA1_STATS_TIMER(var): declare a timestamp var, set if counting
+ *  SHA1_STATS_ELAPSED(var, field): add the time since var to field and
+ *      restart var, so consecutive phases can be charged back to back
+ */
+#if SHA1_STATS
+
+#define SHA1_STATS_ON() __builtin_expect(sha1_stats_on, 0)
+
+#define SHA1_STATS_ADD(field, n)                                            \
+    do {                                                                    \
+        if (SHA1_STATS_ON())                                                \
+        {                                                                   \
+            SHA1_stats_local()->field += (n);                               \
+        }                                                                   \
+    } while (0)
+
+#define SHA1_STATS_TIMER(var) \
+    uint64_t var = SHA1_STATS_ON() ? SHA1_stats_now() : 0
+
+#define SHA1_STATS_ELAPSED(var, field)                                      \
+    do {                                                                    \
+        if (SHA1_STATS_ON())                                                \
+        {                                                                   \
+            uint64_t now_ = SHA1_stats_now();                               \
+            SHA1_stats_local()->field += now_ - (var);                      \
+            (var) = now_;                                                   \
+        }                                                                   \
+    } while (0)
+
+#else
+
+#define SHA1_STATS_ON() 0
+#define SHA1_STATS_ADD(field, n) do { } while (0)
+#define SHA1_STATS_TIMER(var) do { } while (0)
+#define SHA1_STATS_ELAPSED(var, field) do { } while (0)
+
+#endif /* SHA1_STATS */
+
+/*
+ * ENABLE
+ * Turn counting on or off for the whole process.
+ */
+void SHA1_stats_enable(int enable);
+
+/*
+ * RECORD MESSAGE
+ * Count one finished message of msg_length bytes that took latency_ns
+ * from start to digest. No-op while counting is off.
+ */
+void SHA1_stats_record_message(uint64_t msg_length, uint64_t latency_ns);
+
+/*
+ * COLLECT
+ * Snapshot the counters of every thread that has hashed so far.
+ *
+ * Parameters
+ *  per_thread: receives up to max per-thread snapshots, in the order
+ *              the threads first hashed; may be NULL if max is 0
+ *  max: capacity of per_thread
+ *  total_p: if not NULL, receives the sum over all threads
+ *
+ * Returns
+ *  the number of threads with counters (may exceed max)
+ */
+size_t SHA1_stats_collect(SHA1_Stats_t *per_thread, size_t max, SHA1_Stats_t *total_p);
+
+/*
+ * RESET
+ * Zero every thread's counters.
+ */
+void SHA1_stats_reset(void);
+
+/*
+ * KERNEL NAME
+ * Short name of a SHA1_KERNEL, e.g. "scalar".
+ */
+const char *SHA1_stats_kernel_name(int kernel);
+
+/*
+ * PRINT
+ * Write a human-readable report (totals, per-thread lines when more than
+ * one thread hashed, and the short-message latency histogram) to fp.
+ */
+void SHA1_stats_print(FILE *fp);
+
+#endif /* _SHA1_STATS_H_ */
@@ -0,0 +1,646 @@
+/*
+ * Streaming per-member hashing of tar archives
+ */
+
+#define _GNU_SOURCE
+#include "sha1_tar.h"
+#include "sha1_ctx.h"
+#include "sha1_decompress.h"
+#include "sha1_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Offsets into a ustar header block
+ */
+#define TAR_NAME      0
+#define TAR_SIZE      124
+#define TAR_CHKSUM    148
+#define TAR_TYPEFLAG  156
+#define TAR_LINKNAME  157
+#define TAR_MAGIC     257
+#define TAR_PREFIX    345
+
+typedef enum tar_stage {
+    TAR_HEADER,              /* collecting a header block */
+    TAR_DATA,                /* member data */
+    TAR_EXTENDED,            /* pax or long-name data, kept */
+    TAR_PADDING,             /* up to the next 512-byte boundary */
+    TAR_END                  /* past the end-of-archive block */
+} tar_stage_t;
+
+/*
+ * A listed member's digest by path, for hard links to it later on
+ */
+typedef struct tar_entry {
+    struct tar_entry *next;
+    SHA1_DIGEST_t digest;
+    char path[];
+} tar_entry_t;
+
+typedef struct tar_state {
+    const SHA1_TarOptions_t *options_p;
+    SHA1_Writer_p_t writer_p;
+    SHA1_TarResult_p_t result_p;
+    tar_stage_t stage;
+    uint8_t header[SHA1_TAR_BLOCK];
+    size_t header_len;
+    uint64_t remaining;      /* bytes left in this stage */
+    uint64_t padding;        /* bytes of padding after the data */
+
+    /*
+     * Current member
+     */
+    int regular;             /* hash and list it */
+    char *path;
+    SHA1_Ctx_t ctx;
+    int collision;
+
+    /*
+     * Extended data, and what it says about the next member
+     */
+    char ext_type;           /* typeflag of the extended header */
+    char *ext;
+    size_t ext_len;
+    char *next_path;
+    char *next_linkpath;
+    uint64_t next_size;
+    int have_next_size;
+
+    /*
+     * Members listed so far, chained in mask + 1 buckets
+     */
+    tar_entry_t **buckets;
+    size_t mask;
+    size_t n_entries;
+
+    int damaged;             /* reported on stderr */
+} tar_state_t;
+
+/*
+ * Octal, space or NUL terminated, or GNU base-256 when the top bit of
+ * the first byte is set
+ */
+static int parse_number(const uint8_t *field, size_t len, uint64_t *value_p)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x3F;
+        for (i = 1; i < len; i++)
+        {
+            if (value >> 56)
+            {
+                return 0;
+            }
+            value = value << 8 | field[i];
+        }
+        *value_p = value;
+        return 1;
+    }
+
+    while (i < len && field[i] == ' ')
+    {
+        i++;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    {
+        value = value << 3 | (uint64_t)(field[i] - '0');
+    }
+    if (i < len && field[i] != ' ' && field[i] != '\0')
+    {
+        return 0;
+    }
+    *value_p = value;
+    return 1;
+}
+
+static char *field_dup(const uint8_t *field, size_t len)
+{
+    return strndup((const char *)field, len);
+}
+
+static SHA1_ERRCODE tar_error(tar_state_t *state_p, const char *what)
+{
+    SHA1_writer_flush(state_p->writer_p);
+    fprintf(stderr, "%s: %s\n", state_p->options_p->prog_name, what);
+    state_p->damaged = 1;
+    return SHA1_BAD_INPUT;
+}
+
+/*
+ * Apply pax records "LEN KEY=VALUE\n" to the next member
+ */
+static SHA1_ERRCODE parse_pax(tar_state_t *state_p)
+{
+    const char *p = state_p->ext, *end = state_p->ext + state_p->ext_len;
+
+    while (p < end && *p != '\0')
+    {
+        const char *key, *value, *record_end;
+        size_t len = 0;
+
+        for (key = p; key < end && *key >= '0' && *key <= '9'; key++)
+        {
+            len = len * 10 + (size_t)(*key - '0');
+        }
+        if (key == p || key >= end || *key != ' ' || len <= (size_t)(key - p) + 1 ||
+            len > (size_t)(end - p) || p[len - 1] != '\n')
+        {
+            return tar_error(state_p, "malformed pax extended header");
+        }
+        record_end = p + len - 1;
+        key++;
+        value = memchr(key, '=', (size_t)(record_end - key));
+        if (value == NULL)
+        {
+            return tar_error(state_p, "malformed pax extended header");
+        }
+        value++;
+
+        if (state_p->ext_type == 'x' && value - key == 5 && memcmp(key, "path", 4) == 0)
+        {
+            free(state_p->next_path);
+            state_p->next_path = strndup(value, (size_t)(record_end - value));
+        }
+        else if (state_p->ext_type == 'x' && value - key == 9 && memcmp(key, "linkpath", 8) == 0)
+        {
+            free(state_p->next_linkpath);
+            state_p->next_linkpath = strndup(value, (size_t)(record_end - value));
+        }
+        else if (state_p->ext_type == 'x' && value - key == 5 && memcmp(key, "size", 4) == 0)
+        {
+            state_p->next_size = strtoull(value, NULL, 10);
+            state_p->have_next_size = 1;
+        }
+        p += len;
+    }
+    return SHA1_SUCCESS;
+}
+
+static SHA1_ERRCODE finish_extended(tar_state_t *state_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    if (state_p->ext_type == 'x' || state_p->ext_type == 'g')
+    {
+        err = parse_pax(state_p);
+    }
+    else if (state_p->ext_type == 'L')
+    {
+        free(state_p->next_path);
+        state_p->next_path = strndup(state_p->ext, state_p->ext_len);
+    }
+    else if (state_p->ext_type == 'K')
+    {
+        free(state_p->next_linkpath);
+        state_p->next_linkpath = strndup(state_p->ext, state_p->ext_len);
+    }
+    free(state_p->ext);
+    state_p->ext = NULL;
+    state_p->ext_len = 0;
+    return err;
+}
+
+static size_t path_hash(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ull; /* FNV-1a */
+
+    for (; *path != '\0'; path++)
+    {
+        h = (h ^ (uint8_t)*path) * 0x100000001b3ull;
+    }
+    return (size_t)h;
+}
+
+static const tar_entry_t *find_entry(const tar_state_t *state_p, const char *path)
+{
+    const tar_entry_t *entry_p;
+
+    if (state_p->buckets == NULL)
+    {
+        return NULL;
+    }
+    for (entry_p = state_p->buckets[path_hash(path) & state_p->mask]; entry_p != NULL;
+         entry_p = entry_p->next)
+    {
+        if (strcmp(entry_p->path, path) == 0)
+        {
+            return entry_p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Remember a member's digest; the table doubles when it averages two
+ * entries a bucket. A later member of the same path replaces it.
+ */
+static SHA1_ERRCODE add_entry(tar_state_t *state_p, const char *path, const SHA1_DIGEST_t digest)
+{
+    size_t len = strlen(path);
+    tar_entry_t *entry_p, **pp;
+
+    if (state_p->buckets == NULL || state_p->n_entries >= 2 * (state_p->mask + 1))
+    {
+        size_t n_buckets = state_p->buckets == NULL ? 1024 : 2 * (state_p->mask + 1);
+        tar_entry_t **buckets = calloc(n_buckets, sizeof(*buckets));
+
+        if (buckets == NULL)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        for (size_t i = 0; state_p->buckets != NULL && i <= state_p->mask; i++)
+        {
+            while ((entry_p = state_p->buckets[i]) != NULL)
+            {
+                state_p->buckets[i] = entry_p->next;
+                pp = &buckets[path_hash(entry_p->path) & (n_buckets - 1)];
+                entry_p->next = *pp;
+                *pp = entry_p;
+            }
+        }
+        free(state_p->buckets);
+        state_p->buckets = buckets;
+        state_p->mask = n_buckets - 1;
+    }
+
+    entry_p = (tar_entry_t *)find_entry(state_p, path);
+    if (entry_p != NULL)
+    {
+        memcpy(entry_p->digest, digest, SHA1_DIGEST_SIZE);
+        return SHA1_SUCCESS;
+    }
+    entry_p = malloc(sizeof(*entry_p) + len + 1);
+    if (entry_p == NULL)
+    {
+        return SHA1_ALLOC_ERROR;
+    }
+    memcpy(entry_p->digest, digest, SHA1_DIGEST_SIZE);
+    memcpy(entry_p->path, path, len + 1);
+    pp = &state_p->buckets[path_hash(path) & state_p->mask];
+    entry_p->next = *pp;
+    *pp = entry_p;
+    state_p->n_entries++;
+    return SHA1_SUCCESS;
+}
+
+static void free_entries(tar_state_t *state_p)
+{
+    for (size_t i = 0; state_p->buckets != NULL && i <= state_p->mask; i++)
+    {
+        tar_entry_t *entry_p, *next_p;
+
+        for (entry_p = state_p->buckets[i]; entry_p != NULL; entry_p = next_p)
+        {
+            next_p = entry_p->next;
+            free(entry_p);
+        }
+    }
+    free(state_p->buckets);
+}
+
+/*
+ * Write the line for a member, unless the index filters it out
+ */
+static SHA1_ERRCODE list_member(tar_state_t *state_p, const SHA1_DIGEST_t digest, const char *path)
+{
+    const SHA1_TarOptions_t *options_p = state_p->options_p;
+
+    if (options_p->index_p != NULL &&
+        SHA1_index_contains(options_p->index_p, digest) != options_p->want_known)
+    {
+        return SHA1_SUCCESS;
+    }
+    return SHA1_writer_put_digest(state_p->writer_p, digest, path, options_p->format);
+}
+
+/*
+ * A hard link (typeflag '1') has no data of its own: it is listed with
+ * the digest of the member it links to, which precedes it in the
+ * archive. A link to anything else is reported and counted.
+ */
+static SHA1_ERRCODE link_member(tar_state_t *state_p, const char *target)
+{
+    const tar_entry_t *entry_p = find_entry(state_p, target);
+
+    if (entry_p == NULL)
+    {
+        SHA1_writer_flush(state_p->writer_p);
+        fprintf(stderr, "%s: %s: hard link to %s, which was not listed; skipped\n",
+                state_p->options_p->prog_name, state_p->path, target);
+        state_p->result_p->n_skipped_links++;
+        return SHA1_SUCCESS;
+    }
+    state_p->result_p->n_links++;
+    return list_member(state_p, entry_p->digest, state_p->path);
+}
+
+static SHA1_ERRCODE finish_member(tar_state_t *state_p)
+{
+    SHA1_DIGEST_t digest;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    if (SHA1_ctx_final(&state_p->ctx, digest) == SHA1_COLLISION_DETECTED || state_p->collision)
+    {
+        SHA1_writer_flush(state_p->writer_p);
+        fprintf(stderr, "%s: %s: SHA-1 collision attack detected\n",
+                state_p->options_p->prog_name, state_p->path);
+        state_p->result_p->n_collisions++;
+    }
+    else
+    {
+        err = add_entry(state_p, state_p->path, digest);
+        if (err == SHA1_SUCCESS)
+        {
+            err = list_member(state_p, digest, state_p->path);
+        }
+        state_p->result_p->n_hashed++;
+        state_p->result_p->bytes_hashed += state_p->ctx.length;
+    }
+    free(state_p->path);
+    state_p->path = NULL;
+    state_p->regular = 0;
+    return err;
+}
+
+/*
+ * Start the stage after a member's (or extended header's) data
+ */
+static SHA1_ERRCODE end_data(tar_state_t *state_p)
+{
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    if (state_p->stage == TAR_EXTENDED)
+    {
+        err = finish_extended(state_p);
+    }
+    else if (state_p->regular)
+    {
+        err = finish_member(state_p);
+    }
+    state_p->stage = state_p->padding ? TAR_PADDING : TAR_HEADER;
+    state_p->remaining = state_p->padding;
+    return err;
+}
+
+static SHA1_ERRCODE parse_header(tar_state_t *state_p)
+{
+    const uint8_t *h = state_p->header;
+    uint64_t size, chksum, sum = 0;
+    char type = (char)h[TAR_TYPEFLAG];
+    size_t i;
+
+    for (i = 0; i < SHA1_TAR_BLOCK && h[i] == 0; i++)
+    {
+    }
+    if (i == SHA1_TAR_BLOCK)
+    {
+        state_p->stage = TAR_END;
+        return SHA1_SUCCESS;
+    }
+
+    for (i = 0; i < SHA1_TAR_BLOCK; i++)
+    {
+        sum += i >= TAR_CHKSUM && i < TAR_CHKSUM + 8 ? ' ' : h[i];
+    }
+    if (!parse_number(h + TAR_CHKSUM, 8, &chksum) || chksum != sum)
+    {
+        return tar_error(state_p, "bad tar header checksum");
+    }
+    if (!parse_number(h + TAR_SIZE, 12, &size))
+    {
+        return tar_error(state_p, "bad tar member size");
+    }
+
+    state_p->header_len = 0;
+    if (type == 'x' || type == 'g' || type == 'L' || type == 'K')
+    {
+        if (size > SHA1_TAR_MAX_EXTENDED)
+        {
+            return tar_error(state_p, "tar extended header too long");
+        }
+        state_p->ext_type = type;
+        state_p->ext = malloc(size + 1);
+        if (state_p->ext == NULL)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        state_p->ext_len = 0;
+        state_p->stage = TAR_EXTENDED;
+    }
+    else
+    {
+        if (state_p->have_next_size)
+        {
+            size = state_p->next_size;
+        }
+        if (state_p->next_path != NULL)
+        {
+            state_p->path = state_p->next_path;
+            state_p->next_path = NULL;
+        }
+        else if (memcmp(h + TAR_MAGIC, "ustar", 6) == 0 && h[TAR_PREFIX] != '\0')
+        {
+            size_t prefix_len = strnlen((const char *)h + TAR_PREFIX, 155);
+            size_t name_len = strnlen((const char *)h + TAR_NAME, 100);
+
+            state_p->path = malloc(prefix_len + name_len + 2);
+            if (state_p->path != NULL)
+            {
+                memcpy(state_p->path, h + TAR_PREFIX, prefix_len);
+                state_p->path[prefix_len] = '/';
+                memcpy(state_p->path + prefix_len + 1, h + TAR_NAME, name_len);
+                state_p->path[prefix_len + name_len + 1] = '\0';
+            }
+        }
+        else
+        {
+            state_p->path = field_dup(h + TAR_NAME, 100);
+        }
+        if (state_p->path == NULL)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        state_p->have_next_size = 0;
+        state_p->result_p->n_members++;
+
+        state_p->regular = type == '0' || type == '\0' || type == '7';
+        if (state_p->regular)
+        {
+            SHA1_ctx_init(&state_p->ctx);
+            state_p->collision = 0;
+        }
+        else
+        {
+            SHA1_ERRCODE err = SHA1_SUCCESS;
+
+            if (type == '1')
+            {
+                char *target = state_p->next_linkpath;
+
+                state_p->next_linkpath = NULL;
+                if (target == NULL)
+                {
+                    target = field_dup(h + TAR_LINKNAME, 100);
+                }
+                err = target == NULL ? SHA1_ALLOC_ERROR : link_member(state_p, target);
+                free(target);
+            }
+            free(state_p->path);
+            state_p->path = NULL;
+            if (err != SHA1_SUCCESS)
+            {
+                return err;
+            }
+        }
+        free(state_p->next_linkpath);
+        state_p->next_linkpath = NULL;
+        state_p->stage = TAR_DATA;
+    }
+
+    state_p->remaining = size;
+    state_p->padding = (SHA1_TAR_BLOCK - size % SHA1_TAR_BLOCK) % SHA1_TAR_BLOCK;
+    return size == 0 ? end_data(state_p) : SHA1_SUCCESS;
+}
+
+/*
+ * Parse the next len bytes of the archive
+ */
+static SHA1_ERRCODE tar_feed(void *arg, const uint8_t *data, size_t len)
+{
+    tar_state_t *state_p = arg;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    while (len > 0 && err == SHA1_SUCCESS)
+    {
+        size_t take;
+
+        switch (state_p->stage)
+        {
+            case TAR_HEADER:
+                take = SHA1_TAR_BLOCK - state_p->header_len;
+                take = take < len ? take : len;
+                memcpy(state_p->header + state_p->header_len, data, take);
+                state_p->header_len += take;
+                if (state_p->header_len == SHA1_TAR_BLOCK)
+                {
+                    err = parse_header(state_p);
+                }
+                break;
+
+            case TAR_END:
+                return SHA1_SUCCESS;
+
+            default:
+                take = state_p->remaining < len ? (size_t)state_p->remaining : len;
+                if (state_p->stage == TAR_DATA && state_p->regular)
+                {
+                    /* hashed in place: whole blocks straight from data */
+                    if (SHA1_ctx_update(&state_p->ctx, data, take) == SHA1_COLLISION_DETECTED)
+                    {
+                        state_p->collision = 1;
+                    }
+                }
+                else if (state_p->stage == TAR_EXTENDED)
+                {
+                    memcpy(state_p->ext + state_p->ext_len, data, take);
+                    state_p->ext_len += take;
+                }
+                state_p->remaining -= take;
+                if (state_p->remaining == 0)
+                {
+                    if (state_p->stage == TAR_PADDING)
+                    {
+                        state_p->stage = TAR_HEADER;
+                    }
+                    else
+                    {
+                        err = end_data(state_p);
+                    }
+                }
+                break;
+        }
+        data += take;
+        len -= take;
+    }
+    return err;
+}
+
+/*
+ * TAR HASH FD
+ */
+SHA1_ERRCODE SHA1_tar_hash_fd(int fd, const SHA1_TarOptions_t *options_p, SHA1_Writer_p_t writer_p,
+                              SHA1_TarResult_p_t result_p)
+{
+    tar_state_t state;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+
+    memset(result_p, 0, sizeof(*result_p));
+    memset(&state, 0, sizeof(state));
+    state.options_p = options_p;
+    state.writer_p = writer_p;
+    state.result_p = result_p;
+    state.stage = TAR_HEADER;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (options_p->decompress)
+    {
+        err = SHA1_decompress_fd(fd, tar_feed, &state);
+        if (err == SHA1_BAD_INPUT && !state.damaged)
+        {
+            tar_error(&state, "not in a supported compressed format, or corrupt");
+        }
+    }
+    else
+    {
+        uint8_t *buf;
+
+        if (posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+        {
+            return SHA1_ALLOC_ERROR;
+        }
+        while (err == SHA1_SUCCESS && state.stage != TAR_END)
+        {
+            ssize_t n = read(fd, buf, SHA1_FILE_CHUNK);
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                err = SHA1_IO_ERROR;
+                break;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            err = tar_feed(&state, buf, (size_t)n);
+        }
+        free(buf);
+    }
+
+    /*
+     * Archives may end without the zero blocks, but not inside a member
+     */
+    if (err == SHA1_SUCCESS && state.stage != TAR_END &&
+        (state.stage != TAR_HEADER || state.header_len != 0))
+    {
+        err = tar_error(&state, "unexpected end of tar archive");
+    }
+
+    free(state.path);
+    free(state.ext);
+    free(state.next_path);
+    free(state.next_linkpath);
+    free_entries(&state);
+    return err;
+}
@@ -0,0 +1,65 @@
+/* SHA1 tar archive header file */
+
+#include "sha1.h"
+#include "sha1_index.h"
+#include "sha1_output.h"
+
+#ifndef _SHA1_TAR_H_
+#define _SHA1_TAR_H_
+
+/*
+ * Hash every regular member of a tar archive in one sequential pass,
+ * without extracting anything.
+ *
+ * The archive is read SHA1_FILE_CHUNK at a time (or taken from the
+ * decompression ring, see sha1_decompress.h) and parsed as a stream:
+ * headers are collected 512 bytes at a time, and member data is hashed
+ * straight out of the read buffer, whole blocks in place, so memory use
+ * does not depend on the archive or member sizes.
+ *
+ * ustar, pax (per-member "path", "linkpath" and "size" records) and GNU
+ * long names are understood. A line is written for each regular file
+ * member, named as in the archive, and for each hard link to one of
+ * them, with its digest; the digests listed are kept by path for that,
+ * which is all the memory that grows with the archive. Hard links to
+ * anything else are reported on stderr and counted; directories,
+ * symbolic links, devices and GNU sparse members are skipped.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_TAR_BLOCK        512
+#define SHA1_TAR_MAX_EXTENDED (1024 * 1024) /* longest pax or long-name data kept */
+
+typedef struct SHA1_TarOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    SHA1_FORMAT format;      /* of the output lines */
+    int decompress;          /* the archive is gzip or zstd compressed */
+    const SHA1_Index_t *index_p; /* if set, list only members whose digest is */
+    int want_known;          /* in it (nonzero) or not in it (0) */
+} SHA1_TarOptions_t, *SHA1_TarOptions_p_t;
+
+typedef struct SHA1_TarResult {
+    size_t n_members;        /* headers, extended headers not counted */
+    size_t n_hashed;         /* regular members listed */
+    size_t n_links;          /* hard links listed with their target's digest */
+    size_t n_skipped_links;  /* hard links to a member that was not listed */
+    size_t n_collisions;     /* members refused by collision detection */
+    uint64_t bytes_hashed;
+} SHA1_TarResult_t, *SHA1_TarResult_p_t;
+
+/*
+ * TAR HASH FD
+ * Read the archive from fd and write a line per regular member, and per
+ * hard link to one, to writer_p. result_p is zeroed first.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set; also for write errors),
+ *  SHA1_BAD_INPUT for a damaged or truncated archive (the members
+ *  before the damage are listed) or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_tar_hash_fd(int fd, const SHA1_TarOptions_t *options_p, SHA1_Writer_p_t writer_p,
+                              SHA1_TarResult_p_t result_p);
+
+#endif /* _SHA1_TAR_H_ */
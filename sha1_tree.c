@@ -0,0 +1,830 @@
+/*
+ * Merkle digest of a directory tree, git style, with a node cache
+ */
+
+#define _GNU_SOURCE
+#include "sha1_tree.h"
+#include "sha1_ctx.h"
+#include "sha1_stats.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NO_PARENT   SIZE_MAX
+#define TREE_READ   (128 * 1024) /* leaf read buffer, on each worker's stack */
+
+/*
+ * CACHE FILE
+ * A header, then one record per node, each followed by the node's path
+ * relative to the root ("" for the root) padded to 8 bytes. Native byte
+ * order, like sha1_cache.h.
+ */
+typedef struct tree_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t n_records;
+} tree_header_t;
+
+typedef struct tree_record {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint32_t st_mode;
+    uint32_t path_len;
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    uint32_t reserved;
+} tree_record_t;
+
+_Static_assert(sizeof(tree_record_t) % 8 == 0, "tree records must keep 8-byte alignment");
+
+#define PADDED(len) (((len) + 7) & ~(size_t)7)
+
+typedef struct tree_node {
+    char *path;              /* the root as given, or parent path + '/' + name */
+    size_t name_off;         /* name = path + name_off */
+    size_t parent;
+    size_t first_child;      /* children are consecutive, in git order */
+    size_t n_children;
+    size_t pending;          /* children not finished yet (under the job lock) */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint32_t st_mode;
+    int cached;              /* stat data matches the cache; digest is its entry */
+    int reused;              /* final digest came from the cache */
+    int no_store;            /* changed while it was read: do not record */
+    int failed;
+    SHA1_DIGEST_t digest;
+} tree_node_t;
+
+typedef struct tree_job {
+    const SHA1_TreeOptions_t *options_p;
+    SHA1_TreeResult_p_t result_p;
+    tree_node_t *nodes;
+    size_t n_nodes;
+    size_t cap;
+    size_t key_off;          /* node path + key_off is its path relative to the root */
+    int64_t start_ns;        /* CLOCK_REALTIME when the run began */
+
+    /*
+     * The cache read at the start, indexed by path
+     */
+    uint8_t *cache_data;
+    const tree_record_t **cache_table;
+    size_t cache_mask;
+
+    /*
+     * Nodes ready to be finished, and the count of finished ones
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t *ready;
+    size_t n_ready;
+    size_t n_done;
+} tree_job_t;
+
+static int64_t stat_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static uint64_t path_hash(const char *path, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (uint8_t)path[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static const char *node_key(const tree_job_t *job_p, size_t i)
+{
+    return i == 0 ? "" : job_p->nodes[i].path + job_p->key_off;
+}
+
+static void node_error(tree_job_t *job_p, tree_node_t *node_p, const char *path)
+{
+    fprintf(stderr, "%s: %s: %s\n", job_p->options_p->prog_name, path, strerror(errno));
+    node_p->failed = 1;
+    __atomic_fetch_add(&job_p->result_p->n_unreadable, 1, __ATOMIC_RELAXED);
+}
+
+static void node_set_stat(tree_node_t *node_p, const struct stat *st)
+{
+    node_p->dev = st->st_dev;
+    node_p->ino = st->st_ino;
+    node_p->size = (uint64_t)st->st_size;
+    node_p->mtime_ns = stat_ns(&st->st_mtim);
+    node_p->ctime_ns = stat_ns(&st->st_ctim);
+    node_p->st_mode = st->st_mode;
+}
+
+/*
+ * CACHE LOAD
+ * An unreadable or malformed cache is simply not used
+ */
+static void cache_load(tree_job_t *job_p)
+{
+    const tree_header_t *header_p;
+    size_t size, offset, n_slots = 1;
+    struct stat st;
+    int fd = open(job_p->options_p->cache_path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(tree_header_t) ||
+        (job_p->cache_data = malloc((size_t)st.st_size)) == NULL)
+    {
+        close(fd);
+        return;
+    }
+    size = (size_t)st.st_size;
+    for (offset = 0; offset < size; )
+    {
+        ssize_t n = read(fd, job_p->cache_data + offset, size - offset);
+
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        offset += (size_t)n;
+    }
+    close(fd);
+
+    header_p = (const tree_header_t *)job_p->cache_data;
+    if (offset != size || memcmp(header_p->magic, SHA1_TREE_MAGIC, 8) != 0 ||
+        header_p->version != SHA1_TREE_VERSION ||
+        header_p->n_records > (size - sizeof(*header_p)) / sizeof(tree_record_t))
+    {
+        goto invalid;
+    }
+
+    while (n_slots < 2 * header_p->n_records)
+    {
+        n_slots *= 2;
+    }
+    job_p->cache_table = calloc(n_slots, sizeof(*job_p->cache_table));
+    if (job_p->cache_table == NULL)
+    {
+        goto invalid;
+    }
+    job_p->cache_mask = n_slots - 1;
+
+    offset = sizeof(*header_p);
+    for (uint64_t r = 0; r < header_p->n_records; r++)
+    {
+        const tree_record_t *record_p = (const tree_record_t *)(job_p->cache_data + offset);
+        const char *path = (const char *)(record_p + 1);
+        size_t slot;
+
+        if (size - offset < sizeof(*record_p) ||
+            size - offset - sizeof(*record_p) < PADDED((size_t)record_p->path_len))
+        {
+            goto invalid;
+        }
+        slot = path_hash(path, record_p->path_len) & job_p->cache_mask;
+        while (job_p->cache_table[slot] != NULL)
+        {
+            slot = (slot + 1) & job_p->cache_mask;
+        }
+        job_p->cache_table[slot] = record_p;
+        offset += sizeof(*record_p) + PADDED((size_t)record_p->path_len);
+    }
+    return;
+
+invalid:
+    free(job_p->cache_table);
+    free(job_p->cache_data);
+    job_p->cache_table = NULL;
+    job_p->cache_data = NULL;
+}
+
+static const tree_record_t *cache_find(const tree_job_t *job_p, const char *key)
+{
+    size_t len = strlen(key);
+    size_t slot;
+
+    if (job_p->cache_table == NULL)
+    {
+        return NULL;
+    }
+    for (slot = path_hash(key, len) & job_p->cache_mask; job_p->cache_table[slot] != NULL;
+         slot = (slot + 1) & job_p->cache_mask)
+    {
+        const tree_record_t *record_p = job_p->cache_table[slot];
+
+        if (record_p->path_len == len && memcmp(record_p + 1, key, len) == 0)
+        {
+            return record_p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * CACHE WRITE
+ * Every node that was hashed or reused, not changed meanwhile and not
+ * racy; a failure costs only the next run's speed
+ */
+static void cache_write(tree_job_t *job_p)
+{
+    const char *path = job_p->options_p->cache_path;
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp = malloc(tmp_len);
+    tree_header_t header;
+    uint64_t n_records = 0;
+    FILE *fp;
+    int ok;
+
+    if (tmp == NULL)
+    {
+        return;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp.%ld", path, (long)getpid());
+    fp = fopen(tmp, "we");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "%s: %s: %s\n", job_p->options_p->prog_name, tmp, strerror(errno));
+        free(tmp);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; ok && i < job_p->n_nodes; i++)
+    {
+        const tree_node_t *node_p = &job_p->nodes[i];
+        const char *key = node_key(job_p, i);
+        static const uint8_t zeros[8] = { 0 };
+        tree_record_t record;
+
+        if (node_p->failed || node_p->no_store ||
+            node_p->mtime_ns > job_p->start_ns - SHA1_TREE_RACY_NS ||
+            node_p->ctime_ns > job_p->start_ns - SHA1_TREE_RACY_NS)
+        {
+            continue;
+        }
+        memset(&record, 0, sizeof(record));
+        record.dev = node_p->dev;
+        record.ino = node_p->ino;
+        record.size = node_p->size;
+        record.mtime_ns = node_p->mtime_ns;
+        record.ctime_ns = node_p->ctime_ns;
+        record.st_mode = node_p->st_mode;
+        record.path_len = (uint32_t)strlen(key);
+        memcpy(record.digest, node_p->digest, SHA1_DIGEST_SIZE);
+        ok = fwrite(&record, sizeof(record), 1, fp) == 1 &&
+             fwrite(key, 1, record.path_len, fp) == record.path_len &&
+             fwrite(zeros, 1, PADDED(record.path_len) - record.path_len, fp) ==
+                PADDED(record.path_len) - record.path_len;
+        n_records++;
+    }
+
+    memcpy(header.magic, SHA1_TREE_MAGIC, 8);
+    header.version = SHA1_TREE_VERSION;
+    header.n_records = n_records;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", job_p->options_p->prog_name, path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+/*
+ * WALK
+ * Breadth first, so that the children of a directory are appended
+ * together and can be sorted in place
+ */
+static SHA1_ERRCODE add_node(tree_job_t *job_p, char *path, size_t name_off, size_t parent,
+                             const struct stat *st)
+{
+    tree_node_t *node_p;
+    const tree_record_t *record_p;
+
+    if (job_p->n_nodes == job_p->cap)
+    {
+        size_t cap = job_p->cap ? job_p->cap * 2 : 1024;
+        tree_node_t *grown = realloc(job_p->nodes, cap * sizeof(*grown));
+
+        if (grown == NULL)
+        {
+            free(path);
+            return SHA1_ALLOC_ERROR;
+        }
+        job_p->nodes = grown;
+        job_p->cap = cap;
+    }
+    node_p = &job_p->nodes[job_p->n_nodes++];
+    memset(node_p, 0, sizeof(*node_p));
+    node_p->path = path;
+    node_p->name_off = name_off;
+    node_p->parent = parent;
+    node_set_stat(node_p, st);
+
+    record_p = cache_find(job_p, node_key(job_p, job_p->n_nodes - 1));
+    if (record_p != NULL && record_p->dev == node_p->dev && record_p->ino == node_p->ino &&
+        record_p->size == node_p->size && record_p->mtime_ns == node_p->mtime_ns &&
+        record_p->ctime_ns == node_p->ctime_ns && record_p->st_mode == node_p->st_mode)
+    {
+        node_p->cached = 1;
+        memcpy(node_p->digest, record_p->digest, SHA1_DIGEST_SIZE);
+    }
+
+    if (S_ISDIR(st->st_mode))
+    {
+        job_p->result_p->n_trees++;
+    }
+    else
+    {
+        job_p->result_p->n_leaves++;
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * Git's order: byte-wise, a directory's name compared as if followed
+ * by '/'
+ */
+static int compare_git(const void *a, const void *b)
+{
+    const tree_node_t *x = a, *y = b;
+    const char *nx = x->path + x->name_off, *ny = y->path + y->name_off;
+    size_t lx = strlen(nx), ly = strlen(ny), len = lx < ly ? lx : ly;
+    int c = memcmp(nx, ny, len);
+    unsigned cx, cy;
+
+    if (c != 0)
+    {
+        return c;
+    }
+    cx = lx > len ? (uint8_t)nx[len] : S_ISDIR(x->st_mode) ? '/' : 0;
+    cy = ly > len ? (uint8_t)ny[len] : S_ISDIR(y->st_mode) ? '/' : 0;
+    return cx < cy ? -1 : cx > cy;
+}
+
+static SHA1_ERRCODE walk(tree_job_t *job_p)
+{
+    for (size_t i = 0; i < job_p->n_nodes; i++)
+    {
+        size_t first = job_p->n_nodes;
+        struct dirent *de;
+        DIR *dir;
+
+        if (!S_ISDIR(job_p->nodes[i].st_mode))
+        {
+            continue;
+        }
+        dir = opendir(job_p->nodes[i].path);
+        if (dir == NULL)
+        {
+            node_error(job_p, &job_p->nodes[i], job_p->nodes[i].path);
+            continue;
+        }
+        while ((de = readdir(dir)) != NULL)
+        {
+            const char *parent_path = job_p->nodes[i].path;
+            size_t parent_len = strlen(parent_path);
+            int slash = parent_len == 0 || parent_path[parent_len - 1] != '/';
+            size_t child_len = parent_len + slash + strlen(de->d_name) + 1;
+            struct stat st;
+            char *child;
+
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            {
+                continue;
+            }
+            child = malloc(child_len);
+            if (child == NULL)
+            {
+                closedir(dir);
+                return SHA1_ALLOC_ERROR;
+            }
+            snprintf(child, child_len, "%s%s%s", parent_path, slash ? "/" : "", de->d_name);
+            if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                node_error(job_p, &job_p->nodes[i], child);
+                free(child);
+                continue;
+            }
+            if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode) && !S_ISDIR(st.st_mode))
+            {
+                free(child);
+                continue;
+            }
+            if (add_node(job_p, child, parent_len + slash, i, &st) != SHA1_SUCCESS)
+            {
+                closedir(dir);
+                return SHA1_ALLOC_ERROR;
+            }
+        }
+        closedir(dir);
+
+        job_p->nodes[i].first_child = first;
+        job_p->nodes[i].n_children = job_p->n_nodes - first;
+        qsort(&job_p->nodes[first], job_p->n_nodes - first, sizeof(tree_node_t), compare_git);
+    }
+    return SHA1_SUCCESS;
+}
+
+/*
+ * LEAVES
+ */
+static void blob_digest(const uint8_t *data, size_t len, SHA1_DIGEST_t digest)
+{
+    char header[32];
+    SHA1_Ctx_t ctx;
+
+    SHA1_ctx_init(&ctx);
+    SHA1_ctx_update(&ctx, (const uint8_t *)header,
+                    (size_t)snprintf(header, sizeof(header), "blob %zu", len) + 1);
+    SHA1_ctx_update(&ctx, data, len);
+    SHA1_ctx_final(&ctx, digest);
+}
+
+static void hash_leaf(tree_job_t *job_p, tree_node_t *node_p, uint8_t *buf)
+{
+    struct stat before, after;
+    char header[32];
+    SHA1_Ctx_t ctx;
+    uint64_t total = 0;
+    int fd;
+    SHA1_STATS_TIMER(start);
+
+    if (S_ISLNK(node_p->st_mode))
+    {
+        char target[PATH_MAX];
+        ssize_t n = readlink(node_p->path, target, sizeof(target));
+
+        if (n < 0)
+        {
+            node_error(job_p, node_p, node_p->path);
+            return;
+        }
+        blob_digest((const uint8_t *)target, (size_t)n, node_p->digest);
+        if (lstat(node_p->path, &after) != 0 || stat_ns(&after.st_ctim) != node_p->ctime_ns)
+        {
+            node_p->no_store = 1;
+        }
+        __atomic_fetch_add(&job_p->result_p->n_hashed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    fd = open(node_p->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &before) != 0)
+    {
+        node_error(job_p, node_p, node_p->path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+    if (!S_ISREG(before.st_mode))
+    {
+        close(fd);
+        errno = ESTALE; /* replaced since the walk */
+        node_error(job_p, node_p, node_p->path);
+        return;
+    }
+    node_set_stat(node_p, &before);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    SHA1_ctx_init(&ctx);
+    SHA1_ctx_update(&ctx, (const uint8_t *)header,
+                    (size_t)snprintf(header, sizeof(header), "blob %llu",
+                                     (unsigned long long)before.st_size) + 1);
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, TREE_READ);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            node_error(job_p, node_p, node_p->path);
+            close(fd);
+            return;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        SHA1_ctx_update(&ctx, buf, (size_t)n);
+        total += (uint64_t)n;
+    }
+
+    /*
+     * The size went into the header: a file that grew or shrank while
+     * it was read has no meaningful digest
+     */
+    if (total != (uint64_t)before.st_size)
+    {
+        close(fd);
+        errno = ESTALE;
+        node_error(job_p, node_p, node_p->path);
+        return;
+    }
+    SHA1_ctx_final(&ctx, node_p->digest);
+    if (fstat(fd, &after) != 0 || stat_ns(&after.st_mtim) != node_p->mtime_ns ||
+        stat_ns(&after.st_ctim) != node_p->ctime_ns)
+    {
+        node_p->no_store = 1;
+    }
+    close(fd);
+
+    __atomic_fetch_add(&job_p->result_p->n_hashed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&job_p->result_p->bytes_hashed, total, __ATOMIC_RELAXED);
+#if SHA1_STATS
+    if (SHA1_STATS_ON())
+    {
+        SHA1_stats_record_message(total, SHA1_stats_now() - start);
+    }
+#endif
+}
+
+/*
+ * TREES
+ * Reused if the directory and all its children are; otherwise the
+ * tree object is built from the children's digests and hashed
+ */
+static const char *git_mode(const tree_node_t *node_p)
+{
+    return S_ISDIR(node_p->st_mode) ? "40000" :
+           S_ISLNK(node_p->st_mode) ? "120000" :
+           (node_p->st_mode & S_IXUSR) ? "100755" : "100644";
+}
+
+static void build_tree(tree_job_t *job_p, tree_node_t *node_p)
+{
+    const tree_node_t *children = &job_p->nodes[node_p->first_child];
+    size_t size = 0, at = 0;
+    char header[32];
+    uint8_t *object;
+    SHA1_Ctx_t ctx;
+    int reused = node_p->cached;
+
+    for (size_t c = 0; c < node_p->n_children; c++)
+    {
+        if (children[c].failed)
+        {
+            node_p->failed = 1; /* already reported */
+            return;
+        }
+        reused = reused && children[c].reused;
+        size += strlen(git_mode(&children[c])) + strlen(children[c].path + children[c].name_off) +
+                2 + SHA1_DIGEST_SIZE;
+    }
+    if (node_p->failed)
+    {
+        return;
+    }
+    if (reused)
+    {
+        node_p->reused = 1;
+        return;
+    }
+
+    object = malloc(size > 0 ? size : 1);
+    if (object == NULL)
+    {
+        errno = ENOMEM;
+        node_error(job_p, node_p, node_p->path);
+        return;
+    }
+    for (size_t c = 0; c < node_p->n_children; c++)
+    {
+        const char *name = children[c].path + children[c].name_off;
+        const char *mode = git_mode(&children[c]);
+
+        at += (size_t)sprintf((char *)object + at, "%s %s", mode, name) + 1; /* and its NUL */
+        memcpy(object + at, children[c].digest, SHA1_DIGEST_SIZE);
+        at += SHA1_DIGEST_SIZE;
+    }
+
+    SHA1_ctx_init(&ctx);
+    SHA1_ctx_update(&ctx, (const uint8_t *)header,
+                    (size_t)snprintf(header, sizeof(header), "tree %zu", size) + 1);
+    SHA1_ctx_update(&ctx, object, size);
+    SHA1_ctx_final(&ctx, node_p->digest);
+    free(object);
+    __atomic_fetch_add(&job_p->result_p->n_rebuilt, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * SCHEDULING
+ * A node is finished once it has its digest (or failed); a directory
+ * becomes ready when its last child is finished
+ */
+static void finished(tree_job_t *job_p, size_t i)
+{
+    size_t parent = job_p->nodes[i].parent;
+
+    pthread_mutex_lock(&job_p->lock);
+    job_p->n_done++;
+    if (parent != NO_PARENT && --job_p->nodes[parent].pending == 0)
+    {
+        job_p->ready[job_p->n_ready++] = parent;
+        pthread_cond_signal(&job_p->cond);
+    }
+    if (job_p->n_done == job_p->n_nodes)
+    {
+        pthread_cond_broadcast(&job_p->cond);
+    }
+    pthread_mutex_unlock(&job_p->lock);
+}
+
+static void *tree_worker(void *arg)
+{
+    tree_job_t *job_p = arg;
+    uint8_t buf[TREE_READ];
+
+    for (;;)
+    {
+        size_t i;
+
+        pthread_mutex_lock(&job_p->lock);
+        while (job_p->n_ready == 0 && job_p->n_done < job_p->n_nodes)
+        {
+            pthread_cond_wait(&job_p->cond, &job_p->lock);
+        }
+        if (job_p->n_ready == 0)
+        {
+            pthread_mutex_unlock(&job_p->lock);
+            break;
+        }
+        i = job_p->ready[--job_p->n_ready];
+        pthread_mutex_unlock(&job_p->lock);
+
+        if (S_ISDIR(job_p->nodes[i].st_mode))
+        {
+            build_tree(job_p, &job_p->nodes[i]);
+        }
+        else
+        {
+            hash_leaf(job_p, &job_p->nodes[i], buf);
+        }
+        finished(job_p, i);
+    }
+    return NULL;
+}
+
+/*
+ * TREE DIGEST
+ */
+SHA1_ERRCODE SHA1_tree_digest(const char *root, const SHA1_TreeOptions_t *options_p,
+                              SHA1_DIGEST_t digest, SHA1_TreeResult_p_t result_p)
+{
+    SHA1_ERRCODE err;
+    tree_job_t job;
+    pthread_t *threads = NULL;
+    struct timespec now;
+    struct stat st;
+    size_t root_len = strlen(root);
+    int n_threads = options_p->n_threads;
+    int n_started = 1;
+    char *root_path;
+
+    memset(result_p, 0, sizeof(*result_p));
+    if (stat(root, &st) != 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", options_p->prog_name, root, strerror(errno));
+        return SHA1_IO_ERROR;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        return SHA1_BAD_INPUT;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.options_p = options_p;
+    job.result_p = result_p;
+    job.key_off = root_len + (root_len == 0 || root[root_len - 1] != '/');
+    clock_gettime(CLOCK_REALTIME, &now);
+    job.start_ns = stat_ns(&now);
+    if (options_p->cache_path != NULL)
+    {
+        cache_load(&job);
+    }
+
+    root_path = strdup(root);
+    err = root_path == NULL ? SHA1_ALLOC_ERROR : add_node(&job, root_path, 0, NO_PARENT, &st);
+    if (err == SHA1_SUCCESS)
+    {
+        err = walk(&job);
+    }
+    free(job.cache_table);
+    free(job.cache_data);
+    if (err == SHA1_SUCCESS)
+    {
+        job.ready = malloc(job.n_nodes * sizeof(*job.ready));
+        err = job.ready == NULL ? SHA1_ALLOC_ERROR : SHA1_SUCCESS;
+    }
+
+    if (err == SHA1_SUCCESS)
+    {
+        /*
+         * Leaves known from the cache (or already failed) finish here;
+         * the rest, and empty directories, start out ready
+         */
+        for (size_t i = 0; i < job.n_nodes; i++)
+        {
+            job.nodes[i].pending = job.nodes[i].n_children;
+        }
+        for (size_t i = job.n_nodes; i-- > 0; )
+        {
+            tree_node_t *node_p = &job.nodes[i];
+
+            if (!S_ISDIR(node_p->st_mode) && (node_p->cached || node_p->failed))
+            {
+                node_p->reused = node_p->cached;
+                job.n_done++;
+                job.nodes[node_p->parent].pending--;
+            }
+        }
+        for (size_t i = 0; i < job.n_nodes; i++)
+        {
+            const tree_node_t *node_p = &job.nodes[i];
+
+            if (S_ISDIR(node_p->st_mode) ? node_p->pending == 0
+                                         : !(node_p->cached || node_p->failed))
+            {
+                job.ready[job.n_ready++] = i;
+            }
+        }
+
+        if (n_threads <= 0)
+        {
+            long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+            n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+        }
+        if (n_threads > 1)
+        {
+            threads = calloc((size_t)n_threads, sizeof(*threads));
+        }
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.cond, NULL);
+        for (; threads != NULL && n_started < n_threads; n_started++)
+        {
+            if (pthread_create(&threads[n_started], NULL, tree_worker, &job) != 0)
+            {
+                break;
+            }
+        }
+        tree_worker(&job);
+        for (int i = 1; i < n_started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        pthread_cond_destroy(&job.cond);
+        pthread_mutex_destroy(&job.lock);
+
+        if (options_p->cache_path != NULL)
+        {
+            cache_write(&job);
+        }
+        if (job.nodes[0].failed)
+        {
+            err = SHA1_IO_ERROR;
+        }
+        else
+        {
+            memcpy(digest, job.nodes[0].digest, SHA1_DIGEST_SIZE);
+        }
+    }
+
+    for (size_t i = 0; i < job.n_nodes; i++)
+    {
+        free(job.nodes[i].path);
+    }
+    free(job.nodes);
+    free(job.ready);
+    return err;
+}
@@ -0,0 +1,77 @@
+/* SHA1 Merkle directory digest header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_TREE_H_
+#define _SHA1_TREE_H_
+
+/*
+ * One digest for a whole directory tree, built like git's: a regular
+ * file or symbolic link is a blob, SHA-1 of "blob <size>\0" and its
+ * contents (the link target for a symlink); a directory is a tree,
+ * SHA-1 of "tree <size>\0" and one "<mode> <name>\0<20-byte digest>"
+ * entry per child in git's order (directories sort as if their name
+ * ended in '/'). Modes are 100644, 100755 (owner-executable), 120000
+ * (symlink) and 40000 (directory). For a tree of files and non-empty
+ * directories the root digest is what git write-tree gives for the
+ * same content; empty directories are kept, as empty trees, and other
+ * file types (devices, FIFOs, sockets) are left out.
+ *
+ * The walk is breadth first, without following symbolic links. Blobs
+ * are hashed on n_threads workers, and every tree is built as soon as
+ * its last child is done, so independent subtrees finish in parallel
+ * from the leaves up.
+ *
+ * With a cache file, the stat data and digest of every node are kept
+ * between runs. A leaf whose stat data is unchanged is not read; a
+ * directory whose own stat data is unchanged (so no entry was added,
+ * removed or renamed) and whose children are all unchanged keeps its
+ * digest. Only the trees on the paths from changed leaves up to the
+ * root are rebuilt. Nodes whose timestamps are within
+ * SHA1_TREE_RACY_NS of the run are not recorded (see sha1_cache.h), and
+ * the cache describes one tree: it is rewritten with that tree's nodes
+ * (to a temporary file renamed into place) after every run.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_TREE_MAGIC    "SHA1TRE"                 /* with its NUL, 8 bytes */
+#define SHA1_TREE_VERSION  1
+#define SHA1_TREE_RACY_NS  (2 * 1000000000LL)        /* as SHA1_CACHE_RACY_NS */
+
+typedef struct SHA1_TreeOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    int n_threads;           /* workers; <= 0 means one per online CPU */
+    const char *cache_path;  /* node cache, or NULL for none */
+} SHA1_TreeOptions_t, *SHA1_TreeOptions_p_t;
+
+typedef struct SHA1_TreeResult {
+    size_t n_leaves;         /* files and symbolic links */
+    size_t n_trees;          /* directories, the root included */
+    size_t n_hashed;         /* leaves read */
+    size_t n_rebuilt;        /* trees whose object was rebuilt */
+    size_t n_unreadable;     /* nodes that could not be read */
+    uint64_t bytes_hashed;   /* leaf contents read */
+} SHA1_TreeResult_t, *SHA1_TreeResult_p_t;
+
+/*
+ * TREE DIGEST
+ * Compute the tree digest of the directory root. Every problem is
+ * reported on stderr.
+ *
+ * Parameters
+ *  root: directory
+ *  options_p: options, see above
+ *  digest: output digest of the root tree
+ *  result_p: counts
+ *
+ * Returns
+ *  SHA1_SUCCESS; SHA1_BAD_INPUT if root is not a directory;
+ *  SHA1_IO_ERROR if any node could not be read (no digest then);
+ *  SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_tree_digest(const char *root, const SHA1_TreeOptions_t *options_p,
+                              SHA1_DIGEST_t digest, SHA1_TreeResult_p_t result_p);
+
+#endif /* _SHA1_TREE_H_ */
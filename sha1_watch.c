@@ -0,0 +1,881 @@
+/*
+ * Watch mode: a live manifest kept current from inotify events
+ */
+
+#define _GNU_SOURCE
+#include "sha1_watch.h"
+#include "sha1_file.h"
+#include "sha1_output.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_FILE_EVENTS  (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+                            IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define WATCH_DIR_EVENTS   (WATCH_FILE_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define WATCH_EVENT_BUF    (64 * 1024)
+
+typedef struct watch_file {
+    struct watch_file *next;        /* hash chain */
+    struct watch_file *dirty_prev;  /* dirty list, while dirty */
+    struct watch_file *dirty_next;
+    char *path;
+    uint64_t hash;
+    uint64_t gen;                   /* bumped by every change */
+    uint64_t epoch;                 /* last rescan that saw it */
+    int64_t first_ns;               /* dirty since */
+    int64_t due_ns;                 /* rehash at */
+    int dirty;
+    int valid;                      /* digest is current */
+    SHA1_DIGEST_t digest;
+} watch_file_t;
+
+typedef struct watch_job {
+    char *path;
+    uint64_t gen;
+    int64_t due_ns;
+} watch_job_t;
+
+typedef struct watch_state {
+    const char *root;
+    const SHA1_WatchOptions_t *options_p;
+    SHA1_WatchResult_p_t result_p;
+    int inotify_fd;
+    char **dirs;                    /* directory of each watch descriptor */
+    size_t n_dirs;                  /* entries in dirs */
+    watch_file_t **buckets;
+    size_t n_buckets;               /* power of two */
+    size_t n_files;
+    watch_file_t *dirty;            /* dirty list */
+    uint64_t epoch;
+
+    /*
+     * Shared with the workers
+     */
+    pthread_mutex_t lock;           /* everything above, and the queue */
+    pthread_cond_t cond;            /* job queued, or stop */
+    watch_job_t *jobs;              /* ring of queued jobs */
+    size_t jobs_head;
+    size_t jobs_count;
+    size_t jobs_cap;
+    int stop;
+} watch_state_t;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t path_hash(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*path)
+    {
+        h = (h ^ (uint8_t)*path++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+
+    if (path != NULL)
+    {
+        snprintf(path, len, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+/*
+ * FILE TABLE
+ */
+
+static watch_file_t *file_find(watch_state_t *state_p, const char *path)
+{
+    uint64_t h = path_hash(path);
+
+    for (watch_file_t *file_p = state_p->buckets[h & (state_p->n_buckets - 1)];
+         file_p != NULL; file_p = file_p->next)
+    {
+        if (file_p->hash == h && strcmp(file_p->path, path) == 0)
+        {
+            return file_p;
+        }
+    }
+    return NULL;
+}
+
+static void table_grow(watch_state_t *state_p)
+{
+    size_t n_buckets = state_p->n_buckets * 2;
+    watch_file_t **buckets = calloc(n_buckets, sizeof(*buckets));
+
+    if (buckets == NULL)
+    {
+        return; /* longer chains, still correct */
+    }
+    for (size_t b = 0; b < state_p->n_buckets; b++)
+    {
+        watch_file_t *file_p = state_p->buckets[b], *next;
+
+        for (; file_p != NULL; file_p = next)
+        {
+            next = file_p->next;
+            file_p->next = buckets[file_p->hash & (n_buckets - 1)];
+            buckets[file_p->hash & (n_buckets - 1)] = file_p;
+        }
+    }
+    free(state_p->buckets);
+    state_p->buckets = buckets;
+    state_p->n_buckets = n_buckets;
+}
+
+static watch_file_t *file_add(watch_state_t *state_p, const char *path)
+{
+    watch_file_t *file_p = file_find(state_p, path);
+
+    if (file_p != NULL)
+    {
+        return file_p;
+    }
+    file_p = calloc(1, sizeof(*file_p));
+    if (file_p == NULL || (file_p->path = strdup(path)) == NULL)
+    {
+        free(file_p);
+        return NULL;
+    }
+    if (state_p->n_files >= 2 * state_p->n_buckets)
+    {
+        table_grow(state_p);
+    }
+    file_p->hash = path_hash(path);
+    file_p->next = state_p->buckets[file_p->hash & (state_p->n_buckets - 1)];
+    state_p->buckets[file_p->hash & (state_p->n_buckets - 1)] = file_p;
+    state_p->n_files++;
+    return file_p;
+}
+
+static void dirty_unlink(watch_state_t *state_p, watch_file_t *file_p)
+{
+    if (!file_p->dirty)
+    {
+        return;
+    }
+    if (file_p->dirty_prev != NULL)
+    {
+        file_p->dirty_prev->dirty_next = file_p->dirty_next;
+    }
+    else
+    {
+        state_p->dirty = file_p->dirty_next;
+    }
+    if (file_p->dirty_next != NULL)
+    {
+        file_p->dirty_next->dirty_prev = file_p->dirty_prev;
+    }
+    file_p->dirty = 0;
+}
+
+/*
+ * Remove every file for which match(path, arg) holds
+ */
+static void files_remove_if(watch_state_t *state_p, int (*match)(const watch_file_t *, const void *),
+                            const void *arg)
+{
+    for (size_t b = 0; b < state_p->n_buckets; b++)
+    {
+        watch_file_t **link_pp = &state_p->buckets[b];
+
+        while (*link_pp != NULL)
+        {
+            watch_file_t *file_p = *link_pp;
+
+            if (match(file_p, arg))
+            {
+                *link_pp = file_p->next;
+                dirty_unlink(state_p, file_p);
+                free(file_p->path);
+                free(file_p);
+                state_p->n_files--;
+            }
+            else
+            {
+                link_pp = &file_p->next;
+            }
+        }
+    }
+}
+
+static int match_prefix(const watch_file_t *file_p, const void *arg)
+{
+    size_t len = strlen(arg);
+
+    return strncmp(file_p->path, arg, len) == 0 && file_p->path[len] == '/';
+}
+
+static int match_stale(const watch_file_t *file_p, const void *arg)
+{
+    return file_p->epoch != *(const uint64_t *)arg;
+}
+
+static void file_remove(watch_state_t *state_p, const char *path)
+{
+    uint64_t h = path_hash(path);
+    watch_file_t **link_pp = &state_p->buckets[h & (state_p->n_buckets - 1)];
+
+    for (; *link_pp != NULL; link_pp = &(*link_pp)->next)
+    {
+        watch_file_t *file_p = *link_pp;
+
+        if (file_p->hash == h && strcmp(file_p->path, path) == 0)
+        {
+            *link_pp = file_p->next;
+            dirty_unlink(state_p, file_p);
+            free(file_p->path);
+            free(file_p);
+            state_p->n_files--;
+            return;
+        }
+    }
+}
+
+/*
+ * Note a change to path: rehash it delay_ms after this event, but no
+ * later than SHA1_WATCH_MAX_DELAY_MS after it first became dirty
+ */
+static void file_changed(watch_state_t *state_p, const char *path, int delay_ms)
+{
+    watch_file_t *file_p = file_add(state_p, path);
+    int64_t now = now_ns();
+    int64_t due = now + (int64_t)delay_ms * 1000000LL;
+
+    if (file_p == NULL)
+    {
+        return;
+    }
+    file_p->gen++;
+    file_p->valid = 0;
+    file_p->epoch = state_p->epoch;
+    if (!file_p->dirty)
+    {
+        file_p->dirty = 1;
+        file_p->first_ns = now;
+        file_p->dirty_prev = NULL;
+        file_p->dirty_next = state_p->dirty;
+        if (state_p->dirty != NULL)
+        {
+            state_p->dirty->dirty_prev = file_p;
+        }
+        state_p->dirty = file_p;
+    }
+    if (due > file_p->first_ns + SHA1_WATCH_MAX_DELAY_MS * 1000000LL)
+    {
+        due = file_p->first_ns + SHA1_WATCH_MAX_DELAY_MS * 1000000LL;
+    }
+    file_p->due_ns = due;
+}
+
+/*
+ * DIRECTORIES
+ */
+
+static void watch_error(watch_state_t *state_p, const char *path)
+{
+    fprintf(stderr, "%s: %s: %s\n", state_p->options_p->prog_name, path, strerror(errno));
+}
+
+/*
+ * Forget the watches on dir and everything below it
+ */
+static void dirs_remove(watch_state_t *state_p, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    for (size_t wd = 0; wd < state_p->n_dirs; wd++)
+    {
+        char *path = state_p->dirs[wd];
+
+        if (path != NULL && strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+        {
+            inotify_rm_watch(state_p->inotify_fd, (int)wd);
+            free(path);
+            state_p->dirs[wd] = NULL;
+        }
+    }
+}
+
+/*
+ * Watch dir and everything below it, and mark every file in it changed
+ */
+static void dir_add(watch_state_t *state_p, const char *dir)
+{
+    struct dirent *de;
+    DIR *dirp;
+    int wd;
+
+    wd = inotify_add_watch(state_p->inotify_fd, dir, WATCH_DIR_EVENTS);
+    if (wd < 0)
+    {
+        watch_error(state_p, dir);
+        return;
+    }
+    if ((size_t)wd >= state_p->n_dirs)
+    {
+        size_t n_dirs = (size_t)wd * 2 + 16;
+        char **dirs = realloc(state_p->dirs, n_dirs * sizeof(char *));
+
+        if (dirs == NULL)
+        {
+            inotify_rm_watch(state_p->inotify_fd, wd);
+            return;
+        }
+        memset(dirs + state_p->n_dirs, 0, (n_dirs - state_p->n_dirs) * sizeof(char *));
+        state_p->dirs = dirs;
+        state_p->n_dirs = n_dirs;
+    }
+    /* the same directory under a new name keeps its descriptor */
+    free(state_p->dirs[wd]);
+    state_p->dirs[wd] = strdup(dir);
+
+    /*
+     * Scan after watching, so nothing created in between is missed
+     */
+    dirp = opendir(dir);
+    if (dirp == NULL)
+    {
+        watch_error(state_p, dir);
+        return;
+    }
+    while ((de = readdir(dirp)) != NULL)
+    {
+        struct stat st;
+        char *path;
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+        {
+            continue;
+        }
+        path = join_path(dir, de->d_name);
+        if (path == NULL)
+        {
+            continue;
+        }
+        if (lstat(path, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                dir_add(state_p, path);
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                file_changed(state_p, path, 0);
+            }
+        }
+        free(path);
+    }
+    closedir(dirp);
+}
+
+/*
+ * Start over after lost events: rescan the tree, and drop files the
+ * scan no longer finds
+ */
+static void rescan(watch_state_t *state_p)
+{
+    state_p->epoch++;
+    dir_add(state_p, state_p->root);
+    files_remove_if(state_p, match_stale, &state_p->epoch);
+    state_p->result_p->n_rescans++;
+}
+
+static void handle_event(watch_state_t *state_p, const struct inotify_event *ev)
+{
+    const char *dir;
+    char *path;
+
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        rescan(state_p);
+        return;
+    }
+    if (ev->wd < 0 || (size_t)ev->wd >= state_p->n_dirs || state_p->dirs[ev->wd] == NULL)
+    {
+        return;
+    }
+    if (ev->mask & IN_IGNORED)
+    {
+        free(state_p->dirs[ev->wd]);
+        state_p->dirs[ev->wd] = NULL;
+        return;
+    }
+    if (ev->len == 0)
+    {
+        return; /* about the directory itself; its parent reports it */
+    }
+
+    dir = state_p->dirs[ev->wd];
+    path = join_path(dir, ev->name);
+    if (path == NULL)
+    {
+        return;
+    }
+
+    if (ev->mask & IN_ISDIR)
+    {
+        if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            dirs_remove(state_p, path);
+            files_remove_if(state_p, match_prefix, path);
+        }
+        else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            dir_add(state_p, path);
+        }
+    }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        file_remove(state_p, path);
+    }
+    else if (ev->mask & IN_CLOSE_WRITE)
+    {
+        file_changed(state_p, path, 0);
+    }
+    else if (ev->mask & (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO))
+    {
+        file_changed(state_p, path, SHA1_WATCH_SETTLE_MS);
+    }
+
+    free(path);
+}
+
+/*
+ * WORKERS
+ */
+
+/*
+ * Queue every dirty file that is due. Returns milliseconds until the
+ * next one is, or -1 if none is dirty.
+ */
+static int dispatch_due(watch_state_t *state_p)
+{
+    int64_t now = now_ns();
+    int64_t next = INT64_MAX;
+    watch_file_t *file_p, *next_p;
+
+    for (file_p = state_p->dirty; file_p != NULL; file_p = next_p)
+    {
+        next_p = file_p->dirty_next;
+        if (file_p->due_ns > now)
+        {
+            next = file_p->due_ns < next ? file_p->due_ns : next;
+            continue;
+        }
+
+        if (state_p->jobs_count == state_p->jobs_cap)
+        {
+            size_t cap = state_p->jobs_cap ? state_p->jobs_cap * 2 : 1024;
+            watch_job_t *jobs = malloc(cap * sizeof(*jobs));
+
+            if (jobs == NULL)
+            {
+                next = now; /* try again shortly */
+                break;
+            }
+            for (size_t i = 0; i < state_p->jobs_count; i++)
+            {
+                jobs[i] = state_p->jobs[(state_p->jobs_head + i) % state_p->jobs_cap];
+            }
+            free(state_p->jobs);
+            state_p->jobs = jobs;
+            state_p->jobs_head = 0;
+            state_p->jobs_cap = cap;
+        }
+
+        watch_job_t *job_p = &state_p->jobs[(state_p->jobs_head + state_p->jobs_count) % state_p->jobs_cap];
+
+        job_p->path = strdup(file_p->path);
+        if (job_p->path == NULL)
+        {
+            next = now;
+            break;
+        }
+        job_p->gen = file_p->gen;
+        job_p->due_ns = file_p->due_ns;
+        state_p->jobs_count++;
+        dirty_unlink(state_p, file_p);
+        pthread_cond_signal(&state_p->cond);
+    }
+
+    if (next == INT64_MAX)
+    {
+        return -1;
+    }
+    return next <= now ? 1 : (int)((next - now + 999999) / 1000000);
+}
+
+static void *watch_worker(void *arg)
+{
+    watch_state_t *state_p = arg;
+    uint8_t *buf = NULL;
+
+    if (posix_memalign((void **)&buf, 4096, SHA1_FILE_CHUNK) != 0)
+    {
+        buf = NULL; /* SHA1_hash_file_buffered allocates instead */
+    }
+
+    pthread_mutex_lock(&state_p->lock);
+    for (;;)
+    {
+        watch_job_t job;
+        watch_file_t *file_p;
+        SHA1_DIGEST_t digest;
+        SHA1_ERRCODE err;
+        struct stat st;
+        int64_t done;
+
+        while (state_p->jobs_count == 0 && !state_p->stop)
+        {
+            pthread_cond_wait(&state_p->cond, &state_p->lock);
+        }
+        if (state_p->stop)
+        {
+            break;
+        }
+        job = state_p->jobs[state_p->jobs_head];
+        state_p->jobs_head = (state_p->jobs_head + 1) % state_p->jobs_cap;
+        state_p->jobs_count--;
+        pthread_mutex_unlock(&state_p->lock);
+
+        if (lstat(job.path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            err = SHA1_hash_file_buffered(job.path, buf, SHA1_FILE_CHUNK, digest);
+        }
+        else
+        {
+            err = SHA1_IO_ERROR; /* gone, or no longer a regular file */
+        }
+        done = now_ns();
+
+        pthread_mutex_lock(&state_p->lock);
+        file_p = file_find(state_p, job.path);
+        if (file_p == NULL || file_p->gen != job.gen || file_p->dirty)
+        {
+            state_p->result_p->n_dropped++;
+        }
+        else if (err == SHA1_SUCCESS)
+        {
+            uint64_t latency = done > job.due_ns ? (uint64_t)(done - job.due_ns) : 0;
+
+            memcpy(file_p->digest, digest, SHA1_DIGEST_SIZE);
+            file_p->valid = 1;
+            state_p->result_p->n_rehashed++;
+            state_p->result_p->latency_ns_total += latency;
+            if (latency > state_p->result_p->latency_ns_max)
+            {
+                state_p->result_p->latency_ns_max = latency;
+            }
+        }
+        else
+        {
+            /* unreadable: left out until it changes again */
+            file_p->valid = 0;
+        }
+        free(job.path);
+    }
+    pthread_mutex_unlock(&state_p->lock);
+
+    free(buf);
+    return NULL;
+}
+
+/*
+ * MANIFEST
+ */
+
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp((*(watch_file_t * const *)a)->path, (*(watch_file_t * const *)b)->path);
+}
+
+static void write_manifest(watch_state_t *state_p)
+{
+    const SHA1_WatchOptions_t *options_p = state_p->options_p;
+    watch_file_t **files;
+    SHA1_Writer_t writer;
+    size_t n = 0;
+    char *tmp_path = NULL;
+    int fd = STDOUT_FILENO;
+    int ok;
+
+    pthread_mutex_lock(&state_p->lock);
+    files = malloc((state_p->n_files ? state_p->n_files : 1) * sizeof(*files));
+    if (files == NULL || SHA1_writer_init(&writer, fd, 0) != SHA1_SUCCESS)
+    {
+        pthread_mutex_unlock(&state_p->lock);
+        free(files);
+        fprintf(stderr, "%s: out of memory writing the manifest\n", options_p->prog_name);
+        return;
+    }
+
+    if (options_p->manifest_path != NULL)
+    {
+        size_t len = strlen(options_p->manifest_path) + 5;
+
+        tmp_path = malloc(len);
+        if (tmp_path != NULL)
+        {
+            snprintf(tmp_path, len, "%s.tmp", options_p->manifest_path);
+            fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        if (tmp_path == NULL || fd < 0)
+        {
+            pthread_mutex_unlock(&state_p->lock);
+            watch_error(state_p, options_p->manifest_path);
+            SHA1_writer_free(&writer);
+            free(tmp_path);
+            free(files);
+            return;
+        }
+        writer.fd = fd;
+    }
+
+    for (size_t b = 0; b < state_p->n_buckets; b++)
+    {
+        for (watch_file_t *file_p = state_p->buckets[b]; file_p != NULL; file_p = file_p->next)
+        {
+            if (file_p->valid)
+            {
+                files[n++] = file_p;
+            }
+        }
+    }
+    qsort(files, n, sizeof(*files), compare_files);
+
+    ok = 1;
+    for (size_t i = 0; i < n && ok; i++)
+    {
+        ok = SHA1_writer_put_digest(&writer, files[i]->digest, files[i]->path,
+                                    SHA1_FORMAT_TEXT) == SHA1_SUCCESS;
+    }
+    ok = ok && SHA1_writer_flush(&writer) == SHA1_SUCCESS;
+    pthread_mutex_unlock(&state_p->lock);
+
+    if (tmp_path != NULL)
+    {
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmp_path, options_p->manifest_path) != 0)
+        {
+            watch_error(state_p, options_p->manifest_path);
+            unlink(tmp_path);
+        }
+    }
+    else if (!ok)
+    {
+        fprintf(stderr, "%s: write error: %s\n", options_p->prog_name, strerror(errno));
+    }
+
+    SHA1_writer_free(&writer);
+    free(tmp_path);
+    free(files);
+}
+
+/*
+ * WATCH
+ */
+SHA1_ERRCODE SHA1_watch(const char *root, const SHA1_WatchOptions_t *options_p,
+                        SHA1_WatchResult_p_t result_p)
+{
+    watch_state_t state;
+    sigset_t signals, old_signals;
+    pthread_t *threads = NULL;
+    SHA1_ERRCODE err = SHA1_SUCCESS;
+    int n_threads = options_p->n_threads;
+    int started = 0;
+    int signal_fd;
+    uint8_t *events;
+
+    memset(result_p, 0, sizeof(*result_p));
+    memset(&state, 0, sizeof(state));
+    state.root = root;
+    state.options_p = options_p;
+    state.result_p = result_p;
+    state.n_buckets = 1024;
+    state.buckets = calloc(state.n_buckets, sizeof(*state.buckets));
+    events = aligned_alloc(__alignof__(struct inotify_event), WATCH_EVENT_BUF);
+    if (n_threads <= 0)
+    {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+    }
+    threads = calloc((size_t)n_threads, sizeof(*threads));
+    if (state.buckets == NULL || events == NULL || threads == NULL)
+    {
+        free(state.buckets);
+        free(events);
+        free(threads);
+        return SHA1_ALLOC_ERROR;
+    }
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    /*
+     * STEP 1
+     * block the signals we serve (the workers inherit the mask), watch
+     * the tree and start hashing it
+     */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    state.inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (signal_fd < 0 || state.inotify_fd < 0)
+    {
+        err = SHA1_IO_ERROR;
+        goto out;
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, watch_worker, &state) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        err = SHA1_ALLOC_ERROR;
+        goto out;
+    }
+
+    pthread_mutex_lock(&state.lock);
+    dir_add(&state, root);
+    if (state.n_dirs == 0)
+    {
+        pthread_mutex_unlock(&state.lock);
+        err = SHA1_IO_ERROR;
+        goto out;
+    }
+    pthread_mutex_unlock(&state.lock);
+
+    /*
+     * STEP 2
+     * serve events and signals until told to stop
+     */
+    for (;;)
+    {
+        struct pollfd fds[2] = {
+            { .fd = state.inotify_fd, .events = POLLIN },
+            { .fd = signal_fd, .events = POLLIN },
+        };
+        int timeout;
+
+        pthread_mutex_lock(&state.lock);
+        timeout = dispatch_due(&state);
+        pthread_mutex_unlock(&state.lock);
+
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR)
+        {
+            err = SHA1_IO_ERROR;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            struct signalfd_siginfo info;
+
+            if (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+            {
+                write_manifest(&state);
+                if (info.ssi_signo != SIGUSR1)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            ssize_t n;
+
+            pthread_mutex_lock(&state.lock);
+            while ((n = read(state.inotify_fd, events, WATCH_EVENT_BUF)) > 0)
+            {
+                for (ssize_t off = 0; off < n; )
+                {
+                    const struct inotify_event *ev = (const struct inotify_event *)(events + off);
+
+                    result_p->n_events++;
+                    handle_event(&state, ev);
+                    off += (ssize_t)(sizeof(*ev) + ev->len);
+                }
+            }
+            pthread_mutex_unlock(&state.lock);
+        }
+    }
+
+out:
+    pthread_mutex_lock(&state.lock);
+    state.stop = 1;
+    pthread_cond_broadcast(&state.cond);
+    pthread_mutex_unlock(&state.lock);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (err == SHA1_IO_ERROR)
+    {
+        int saved_errno = errno;
+
+        watch_error(&state, root);
+        errno = saved_errno;
+    }
+    if (state.inotify_fd >= 0)
+    {
+        close(state.inotify_fd);
+    }
+    if (signal_fd >= 0)
+    {
+        close(signal_fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    for (size_t i = 0; i < state.jobs_count; i++)
+    {
+        free(state.jobs[(state.jobs_head + i) % state.jobs_cap].path);
+    }
+    free(state.jobs);
+    state.epoch++;
+    files_remove_if(&state, match_stale, &state.epoch);
+    free(state.buckets);
+    for (size_t wd = 0; wd < state.n_dirs; wd++)
+    {
+        free(state.dirs[wd]);
+    }
+    free(state.dirs);
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+    free(threads);
+    free(events);
+    return err;
+}
@@ -0,0 +1,64 @@
+/* SHA1 watch mode header file */
+
+#include "sha1.h"
+
+#ifndef _SHA1_WATCH_H_
+#define _SHA1_WATCH_H_
+
+/*
+ * Keep a live manifest of the regular files under a directory tree.
+ *
+ * Every directory of the tree is watched with inotify. A file that is
+ * created, written, moved in or has its attributes changed is marked
+ * dirty; it is rehashed SHA1_WATCH_SETTLE_MS after the last such event,
+ * so that a burst of writes costs one rehash, but at most
+ * SHA1_WATCH_MAX_DELAY_MS after the first, so that a file written
+ * continuously is still refreshed. A close after writing makes it due
+ * at once. Deleted and moved-away files leave the manifest; directories
+ * created or moved in are watched and scanned. If the kernel's event
+ * queue overflows the whole tree is rescanned.
+ *
+ * Hashing runs on a pool of n_threads workers, so the event loop never
+ * waits for a read; results for a file that changed again while it was
+ * being hashed are dropped in favour of the newer rehash.
+ *
+ * SIGUSR1 writes the current manifest (sha1sum format, sorted by name),
+ * to manifest_path, replaced atomically, or to stdout; SIGINT and
+ * SIGTERM write it once more and return. Files not hashed yet, or whose
+ * rehash is still pending, are left out rather than listed stale.
+ */
+
+/*
+ * Constants
+ */
+#define SHA1_WATCH_SETTLE_MS    50    /* quiet time before a rehash */
+#define SHA1_WATCH_MAX_DELAY_MS 1000  /* longest a dirty file waits */
+
+typedef struct SHA1_WatchOptions {
+    const char *prog_name;   /* prefix for diagnostics on stderr */
+    int n_threads;           /* hashing workers; <= 0 means one per online CPU */
+    const char *manifest_path; /* NULL for stdout */
+} SHA1_WatchOptions_t, *SHA1_WatchOptions_p_t;
+
+typedef struct SHA1_WatchResult {
+    size_t n_events;         /* inotify events read */
+    size_t n_rehashed;       /* files hashed, initial scan included */
+    size_t n_dropped;        /* results dropped as stale */
+    size_t n_rescans;        /* queue overflows */
+    uint64_t latency_ns_total; /* from due to digest in the manifest */
+    uint64_t latency_ns_max;
+} SHA1_WatchResult_t, *SHA1_WatchResult_p_t;
+
+/*
+ * WATCH
+ * Watch root until SIGINT or SIGTERM. SIGINT, SIGTERM and SIGUSR1 are
+ * blocked in the calling thread (and the workers) for the duration.
+ *
+ * Returns
+ *  SHA1_SUCCESS, SHA1_IO_ERROR (errno set) if root cannot be watched,
+ *  or SHA1_ALLOC_ERROR
+ */
+SHA1_ERRCODE SHA1_watch(const char *root, const SHA1_WatchOptions_t *options_p,
+                        SHA1_WatchResult_p_t result_p);
+
+#endif /* _SHA1_WATCH_H_ */
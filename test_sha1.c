@@ -1,7 +1,152 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "sha1.h" /* SHA1_ */
+#include "sha1_alg.h"
+#include "sha1_cache.h"
+#include "sha1_check.h"
+#include "sha1_daemon.h"
+#include "sha1_dc.h"
+#include "sha1_decompress.h"
+#include "sha1_delta.h"
+#include "sha1_dedup.h"
+#include "sha1_file.h"
+#include "sha1_index.h"
+#include "sha1_kernel.h"
+#include "sha1_multi.h"
+#include "sha1_output.h"
+#include "sha1_pack.h"
+#include "sha1_pow.h"
+#include "sha1_range.h"
+#include "sha1_stats.h"
+#include "sha1_tar.h"
+#include "sha1_tree.h"
+#include "sha1_watch.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTION]... FILE...\n"
+            "Print SHA1 (160-bit) checksums, in the same format as sha1sum.\n"
+            "A FILE of - is standard input, hashed as it streams in.\n"
+            "\n"
+            "  -b, --binary   mark files as read in binary mode ('*')\n"
+            "  -t, --text     mark files as read in text mode (default)\n"
+            "      --tag      create a BSD-style checksum line\n"
+            "  -z, --zero     end each output line with NUL, not newline,\n"
+            "                 and disable file name escaping\n"
+            "  -c, --check    read checksums from the FILEs (standard input if\n"
+            "                 none) and check them\n"
+            "  -d, --decompress  hash the uncompressed contents of gzip (and, if\n"
+            "                 built with zstd, zstd) FILEs\n"
+            "  -j, --threads=N  verify with N threads (default: one per CPU)\n"
+            "      --detect-collisions  refuse input crafted for a SHA-1\n"
+            "                 collision attack (SHA1DC)\n"
+            "      --sparse   skip the holes of sparse files instead of reading them\n"
+            "      --tree     print one git-style tree digest for each directory FILE\n"
+            "      --tree-cache=FILE  with --tree, keep node digests in FILE and only\n"
+            "                 recompute what changed since the last run\n"
+            "      --range=OFFSET+LENGTH|FIRST-LAST[,...]  hash only these byte ranges\n"
+            "                 of each FILE (repeatable; sizes may end in K, M, G, T)\n"
+            "      --signature=SIGFILE  write the rsync-style block signature of FILE\n"
+            "                 to SIGFILE (- for stdout)\n"
+            "      --delta=SIGFILE  print the copy and literal operations that rebuild\n"
+            "                 each FILE from the file SIGFILE describes\n"
+            "      --block-size=N  block size for --signature (default 2048)\n"
+            "      --afalg    hash files in the Linux kernel's crypto API (AF_ALG),\n"
+            "                 spliced in without copying them to user space\n"
+            "      --benchmark  time the FILEs through every in-process kernel and\n"
+            "                 through AF_ALG\n"
+            "      --stats    report counters and timings on stderr at exit\n"
+            "      --dedup    list sets of identical files among the FILEs and\n"
+            "                 directories (recursively), reading as little as possible\n"
+            "      --suggest=hardlink|reflink  with --dedup, print commands linking\n"
+            "                 every duplicate to the first file of its set\n"
+            "      --cache=FILE  reuse digests of files whose stat data is\n"
+            "                 unchanged since they were recorded in FILE\n"
+            "      --also=crc32c,sha256  compute these digests too, in the same\n"
+            "                 pass, and print BSD-style lines for all of them\n"
+            "      --tar      list a digest for every regular member of the tar\n"
+            "                 archives FILE (- for stdin), without extracting\n"
+            "      --verify-pack  verify the git packs FILE (.pack or .idx): every\n"
+            "                 object against its name and CRC, and both trailers\n"
+            "      --pow=BITS  treat each operand as a PREFIX string, not a file, and\n"
+            "                 print the first stamp PREFIX+nonce whose digest starts\n"
+            "                 with BITS zero bits\n"
+            "      --pow-check=BITS  treat each operand as a STAMP string, not a file,\n"
+            "                 and check that its digest has BITS leading zero bits\n"
+            "      --daemon=SOCKET  serve hashing requests from local clients\n"
+            "                 (sha1_client.h) until SIGINT or SIGTERM\n"
+            "      --budget=USEC  with --daemon, hold a request at most USEC\n"
+            "                 microseconds while batching (default 50)\n"
+            "      --watch    keep the manifest of the directory FILE current until\n"
+            "                 SIGINT or SIGTERM; SIGUSR1 writes it\n"
+            "      --manifest=FILE  with --watch, write the manifest to FILE, not stdout\n"
+            "      --known=INDEX    print only files whose digest is in INDEX\n"
+            "      --unknown=INDEX  print only files whose digest is not in INDEX\n"
+            "      --build-index=INDEX  write the digests listed in the FILEs\n"
+            "                 (sha1sum output, hex lists, NSRL CSV) to INDEX\n"
+            "      --bloom-bits=N  Bloom filter bits per digest for --build-index\n"
+            "                 (default 10, 0 for none)\n"
+            "\n"
+            "The following options are useful only when verifying checksums:\n"
+            "      --ignore-missing  don't fail or report status for missing files\n"
+            "      --quiet           don't print OK for each successfully verified file\n"
+            "      --status          don't output anything, status code shows success\n"
+            "      --strict          exit non-zero for improperly formatted lines\n"
+            "  -w, --warn            warn about improperly formatted checksum lines\n",
+            prog);
+}
+
+/*
+ * Parse the value of option name as a decimal number in min..max, or
+ * complain on stderr. Returns nonzero on success.
+ */
+static int parse_number(const char *prog, const char *name, const char *arg,
+                        unsigned long min, unsigned long max, unsigned long *value_p)
+{
+    unsigned long value;
+    char *end;
+
+    errno = 0;
+    value = strtoul(arg, &end, 10);
+    if (!isdigit((unsigned char)*arg) || *end != '\0' || errno == ERANGE ||
+        value < min || value > max)
+    {
+        fprintf(stderr, "%s: invalid %s '%s' (expected %lu..%lu)\n", prog, name, arg, min, max);
+        return 0;
+    }
+    *value_p = value;
+    return 1;
+}
+
+/*
+ * One line per delta operation: "copy OFFSET LENGTH BLOCK" or
+ * "literal OFFSET LENGTH"
+ */
+static SHA1_ERRCODE delta_print(void *arg, const SHA1_DeltaOp_t *op_p)
+{
+    char line[96];
+    int len;
+
+    if (op_p->type == SHA1_DELTA_COPY)
+    {
+        len = snprintf(line, sizeof(line), "copy %llu %llu %llu\n",
+                       (unsigned long long)op_p->offset, (unsigned long long)op_p->length,
+                       (unsigned long long)op_p->block);
+    }
+    else
+    {
+        len = snprintf(line, sizeof(line), "literal %llu %llu\n",
+                       (unsigned long long)op_p->offset, (unsigned long long)op_p->length);
+    }
+    return SHA1_writer_put((SHA1_Writer_p_t)arg, line, (size_t)len);
+}
 
 int main(const int argc, const char *argv[])
 {
@@ -12,81 +157,1047 @@ int main(const int argc, const char *argv[])
 
     /*
      * STEP 1
-     * allocate a SHA1 object, initialize counter variables
+     * parse options, set up the output writer
      */
-    SHA1_SHA1Object_p_t sha1_p = (SHA1_SHA1Object_p_t)malloc(sizeof(SHA1_SHA1Object_t));
+    enum { OPT_TAG = 256, OPT_QUIET, OPT_STATUS, OPT_STRICT, OPT_IGNORE_MISSING, OPT_DC, OPT_STATS,
+           OPT_KNOWN, OPT_UNKNOWN, OPT_BUILD_INDEX, OPT_BLOOM_BITS, OPT_DEDUP, OPT_SUGGEST,
+           OPT_CACHE, OPT_WATCH, OPT_MANIFEST, OPT_ALSO, OPT_TAR,
+           OPT_DAEMON, OPT_BUDGET, OPT_SPARSE,
+           OPT_VERIFY_PACK, OPT_POW, OPT_POW_CHECK, OPT_AFALG, OPT_BENCHMARK,
+           OPT_RANGE, OPT_TREE, OPT_TREE_CACHE, OPT_SIGNATURE, OPT_DELTA, OPT_BLOCK_SIZE };
+    static const struct option long_options[] = {
+        { "binary",         no_argument,       NULL, 'b' },
+        { "text",           no_argument,       NULL, 't' },
+        { "tag",            no_argument,       NULL, OPT_TAG },
+        { "zero",           no_argument,       NULL, 'z' },
+        { "check",          no_argument,       NULL, 'c' },
+        { "decompress",     no_argument,       NULL, 'd' },
+        { "threads",        required_argument, NULL, 'j' },
+        { "quiet",          no_argument,       NULL, OPT_QUIET },
+        { "status",         no_argument,       NULL, OPT_STATUS },
+        { "strict",         no_argument,       NULL, OPT_STRICT },
+        { "ignore-missing", no_argument,       NULL, OPT_IGNORE_MISSING },
+        { "warn",           no_argument,       NULL, 'w' },
+        { "detect-collisions", no_argument,    NULL, OPT_DC },
+        { "sparse",         no_argument,       NULL, OPT_SPARSE },
+        { "range",          required_argument, NULL, OPT_RANGE },
+        { "tree",           no_argument,       NULL, OPT_TREE },
+        { "tree-cache",     required_argument, NULL, OPT_TREE_CACHE },
+        { "signature",      required_argument, NULL, OPT_SIGNATURE },
+        { "delta",          required_argument, NULL, OPT_DELTA },
+        { "block-size",     required_argument, NULL, OPT_BLOCK_SIZE },
+        { "afalg",          no_argument,       NULL, OPT_AFALG },
+        { "benchmark",      no_argument,       NULL, OPT_BENCHMARK },
+        { "stats",          no_argument,       NULL, OPT_STATS },
+        { "dedup",          no_argument,       NULL, OPT_DEDUP },
+        { "suggest",        required_argument, NULL, OPT_SUGGEST },
+        { "cache",          required_argument, NULL, OPT_CACHE },
+        { "also",           required_argument, NULL, OPT_ALSO },
+        { "tar",            no_argument,       NULL, OPT_TAR },
+        { "verify-pack",    no_argument,       NULL, OPT_VERIFY_PACK },
+        { "pow",            required_argument, NULL, OPT_POW },
+        { "pow-check",      required_argument, NULL, OPT_POW_CHECK },
+        { "daemon",         required_argument, NULL, OPT_DAEMON },
+        { "budget",         required_argument, NULL, OPT_BUDGET },
+        { "watch",          no_argument,       NULL, OPT_WATCH },
+        { "manifest",       required_argument, NULL, OPT_MANIFEST },
+        { "known",          required_argument, NULL, OPT_KNOWN },
+        { "unknown",        required_argument, NULL, OPT_UNKNOWN },
+        { "build-index",    required_argument, NULL, OPT_BUILD_INDEX },
+        { "bloom-bits",     required_argument, NULL, OPT_BLOOM_BITS },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    SHA1_FORMAT format = SHA1_FORMAT_TEXT;
+    SHA1_CheckOptions_t check_options = { 0 };
+    SHA1_CheckResult_t check_result = { 0 };
+    SHA1_DedupOptions_t dedup_options = { 0 };
+    SHA1_DedupResult_t dedup_result;
+    SHA1_DaemonOptions_t daemon_options = { 0 };
+    SHA1_DaemonResult_t daemon_result;
+    const char *daemon_path = NULL;
+    SHA1_WatchOptions_t watch_options = { 0 };
+    SHA1_WatchResult_t watch_result;
+    SHA1_Writer_t writer;
+    SHA1_Index_t index;
+    SHA1_Cache_t cache;
+    SHA1_Cache_p_t cache_p = NULL;
+    const char *cache_path = NULL;
+    const char *index_path = NULL;
+    const char *build_index_path = NULL;
+    unsigned bloom_bits = SHA1_INDEX_BLOOM_BITS;
+    int want_known = 1;
     SHA1_ERRCODE err = 0;
-    long int fsize = 0;       /* file size */
-    long int fsize_read = 0;  /* to check against fsize */
-    FILE *file_p = NULL; /* file pointer */
+    int zero_terminated = 0;
+    int check = 0;
+    int dedup = 0;
+    int watch = 0;
+    unsigned also = 0;
+    int decompress = 0;
+    int tar = 0;
+    int verify_pack = 0;
+    int benchmark = 0;
+    int tree = 0;
+    const char *tree_cache_path = NULL;
+    const char *signature_path = NULL;
+    const char *delta_path = NULL;
+    uint32_t block_size = SHA1_DELTA_BLOCK;
+    SHA1_Range_t *ranges = NULL;
+    size_t n_ranges = 0;
+    int pow_bits = -1;
+    int pow_check = 0;
+    unsigned long number;
+    int stats = 0;
+    int status = 0;
+    int opt;
+
+    check_options.prog_name = argv[0];
+    dedup_options.prog_name = argv[0];
+    watch_options.prog_name = argv[0];
+    daemon_options.prog_name = argv[0];
+    daemon_options.budget_us = SHA1_DAEMON_BUDGET_US;
+
+    while ((opt = getopt_long(argc, (char * const *)argv, "btzcdj:wh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'b': if (format != SHA1_FORMAT_TAG) format = SHA1_FORMAT_BINARY; break;
+            case 't': if (format != SHA1_FORMAT_TAG) format = SHA1_FORMAT_TEXT; break;
+            case OPT_TAG: format = SHA1_FORMAT_TAG; break;
+            case 'z': zero_terminated = 1; break;
+            case 'c': check = 1; break;
+            case 'd': decompress = 1; break;
+            case 'j':
+                if (!parse_number(argv[0], "thread count", optarg, 1, 1024, &number))
+                {
+                    return 1;
+                }
+                check_options.n_threads = (int)number;
+                break;
+            case OPT_QUIET: check_options.quiet = 1; break;
+            case OPT_STATUS: check_options.status_only = 1; break;
+            case OPT_STRICT: check_options.strict = 1; break;
+            case OPT_IGNORE_MISSING: check_options.ignore_missing = 1; break;
+            case 'w': check_options.warn = 1; break;
+            case OPT_DC: SHA1_set_collision_detection(1); break;
+            case OPT_SPARSE: SHA1_file_set_sparse(1); break;
+            case OPT_RANGE:
+                for (char *spec = optarg; *spec != '\0'; )
+                {
+                    size_t len = strcspn(spec, ",");
+                    char saved = spec[len];
+                    SHA1_Range_t *grown = realloc(ranges, (n_ranges + 1) * sizeof(*ranges));
+
+                    if (grown == NULL)
+                    {
+                        fprintf(stderr, "%s: out of memory\n", argv[0]);
+                        return 1;
+                    }
+                    ranges = grown;
+                    spec[len] = '\0';
+                    if (SHA1_parse_range(spec, &ranges[n_ranges++]) != SHA1_SUCCESS)
+                    {
+                        fprintf(stderr, "%s: bad range '%s'\n", argv[0], spec);
+                        return 1;
+                    }
+                    spec[len] = saved;
+                    spec += len + (saved == ',');
+                }
+                break;
+            case OPT_TREE: tree = 1; break;
+            case OPT_TREE_CACHE: tree_cache_path = optarg; break;
+            case OPT_SIGNATURE: signature_path = optarg; break;
+            case OPT_DELTA: delta_path = optarg; break;
+            case OPT_BLOCK_SIZE: block_size = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case OPT_AFALG: SHA1_file_set_afalg(1); break;
+            case OPT_BENCHMARK: benchmark = 1; break;
+            case OPT_STATS: stats = 1; SHA1_stats_enable(1); break;
+            case OPT_DEDUP: dedup = 1; break;
+            case OPT_SUGGEST:
+                if (strcmp(optarg, "hardlink") == 0)
+                {
+                    dedup_options.suggest = SHA1_DEDUP_HARDLINK;
+                }
+                else if (strcmp(optarg, "reflink") == 0)
+                {
+                    dedup_options.suggest = SHA1_DEDUP_REFLINK;
+                }
+                else
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case OPT_CACHE: cache_path = optarg; break;
+            case OPT_ALSO:
+                for (const char *name = optarg; *name != '\0'; )
+                {
+                    size_t len = strcspn(name, ",");
+
+                    if (len == 6 && strncmp(name, "crc32c", 6) == 0)
+                    {
+                        also |= SHA1_MULTI_CRC32C;
+                    }
+                    else if (len == 6 && strncmp(name, "sha256", 6) == 0)
+                    {
+                        also |= SHA1_MULTI_SHA256;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "%s: unknown digest '%.*s' for --also\n", argv[0],
+                                (int)len, name);
+                        return 1;
+                    }
+                    name += len + (name[len] == ',');
+                }
+                break;
+            case OPT_TAR: tar = 1; break;
+            case OPT_VERIFY_PACK: verify_pack = 1; break;
+            case OPT_POW:
+            case OPT_POW_CHECK:
+                if (!parse_number(argv[0], opt == OPT_POW ? "--pow" : "--pow-check", optarg,
+                                  0, 160, &number))
+                {
+                    return 1;
+                }
+                pow_bits = (int)number;
+                pow_check = opt == OPT_POW_CHECK;
+                break;
+            case OPT_DAEMON: daemon_path = optarg; break;
+            case OPT_BUDGET:
+                if (!parse_number(argv[0], "--budget", optarg, 1, 1000000, &number))
+                {
+                    return 1;
+                }
+                daemon_options.budget_us = (unsigned)number;
+                break;
+            case OPT_WATCH: watch = 1; break;
+            case OPT_MANIFEST: watch_options.manifest_path = optarg; break;
+            case OPT_KNOWN: index_path = optarg; want_known = 1; break;
+            case OPT_UNKNOWN: index_path = optarg; want_known = 0; break;
+            case OPT_BUILD_INDEX: build_index_path = optarg; break;
+            case OPT_BLOOM_BITS:
+                if (!parse_number(argv[0], "--bloom-bits", optarg, 0, 64, &number))
+                {
+                    return 1;
+                }
+                bloom_bits = (unsigned)number;
+                break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
 
     /*
-     * Open file. If file is too large, say 5MB, do not allocate.
+     * Detection that misses SHAttered would only give false confidence
      */
-    file_p = fopen(argv[1], "r");
-    if (file_p == NULL)
+    if (SHA1_get_collision_detection() && !SHA1DC_self_test())
     {
-        printf("Pointer to file is NULL! Exiting!\n");
+        fprintf(stderr, "%s: collision detection failed its self-test\n", argv[0]);
         return 1;
     }
-    fseek(file_p, SEEK_SET, 0L);
-    fseek(file_p, 0L, SEEK_END);
-    fsize = ftell(file_p);
 
-    if (fsize > (5 * 1024 * 1024))
+    /*
+     * Daemon mode: no FILEs, requests come from the socket
+     */
+    if (daemon_path != NULL)
     {
-        printf("File %s larger than 5MiB (%ld). Not allocating.\n", argv[1], fsize);
+        SHA1_kernels_init();
+        err = SHA1_daemon(daemon_path, &daemon_options, &daemon_result);
+        if (err == SHA1_ALLOC_ERROR)
+        {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+        }
+        if (stats && err == SHA1_SUCCESS)
+        {
+            fprintf(stderr,
+                    "daemon: %zu clients, %zu requests (%zu rejected), %llu bytes\n"
+                    "daemon: %zu full batches, %zu flushed at the deadline\n",
+                    daemon_result.n_clients, daemon_result.n_requests, daemon_result.n_rejected,
+                    (unsigned long long)daemon_result.bytes,
+                    daemon_result.n_full_batches, daemon_result.n_deadline_flushes);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return err != SHA1_SUCCESS;
+    }
+
+    if (optind >= argc && !check)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (decompress && also)
+    {
+        fprintf(stderr, "%s: --decompress cannot be combined with --also\n", argv[0]);
+        return 1;
+    }
+    if (decompress && cache_path != NULL)
+    {
+        fprintf(stderr, "%s: --decompress cannot be combined with --cache\n", argv[0]);
+        return 1;
+    }
+    if (also && cache_path != NULL)
+    {
+        fprintf(stderr, "%s: --also cannot be combined with --cache\n", argv[0]);
         return 1;
     }
 
-#ifdef DEBUG
-    printf("File size: %ld\n", fsize);
-#endif
+    /*
+     * Benchmark mode: the FILEs are test data
+     */
+    if (benchmark)
+    {
+        for (int i = optind; i < argc; i++)
+        {
+            err = SHA1_alg_benchmark(argv[i], stdout);
+            if (err != SHA1_SUCCESS)
+            {
+                if (err == SHA1_IO_ERROR)
+                {
+                    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+                }
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    /*
+     * Index building: the FILEs are digest lists
+     */
+    if (build_index_path != NULL)
+    {
+        SHA1_DIGEST_t *digests = NULL;
+        size_t count = 0;
+
+        for (int i = optind; i < argc; i++)
+        {
+            err = SHA1_index_read_list(argv[i], &digests, &count);
+            if (err != SHA1_SUCCESS)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i],
+                        err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+                free(digests);
+                return 1;
+            }
+        }
+        err = SHA1_index_build(build_index_path, digests, count, bloom_bits);
+        free(digests);
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], build_index_path,
+                    err == SHA1_IO_ERROR ? strerror(errno) :
+                    err == SHA1_ALLOC_ERROR ? "out of memory" : "too many digests");
+            return 1;
+        }
+        return 0;
+    }
+
+    if (index_path != NULL)
+    {
+        err = SHA1_index_open(index_path, &index);
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], index_path,
+                    err == SHA1_IO_ERROR ? strerror(errno) : "not a digest index");
+            return 1;
+        }
+    }
+
+    /*
+     * A cache that cannot be opened only costs speed
+     */
+    if (cache_path != NULL)
+    {
+        err = SHA1_cache_open(cache_path, &cache);
+        if (err == SHA1_SUCCESS)
+        {
+            cache_p = &cache;
+        }
+        else
+        {
+            fprintf(stderr, "%s: %s: %s; not using the cache\n", argv[0], cache_path,
+                    err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+        }
+    }
 
     /*
-     * Return to beginning of file
-     * Allocate space for the file
+     * Pick the compression kernels now rather than inside the first hash
      */
-    fseek(file_p, SEEK_SET, 0L);
-    void *msg_p = malloc(fsize);
-    if (msg_p == NULL)
+    SHA1_kernels_init();
+
+    if (SHA1_writer_init(&writer, STDOUT_FILENO, 0) != SHA1_SUCCESS)
     {
-        printf("Allocating buffer for message returned NULL!\n");
+        printf("Allocating output buffer returned NULL!\n");
         return 1;
     }
+    writer.zero_terminated = zero_terminated;
 
     /*
-     * Read data into msg_p array, close file
+     * Check mode: the FILEs are manifests
      */
-    fsize_read = fread(msg_p, sizeof(char), fsize, file_p);
-    if (fsize_read != fsize)
+    if (check)
     {
-        printf("fread failed with %li\n", fsize_read);
-        return fsize_read;
+        /* no FILE: the manifest is standard input, as for sha1sum -c */
+        const char *from_stdin[] = { "-" };
+        const char **manifests = optind < argc ? argv + optind : from_stdin;
+        int n_manifests = optind < argc ? argc - optind : 1;
+
+        for (int i = 0; i < n_manifests; i++)
+        {
+            if (SHA1_check_manifest(manifests[i], &check_options, &writer, &check_result) != SHA1_SUCCESS)
+            {
+                status = 1;
+            }
+        }
+
+        if (check_result.n_mismatched || check_result.n_unreadable ||
+            (check_options.strict && check_result.n_improper))
+        {
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
     }
-    fclose(file_p);
 
     /*
-     * Invoke hash algorithm
+     * Dedup mode: the FILEs are files and directories to compare
      */
-    err = SHA1_process_message((const char *)msg_p, sha1_p);
-    if (err != SHA1_SUCCESS)
+    if (dedup)
     {
-        printf("ERROR CODE %i\n", err);
+        dedup_options.n_threads = check_options.n_threads;
+        err = SHA1_dedup(argv + optind, argc - optind, &dedup_options, &writer, &dedup_result);
+        if (err == SHA1_SUCCESS)
+        {
+            err = SHA1_writer_flush(&writer);
+        }
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0],
+                    err == SHA1_ALLOC_ERROR ? "out of memory" : "write error");
+            status = 1;
+        }
+        if (dedup_result.n_unreadable > 0)
+        {
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            fprintf(stderr,
+                    "dedup: %zu files, %llu bytes; %zu edge-hashed, %zu fully hashed, %llu bytes read\n"
+                    "dedup: %zu sets, %zu duplicates, %llu bytes duplicated\n",
+                    dedup_result.n_files, (unsigned long long)dedup_result.bytes_total,
+                    dedup_result.n_edge_hashed, dedup_result.n_full_hashed,
+                    (unsigned long long)dedup_result.bytes_read,
+                    dedup_result.n_sets, dedup_result.n_duplicates,
+                    (unsigned long long)dedup_result.bytes_duplicate);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
     }
 
-    printf("Computed hash: ");
-    for (int i=0; i<5; i++)
+    /*
+     * Pack mode: the FILEs are git packs to verify
+     */
+    if (verify_pack)
     {
-        printf("%08X", sha1_p->temp_hash[i]);
+        SHA1_PackOptions_t pack_options = { argv[0], check_options.n_threads, 0 };
+        SHA1_PackResult_t pack_result, pack_total = { 0 };
+
+        for (int i = optind; i < argc; i++)
+        {
+            err = SHA1_verify_pack(argv[i], &pack_options, &writer, &pack_result);
+            if (err == SHA1_ALLOC_ERROR)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: out of memory\n", argv[0], argv[i]);
+            }
+            if (err != SHA1_SUCCESS)
+            {
+                status = 1;
+            }
+            pack_total.n_objects += pack_result.n_objects;
+            pack_total.n_deltas += pack_result.n_deltas;
+            pack_total.n_bad += pack_result.n_bad;
+            pack_total.cache_hits += pack_result.cache_hits;
+            pack_total.cache_misses += pack_result.cache_misses;
+            pack_total.bytes_inflated += pack_result.bytes_inflated;
+            if (pack_result.max_depth > pack_total.max_depth)
+            {
+                pack_total.max_depth = pack_result.max_depth;
+            }
+        }
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            fprintf(stderr,
+                    "pack: %zu objects (%zu deltas, chains up to %zu), %zu bad, %llu bytes inflated\n"
+                    "pack: delta base cache %zu hits, %zu rebuilt\n",
+                    pack_total.n_objects, pack_total.n_deltas, pack_total.max_depth,
+                    pack_total.n_bad, (unsigned long long)pack_total.bytes_inflated,
+                    pack_total.cache_hits, pack_total.cache_misses);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Proof-of-work mode: the FILEs are prefixes to solve, or stamps to check
+     */
+    if (pow_bits >= 0)
+    {
+        SHA1_PowOptions_t pow_options = { (unsigned)pow_bits, check_options.n_threads, 0, 0 };
+        SHA1_PowResult_t pow_result;
+        uint64_t tries = 0;
+        double seconds = 0;
+
+        for (int i = optind; i < argc; i++)
+        {
+            const uint8_t *arg = (const uint8_t *)argv[i];
+            size_t len = strlen(argv[i]);
+
+            if (pow_check)
+            {
+                int ok = SHA1_pow_check(arg, len, (unsigned)pow_bits);
+
+                SHA1_writer_put(&writer, argv[i], len);
+                SHA1_writer_put(&writer, ok ? ": ok\n" : ": bad\n", ok ? 5 : 6);
+                status |= !ok;
+                continue;
+            }
+            err = SHA1_pow_solve(arg, len, &pow_options, &pow_result);
+            if (err != SHA1_SUCCESS)
+            {
+                fprintf(stderr, "%s: %s\n", argv[0],
+                        err == SHA1_ALLOC_ERROR ? "out of memory" : "at most 160 bits");
+                status = 1;
+                break;
+            }
+            SHA1_writer_put(&writer, argv[i], len);
+            SHA1_writer_put(&writer, pow_result.suffix, strlen(pow_result.suffix));
+            SHA1_writer_put(&writer, "\n", 1);
+            tries += pow_result.tries;
+            seconds += pow_result.seconds;
+        }
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats && !pow_check)
+        {
+            fprintf(stderr, "pow: %llu nonces in %.3f s, %.1f M/s\n",
+                    (unsigned long long)tries, seconds,
+                    seconds > 0 ? (double)tries / seconds / 1e6 : 0.0);
+            SHA1_pow_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Signature mode: the block signature of one FILE
+     */
+    if (signature_path != NULL)
+    {
+        SHA1_Writer_t sig_writer;
+        uint64_t n_blocks = 0;
+        int sig_fd = strcmp(signature_path, "-") == 0 ? STDOUT_FILENO :
+                     open(signature_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        int fd;
+
+        SHA1_writer_free(&writer);
+        if (optind != argc - 1)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if (sig_fd < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], signature_path, strerror(errno));
+            return 1;
+        }
+        fd = strcmp(argv[optind], "-") == 0 ? STDIN_FILENO : open(argv[optind], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(errno));
+            return 1;
+        }
+        if (SHA1_writer_init(&sig_writer, sig_fd, 0) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return 1;
+        }
+        err = SHA1_signature_write(fd, block_size, &sig_writer, &n_blocks);
+        if (err == SHA1_SUCCESS)
+        {
+            err = SHA1_writer_flush(&sig_writer);
+        }
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind],
+                    err == SHA1_BAD_INPUT ? "bad block size" :
+                    err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+            status = 1;
+        }
+        SHA1_writer_free(&sig_writer);
+        if (sig_fd != STDOUT_FILENO && close(sig_fd) != 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], signature_path, strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO)
+        {
+            close(fd);
+        }
+        if (stats)
+        {
+            fprintf(stderr, "signature: %llu blocks of %u bytes\n",
+                    (unsigned long long)n_blocks, (unsigned)block_size);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Delta mode: rebuild every FILE from the file the signature describes
+     */
+    if (delta_path != NULL)
+    {
+        SHA1_Signature_t sig;
+        SHA1_DeltaResult_t delta_result, delta_total = { 0 };
+        int sig_fd = open(delta_path, O_RDONLY | O_CLOEXEC);
+
+        if (sig_fd < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], delta_path, strerror(errno));
+            return 1;
+        }
+        err = SHA1_signature_read(sig_fd, &sig);
+        close(sig_fd);
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], delta_path,
+                    err == SHA1_BAD_INPUT ? "not a block signature" :
+                    err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+            return 1;
+        }
+
+        for (int i = optind; i < argc; i++)
+        {
+            int fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY | O_CLOEXEC);
+
+            if (fd < 0)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+                status = 1;
+                continue;
+            }
+            err = SHA1_delta_match(fd, &sig, delta_print, &writer, &delta_result);
+            if (fd != STDIN_FILENO)
+            {
+                close(fd);
+            }
+            if (err != SHA1_SUCCESS)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i],
+                        err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+                status = 1;
+                continue;
+            }
+            delta_total.bytes += delta_result.bytes;
+            delta_total.bytes_copied += delta_result.bytes_copied;
+            delta_total.n_copies += delta_result.n_copies;
+            delta_total.n_weak_hits += delta_result.n_weak_hits;
+            delta_total.n_false_hits += delta_result.n_false_hits;
+        }
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        SHA1_signature_free(&sig);
+        if (stats)
+        {
+            fprintf(stderr, "delta: %llu bytes, %llu copied in %llu copies, %llu literal; "
+                    "%llu weak hits (%llu false)\n",
+                    (unsigned long long)delta_total.bytes,
+                    (unsigned long long)delta_total.bytes_copied,
+                    (unsigned long long)delta_total.n_copies,
+                    (unsigned long long)(delta_total.bytes - delta_total.bytes_copied),
+                    (unsigned long long)delta_total.n_weak_hits,
+                    (unsigned long long)delta_total.n_false_hits);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Tree mode: the FILEs are directories, one digest each
+     */
+    if (tree)
+    {
+        SHA1_TreeOptions_t tree_options = { argv[0], check_options.n_threads, tree_cache_path };
+        SHA1_TreeResult_t tree_result, tree_total = { 0 };
+        SHA1_DIGEST_t digest;
+
+        for (int i = optind; i < argc; i++)
+        {
+            err = SHA1_tree_digest(argv[i], &tree_options, digest, &tree_result);
+            if (err == SHA1_SUCCESS)
+            {
+                SHA1_writer_put_digest(&writer, digest, argv[i], format);
+            }
+            else
+            {
+                SHA1_writer_flush(&writer);
+                if (err != SHA1_IO_ERROR)
+                {
+                    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i],
+                            err == SHA1_ALLOC_ERROR ? "out of memory" : "not a directory");
+                }
+                status = 1;
+            }
+            tree_total.n_leaves += tree_result.n_leaves;
+            tree_total.n_trees += tree_result.n_trees;
+            tree_total.n_hashed += tree_result.n_hashed;
+            tree_total.n_rebuilt += tree_result.n_rebuilt;
+            tree_total.bytes_hashed += tree_result.bytes_hashed;
+        }
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            fprintf(stderr, "tree: %zu leaves (%zu read, %llu bytes), %zu trees (%zu rebuilt)\n",
+                    tree_total.n_leaves, tree_total.n_hashed,
+                    (unsigned long long)tree_total.bytes_hashed,
+                    tree_total.n_trees, tree_total.n_rebuilt);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Range mode: the same byte ranges of every FILE
+     */
+    if (n_ranges > 0)
+    {
+        SHA1_RangeOptions_t range_options = { check_options.n_threads };
+        SHA1_RangeResult_t range_result, range_total = { 0 };
+
+        for (int i = optind; i < argc; i++)
+        {
+            int fd;
+
+            if (strcmp(argv[i], "-") == 0)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: -: --range needs a file it can seek in, not standard input\n",
+                        argv[0]);
+                status = 1;
+                continue;
+            }
+            fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+                status = 1;
+                continue;
+            }
+            err = SHA1_hash_ranges(fd, ranges, n_ranges, &range_options, &range_result);
+            close(fd);
+            if (err == SHA1_ALLOC_ERROR)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: out of memory\n", argv[0], argv[i]);
+                status = 1;
+                continue;
+            }
+
+            for (size_t r = 0; r < n_ranges; r++)
+            {
+                char name[4096];
+
+                snprintf(name, sizeof(name), "%s:%llu+%llu", argv[i],
+                         (unsigned long long)ranges[r].offset,
+                         (unsigned long long)ranges[r].length);
+                if (ranges[r].err == SHA1_SUCCESS)
+                {
+                    if (index_path == NULL ||
+                        SHA1_index_contains(&index, ranges[r].digest) == want_known)
+                    {
+                        SHA1_writer_put_digest(&writer, ranges[r].digest, name, format);
+                    }
+                    continue;
+                }
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: %s\n", argv[0], name,
+                        ranges[r].err == SHA1_BAD_INPUT ? "past end of file" :
+                        ranges[r].err == SHA1_COLLISION_DETECTED ? "SHA-1 collision attack detected" :
+                        ranges[r].err == SHA1_ALLOC_ERROR ? "out of memory" :
+                        strerror(ranges[r].err_errno));
+                status = 1;
+            }
+            range_total.n_spans += range_result.n_spans;
+            range_total.bytes_requested += range_result.bytes_requested;
+            range_total.bytes_read += range_result.bytes_read;
+        }
+        free(ranges);
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            fprintf(stderr, "range: %llu bytes in ranges, %llu bytes read in %zu spans\n",
+                    (unsigned long long)range_total.bytes_requested,
+                    (unsigned long long)range_total.bytes_read, range_total.n_spans);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Tar mode: the FILEs are archives whose members are hashed
+     */
+    if (tar)
+    {
+        SHA1_TarOptions_t tar_options = { argv[0], format, decompress,
+                                          index_path != NULL ? &index : NULL, want_known };
+        SHA1_TarResult_t tar_result, tar_total = { 0 };
+
+        for (int i = optind; i < argc; i++)
+        {
+            int fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY);
+
+            err = fd < 0 ? SHA1_IO_ERROR : SHA1_tar_hash_fd(fd, &tar_options, &writer, &tar_result);
+            if (err == SHA1_IO_ERROR || err == SHA1_ALLOC_ERROR)
+            {
+                SHA1_writer_flush(&writer);
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i],
+                        err == SHA1_ALLOC_ERROR ? "out of memory" : strerror(errno));
+            }
+            if (err != SHA1_SUCCESS || tar_result.n_collisions > 0)
+            {
+                status = 1;
+            }
+            if (fd > STDIN_FILENO)
+            {
+                close(fd);
+            }
+            if (fd >= 0)
+            {
+                tar_total.n_members += tar_result.n_members;
+                tar_total.n_hashed += tar_result.n_hashed;
+                tar_total.n_links += tar_result.n_links;
+                tar_total.n_skipped_links += tar_result.n_skipped_links;
+                tar_total.bytes_hashed += tar_result.bytes_hashed;
+            }
+        }
+        if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+        }
+
+        SHA1_writer_free(&writer);
+        if (stats)
+        {
+            fprintf(stderr, "tar: %zu members, %zu hashed, %zu hard links, %zu links skipped, "
+                    "%llu bytes\n",
+                    tar_total.n_members, tar_total.n_hashed, tar_total.n_links,
+                    tar_total.n_skipped_links, (unsigned long long)tar_total.bytes_hashed);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * Watch mode: the FILE is a directory to keep a manifest of
+     */
+    if (watch)
+    {
+        SHA1_writer_free(&writer);
+        if (argc - optind != 1)
+        {
+            fprintf(stderr, "%s: --watch takes exactly one directory\n", argv[0]);
+            return 1;
+        }
+        watch_options.n_threads = check_options.n_threads;
+        err = SHA1_watch(argv[optind], &watch_options, &watch_result);
+        if (err != SHA1_SUCCESS)
+        {
+            if (err == SHA1_ALLOC_ERROR)
+            {
+                fprintf(stderr, "%s: out of memory\n", argv[0]);
+            }
+            status = 1;
+        }
+        if (stats)
+        {
+            fprintf(stderr,
+                    "watch: %zu events, %zu rehashed, %zu dropped as stale, %zu rescans\n"
+                    "watch: latency %.3f ms mean, %.3f ms max\n",
+                    watch_result.n_events, watch_result.n_rehashed, watch_result.n_dropped,
+                    watch_result.n_rescans,
+                    watch_result.n_rehashed ?
+                        watch_result.latency_ns_total / 1e6 / watch_result.n_rehashed : 0.0,
+                    watch_result.latency_ns_max / 1e6);
+            SHA1_stats_print(stderr);
+            SHA1_kernels_print(stderr);
+        }
+        return status;
+    }
+
+    /*
+     * STEP 2
+     * hash every file and queue its line; a file that cannot be read is
+     * reported and skipped, as sha1sum does
+     */
+    for (int i = optind; i < argc; i++)
+    {
+        SHA1_MultiDigest_t multi_digest;
+        uint8_t *digest = multi_digest.sha1;
+
+        if (strcmp(argv[i], "-") == 0 && also)
+        {
+            err = SHA1_multi_hash_fd(STDIN_FILENO, SHA1_MULTI_SHA1 | also, &multi_digest);
+        }
+        else if (strcmp(argv[i], "-") == 0)
+        {
+            err = decompress ? SHA1_hash_compressed_fd(STDIN_FILENO, digest)
+                             : SHA1_hash_fd(STDIN_FILENO, digest);
+        }
+        else if (decompress)
+        {
+            err = SHA1_hash_compressed_file(argv[i], digest);
+        }
+        else if (also)
+        {
+            err = SHA1_multi_hash_file(argv[i], SHA1_MULTI_SHA1 | also, &multi_digest);
+        }
+        else
+        {
+            err = SHA1_hash_file_cached(cache_p, argv[i], digest);
+        }
+        if (err == SHA1_COLLISION_DETECTED)
+        {
+            SHA1_writer_flush(&writer);
+            fprintf(stderr, "%s: %s: SHA-1 collision attack detected\n", argv[0], argv[i]);
+            status = 1;
+            continue;
+        }
+        if (err != SHA1_SUCCESS)
+        {
+            /* keep stdout and stderr in order */
+            SHA1_writer_flush(&writer);
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i],
+                    err == SHA1_BAD_INPUT ? "not in a supported compressed format, or corrupt" :
+                    strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        if (index_path != NULL && SHA1_index_contains(&index, digest) != want_known)
+        {
+            continue;
+        }
+
+        if (also)
+        {
+            char hex[SHA256_HEX_SIZE + 1];
+
+            err = SHA1_writer_put_digest(&writer, digest, argv[i], SHA1_FORMAT_TAG);
+            if (err == SHA1_SUCCESS && (also & SHA1_MULTI_CRC32C))
+            {
+                snprintf(hex, sizeof(hex), "%08x", multi_digest.crc32c);
+                err = SHA1_writer_put_tag(&writer, "CRC32C", hex, 8, argv[i]);
+            }
+            if (err == SHA1_SUCCESS && (also & SHA1_MULTI_SHA256))
+            {
+                for (int k = 0; k < SHA256_DIGEST_SIZE; k++)
+                {
+                    snprintf(hex + 2 * k, 3, "%02x", multi_digest.sha256[k]);
+                }
+                err = SHA1_writer_put_tag(&writer, "SHA256", hex, SHA256_HEX_SIZE, argv[i]);
+            }
+        }
+        else
+        {
+            err = SHA1_writer_put_digest(&writer, digest, argv[i], format);
+        }
+        if (err != SHA1_SUCCESS)
+        {
+            fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+            status = 1;
+            break;
+        }
     }
-    printf("\n");
 
     /*
      * free any dynamically allocated memory
      */
-    free(msg_p);
-    free(sha1_p);
+    if (SHA1_writer_flush(&writer) != SHA1_SUCCESS)
+    {
+        fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(errno));
+        status = 1;
+    }
+    SHA1_writer_free(&writer);
+    if (index_path != NULL)
+    {
+        SHA1_index_close(&index);
+    }
+    if (stats && cache_p != NULL)
+    {
+        fprintf(stderr, "cache: %zu hits, %zu misses, %zu stored, %llu of %llu slots used\n",
+                cache.hits, cache.misses, cache.stored,
+                (unsigned long long)*cache.n_used_p, (unsigned long long)cache.mask + 1);
+    }
+    if (cache_p != NULL)
+    {
+        SHA1_cache_close(cache_p);
+    }
+    if (stats)
+    {
+        SHA1_stats_print(stderr);
+        SHA1_kernels_print(stderr);
+    }
 
-    return 0;
+    return status;
 }